@@ -21,15 +21,21 @@
  * These routines generally fork() and talk to us via pipes.
  */
 
+/* For copy_file_range() and SEEK_DATA/SEEK_HOLE */
+#define _GNU_SOURCE
+
 #include "config.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <sys/param.h>
+#include <limits.h>
 #include <errno.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <fcntl.h>
 #include <utime.h>
 #include <stdarg.h>
 
@@ -52,6 +58,8 @@
 #include "type.h"
 #include "xtypes.h"
 #include "log.h"
+#include "opqueue.h"
+#include "remote.h"
 
 #if defined(HAVE_GETXATTR)
 # define ATTR_MAN_PAGE N_("See the attr(5) man page for full details.")
@@ -61,6 +69,14 @@
 # define ATTR_MAN_PAGE N_("You do not appear to have OS support.")
 #endif 
 
+/* The fast walks for Permissions and Set type work relative to an open
+ * directory, rather than looking up the whole path for every item.
+ */
+#if defined(HAVE_FCHMODAT) && defined(HAVE_FDOPENDIR) && \
+	!defined(HAVE_LIBVFS)
+# define WALK_WITH_FDS
+#endif
+
 /* Parent->Child messages are one character each:
  *
  * Y/N 		Yes/No button clicked
@@ -68,6 +84,7 @@
  * Q		Quiet toggled
  * E		Entry text changed
  * W		neWer toggled
+ * U		resUme toggled
  */
 
 typedef struct _GUIside GUIside;
@@ -90,6 +107,16 @@ struct _GUIside
 					     const guchar *string);
 
 	int		abort_attempts;
+
+	/* For queued actions (copy, move, delete), the child isn't forked
+	 * until the devices are free. These hold what it will need.
+	 */
+	OpJob		*job;		/* NULL once finished */
+	ActionChild	*func;
+	GList		*paths;		/* (a copy) */
+	int		force, brief, recurse, newer, resume;
+	gchar		*dest, *leaf;
+	void		(*do_func)(const char *source, const char *dest);
 };
 
 /* These don't need to be in a structure because we fork() before
@@ -110,13 +137,40 @@ static unsigned long file_counter;	/* For Disk Usage */
 
 static struct mode_change *mode_change = NULL;	/* For Permissions */
 static FindCondition *find_condition = NULL;	/* For Find */
+static FindNeeds find_needs = FIND_NEED_STAT;	/* For Find */
+static time_t	find_now;			/* For Find (once per search) */
+static GString	*find_results = NULL;		/* For Find (unsent matches) */
 static MIME_type *type_change = NULL;
 
+/* For the fast tree walks (Find, Permissions and Set type) */
+static gboolean	walk_worker = FALSE;		/* A forked walker */
+static int	*walk_flag_fds = NULL;		/* Flag toggles to workers */
+static int	walk_n_flag_fds = 0;
+static struct timeval walk_last_flush;		/* Last batch sent */
+static GString	*walk_log = NULL;		/* Unsent log lines */
+
 /* Only used by child */
 static gboolean o_force = FALSE;
 static gboolean o_brief = FALSE;
 static gboolean o_recurse = FALSE;
 static gboolean o_newer = FALSE;
+static gboolean o_resume = FALSE;
+static int	child_errors = 0;		/* '!' messages sent */
+
+/* For Copy. The child appends a record to the journal as each file is
+ * finished (and at checkpoints within big files), so that an interrupted
+ * copy can be resumed. Records are NUL-terminated:
+ *
+ * D<path>			<path> has been copied
+ * M<path>			The directory for <path> was made by this copy
+ * P<offset> <mtime> <path>	The first <offset> bytes of <path> (last
+ *				modified at <mtime>) are safely on disk
+ */
+static FILE	*copy_journal = NULL;
+static gchar	*copy_journal_file = NULL;
+static GHashTable *journal_done = NULL;		/* Path -> TRUE */
+static GHashTable *journal_partial = NULL;	/* Path -> gint64[2] */
+static GHashTable *journal_made = NULL;		/* Path -> TRUE */
 
 static Option o_action_copy, o_action_move, o_action_link;
 static Option o_action_delete, o_action_mount;
@@ -152,6 +206,38 @@ static void do_mount(const guchar *path, gboolean mount);
 static gboolean printf_reply(int fd, gboolean ignore_quiet,
 			     const char *msg, ...);
 static gboolean remove_pinned_ok(GList *paths);
+static void do_find(const char *path, const char *unused);
+static void do_chmod(const char *path, const char *unused);
+static void do_settype(const char *path, const char *unused);
+
+typedef void WalkDirFunc(const char *path, GPtrArray *defer);
+
+static void walk_forward_flag(char flag);
+
+#ifndef PIPE_BUF
+# define PIPE_BUF 512		/* The smallest POSIX allows */
+#endif
+
+/* Find matches (NUL-separated paths) and log lines from the fast walkers
+ * are sent to the filer in batches. A batch is sent before it would get
+ * bigger than this. It's kept within PIPE_BUF (including send_msg()'s
+ * length and the message type), so that a worker's batch reaches the main
+ * walker, which relays it, in a single write...
+ */
+#if PIPE_BUF - 5 < 2048
+# define WALK_BATCH_BYTES (PIPE_BUF - 5)
+#else
+# define WALK_BATCH_BYTES 2048
+#endif
+/* ... or when it has been waiting this long (microseconds) */
+#define WALK_BATCH_DELAY 200000
+/* Maximum number of processes to walk subtrees in parallel */
+#define WALK_MAX_WORKERS 8
+
+/* Regular files are copied in chunks of this size... */
+#define COPY_CHUNK (1 << 20)
+/* ... and synced and recorded in the journal after each this many bytes */
+#define COPY_CHECKPOINT (64 << 20)
 
 /*			SUPPORT				*/
 
@@ -332,7 +418,8 @@ static void show_settype_help(gpointer data)
 	gtk_widget_show_all(help);
 }
 
-static void process_message(GUIside *gui_side, const gchar *buffer)
+static void process_message(GUIside *gui_side, const gchar *buffer,
+			    ssize_t len)
 {
 	ABox *abox = gui_side->abox;
 
@@ -341,7 +428,16 @@ static void process_message(GUIside *gui_side, const gchar *buffer)
 	else if (*buffer == 's')
 		dir_check_this(buffer + 1);	/* Update this item */
 	else if (*buffer == '=')
-		abox_add_filename(abox, buffer + 1);
+	{
+		const gchar *name = buffer + 1;
+
+		/* Find sends several NUL-separated matches at once */
+		while (name < buffer + len)
+		{
+			abox_add_filename(abox, name);
+			name += strlen(name) + 1;
+		}
+	}
 	else if (*buffer == '#')
 		abox_clear_results(abox);
 	else if (*buffer == 'X')
@@ -408,7 +504,7 @@ static void message_from_child(gpointer 	  data,
 		if (message_len > 0 && read_exact(source, buffer, message_len))
 		{
 			buffer[message_len] = '\0';
-			process_message(gui_side, buffer);
+			process_message(gui_side, buffer, message_len);
 			g_free(buffer);
 			return;
 		}
@@ -421,6 +517,12 @@ static void message_from_child(gpointer 	  data,
 	/* The child is dead */
 	gui_side->child = 0;
 
+	if (gui_side->job)
+	{
+		opqueue_job_done(gui_side->job);
+		gui_side->job = NULL;
+	}
+
 	fclose(gui_side->to_child);
 	gui_side->to_child = NULL;
 	close(gui_side->from_child);
@@ -542,6 +644,9 @@ static gboolean send_msg(void)
 
 	g_return_val_if_fail(message->len < 0xffff, FALSE);
 
+	if (message->len && *message->str == '!')
+		child_errors++;
+
 	sprintf(len_buffer, "%04" G_GSIZE_MODIFIER "x", message->len);
 	fwrite(len_buffer, 1, 4, to_parent);
 	len = fwrite(message->str, 1, message->len, to_parent);
@@ -582,7 +687,22 @@ static void response(GtkDialog *dialog, gint response, GUIside *gui_side)
 static void flag_toggled(ABox *abox, gint flag, GUIside *gui_side)
 {
 	if (!gui_side->to_child)
+	{
+		/* Still waiting in the queue; remember for when we fork.
+		 * (Quiet is read from the window at that point.)
+		 */
+		if (flag == 'F')
+			gui_side->force = !gui_side->force;
+		else if (flag == 'B')
+			gui_side->brief = !gui_side->brief;
+		else if (flag == 'R')
+			gui_side->recurse = !gui_side->recurse;
+		else if (flag == 'W')
+			gui_side->newer = !gui_side->newer;
+		else if (flag == 'U')
+			gui_side->resume = !gui_side->resume;
 		return;
+	}
 
 	fputc(flag, gui_side->to_child);
 	fflush(gui_side->to_child);
@@ -635,13 +755,18 @@ static void process_flag(char flag)
 	        case 'W':
 		        o_newer = !o_newer;
 			break;
+		case 'U':
+			o_resume = !o_resume;
+			break;
 		case 'E':
 			read_new_entry_text();
 			break;
 		default:
 			printf_send("!ERROR: Bad message '%c'\n", flag);
-			break;
+			return;
 	}
+
+	walk_forward_flag(flag);
 }
 
 /* If the parent has sent any flag toggles, read them */
@@ -735,6 +860,7 @@ static void abort_operation(GtkWidget *widget, gpointer data)
 				 _("\nAsking child process to terminate...\n"),
 				 "error");
 			kill(-gui_side->child, SIGTERM);
+			kill(-gui_side->child, SIGCONT); /* If paused */
 		}
 		else
 		{
@@ -757,33 +883,38 @@ static void destroy_action_window(GtkWidget *widget, gpointer data)
 	if (gui_side->child)
 	{
 		kill(-gui_side->child, SIGTERM);
+		kill(-gui_side->child, SIGCONT);
 		fclose(gui_side->to_child);
 		close(gui_side->from_child);
 		g_source_remove(gui_side->input_tag);
 	}
 
+	if (gui_side->job)
+		opqueue_job_done(gui_side->job);
+
+	destroy_glist(&gui_side->paths);
+	g_free(gui_side->dest);
+	g_free(gui_side->leaf);
 	g_free(gui_side);
 	
 	one_less_window();
 }
 
-/* Create two pipes, fork() a child and return a pointer to a GUIside struct
- * (NULL on failure). The child calls func().
+/* Create two pipes and fork() a child, which calls func(data). Fills in
+ * the child's details in gui_side. FALSE on failure (already reported).
  */
-static GUIside *start_action(GtkWidget *abox, ActionChild *func, gpointer data,
-			      int force, int brief, int recurse, int newer)
+static gboolean fork_child(GUIside *gui_side, ActionChild *func, gpointer data,
+			   int force, int brief, int recurse, int newer)
 {
 	gboolean	autoq;
 	int		filedes[4];	/* 0 and 2 are for reading */
-	GUIside		*gui_side;
 	pid_t		child;
 	struct sigaction act;
 
 	if (pipe(filedes))
 	{
 		report_error("pipe: %s", g_strerror(errno));
-		gtk_widget_destroy(abox);
-		return NULL;
+		return FALSE;
 	}
 
 	if (pipe(filedes + 2))
@@ -791,25 +922,28 @@ static GUIside *start_action(GtkWidget *abox, ActionChild *func, gpointer data,
 		close(filedes[0]);
 		close(filedes[1]);
 		report_error("pipe: %s", g_strerror(errno));
-		gtk_widget_destroy(abox);
-		return NULL;
+		return FALSE;
 	}
 
 	autoq = gtk_toggle_button_get_active(
-			GTK_TOGGLE_BUTTON(ABOX(abox)->quiet));
+			GTK_TOGGLE_BUTTON(gui_side->abox->quiet));
 
 	o_force = force;
 	o_brief = brief;
 	o_recurse = recurse;
 	o_newer = newer;
+	o_resume = gui_side->resume;
 
 	child = fork();
 	switch (child)
 	{
 		case -1:
+			close(filedes[0]);
+			close(filedes[1]);
+			close(filedes[2]);
+			close(filedes[3]);
 			report_error("fork: %s", g_strerror(errno));
-			gtk_widget_destroy(abox);
-			return NULL;
+			return FALSE;
 		case 0:
 			/* We are the child */
 
@@ -819,6 +953,7 @@ static GUIside *start_action(GtkWidget *abox, ActionChild *func, gpointer data,
 			quiet = autoq;
 
 			dir_drop_all_notifies();
+			remote_drop_socket();
 
 			/* Reset the SIGCHLD handler */
 			act.sa_handler = SIG_DFL;
@@ -839,17 +974,50 @@ static GUIside *start_action(GtkWidget *abox, ActionChild *func, gpointer data,
 	/* We are the parent */
 	close(filedes[1]);
 	close(filedes[2]);
-	gui_side = g_new(GUIside, 1);
 	gui_side->from_child = filedes[0];
 	gui_side->to_child = fdopen(filedes[3], "wb");
 	gui_side->child = child;
+
+	gui_side->input_tag = gdk_input_add_full(gui_side->from_child,
+						GDK_INPUT_READ,
+						message_from_child,
+						gui_side, NULL);
+
+	return TRUE;
+}
+
+static GUIside *new_gui_side(GtkWidget *abox)
+{
+	GUIside		*gui_side;
+
+	gui_side = g_new(GUIside, 1);
+	gui_side->from_child = -1;
+	gui_side->to_child = NULL;
+	gui_side->input_tag = 0;
+	gui_side->child = 0;
 	gui_side->errors = 0;
 	gui_side->show_info = FALSE;
 	gui_side->default_string = NULL;
 	gui_side->entry_string_func = NULL;
 	gui_side->abort_attempts = 0;
 
+	gui_side->job = NULL;
+	gui_side->func = NULL;
+	gui_side->paths = NULL;
+	gui_side->resume = FALSE;
+	gui_side->dest = NULL;
+	gui_side->leaf = NULL;
+	gui_side->do_func = NULL;
+
 	gui_side->abox = ABOX(abox);
+
+	return gui_side;
+}
+
+static void connect_gui_side(GUIside *gui_side)
+{
+	GtkWidget *abox = GTK_WIDGET(gui_side->abox);
+
 	g_signal_connect(abox, "destroy",
 			G_CALLBACK(destroy_action_window), gui_side);
 
@@ -858,15 +1026,450 @@ static GUIside *start_action(GtkWidget *abox, ActionChild *func, gpointer data,
 			 G_CALLBACK(flag_toggled), gui_side);
 	g_signal_connect(abox, "abort_operation",
 			 G_CALLBACK(abort_operation), gui_side);
+}
 
-	gui_side->input_tag = gdk_input_add_full(gui_side->from_child,
-						GDK_INPUT_READ,
-						message_from_child,
-						gui_side, NULL);
+/* Create two pipes, fork() a child and return a pointer to a GUIside struct
+ * (NULL on failure). The child calls func().
+ */
+static GUIside *start_action(GtkWidget *abox, ActionChild *func, gpointer data,
+			      int force, int brief, int recurse, int newer)
+{
+	GUIside		*gui_side;
+
+	gui_side = new_gui_side(abox);
+
+	if (!fork_child(gui_side, func, data, force, brief, recurse, newer))
+	{
+		g_free(gui_side);
+		gtk_widget_destroy(abox);
+		return NULL;
+	}
+
+	connect_gui_side(gui_side);
+
+	return gui_side;
+}
+
+/* Called by the operation queue for jobs added by start_queued_action() */
+static void queued_action_event(OpJobEvent event, gpointer data)
+{
+	GUIside	*gui_side = (GUIside *) data;
+
+	switch (event)
+	{
+		case OPJOB_START:
+			action_dest = gui_side->dest;
+			action_leaf = gui_side->leaf;
+			action_do_func = gui_side->do_func;
+
+			if (!fork_child(gui_side, gui_side->func,
+					gui_side->paths,
+					gui_side->force, gui_side->brief,
+					gui_side->recurse, gui_side->newer))
+				gtk_widget_destroy(GTK_WIDGET(gui_side->abox));
+			break;
+		case OPJOB_WAIT:
+			abox_log(gui_side->abox,
+				_("Waiting for other operations on the same "
+				  "device to finish (see Window/Show Queue)..."
+				  "\n"), NULL);
+			break;
+		case OPJOB_STOP:
+			if (gui_side->child)
+				kill(-gui_side->child, SIGSTOP);
+			break;
+		case OPJOB_CONTINUE:
+			if (gui_side->child)
+				kill(-gui_side->child, SIGCONT);
+			break;
+	}
+}
+
+/* Like start_action(), but the operation goes into the queue and the child
+ * is only forked once no earlier operation is using the same devices.
+ * The paths and the current action_dest, action_leaf and action_do_func
+ * are copied for later. Never fails (forking errors are reported later).
+ */
+static GUIside *start_queued_action(GtkWidget *abox, const gchar *title,
+				    ActionChild *func, GList *paths,
+				    int force, int brief, int recurse,
+				    int newer)
+{
+	GUIside		*gui_side;
+	GList		*next;
+
+	gui_side = new_gui_side(abox);
+
+	gui_side->func = func;
+	for (next = paths; next; next = next->next)
+		gui_side->paths = g_list_prepend(gui_side->paths,
+						 g_strdup(next->data));
+	gui_side->paths = g_list_reverse(gui_side->paths);
+	gui_side->force = force;
+	gui_side->brief = brief;
+	gui_side->recurse = recurse;
+	gui_side->newer = newer;
+	gui_side->dest = g_strdup(action_dest);
+	gui_side->leaf = g_strdup(action_leaf);
+	gui_side->do_func = action_do_func;
+
+	connect_gui_side(gui_side);
+
+	gui_side->job = opqueue_add(title, paths, action_dest,
+				    queued_action_event, gui_side);
 
 	return gui_side;
 }
 
+/* Where the journal for copying 'paths' to 'dest' (renaming to 'leaf')
+ * is kept. The same operation always uses the same file, so that running it
+ * again after an interruption finds the old journal. g_free() the result.
+ */
+static gchar *copy_journal_path(GList *paths, const char *dest,
+				const char *leaf)
+{
+	GString	*key;
+	gchar	*hash, *file;
+
+	key = g_string_new(dest);
+	g_string_append_c(key, '\n');
+	if (leaf)
+		g_string_append(key, leaf);
+	for (; paths; paths = paths->next)
+	{
+		g_string_append_c(key, '\n');
+		g_string_append(key, (char *) paths->data);
+	}
+
+	hash = md5_hash(key->str);
+	g_string_free(key, TRUE);
+
+	file = g_build_filename(g_get_user_cache_dir(), SITE, PROJECT,
+				"copy-journals", hash, NULL);
+	g_free(hash);
+
+	return file;
+}
+
+/* Child: load the records left by an earlier attempt (if resuming) and
+ * open the journal to add more.
+ */
+static void copy_journal_open(GList *paths)
+{
+	gchar	*data, *dir;
+	gsize	len;
+	gboolean torn = FALSE;
+
+	copy_journal_file = copy_journal_path(paths, action_dest, action_leaf);
+	journal_done = g_hash_table_new_full(g_str_hash, g_str_equal,
+					     g_free, NULL);
+	journal_partial = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, g_free);
+	journal_made = g_hash_table_new_full(g_str_hash, g_str_equal,
+					     g_free, NULL);
+
+	if (o_resume &&
+	    g_file_get_contents(copy_journal_file, &data, &len, NULL))
+	{
+		gchar	*rec = data;
+		gchar	*end = data + len;
+
+		while (rec < end)
+		{
+			gchar	*next = rec + strlen(rec) + 1;
+			gint64	p[2];
+			gchar	*space;
+
+			if (next > end)
+			{
+				/* We were killed while writing this one */
+				torn = TRUE;
+				break;
+			}
+
+			if (*rec == 'D')
+				g_hash_table_insert(journal_done,
+						g_strdup(rec + 1),
+						GINT_TO_POINTER(TRUE));
+			else if (*rec == 'M')
+				g_hash_table_insert(journal_made,
+						g_strdup(rec + 1),
+						GINT_TO_POINTER(TRUE));
+			else if (*rec == 'P')
+			{
+				p[0] = g_ascii_strtoll(rec + 1, &space, 10);
+				if (*space == ' ')
+					p[1] = g_ascii_strtoll(space + 1,
+							       &space, 10);
+				if (*space == ' ')
+					g_hash_table_insert(journal_partial,
+						g_strdup(space + 1),
+						g_memdup(p, sizeof(p)));
+			}
+
+			rec = next;
+		}
+
+		g_free(data);
+	}
+
+	dir = g_path_get_dirname(copy_journal_file);
+	g_mkdir_with_parents(dir, 0700);
+	g_free(dir);
+
+	copy_journal = fopen(copy_journal_file, o_resume ? "ab" : "wb");
+	if (!copy_journal)
+		printf_send(_("'Can't write journal '%s' (%s); this copy "
+			      "won't be resumable\n"),
+			    copy_journal_file, g_strerror(errno));
+	else if (torn)
+		fputc('\0', copy_journal);
+}
+
+/* Child: the copy finished. If everything was copied the journal is no
+ * longer needed; otherwise keep it so that the rest can be resumed.
+ */
+static void copy_journal_close(void)
+{
+	if (copy_journal)
+	{
+		fclose(copy_journal);
+		copy_journal = NULL;
+		if (child_errors == 0)
+			unlink(copy_journal_file);
+	}
+
+	null_g_free(&copy_journal_file);
+	g_hash_table_destroy(journal_done);
+	g_hash_table_destroy(journal_partial);
+	g_hash_table_destroy(journal_made);
+	journal_done = journal_partial = journal_made = NULL;
+}
+
+static void copy_journal_write(const char *record)
+{
+	if (!copy_journal)
+		return;
+
+	fputs(record, copy_journal);
+	fputc('\0', copy_journal);
+	fflush(copy_journal);
+}
+
+/* Child: when resuming, see how much of 'path' the journal says has been
+ * copied to its (existing) destination. Returns info->st_size if it's
+ * all there, the offset to continue from if only part is, or -1 if the
+ * destination can't be trusted.
+ */
+static off_t copy_journal_copied(const char *path, struct stat *info,
+				 struct stat *dest_info)
+{
+	gint64	*p;
+
+	if (!journal_done || !S_ISREG(info->st_mode) ||
+	    !S_ISREG(dest_info->st_mode))
+		return -1;
+
+	if (g_hash_table_lookup(journal_done, path))
+	{
+		if (dest_info->st_size == info->st_size &&
+		    dest_info->st_mtime == info->st_mtime)
+			return info->st_size;
+		return -1;
+	}
+
+	p = g_hash_table_lookup(journal_partial, path);
+	if (p && p[1] == info->st_mtime && p[0] < info->st_size &&
+	    p[0] <= dest_info->st_size)
+		return p[0];
+
+	return -1;
+}
+
+/* Copy the regular file 'path' to 'dest_path', preserving the permissions,
+ * owner and times like 'cp -p' does, and leaving holes in sparse files.
+ * If 'offset' is non-zero, dest_path already holds that much of the file
+ * from an earlier attempt.
+ * Progress is recorded in the journal. FALSE on error (already reported).
+ */
+static gboolean copy_reg_file(const char *path, const char *dest_path,
+			      struct stat *info, off_t offset)
+{
+	int		from, to = -1;
+	off_t		next_checkpoint;
+	gchar		*buffer = NULL;
+	gchar		*record;
+#ifdef HAVE_FUTIMENS
+	struct timespec	times[2];
+#else
+	struct utimbuf	utb;
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+	gboolean	use_range = TRUE;
+#endif
+#ifdef SEEK_DATA
+	gboolean	use_holes = TRUE;
+#endif
+
+	from = open(path, O_RDONLY);
+	if (from == -1)
+		goto err;
+
+	if (offset)
+		to = open(dest_path, O_WRONLY);
+	else
+		to = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC,
+			  (info->st_mode & 0777) | S_IWUSR);
+	if (to == -1)
+		goto err;
+
+	/* Anything after the last checkpoint may not have reached the disk */
+	if (offset && ftruncate(to, offset))
+		goto err;
+
+	next_checkpoint = offset + COPY_CHECKPOINT;
+
+	for (;;)
+	{
+		ssize_t	got;
+		size_t	chunk = COPY_CHUNK;
+
+#ifdef SEEK_DATA
+		if (use_holes)
+		{
+			off_t	data, hole;
+
+			/* Skip over holes, so they stay holes in the copy */
+			data = lseek(from, offset, SEEK_DATA);
+			if (data == -1 && errno == ENXIO)
+			{
+				/* Nothing but (maybe) a hole left */
+				offset = lseek(from, 0, SEEK_END);
+				if (offset == -1 || ftruncate(to, offset))
+					goto err;
+				break;
+			}
+			else if (data == -1)
+				use_holes = FALSE;	/* Not supported */
+			else
+			{
+				offset = data;
+				hole = lseek(from, data, SEEK_HOLE);
+				if (hole > data &&
+				    (size_t) (hole - data) < chunk)
+					chunk = hole - data;
+			}
+		}
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+		if (use_range)
+		{
+			off_t	in = offset, out = offset;
+
+			/* Lets the kernel (or filesystem) do the copy */
+			got = copy_file_range(from, &in, to, &out,
+					      chunk, 0);
+			if (got == -1 && (errno == ENOSYS || errno == EXDEV ||
+				errno == EINVAL || errno == EOPNOTSUPP))
+			{
+				use_range = FALSE;
+				continue;
+			}
+		}
+		else
+#endif
+		{
+			ssize_t	done = 0;
+
+			if (!buffer)
+				buffer = g_malloc(COPY_CHUNK);
+
+			got = pread(from, buffer, chunk, offset);
+			while (got > 0 && done < got)
+			{
+				ssize_t	wrote;
+
+				wrote = pwrite(to, buffer + done, got - done,
+					       offset + done);
+				if (wrote == -1 && errno != EINTR)
+					goto err;
+				if (wrote > 0)
+					done += wrote;
+			}
+		}
+
+		if (got == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			goto err;
+		}
+		if (got == 0)
+			break;
+
+		offset += got;
+
+		if (offset >= next_checkpoint)
+		{
+			if (fdatasync(to))
+				goto err;
+			record = g_strdup_printf("P%" G_GINT64_FORMAT
+					" %" G_GINT64_FORMAT " %s",
+					(gint64) offset,
+					(gint64) info->st_mtime, path);
+			copy_journal_write(record);
+			g_free(record);
+			next_checkpoint = offset + COPY_CHECKPOINT;
+
+			check_flags();
+		}
+	}
+
+	/* Only root can give files away, so ignore errors here. Do this
+	 * first, since it may clear the SetUID and SetGID bits.
+	 */
+	(void) fchown(to, info->st_uid, info->st_gid);
+
+	/* Some filesystems don't support SetGID and SetUID bits */
+	if (fchmod(to, info->st_mode & 07777) && errno != EPERM)
+		goto err;
+
+#ifdef HAVE_FUTIMENS
+	times[0] = info->st_atim;
+	times[1] = info->st_mtim;
+	futimens(to, times);
+#endif
+
+	if (close(to))
+	{
+		to = -1;
+		goto err;
+	}
+	close(from);
+	g_free(buffer);
+
+#ifndef HAVE_FUTIMENS
+	utb.actime = info->st_atime;
+	utb.modtime = info->st_mtime;
+	utime(dest_path, &utb);
+#endif
+
+	record = g_strconcat("D", path, NULL);
+	copy_journal_write(record);
+	g_free(record);
+
+	return TRUE;
+err:
+	printf_send(_("!%s\nFailed to copy '%s'\n"), g_strerror(errno), path);
+	if (from != -1)
+		close(from);
+	if (to != -1)
+		close(to);
+	g_free(buffer);
+	return FALSE;
+}
+
 /* 			ACTIONS ON ONE ITEM 			*/
 
 /* These may call themselves recursively, or ask questions, etc */
@@ -940,80 +1543,633 @@ static void do_delete(const char *src_path, const char *unused)
 
 	safe_path = g_strdup(src_path);
 
-	if (S_ISDIR(info.st_mode))
+	if (S_ISDIR(info.st_mode))
+	{
+		for_dir_contents(do_delete, safe_path, safe_path);
+		if (rmdir(safe_path))
+		{
+			g_free(safe_path);
+			send_error();
+			return;
+		}
+		printf_send(_("'Directory '%s' deleted\n"), safe_path);
+		send_mount_path(safe_path);
+	}
+	else if (unlink(src_path))
+		send_error();
+	else
+	{
+		send_check_path(safe_path);
+		if (strcmp(g_basename(safe_path), ".DirIcon") == 0)
+		{
+			gchar *dir;
+			dir = g_path_get_dirname(safe_path);
+			send_check_path(dir);
+			g_free(dir);
+		}
+	}
+
+	g_free(safe_path);
+}
+
+static void do_eject(const char *path)
+{
+	const char *argv[]={"sh", "-c", NULL, NULL};
+	char *err;
+	
+	check_flags();
+
+	if (!quiet)
+	{
+		int res;
+		printf_send("<%s", path);
+		printf_send(">");
+		res=printf_reply(from_parent, !o_force,
+				  _("?Eject '%s'?"),
+				 path);
+		printf_send("<");
+		if (!res)
+			return;
+	}
+	else if (!o_brief)
+		printf_send(_("'Eject '%s'\n"), path);
+
+	/* Need to close all sub-directories now, or we
+	 * can't unmount if dnotify is used.
+	 */
+	{
+		char c = '?';
+		printf_send("X%s", path);
+		/* Wait until it's safe... */
+		read(from_parent, &c, 1);
+		g_return_if_fail(c == 'X');
+	}
+
+	argv[2] = build_command_with_path(o_action_eject_command.value,
+					  path);
+	err = fork_exec_wait((const char**)argv);
+	g_free((gchar *) argv[2]);
+	if (err)
+	{
+		printf_send(_("!%s\neject failed\n"), err);
+		g_free(err);
+	}
+
+	printf_send("M%s", path);
+
+}
+
+/* TRUE if it's been a while since we last sent anything */
+static gboolean walk_flush_due(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - walk_last_flush.tv_sec) * 1000000 +
+		(now.tv_usec - walk_last_flush.tv_usec) > WALK_BATCH_DELAY;
+}
+
+static int walk_n_workers(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long	n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return CLAMP(n, 1, WALK_MAX_WORKERS);
+#else
+	return 1;
+#endif
+}
+
+/* Pass a flag toggle from the filer on to any workers walking for us, so
+ * that they stay in step with the main walker.
+ */
+static void walk_forward_flag(char flag)
+{
+	int	i;
+
+	for (i = 0; i < walk_n_flag_fds; i++)
+	{
+		if (walk_flag_fds[i] == -1)
+			continue;
+
+		/* (a worker which has already finished gets EPIPE) */
+		if (flag == 'E')
+		{
+			gchar	*line;
+
+			line = g_strdup_printf("E%s\n", new_entry_string);
+			write(walk_flag_fds[i], line, strlen(line));
+			g_free(line);
+		}
+		else
+			write(walk_flag_fds[i], &flag, 1);
+	}
+}
+
+/* A forked worker can't ask the user questions, so it passes directories
+ * which need asking about back to the main walker (see walk_relay()).
+ */
+static void walk_hand_back(const char *path)
+{
+	printf_send("d%s", path);
+}
+
+/* Fork a worker for walk_tree(). Its messages come to us through a pipe
+ * (*relay), and we send it flag toggles through another (*flags).
+ * Returns as fork() does.
+ */
+static pid_t fork_walker(int *relay, int *flags)
+{
+	int	up[2], down[2];
+	pid_t	child;
+
+	if (pipe(up))
+		return -1;
+	if (pipe(down))
+	{
+		close(up[0]);
+		close(up[1]);
+		return -1;
+	}
+
+	child = fork();
+	if (child == 0)
+	{
+		close(up[0]);
+		close(down[1]);
+		fclose(to_parent);
+		close(from_parent);
+		to_parent = fdopen(up[1], "wb");
+		from_parent = down[0];
+		walk_worker = TRUE;
+		walk_n_flag_fds = 0;
+		return 0;
+	}
+
+	close(up[1]);
+	close(down[0]);
+	if (child == -1)
+	{
+		close(up[0]);
+		close(down[1]);
+		return -1;
+	}
+
+	*relay = up[0];
+	*flags = down[1];
+	return child;
+}
+
+/* Read one message from a worker and send it on to the filer, or add it
+ * to 'handback' if it's a directory being handed back. FALSE at the end.
+ */
+static gboolean walk_relay_message(int fd, GPtrArray *handback)
+{
+	char	len_buffer[5];
+	ssize_t	len;
+
+	if (!read_exact(fd, len_buffer, 4))
+		return FALSE;
+	len_buffer[4] = '\0';
+	len = strtol(len_buffer, NULL, 16);
+
+	g_string_set_size(message, len);
+	if (len > 0 && !read_exact(fd, message->str, len))
+		return FALSE;
+
+	if (len > 0 && message->str[0] == 'd')
+		g_ptr_array_add(handback, g_strndup(message->str + 1, len - 1));
+	else
+		send_msg();	/* (counts any errors, too) */
+
+	return TRUE;
+}
+
+/* Send on the workers' messages, one at a time, until they have all
+ * finished. Flag toggles from the filer are handled (and passed on to the
+ * workers) meanwhile.
+ */
+static void walk_relay(int *relay, int n, GPtrArray *handback)
+{
+	fd_set	set;
+	int	w, max_fd, n_open = 0;
+
+	for (w = 0; w < n; w++)
+		if (relay[w] != -1)
+			n_open++;
+
+	while (n_open > 0)
+	{
+		FD_ZERO(&set);
+		FD_SET(from_parent, &set);
+		max_fd = from_parent;
+		for (w = 0; w < n; w++)
+		{
+			if (relay[w] == -1)
+				continue;
+			FD_SET(relay[w], &set);
+			max_fd = MAX(max_fd, relay[w]);
+		}
+
+		if (select(max_fd + 1, &set, NULL, NULL, NULL) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			g_error("select() failed: %s\n", g_strerror(errno));
+		}
+
+		if (FD_ISSET(from_parent, &set))
+			check_flags();
+
+		for (w = 0; w < n; w++)
+		{
+			if (relay[w] == -1 || !FD_ISSET(relay[w], &set))
+				continue;
+			if (!walk_relay_message(relay[w], handback))
+			{
+				close(relay[w]);
+				relay[w] = -1;
+				n_open--;
+			}
+		}
+	}
+}
+
+/* Walk everything under directory 'path' using walk_dir(). The top few
+ * levels are expanded here until there are enough subdirectories to share
+ * out, and then the subtrees are split between several forked workers.
+ * We relay the workers' messages to the filer, so they don't get mixed
+ * up, and walk any directories they hand back. flush() sends anything
+ * batched up.
+ */
+static void walk_tree(const char *path, WalkDirFunc *walk_dir,
+		      void (*flush)(void))
+{
+	static gboolean	walking = FALSE;
+	GPtrArray	*frontier;
+	pid_t		workers[WALK_MAX_WORKERS];
+	int		relay[WALK_MAX_WORKERS];
+	int		flag_fds[WALK_MAX_WORKERS];
+	GPtrArray	*handback;
+	int		n_workers, w;
+	guint		i;
+
+	n_workers = walk_n_workers();
+
+	/* (we may get here again via do_find, etc, if the user turns off
+	 * quiet mode; just walk normally in that case)
+	 */
+	if (walking || n_workers < 2)
+	{
+		walk_dir(path, NULL);
+		return;
+	}
+	walking = TRUE;
+
+	frontier = g_ptr_array_new();
+	g_ptr_array_add(frontier, g_strdup(path));
+
+	while (frontier->len > 0 && frontier->len < 4 * n_workers)
+	{
+		GPtrArray *next;
+
+		next = g_ptr_array_new();
+		for (i = 0; i < frontier->len; i++)
+		{
+			walk_dir((char *) frontier->pdata[i], next);
+			g_free(frontier->pdata[i]);
+		}
+		g_ptr_array_free(frontier, TRUE);
+		frontier = next;
+	}
+
+	if (frontier->len < 2 || !quiet || new_entry_string)
+		n_workers = 1;
+	n_workers = MIN(n_workers, (int) frontier->len);
+
+	/* Don't let the workers inherit unsent results */
+	flush();
+
+	for (w = 0; w < n_workers; w++)
+		relay[w] = flag_fds[w] = -1;
+	walk_flag_fds = flag_fds;
+	walk_n_flag_fds = n_workers;
+
+	for (w = 0; w < n_workers; w++)
+	{
+		workers[w] = -1;
+		if (n_workers > 1)
+			workers[w] = fork_walker(&relay[w], &flag_fds[w]);
+
+		if (workers[w] == 0)
+		{
+			for (i = w; i < frontier->len; i += n_workers)
+				walk_dir((char *) frontier->pdata[i], NULL);
+			flush();
+			fclose(to_parent);
+			_exit(0);
+		}
+		else if (workers[w] == -1)
+		{
+			/* Can't fork (or not worth it); do it ourselves */
+			for (i = w; i < frontier->len; i += n_workers)
+				walk_dir((char *) frontier->pdata[i], NULL);
+		}
+	}
+
+	handback = g_ptr_array_new();
+	walk_relay(relay, n_workers, handback);
+
+	walk_flag_fds = NULL;
+	walk_n_flag_fds = 0;
+
+	for (w = 0; w < n_workers; w++)
+	{
+		if (flag_fds[w] != -1)
+			close(flag_fds[w]);
+		if (workers[w] > 0)
+			waitpid(workers[w], NULL, 0);
+	}
+
+	/* The workers couldn't ask about these; we can */
+	for (i = 0; i < handback->len; i++)
+	{
+		walk_dir((char *) handback->pdata[i], NULL);
+		g_free(handback->pdata[i]);
+	}
+	g_ptr_array_free(handback, TRUE);
+
+	for (i = 0; i < frontier->len; i++)
+		g_free(frontier->pdata[i]);
+	g_ptr_array_free(frontier, TRUE);
+
+	walking = FALSE;
+}
+
+/* Send any log lines which are waiting to the filer */
+static void walk_flush_log(void)
+{
+	if (walk_log && walk_log->len)
+	{
+		g_string_assign(message, "'");
+		g_string_append_len(message, walk_log->str, walk_log->len);
+		send_msg();
+		g_string_truncate(walk_log, 0);
+	}
+
+	gettimeofday(&walk_last_flush, NULL);
+}
+
+/* Add a line to the batch of log messages to send. msg is in the same
+ * format as for printf_send() (starting with "'").
+ */
+static void walk_log_printf(const char *msg, ...)
+{
+	va_list	args;
+	gchar	*line;
+	const gchar *start, *end;
+	size_t	len;
+
+	g_return_if_fail(*msg == '\'');
+
+	va_start(args, msg);
+	line = g_strdup_vprintf(msg + 1, args);
+	va_end(args);
+
+	len = strlen(line);
+
+	if (!walk_log)
+		walk_log = g_string_new(NULL);
+
+	if (walk_log->len && walk_log->len + len > WALK_BATCH_BYTES)
+		walk_flush_log();
+
+	/* A line too long for one batch is split between several, at
+	 * character boundaries where possible.
+	 */
+	start = line;
+	while (len > WALK_BATCH_BYTES)
+	{
+		end = g_utf8_find_prev_char(start,
+					    start + WALK_BATCH_BYTES + 1);
+		if (!end || end == start)
+			end = start + WALK_BATCH_BYTES;
+
+		g_string_append_len(walk_log, start, end - start);
+		walk_flush_log();
+		len -= end - start;
+		start = end;
+	}
+
+	g_string_append_len(walk_log, start, len);
+	g_free(line);
+
+	if (walk_flush_due())
+		walk_flush_log();
+}
+
+/* Report an error with 'leaf' in directory 'dir' (using errno) */
+static void walk_error(const char *dir, const char *leaf)
+{
+	int	error = errno;
+
+	walk_flush_log();
+	printf_send("!%s: %s\n", make_path(dir, leaf), g_strerror(error));
+}
+
+#ifdef WALK_WITH_FDS
+/* Open directory 'path' for walking, reporting any error */
+static DIR *walk_opendir(const char *path)
+{
+	DIR	*d = NULL;
+	int	fd, error;
+
+	fd = open(path, O_RDONLY | O_DIRECTORY);
+	if (fd != -1)
 	{
-		for_dir_contents(do_delete, safe_path, safe_path);
-		if (rmdir(safe_path))
+		d = fdopendir(fd);
+		if (!d)
 		{
-			g_free(safe_path);
-			send_error();
-			return;
+			error = errno;
+			close(fd);
+			errno = error;
 		}
-		printf_send(_("'Directory '%s' deleted\n"), safe_path);
-		send_mount_path(safe_path);
 	}
-	else if (unlink(src_path))
-		send_error();
-	else
+
+	if (!d)
+		printf_send("!%s '%s': %s\n", _("ERROR reading"),
+			    path, g_strerror(errno));
+
+	return d;
+}
+
+/* Walk the subdirectories collected by a walk_dir function (or add them to
+ * 'defer' instead), and free the list.
+ */
+static void walk_subdirs(GList *subdirs, WalkDirFunc *walk_dir,
+			 GPtrArray *defer)
+{
+	GList	*next;
+
+	for (next = subdirs; next; next = next->next)
 	{
-		send_check_path(safe_path);
-		if (strcmp(g_basename(safe_path), ".DirIcon") == 0)
+		if (defer)
+			g_ptr_array_add(defer, next->data);
+		else
 		{
-			gchar *dir;
-			dir = g_path_get_dirname(safe_path);
-			send_check_path(dir);
-			g_free(dir);
+			walk_dir((char *) next->data, NULL);
+			g_free(next->data);
 		}
 	}
+	g_list_free(subdirs);
+}
+#endif
 
-	g_free(safe_path);
+/* Send any matches which are waiting to the filer */
+static void find_flush_results(void)
+{
+	if (find_results && find_results->len)
+	{
+		g_string_assign(message, "=");
+		g_string_append_len(message, find_results->str,
+				    find_results->len);
+		send_msg();
+		g_string_truncate(find_results, 0);
+	}
+
+	gettimeofday(&walk_last_flush, NULL);
 }
 
-static void do_eject(const char *path)
+/* Add path to the batch of matches to send. A match can't be split, so
+ * one longer than a whole batch (a path of nearly PIPE_BUF bytes) still
+ * goes in a message by itself.
+ */
+static void find_add_result(const char *path)
 {
-	const char *argv[]={"sh", "-c", NULL, NULL};
-	char *err;
-	
+	size_t	len = strlen(path) + 1;		/* Include the NUL */
+
+	if (!find_results)
+		find_results = g_string_new(NULL);
+
+	if (find_results->len && find_results->len + len > WALK_BATCH_BYTES)
+		find_flush_results();
+
+	g_string_append_len(find_results, path, len);
+
+	if (walk_flush_due())
+		find_flush_results();
+}
+
+/* Fill in info->stats, as far as find_needs requires. The type comes
+ * from the directory entry if possible, avoiding the lstat().
+ * FALSE (with errno set) on error.
+ */
+static gboolean find_get_stats(FindInfo *info, struct dirent *ent)
+{
+#if defined(DTTOIF) && !defined(HAVE_LIBVFS)
+	if (!(find_needs & FIND_NEED_STAT) && ent->d_type != DT_UNKNOWN)
+	{
+		info->stats.st_mode = DTTOIF(ent->d_type);
+		return TRUE;
+	}
+#endif
+	return mc_lstat(info->fullpath, &info->stats) == 0;
+}
+
+/* Test everything inside directory 'path' (which has already been tested
+ * itself) and recurse into subdirectories. If 'defer' is not NULL, the
+ * subdirectories are added to it instead of being walked now.
+ * This is the fast path for quiet mode; if the user wants to be asked about
+ * each item, or has changed the condition, we fall back to do_find().
+ */
+static void find_walk_dir(const char *path, GPtrArray *defer)
+{
+	DIR		*d;
+	struct dirent	*ent;
+	GString		*full;
+	size_t		base_len;
+	GList		*subdirs = NULL, *next;
+	FindInfo	info;
+
 	check_flags();
 
-	if (!quiet)
+	if (new_entry_string || !quiet)
 	{
-		int res;
-		printf_send("<%s", path);
-		printf_send(">");
-		res=printf_reply(from_parent, !o_force,
-				  _("?Eject '%s'?"),
-				 path);
-		printf_send("<");
-		if (!res)
-			return;
+		if (walk_worker)
+			walk_hand_back(path);
+		else
+			for_dir_contents(do_find, path, path);
+		return;
 	}
-	else if (!o_brief)
-		printf_send(_("'Eject '%s'\n"), path);
 
-	/* Need to close all sub-directories now, or we
-	 * can't unmount if dnotify is used.
-	 */
+	d = mc_opendir(path);
+	if (!d)
 	{
-		char c = '?';
-		printf_send("X%s", path);
-		/* Wait until it's safe... */
-		read(from_parent, &c, 1);
-		g_return_if_fail(c == 'X');
+		printf_send("!%s '%s': %s\n", _("ERROR reading"),
+			    path, g_strerror(errno));
+		return;
 	}
 
-	argv[2] = build_command_with_path(o_action_eject_command.value,
-					  path);
-	err = fork_exec_wait((const char**)argv);
-	g_free((gchar *) argv[2]);
-	if (err)
+	if (walk_flush_due())
 	{
-		printf_send(_("!%s\neject failed\n"), err);
-		g_free(err);
+		send_dir(path);
+		find_flush_results();
 	}
 
-	printf_send("M%s", path);
+	full = g_string_new(path);
+	if (path[0] != '/' || path[1] != '\0')
+		g_string_append_c(full, '/');
+	base_len = full->len;
+
+	info.now = find_now;
+
+	while ((ent = mc_readdir(d)))
+	{
+		const char *leaf = ent->d_name;
 
+		if (leaf[0] == '.' && (leaf[1] == '\0'
+			|| (leaf[1] == '.' && leaf[2] == '\0')))
+			continue;
+
+		g_string_truncate(full, base_len);
+		g_string_append(full, leaf);
+
+		info.fullpath = full->str;
+		info.leaf = full->str + base_len;
+		info.prune = FALSE;
+
+		if (!find_get_stats(&info, ent))
+		{
+			send_error();
+			printf_send(_("'(while checking '%s')\n"), full->str);
+			continue;
+		}
+
+		if (find_test_condition(find_condition, &info))
+			find_add_result(full->str);
+
+		if (S_ISDIR(info.stats.st_mode) && !info.prune)
+		{
+			if (defer)
+				g_ptr_array_add(defer, g_strdup(full->str));
+			else
+				subdirs = g_list_prepend(subdirs,
+							 g_strdup(full->str));
+		}
+	}
+	mc_closedir(d);
+	g_string_free(full, TRUE);
+
+	/* Recurse after closing, so we don't run out of file descriptors */
+	for (next = subdirs; next; next = next->next)
+	{
+		find_walk_dir((char *) next->data, NULL);
+		g_free(next->data);
+	}
+	g_list_free(subdirs);
 }
 
 /* path is the item to check. If is is a directory then we may recurse
@@ -1027,6 +2183,7 @@ static void do_find(const char *path, const char *unused)
 
 	if (!quiet)
 	{
+		find_flush_results();
 		if (!printf_reply(from_parent, FALSE, _("?Check '%s'?"), path))
 			return;
 	}
@@ -1038,6 +2195,9 @@ static void do_find(const char *path, const char *unused)
 			find_condition_free(find_condition);
 			find_condition = find_compile(new_entry_string);
 			null_g_free(&new_entry_string);
+			if (find_condition)
+				find_needs = find_condition_needs(
+							find_condition);
 		}
 
 		if (find_condition)
@@ -1058,18 +2218,22 @@ static void do_find(const char *path, const char *unused)
 	}
 
 	info.fullpath = path;
-	time(&info.now);	/* XXX: Not for each check! */
+	info.now = find_now;
 
 	info.leaf = g_basename(path);
 	info.prune = FALSE;
 	if (find_test_condition(find_condition, &info))
-		printf_send("=%s", path);
+		find_add_result(path);
 
 	if (S_ISDIR(info.stats.st_mode) && !info.prune)
 	{
 		char *safe_path;
 		safe_path = g_strdup(path);
-		for_dir_contents(do_find, safe_path, safe_path);
+		if (quiet)
+			walk_tree(safe_path, find_walk_dir,
+				  find_flush_results);
+		else
+			for_dir_contents(do_find, safe_path, safe_path);
 		g_free(safe_path);
 	}
 }
@@ -1106,6 +2270,89 @@ static struct mode_change *nice_mode_compile(const char *mode_string,
 	return retval;
 }
 
+/* Change the permissions of everything inside directory 'path' (which
+ * has been done itself) and recurse, for walk_tree(). The compiled
+ * mode_change is shared by all the workers. Like find_walk_dir(), this
+ * falls back to do_chmod() if the user wants to be asked about each item.
+ */
+static void chmod_walk_dir(const char *path, GPtrArray *defer)
+{
+#ifdef WALK_WITH_FDS
+	DIR		*d;
+	struct dirent	*ent;
+	GList		*subdirs = NULL;
+	int		dfd;
+#endif
+
+	check_flags();
+
+	if (new_entry_string || !quiet)
+	{
+		if (walk_worker)
+			walk_hand_back(path);
+		else
+		{
+			walk_flush_log();
+			for_dir_contents(do_chmod, path, path);
+		}
+		return;
+	}
+
+#ifdef WALK_WITH_FDS
+	d = walk_opendir(path);
+	if (!d)
+		return;
+	dfd = dirfd(d);
+
+	if (walk_flush_due())
+	{
+		send_dir(path);
+		walk_flush_log();
+	}
+
+	while ((ent = readdir(d)))
+	{
+		const char	*leaf = ent->d_name;
+		struct stat	info;
+		mode_t		new_mode;
+
+		if (leaf[0] == '.' && (leaf[1] == '\0'
+			|| (leaf[1] == '.' && leaf[2] == '\0')))
+			continue;
+
+		if (fstatat(dfd, leaf, &info, AT_SYMLINK_NOFOLLOW))
+		{
+			walk_error(path, leaf);
+			continue;
+		}
+		if (S_ISLNK(info.st_mode))
+			continue;
+
+		if (!o_brief)
+			walk_log_printf(_("'Changing permissions of '%s'\n"),
+					make_path(path, leaf));
+
+		new_mode = mode_adjust(info.st_mode, mode_change);
+		if (new_mode != (info.st_mode & 07777) &&
+		    fchmodat(dfd, leaf, new_mode, 0))
+		{
+			walk_error(path, leaf);
+			continue;
+		}
+
+		if (S_ISDIR(info.st_mode))
+			subdirs = g_list_prepend(subdirs,
+					g_strdup(make_path(path, leaf)));
+	}
+	closedir(d);
+
+	/* Recurse after closing, so we don't run out of file descriptors */
+	walk_subdirs(subdirs, chmod_walk_dir, defer);
+#else
+	for_dir_contents(do_chmod, path, path);
+#endif
+}
+
 static void do_chmod(const char *path, const char *unused)
 {
 	struct stat 	info;
@@ -1175,16 +2422,109 @@ static void do_chmod(const char *path, const char *unused)
 
 	if (S_ISDIR(info.st_mode))
 	{
-		send_mount_path(path);
-
 		if (o_recurse)
 		{
 			guchar *safe_path;
 			safe_path = g_strdup(path);
-			for_dir_contents(do_chmod, safe_path, safe_path);
+			walk_tree(safe_path, chmod_walk_dir, walk_flush_log);
+			walk_flush_log();
+			send_mount_path(safe_path);
 			g_free(safe_path);
 		}
+		else
+			send_mount_path(path);
+	}
+}
+
+/* Set the type of every regular file inside directory 'path' and recurse,
+ * for walk_tree(). Falls back to do_settype() if the user wants to be asked
+ * about each item.
+ */
+static void settype_walk_dir(const char *path, GPtrArray *defer)
+{
+#ifdef WALK_WITH_FDS
+	DIR		*d;
+	struct dirent	*ent;
+	GList		*subdirs = NULL;
+	int		dfd;
+	const char	*comment;
+#endif
+
+	check_flags();
+
+	if (new_entry_string || !quiet)
+	{
+		if (walk_worker)
+			walk_hand_back(path);
+		else
+		{
+			walk_flush_log();
+			for_dir_contents(do_settype, path, NULL);
+		}
+		return;
+	}
+
+#ifdef WALK_WITH_FDS
+	d = walk_opendir(path);
+	if (!d)
+		return;
+	dfd = dirfd(d);
+
+	if (walk_flush_due())
+	{
+		send_dir(path);
+		walk_flush_log();
+	}
+
+	comment = mime_type_comment(type_change);
+
+	while ((ent = readdir(d)))
+	{
+		const char	*leaf = ent->d_name;
+		struct stat	info;
+		int		err;
+
+		if (leaf[0] == '.' && (leaf[1] == '\0'
+			|| (leaf[1] == '.' && leaf[2] == '\0')))
+			continue;
+
+#ifdef DTTOIF
+		if (ent->d_type != DT_UNKNOWN)
+			info.st_mode = DTTOIF(ent->d_type);
+		else
+#endif
+		if (fstatat(dfd, leaf, &info, AT_SYMLINK_NOFOLLOW))
+		{
+			walk_error(path, leaf);
+			continue;
+		}
+
+		if (S_ISDIR(info.st_mode))
+		{
+			subdirs = g_list_prepend(subdirs,
+					g_strdup(make_path(path, leaf)));
+			continue;
+		}
+		if (!S_ISREG(info.st_mode))
+			continue;
+
+		if (!o_brief)
+			walk_log_printf(_("'Changing type of '%s' to '%s'\n"),
+					make_path(path, leaf), comment);
+
+		/* (by name, since opening it would update its access time
+		 * and we may not be allowed to read it anyway)
+		 */
+		err = xtype_set(make_path(path, leaf), type_change);
+		if (err)
+			walk_error(path, leaf);
 	}
+	closedir(d);
+
+	walk_subdirs(subdirs, settype_walk_dir, defer);
+#else
+	for_dir_contents(do_settype, path, NULL);
+#endif
 }
 
 static void do_settype(const char *path, const char *unused)
@@ -1268,7 +2608,9 @@ static void do_settype(const char *path, const char *unused)
 		{
 			guchar *safe_path;
 			safe_path = g_strdup(path);
-			for_dir_contents(do_settype, safe_path, unused);
+			walk_tree(safe_path, settype_walk_dir, walk_flush_log);
+			walk_flush_log();
+			send_mount_path(safe_path);
 			g_free(safe_path);
 		}
 		else if(!o_brief)
@@ -1312,6 +2654,7 @@ static void do_copy2(const char *path, const char *dest)
 	const char	*dest_path;
 	struct stat 	info;
 	struct stat 	dest_info;
+	off_t		resume_from = 0;
 
 	check_flags();
 
@@ -1328,37 +2671,62 @@ static void do_copy2(const char *path, const char *dest)
 		int		err;
 		gboolean	merge;
 
+		off_t		copied;
+
 		merge = S_ISDIR(info.st_mode) && S_ISDIR(dest_info.st_mode);
+		copied = o_resume ? copy_journal_copied(path, &info, &dest_info)
+				  : -1;
 
-		if (!merge && o_newer && info.st_mtime > dest_info.st_mtime)
+		if (copied == info.st_size)
 		{
-			/* Newer; keep going */
+			if (!o_brief)
+				printf_send(_("'Already copied %s\n"), path);
+			return;
+		}
+		else if (copied >= 0)
+		{
+			resume_from = copied;
+			printf_send(_("'Resuming copy of %s from %s\n"),
+				    path, format_size(copied));
+		}
+		else if (merge && o_resume)
+		{
+			/* Probably created by the earlier attempt */
 		}
 		else
 		{
-			printf_send("<%s", path);
-			printf_send(">%s", dest_path);
-			if (!printf_reply(from_parent, merge,
+			if (!merge && o_newer &&
+			    info.st_mtime > dest_info.st_mtime)
+			{
+				/* Newer; keep going */
+			}
+			else
+			{
+				printf_send("<%s", path);
+				printf_send(">%s", dest_path);
+				if (!printf_reply(from_parent, merge,
 					  _("?'%s' already exists - %s?"),
 					  dest_path,
 					  merge ? _("merge contents")
 					  	: _("overwrite")))
-				return;
-		}
-
-		if (!merge)
-		{
-			if (S_ISDIR(dest_info.st_mode))
-				err = rmdir(dest_path);
-			else
-				err = unlink(dest_path);
+					return;
+			}
 
-			if (err)
+			if (!merge)
 			{
-				send_error();
-				if (errno != ENOENT)
-					return;
-				printf_send(_("'Trying copy anyway...\n"));
+				if (S_ISDIR(dest_info.st_mode))
+					err = rmdir(dest_path);
+				else
+					err = unlink(dest_path);
+
+				if (err)
+				{
+					send_error();
+					if (errno != ENOENT)
+						return;
+					printf_send(
+					   _("'Trying copy anyway...\n"));
+				}
 			}
 		}
 	}
@@ -1378,13 +2746,17 @@ static void do_copy2(const char *path, const char *dest)
 		mode_t	mode = info.st_mode;
 		char *safe_path, *safe_dest;
 		struct stat 	dest_info;
-		gboolean	exists;
+		gboolean	exists, made;
 
 		safe_path = g_strdup(path);
 		safe_dest = g_strdup(dest_path);
 
 		exists = !mc_lstat(dest_path, &dest_info);
 
+		/* If an earlier attempt made it, it still needs fixing up */
+		made = !exists || (o_resume && journal_made &&
+				   g_hash_table_lookup(journal_made, path));
+
 		if (exists && !S_ISDIR(dest_info.st_mode))
 			printf_send(_("!ERROR: Destination already exists, "
 				      "but is not a directory\n"));
@@ -1393,14 +2765,22 @@ static void do_copy2(const char *path, const char *dest)
 		else
 		{
 			if (!exists)
+			{
+				gchar	*record;
+
 				/* (just been created then) */
 				send_check_path(dest_path);
 
+				record = g_strconcat("M", path, NULL);
+				copy_journal_write(record);
+				g_free(record);
+			}
+
 			action_leaf = NULL;
 			for_dir_contents(do_copy2, safe_path, safe_dest);
 			/* Note: dest_path now invalid... */
 
-			if (!exists)
+			if (made)
 			{
 				struct utimbuf utb;
 
@@ -1450,6 +2830,11 @@ static void do_copy2(const char *path, const char *dest)
 		else
 			send_error();
 	}
+	else if (S_ISREG(info.st_mode))
+	{
+		if (copy_reg_file(path, dest_path, &info, resume_from))
+			send_check_path(dest_path);
+	}
 	else
 	{
 		guchar	*error;
@@ -1845,6 +3230,8 @@ static void find_cb(gpointer data)
 
 	while (1)
 	{
+		time(&find_now);
+
 		for (paths = all_paths; paths; paths = paths->next)
 		{
 			guchar	*path = (guchar *) paths->data;
@@ -1854,6 +3241,8 @@ static void find_cb(gpointer data)
 			do_find(path, NULL);
 		}
 
+		find_flush_results();
+
 		if (!printf_reply(from_parent, TRUE,
 				  _("?Another search?")))
 			break;
@@ -1947,6 +3336,13 @@ static void list_cb(gpointer data)
 	send_done();
 }
 
+static void copy_cb(gpointer data)
+{
+	copy_journal_open((GList *) data);
+	list_cb(data);
+	copy_journal_close();
+}
+
 /*			EXTERNAL INTERFACE			*/
 
 void action_find(GList *paths)
@@ -2070,10 +3466,14 @@ void action_delete(GList *paths)
 	if (!remove_pinned_ok(paths))
 		return;
 
+	action_dest = NULL;
+	action_leaf = NULL;
+	action_do_func = NULL;
+
 	abox = abox_new(_("Delete"), o_action_delete.int_value);
 	if(paths && paths->next)
 		abox_set_percentage(ABOX(abox), 0);
-	gui_side = start_action(abox, delete_cb, paths,
+	gui_side = start_queued_action(abox, _("Delete"), delete_cb, paths,
 					 o_action_force.int_value,
 					 o_action_brief.int_value,
 					 o_action_recurse.int_value,
@@ -2256,6 +3656,8 @@ void action_copy(GList *paths, const char *dest, const char *leaf, int quiet)
 {
 	GUIside		*gui_side;
 	GtkWidget	*abox;
+	gchar		*journal;
+	gboolean	resume;
 
 	if (quiet == -1)
 		quiet = o_action_copy.int_value;
@@ -2267,7 +3669,7 @@ void action_copy(GList *paths, const char *dest, const char *leaf, int quiet)
 	abox = abox_new(_("Copy"), quiet);
 	if(paths && paths->next)
 		abox_set_percentage(ABOX(abox), 0);
-	gui_side = start_action(abox, list_cb, paths,
+	gui_side = start_queued_action(abox, _("Copy"), copy_cb, paths,
 					 o_action_force.int_value,
 					 o_action_brief.int_value,
 					 o_action_recurse.int_value,
@@ -2283,6 +3685,22 @@ void action_copy(GList *paths, const char *dest, const char *leaf, int quiet)
 		_("Brief"), _("Only log directories as they are copied"),
 		'B', o_action_brief.int_value);
 
+	/* If the same copy was interrupted before, offer to carry on */
+	journal = copy_journal_path(paths, dest, leaf);
+	resume = file_exists(journal);
+	g_free(journal);
+
+	gui_side->resume = resume;
+	abox_add_flag(ABOX(abox),
+		_("Resume"),
+		_("Skip files already copied by an earlier, interrupted "
+		  "attempt, and continue partly copied files from where "
+		  "it stopped."),
+		'U', resume);
+	if (resume)
+		abox_log(ABOX(abox), _("This copy was interrupted before; "
+				       "it will be resumed.\n"), NULL);
+
 	log_info_paths_leaf("Copy", paths, dest, leaf);
 
 	number_of_windows++;
@@ -2307,7 +3725,7 @@ void action_move(GList *paths, const char *dest, const char *leaf, int quiet)
 	abox = abox_new(_("Move"), quiet);
 	if(paths && paths->next)
 		abox_set_percentage(ABOX(abox), 0);
-	gui_side = start_action(abox, list_cb, paths,
+	gui_side = start_queued_action(abox, _("Move"), list_cb, paths,
 					 o_action_force.int_value,
 					 o_action_brief.int_value,
 					 o_action_recurse.int_value,
@@ -2401,6 +3819,8 @@ void action_init(void)
 			  "action_umount_command", "umount");
 	option_add_string(&o_action_eject_command,
 			  "action_eject_command", "eject");
+
+	opqueue_init();
 }
 
 #define MAX_ASK 4
@@ -54,6 +54,7 @@ static struct migration {
 
 /* Static prototypes */
 static gboolean exists(char *path);
+static GPtrArray *list_xdg_dirs(char *dir, char *site, gboolean only_existing);
 static void migrate_choices(void);
 
 /****************************************************************
@@ -332,6 +333,25 @@ gchar *choices_find_xdg_path_save(const char *leaf, const char *dir,
  * Free the list using choices_free_list().
  */
 GPtrArray *choices_list_xdg_dirs(char *dir, char *site)
+{
+	return list_xdg_dirs(dir, site, TRUE);
+}
+
+/* As choices_list_xdg_dirs(), but includes the directories that don't exist
+ * (yet). 'dir' may be NULL, to get the 'site' directories themselves, and
+ * then 'site' may also be NULL, to get the XDG directories.
+ */
+GPtrArray *choices_list_all_xdg_dirs(char *dir, char *site)
+{
+	return list_xdg_dirs(dir, site, FALSE);
+}
+
+/****************************************************************
+ *			INTERNAL FUNCTIONS			*
+ ****************************************************************/
+
+
+static GPtrArray *list_xdg_dirs(char *dir, char *site, gboolean only_existing)
 {
 	GPtrArray	*list;
 	int              i;
@@ -350,7 +370,7 @@ GPtrArray *choices_list_xdg_dirs(char *dir, char *site)
 		else
 			path = g_build_filename(xdg_dir_list[i], dir, NULL);
 		
-		if (exists(path))
+		if (!only_existing || exists(path))
 			g_ptr_array_add(list, path);
 		else
 			g_free(path);
@@ -359,11 +379,6 @@ GPtrArray *choices_list_xdg_dirs(char *dir, char *site)
 	return list;
 }
 
-/****************************************************************
- *			INTERNAL FUNCTIONS			*
- ****************************************************************/
-
-
 /* Returns TRUE if the object exists, FALSE if it doesn't */
 static gboolean exists(char *path)
 {
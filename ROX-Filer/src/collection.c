@@ -25,6 +25,7 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
@@ -38,6 +39,19 @@
 
 #define MAX_WINKS 5		/* Should be an odd number */
 
+/* Rendered items are kept in an offscreen atlas of tiles so that scrolling
+ * and expose events only need to copy pixels. This is the maximum number of
+ * pixels to use for the atlas of each Collection.
+ */
+#define TILE_BUDGET (4 << 20)
+
+struct _CollectionTile {
+	gpointer	data;		/* Item drawn here, or NULL if free */
+	gboolean	selected;	/* State the item was drawn in */
+	int		width;		/* Width of the area drawn */
+	guint		last_used;	/* For LRU eviction */
+};
+
 /* Macro to emit the "selection_changed" signal only if allowed */
 #define EMIT_SELECTION_CHANGED(collection, time) \
 	if (!collection->block_selection_changed) \
@@ -107,6 +121,7 @@ static void collection_set_property(GObject      *object,
 				    GParamSpec   *pspec);
 static gint collection_expose(GtkWidget *widget, GdkEventExpose *event);
 static void default_draw_item(GtkWidget *widget,
+				GdkDrawable *drawable,
 				CollectionItem *data,
 				GdkRectangle *area,
 				gpointer user_data);
@@ -132,6 +147,16 @@ static void collection_item_set_selected(Collection *collection,
 static gint collection_scroll_event(GtkWidget *widget, GdkEventScroll *event);
 static int collection_get_rows(const Collection *collection);
 static int collection_get_cols(const Collection *collection);
+static gboolean alloc_tiles(Collection *collection);
+static gboolean draw_cached_item(Collection *collection, int item,
+				 GdkRectangle *area);
+static void forget_tile(Collection *collection, gpointer data);
+static gboolean tail_in_order(Collection *collection, int n_sorted,
+			      int (*compar)(const void *, const void *),
+			      GtkSortType order);
+static void merge_tail(Collection *collection, int n_sorted,
+		       int (*compar)(const void *, const void *),
+		       GtkSortType order);
 
 
 /* The number of rows, at least 1.  */
@@ -182,9 +207,12 @@ static void draw_focus_at(Collection *collection, GdkRectangle *area)
 
 static void draw_one_item(Collection *collection, int item, GdkRectangle *area)
 {
-	if (item < collection->number_of_items)
+	if (item < collection->number_of_items &&
+	    !draw_cached_item(collection, item, area))
 	{
-		collection->draw_item((GtkWidget *) collection,
+		GtkWidget *widget = (GtkWidget *) collection;
+
+		collection->draw_item(widget, widget->window,
 				&collection->items[item],
 				area, collection->cb_user_data);
 	}
@@ -302,6 +330,7 @@ static void collection_init(GTypeInstance *instance, gpointer g_class)
 
 	object->number_of_items = 0;
 	object->number_selected = 0;
+	object->selected_weight = 0;
 	object->block_selection_changed = 0;
 	object->columns = 1;
 	object->vertical_order = FALSE;
@@ -318,6 +347,15 @@ static void collection_init(GTypeInstance *instance, gpointer g_class)
 	object->draw_item = default_draw_item;
 	object->test_point = default_test_point;
 	object->free_item = NULL;
+	object->weigh_item = NULL;
+
+	object->tiles = NULL;
+	object->tile_scratch = NULL;
+	object->tile_info = NULL;
+	object->n_tiles = 0;
+	object->tiles_per_row = 0;
+	object->tile_slots = NULL;
+	object->tile_clock = 0;
 }
 
 GtkWidget* collection_new(void)
@@ -338,6 +376,7 @@ static void collection_destroy(GtkObject *object)
 	collection = COLLECTION(object);
 
 	collection_clear(collection);
+	collection_discard_tiles(collection);
 
 	if (collection->vadj)
 	{
@@ -499,6 +538,9 @@ static void collection_size_allocate(GtkWidget *widget,
 
 	if (old_columns != collection->columns)
 	{
+		/* The atlas was sized for the old number of columns */
+		collection_discard_tiles(collection);
+
 		/* Need to go around again... */
 		gtk_widget_queue_resize(widget);
 	}
@@ -597,11 +639,12 @@ static gint collection_expose(GtkWidget *widget, GdkEventExpose *event)
 }
 
 static void default_draw_item(GtkWidget *widget,
+			      GdkDrawable *drawable,
 			      CollectionItem *item,
 			      GdkRectangle *area,
 			      gpointer user_data)
 {
-	gdk_draw_arc(widget->window,
+	gdk_draw_arc(drawable,
 			item->selected ? widget->style->white_gc
 				       : widget->style->black_gc,
 			TRUE,
@@ -690,6 +733,157 @@ static void collection_get_property(GObject    *object,
 	}
 }
 
+/* Create the tile atlas for the current item size, if there is room for at
+ * least a screenful of items. Returns FALSE if items should be drawn
+ * directly to the window instead.
+ */
+static gboolean alloc_tiles(Collection *collection)
+{
+	GtkWidget *widget = GTK_WIDGET(collection);
+	int	tw = collection->item_width << 1;
+	int	th = collection->item_height;
+	int	page, visible, n, per_row;
+
+	if (!GTK_WIDGET_REALIZED(widget))
+		return FALSE;
+
+	if (collection->vadj)
+		page = collection->vadj->page_size;
+	else
+		page = widget->allocation.height;
+
+	visible = (page / th + 2) * collection->columns;
+	n = MIN(visible * 2, TILE_BUDGET / (tw * th));
+	if (n < visible)
+		return FALSE;
+
+	/* Keep both sides of the atlas within what X servers will accept */
+	per_row = MAX(1, MIN(n, 16384 / tw));
+	n = MIN(n, per_row * (16384 / th));
+	if (n < visible)
+		return FALSE;
+
+	collection->tiles = gdk_pixmap_new(widget->window,
+			per_row * tw, ((n + per_row - 1) / per_row) * th, -1);
+	collection->tile_scratch = gdk_pixmap_new(widget->window, tw, th, -1);
+	collection->tile_info = g_new0(CollectionTile, n);
+	collection->n_tiles = n;
+	collection->tiles_per_row = per_row;
+	collection->tile_slots = g_hash_table_new(NULL, NULL);
+
+	return TRUE;
+}
+
+/* Copy this item to the window from the tile cache, rendering it into the
+ * cache first if it isn't there or is out of date.
+ * Returns FALSE if the item can't be cached and must be drawn directly.
+ */
+static gboolean draw_cached_item(Collection *collection, int item,
+				 GdkRectangle *area)
+{
+	GtkWidget	*widget = GTK_WIDGET(collection);
+	CollectionItem	*colitem = &collection->items[item];
+	CollectionTile	*tile;
+	GdkRectangle	local;
+	int		slot, x, y;
+
+	/* Items are drawn over the background pixmap, so each tile would
+	 * depend on its position.
+	 */
+	if (widget->style->bg_pixmap[GTK_STATE_NORMAL])
+		return FALSE;
+	if (area->width > collection->item_width << 1)
+		return FALSE;
+	if (!collection->tiles && !alloc_tiles(collection))
+		return FALSE;
+
+	slot = GPOINTER_TO_INT(g_hash_table_lookup(collection->tile_slots,
+						   colitem->data)) - 1;
+	if (slot < 0)
+	{
+		int	i;
+
+		/* Take a free slot, or the least recently used one */
+		slot = 0;
+		for (i = 0; i < collection->n_tiles; i++)
+		{
+			tile = &collection->tile_info[i];
+			if (!tile->data)
+			{
+				slot = i;
+				break;
+			}
+			if (tile->last_used <
+			    collection->tile_info[slot].last_used)
+				slot = i;
+		}
+
+		tile = &collection->tile_info[slot];
+		if (tile->data)
+			g_hash_table_remove(collection->tile_slots,
+					    tile->data);
+		tile->data = colitem->data;
+		tile->width = -1;
+		g_hash_table_insert(collection->tile_slots, colitem->data,
+				    GINT_TO_POINTER(slot + 1));
+	}
+	tile = &collection->tile_info[slot];
+
+	x = (slot % collection->tiles_per_row) * (collection->item_width << 1);
+	y = (slot / collection->tiles_per_row) * collection->item_height;
+
+	if (tile->width != area->width || tile->selected != colitem->selected)
+	{
+		local.x = 0;
+		local.y = 0;
+		local.width = area->width;
+		local.height = area->height;
+
+		/* Render via the scratch pixmap so that nothing outside the
+		 * item's area can spill into the neighbouring tiles.
+		 */
+		gdk_draw_rectangle(collection->tile_scratch,
+				widget->style->base_gc[GTK_STATE_NORMAL], TRUE,
+				0, 0, local.width, local.height);
+		collection->draw_item(widget, collection->tile_scratch,
+				colitem, &local, collection->cb_user_data);
+		gdk_draw_drawable(collection->tiles,
+				widget->style->fg_gc[GTK_STATE_NORMAL],
+				collection->tile_scratch,
+				0, 0, x, y, local.width, local.height);
+
+		tile->width = area->width;
+		tile->selected = colitem->selected;
+	}
+
+	tile->last_used = ++collection->tile_clock;
+
+	gdk_draw_drawable(widget->window,
+			widget->style->fg_gc[GTK_STATE_NORMAL],
+			collection->tiles,
+			x, y, area->x, area->y, area->width, area->height);
+
+	return TRUE;
+}
+
+/* The item with this data is going away, or has changed; drop its tile */
+static void forget_tile(Collection *collection, gpointer data)
+{
+	int	slot;
+
+	if (!collection->tile_slots)
+		return;
+
+	slot = GPOINTER_TO_INT(g_hash_table_lookup(collection->tile_slots,
+						   data)) - 1;
+	if (slot < 0)
+		return;
+
+	g_hash_table_remove(collection->tile_slots, data);
+	collection->tile_info[slot].data = NULL;
+	collection->tile_info[slot].last_used = 0;
+}
+
 static void resize_arrays(Collection *collection, guint new_size)
 {
 	g_return_if_fail(collection != NULL);
@@ -701,6 +895,13 @@ static void resize_arrays(Collection *collection, guint new_size)
 	collection->array_size = new_size;
 }
 
+static inline double item_weight(Collection *collection, int item)
+{
+	if (!collection->weigh_item)
+		return 0;
+	return collection->weigh_item(collection, &collection->items[item]);
+}
+
 static gint collection_key_press(GtkWidget *widget, GdkEventKey *event)
 {
 	Collection *collection;
@@ -1142,6 +1343,7 @@ static void collection_item_set_selected(Collection *collection,
 	if (selected)
 	{
 		collection->number_selected++;
+		collection->selected_weight += item_weight(collection, item);
 		if (signal && collection->number_selected == 1)
 			g_signal_emit(collection,
 					collection_signals[GAIN_SELECTION], 0,
@@ -1150,6 +1352,11 @@ static void collection_item_set_selected(Collection *collection,
 	else
 	{
 		collection->number_selected--;
+		if (collection->number_selected)
+			collection->selected_weight -=
+					item_weight(collection, item);
+		else
+			collection->selected_weight = 0;
 		if (signal && collection->number_selected == 0)
 			g_signal_emit(collection,
 					collection_signals[LOSE_SELECTION], 0,
@@ -1227,6 +1434,7 @@ void collection_select_all(Collection *collection)
 			item++;
 
 		collection->items[item].selected = TRUE;
+		collection->selected_weight += item_weight(collection, item);
 		collection_draw_item(collection, item, TRUE);
 		item++;
 		
@@ -1263,6 +1471,7 @@ void collection_invert_selection(Collection *collection)
 
 	collection->number_selected = collection->number_of_items -
 				      collection->number_selected;
+	collection_reweigh_selection(collection);
 	
 	/* Have to redraw everything... */
 	gtk_widget_queue_draw(GTK_WIDGET(collection));
@@ -1305,6 +1514,11 @@ void collection_clear_except(Collection *collection, gint item)
 		collection->number_selected--;
 	}
 
+	if (end == 0)
+		collection->selected_weight = 0;
+	else
+		collection->selected_weight = item_weight(collection, item);
+
 	if (end == 0)
 		g_signal_emit(collection, collection_signals[LOSE_SELECTION], 0,
 				current_event_time);
@@ -1343,6 +1557,45 @@ void collection_draw_item(Collection *collection, gint item, gboolean blank)
 	gdk_window_invalidate_rect(widget->window, &area, FALSE);
 }
 
+/* The contents of this item have changed. Drop any cached rendering of it
+ * and redraw it.
+ */
+void collection_item_changed(Collection *collection, gint item)
+{
+	g_return_if_fail(collection != NULL);
+	g_return_if_fail(item >= 0 && item < collection->number_of_items);
+
+	forget_tile(collection, collection->items[item].data);
+	collection_draw_item(collection, item, TRUE);
+}
+
+/* Free the tile cache. Call this when the way items are drawn changes
+ * (eg, a new style). The cache is recreated on the next expose.
+ */
+void collection_discard_tiles(Collection *collection)
+{
+	g_return_if_fail(collection != NULL);
+
+	if (collection->tiles)
+	{
+		g_object_unref(collection->tiles);
+		collection->tiles = NULL;
+	}
+	if (collection->tile_scratch)
+	{
+		g_object_unref(collection->tile_scratch);
+		collection->tile_scratch = NULL;
+	}
+	if (collection->tile_slots)
+	{
+		g_hash_table_destroy(collection->tile_slots);
+		collection->tile_slots = NULL;
+	}
+	g_free(collection->tile_info);
+	collection->tile_info = NULL;
+	collection->n_tiles = 0;
+}
+
 void collection_set_item_size(Collection *collection, int width, int height)
 {
 	GtkWidget	*widget;
@@ -1359,6 +1612,7 @@ void collection_set_item_size(Collection *collection, int width, int height)
 
 	collection->item_width = width;
 	collection->item_height = height;
+	collection_discard_tiles(collection);
 
 	if (GTK_WIDGET_REALIZED(widget))
 	{
@@ -1375,16 +1629,88 @@ void collection_set_item_size(Collection *collection, int width, int height)
 	gtk_widget_queue_resize(GTK_WIDGET(collection));
 }
 
-static int (*cmp_callback)(const void *a, const void *b) = NULL;
-static int collection_cmp(const void *a, const void *b)
+typedef struct _SortCmp SortCmp;
+
+struct _SortCmp {
+	int	(*compar)(const void *a, const void *b);
+	int	mul;		/* -1 for GTK_SORT_DESCENDING */
+};
+
+static gint collection_cmp(gconstpointer a, gconstpointer b, gpointer data)
 {
-	return cmp_callback(((CollectionItem *) a)->data,
-			    ((CollectionItem *) b)->data);
+	SortCmp	*cmp = (SortCmp *) data;
+
+	return cmp->mul * cmp->compar(((CollectionItem *) a)->data,
+				      ((CollectionItem *) b)->data);
 }
-static int collection_rcmp(const void *a, const void *b)
+
+/* While the items are being rearranged, the cursor and wink items are
+ * remembered by their data.
+ */
+typedef struct _SortMarks SortMarks;
+
+struct _SortMarks {
+	int	 cursor, wink, wink_on_map;
+	gpointer cursor_data, wink_data, wink_on_map_data;
+};
+
+static void save_marks(Collection *collection, SortMarks *marks)
 {
-	return -cmp_callback(((CollectionItem *) a)->data,
-			     ((CollectionItem *) b)->data);
+	int	items = collection->number_of_items;
+
+	marks->cursor_data = NULL;
+	marks->wink_data = NULL;
+	marks->wink_on_map_data = NULL;
+
+	marks->wink_on_map = collection->wink_on_map;
+	if (marks->wink_on_map >= 0 && marks->wink_on_map < items)
+	{
+		marks->wink_on_map_data =
+			collection->items[marks->wink_on_map].data;
+		collection->wink_on_map = -1;
+	}
+	else
+		marks->wink_on_map = -1;
+
+	marks->wink = collection->wink_item;
+	if (marks->wink >= 0 && marks->wink < items)
+	{
+		marks->wink_data = collection->items[marks->wink].data;
+		collection->wink_item = -1;
+	}
+	else
+		marks->wink = -1;
+
+	marks->cursor = collection->cursor_item;
+	if (marks->cursor >= 0 && marks->cursor < items)
+		marks->cursor_data = collection->items[marks->cursor].data;
+	else
+		marks->cursor = -1;
+}
+
+static void restore_marks(Collection *collection, SortMarks *marks)
+{
+	int	item;
+
+	if (marks->cursor == -1 && marks->wink == -1 &&
+	    marks->wink_on_map == -1)
+		return;
+
+	for (item = 0; item < collection->number_of_items; item++)
+	{
+		gpointer data = collection->items[item].data;
+
+		if (data == marks->cursor_data)
+			collection_set_cursor_item(collection, item, TRUE);
+		if (data == marks->wink_on_map_data)
+			collection->wink_on_map = item;
+		if (data == marks->wink_data)
+		{
+			collection->cursor_item_old = item;
+			collection->wink_item = item;
+			scroll_to_show(collection, item);
+		}
+	}
 }
 
 /* Cursor is positioned on item with the same data as before the sort.
@@ -1394,18 +1720,15 @@ void collection_qsort(Collection *collection,
 		      int (*compar)(const void *, const void *),
 		      GtkSortType order)
 {
-	int	cursor, wink, items, wink_on_map;
-	gpointer cursor_data = NULL;
-	gpointer wink_data = NULL;
-	gpointer wink_on_map_data = NULL;
 	CollectionItem *array;
+	SortMarks marks;
+	SortCmp	cmp;
 	int	i;
 	int	mul = order == GTK_SORT_ASCENDING ? 1 : -1;
 	
 	g_return_if_fail(collection != NULL);
 	g_return_if_fail(IS_COLLECTION(collection));
 	g_return_if_fail(compar != NULL);
-	g_return_if_fail(cmp_callback == NULL);
 
 	/* Check to see if it needs sorting (saves redrawing) */
 	if (collection->number_of_items < 2)
@@ -1420,59 +1743,177 @@ void collection_qsort(Collection *collection,
 	if (i == collection->number_of_items)
 		return;		/* Already sorted */
 
-	items = collection->number_of_items;
+	save_marks(collection, &marks);
+	
+	cmp.compar = compar;
+	cmp.mul = mul;
+	g_qsort_with_data(collection->items, collection->number_of_items,
+			  sizeof(collection->items[0]), collection_cmp, &cmp);
+
+	restore_marks(collection, &marks);
+	
+	gtk_widget_queue_draw(GTK_WIDGET(collection));
+}
+
+/* Rearrange the items so that item i is the one which was at order[i].
+ * As with collection_qsort(), the cursor and wink stay with their items.
+ */
+void collection_reorder(Collection *collection, const guint *order)
+{
+	CollectionItem *old;
+	SortMarks marks;
+	int	i, n;
+
+	g_return_if_fail(collection != NULL);
+	g_return_if_fail(IS_COLLECTION(collection));
+
+	n = collection->number_of_items;
+
+	for (i = 0; i < n && order[i] == i; i++)
+		;
+	if (i == n)
+		return;		/* Nothing moves (saves redrawing) */
 
-	wink_on_map = collection->wink_on_map;
-	if (wink_on_map >= 0 && wink_on_map < items)
+	save_marks(collection, &marks);
+
+	old = g_memdup(collection->items, n * sizeof(*old));
+	for (i = 0; i < n; i++)
+		collection->items[i] = old[order[i]];
+	g_free(old);
+
+	restore_marks(collection, &marks);
+
+	gtk_widget_queue_draw(GTK_WIDGET(collection));
+}
+
+/* Like collection_qsort(), but only the items from 'n_sorted' onwards may
+ * be out of order. Those are sorted on their own and then merged with the
+ * rest in a single pass, which is much quicker when adding a few items to
+ * a big collection.
+ */
+void collection_merge_tail(Collection *collection, int n_sorted,
+			   int (*compar)(const void *, const void *),
+			   GtkSortType order)
+{
+	SortMarks marks;
+
+	g_return_if_fail(collection != NULL);
+	g_return_if_fail(IS_COLLECTION(collection));
+	g_return_if_fail(compar != NULL);
+
+	if (tail_in_order(collection, n_sorted, compar, order))
+		return;		/* Already sorted (saves redrawing) */
+
+	save_marks(collection, &marks);
+
+	merge_tail(collection, n_sorted, compar, order);
+
+	restore_marks(collection, &marks);
+
+	gtk_widget_queue_draw(GTK_WIDGET(collection));
+}
+
+/* The sort keys of the items whose data is in 'changed' (a set) have
+ * changed, but the others are still in order. Move just the changed
+ * ones into place.
+ */
+void collection_resort_items(Collection *collection, GHashTable *changed,
+			     int (*compar)(const void *, const void *),
+			     GtkSortType order)
+{
+	CollectionItem *array;
+	SortMarks marks;
+	GArray	*moved;
+	int	i, n = 0;
+
+	g_return_if_fail(collection != NULL);
+	g_return_if_fail(IS_COLLECTION(collection));
+	g_return_if_fail(changed != NULL);
+	g_return_if_fail(compar != NULL);
+
+	/* Before anything moves, so the indexes are still right */
+	save_marks(collection, &marks);
+
+	array = collection->items;
+	moved = g_array_new(FALSE, FALSE, sizeof(CollectionItem));
+
+	/* Keep the order of the others (and the selection) as we go */
+	for (i = 0; i < collection->number_of_items; i++)
 	{
-		wink_on_map_data = collection->items[wink_on_map].data;
-		collection->wink_on_map = -1;
+		if (g_hash_table_lookup(changed, array[i].data))
+			g_array_append_val(moved, array[i]);
+		else
+			array[n++] = array[i];
 	}
-	else
-		wink = -1;
+	memcpy(array + n, moved->data, moved->len * sizeof(*array));
+	g_array_free(moved, TRUE);
 
-	wink = collection->wink_item;
-	if (wink >= 0 && wink < items)
+	if (!tail_in_order(collection, n, compar, order))
+		merge_tail(collection, n, compar, order);
+
+	restore_marks(collection, &marks);
+
+	/* The changed items need redrawing even if they didn't move */
+	gtk_widget_queue_draw(GTK_WIDGET(collection));
+}
+
+/* TRUE if the items from 'n_sorted' onwards are already in place (given
+ * that the ones before are in order).
+ */
+static gboolean tail_in_order(Collection *collection, int n_sorted,
+			      int (*compar)(const void *, const void *),
+			      GtkSortType order)
+{
+	CollectionItem *array = collection->items;
+	int	i;
+	int	mul = order == GTK_SORT_ASCENDING ? 1 : -1;
+
+	if (n_sorted >= collection->number_of_items)
+		return TRUE;
+
+	/* Often, the new items all go at the end anyway */
+	for (i = n_sorted > 0 ? n_sorted : 1;
+	     i < collection->number_of_items; i++)
 	{
-		wink_data = collection->items[wink].data;
-		collection->wink_item = -1;
+		if (mul * compar(array[i - 1].data, array[i].data) > 0)
+			return FALSE;
 	}
-	else
-		wink = -1;
 
-	cursor = collection->cursor_item;
-	if (cursor >= 0 && cursor < items)
-		cursor_data = collection->items[cursor].data;
-	else
-		cursor = -1;
-	
-	cmp_callback = compar;
-	qsort(collection->items, items, sizeof(collection->items[0]),
-			order == GTK_SORT_ASCENDING ? collection_cmp
-						    : collection_rcmp);
-	cmp_callback = NULL;
+	return TRUE;
+}
 
-	if (cursor > -1 || wink > -1 || wink_on_map > -1)
-	{
-		int	item;
+/* Sort the items from 'n_sorted' onwards and merge them with the others.
+ * The caller deals with the cursor and wink items.
+ */
+static void merge_tail(Collection *collection, int n_sorted,
+		       int (*compar)(const void *, const void *),
+		       GtkSortType order)
+{
+	CollectionItem *array, *tail;
+	SortCmp	cmp;
+	int	n_tail, i, j, out;
+	int	mul = order == GTK_SORT_ASCENDING ? 1 : -1;
 
-		for (item = 0; item < items; item++)
-		{
-			if (collection->items[item].data == cursor_data)
-				collection_set_cursor_item(collection, item,
-						TRUE);
-			if (collection->items[item].data == wink_on_map_data)
-				collection->wink_on_map = item;
-			if (collection->items[item].data == wink_data)
-			{
-				collection->cursor_item_old = item;
-				collection->wink_item = item;
-				scroll_to_show(collection, item);
-			}
-		}
+	array = collection->items;
+	n_tail = collection->number_of_items - n_sorted;
+
+	tail = g_memdup(array + n_sorted, n_tail * sizeof(*array));
+	cmp.compar = compar;
+	cmp.mul = mul;
+	g_qsort_with_data(tail, n_tail, sizeof(*tail), collection_cmp, &cmp);
+
+	/* Fill in from the end. Existing items go before equal new ones. */
+	i = n_sorted - 1;
+	j = n_tail - 1;
+	out = collection->number_of_items - 1;
+	while (j >= 0)
+	{
+		if (i >= 0 && mul * compar(array[i].data, tail[j].data) > 0)
+			array[out--] = array[i--];
+		else
+			array[out--] = tail[j--];
 	}
-	
-	gtk_widget_queue_draw(GTK_WIDGET(collection));
+	g_free(tail);
 }
 
 /* Find an item in a sorted collection.
@@ -1663,6 +2104,7 @@ void collection_delete_if(Collection *collection,
 		else 
 		{
 			/* Remove item */
+			forget_tile(collection, collection->items[in].data);
 			if (collection->free_item)
 				collection->free_item(collection,
 							&collection->items[in]);
@@ -1692,6 +2134,7 @@ void collection_delete_if(Collection *collection,
 		}
 
 		collection->number_selected = selected;
+		collection_reweigh_selection(collection);
 		resize_arrays(collection,
 			MAX(collection->number_of_items, MINIMUM_ITEMS));
 
@@ -1702,6 +2145,27 @@ void collection_delete_if(Collection *collection,
 	}
 }
 
+/* Recalculate selected_weight from scratch. Call this if the weights of
+ * any selected items may have changed.
+ */
+void collection_reweigh_selection(Collection *collection)
+{
+	int	i;
+	double	total = 0;
+
+	g_return_if_fail(collection != NULL);
+	g_return_if_fail(IS_COLLECTION(collection));
+
+	if (collection->weigh_item && collection->number_selected)
+	{
+		for (i = 0; i < collection->number_of_items; i++)
+			if (collection->items[i].selected)
+				total += item_weight(collection, i);
+	}
+
+	collection->selected_weight = total;
+}
+
 /* Move the cursor by the given row and column offsets.
  * Moving by (0,0) can be used to simply make the cursor appear.
  */
@@ -42,7 +42,9 @@ typedef struct _Collection Collection;
 typedef struct _CollectionItem   CollectionItem;
 
 typedef struct _CollectionClass  CollectionClass;
+typedef struct _CollectionTile   CollectionTile;
 typedef void (*CollectionDrawFunc)(GtkWidget *widget,
+				  GdkDrawable *drawable,
 			     	  CollectionItem *item,
 			     	  GdkRectangle *area,
 				  gpointer user_data);
@@ -53,6 +55,8 @@ typedef gboolean (*CollectionTestFunc)( Collection *collection,
 					gpointer user_data);
 typedef void (*CollectionFreeFunc)(Collection *collection,
 			     	   CollectionItem *item);
+typedef double (*CollectionWeighFunc)(Collection *collection,
+				      CollectionItem *item);
 
 struct _CollectionItem
 {
@@ -73,6 +77,7 @@ struct _Collection
 	CollectionDrawFunc draw_item;
 	CollectionTestFunc test_point;
 	CollectionFreeFunc free_item;
+	CollectionWeighFunc weigh_item;	/* NULL => everything weighs 0 */
 	gpointer	cb_user_data;	/* Passed to above functions */
 
 	gboolean	lasso_box;	/* Is the box drawn? */
@@ -93,10 +98,21 @@ struct _Collection
 	guint		item_width, item_height;
 
 	guint		number_selected;
+	double		selected_weight;	/* Sum of weigh_item over them */
 
 	guint		array_size;
 
 	gint		block_selection_changed;
+
+	/* Rendered items are cached offscreen, so that most exposes only
+	 * need to copy them to the window. See draw_one_item().
+	 */
+	GdkPixmap	*tiles;			/* NULL => not allocated */
+	GdkPixmap	*tile_scratch;		/* One tile, to draw into */
+	CollectionTile	*tile_info;
+	int		n_tiles, tiles_per_row;
+	GHashTable	*tile_slots;		/* Item data -> slot + 1 */
+	guint		tile_clock;
 };
 
 struct _CollectionClass
@@ -133,6 +149,18 @@ void 	collection_qsort		(Collection *collection,
 					 int (*compar)(const void *,
 						       const void *),
 					 GtkSortType order);
+void 	collection_reorder		(Collection *collection,
+					 const guint *order);
+void 	collection_merge_tail		(Collection *collection,
+					 int n_sorted,
+					 int (*compar)(const void *,
+						       const void *),
+					 GtkSortType order);
+void 	collection_resort_items		(Collection *collection,
+					 GHashTable *changed,
+					 int (*compar)(const void *,
+						       const void *),
+					 GtkSortType order);
 int 	collection_find_item		(Collection *collection,
 					 gpointer data,
 					 int (*compar)(const void *,
@@ -142,6 +170,9 @@ int 	collection_get_item		(Collection *collection, int x, int y);
 void 	collection_set_cursor_item	(Collection *collection, gint item,
 					 gboolean may_scroll);
 void 	collection_wink_item		(Collection *collection, gint item);
+void 	collection_reweigh_selection	(Collection *collection);
+void 	collection_item_changed		(Collection *collection, gint item);
+void 	collection_discard_tiles	(Collection *collection);
 void 	collection_delete_if		(Collection *collection,
 			  		 gboolean (*test)(gpointer item,
 						          gpointer data),
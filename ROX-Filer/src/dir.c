@@ -54,6 +54,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "global.h"
 
@@ -68,6 +69,7 @@
 #include "type.h"
 #include "usericons.h"
 #include "main.h"
+#include "remote.h"
 
 #ifdef USE_NOTIFY
 static GHashTable *notify_fd_to_dir = NULL;
@@ -85,6 +87,15 @@ gboolean dnotify_wakeup_flag = FALSE;
 static int dnotify_last_fd = -1;
 #endif
 
+/* Type sniffing is done in batches of this many files, by at most
+ * MAX_SNIFFERS child processes at once.
+ */
+#define SNIFF_BATCH 128
+#define MAX_SNIFFERS 2
+
+static int n_sniffers = 0;
+static GList *waiting_to_sniff = NULL;	/* Directories (ref'd) */
+
 /* For debugging. Can't detach when this is non-zero. */
 static int in_callback = 0;
 
@@ -96,11 +107,17 @@ static void set_idle_callback(Directory *dir);
 static DirItem *insert_item(Directory *dir, const guchar *leafname);
 static void remove_missing(Directory *dir, GPtrArray *keep);
 static void dir_recheck(Directory *dir,
-			const guchar *path, const guchar *leafname);
+			const guchar *path, GPtrArray *leafnames);
+static gboolean item_unchanged(const guchar *path, DirItem *item);
 static GPtrArray *hash_to_array(GHashTable *hash);
 static void dir_force_update_item(Directory *dir, const gchar *leaf);
 static Directory *dir_new(const char *pathname);
 static void dir_rescan(Directory *dir);
+static void queue_sniff(Directory *dir, DirItem *item);
+static void start_sniffing(Directory *dir);
+static void sniff_batch(const char *dir_path, GList *leafnames, int fd);
+static void got_sniff_output(Directory *dir, gint source,
+			     GdkInputCondition condition);
 #ifdef USE_NOTIFY
 static void dir_rescan_soon(Directory *dir);
 # ifdef USE_INOTIFY
@@ -301,25 +318,87 @@ void refresh_dirs(const char *path)
  */
 void dir_check_this(const guchar *path)
 {
-	guchar	*real_path;
 	guchar	*dir_path;
-	Directory *dir;
+	GPtrArray *leafnames;
 
 	dir_path = g_path_get_dirname(path);
-	real_path = pathdup(dir_path);
+	leafnames = g_ptr_array_new();
+	g_ptr_array_add(leafnames, (gchar *) g_basename(path));
+
+	dir_check_these(dir_path, leafnames);
+
+	g_ptr_array_free(leafnames, TRUE);
 	g_free(dir_path);
+}
+
+/* As dir_check_this(), for each of 'leafnames' inside 'dir_path'.
+ * The directory is only looked up once.
+ */
+void dir_check_these(const guchar *dir_path, GPtrArray *leafnames)
+{
+	guchar	*real_path;
+	Directory *dir;
+
+	real_path = pathdup(dir_path);
 
 	dir = g_fscache_lookup_full(dir_cache, real_path,
 					FSCACHE_LOOKUP_PEEK, NULL);
 	if (dir)
 	{
-		dir_recheck(dir, real_path, g_basename(path));
+		dir_recheck(dir, real_path, leafnames);
 		g_object_unref(dir);
 	}
 	
 	g_free(real_path);
 }
 
+/* Store the type of each of 'leafnames' inside 'dir_path' in 'types', as
+ * found by type_get_type(). If the directory is open and an item hasn't
+ * changed since it was scanned then the type found then is used, which
+ * saves reading the file again.
+ */
+void dir_get_types(const guchar *dir_path, GPtrArray *leafnames,
+		   MIME_type **types)
+{
+	guchar	*real_path;
+	Directory *dir;
+	int	i;
+
+	real_path = pathdup(dir_path);
+
+	dir = g_fscache_lookup_full(dir_cache, real_path,
+					FSCACHE_LOOKUP_PEEK, NULL);
+	if (dir && !dir->users)
+	{
+		/* Nothing is keeping it uptodate */
+		g_object_unref(dir);
+		dir = NULL;
+	}
+
+	for (i = 0; i < leafnames->len; i++)
+	{
+		const guchar *leaf = g_ptr_array_index(leafnames, i);
+		DirItem	*item = NULL;
+		gchar	*path;
+
+		path = g_build_filename(dir_path, leaf, NULL);
+
+		if (dir)
+			item = g_hash_table_lookup(dir->known_items, leaf);
+
+		if (item && item_unchanged(path, item))
+			types[i] = item->mime_type;
+		else
+			types[i] = type_get_type(path);
+
+		g_free(path);
+	}
+
+	if (dir)
+		g_object_unref(dir);
+	g_free(real_path);
+}
+
 #ifdef USE_NOTIFY
 static void drop_notify(gpointer key, gpointer value, gpointer data)
 {
@@ -482,6 +561,7 @@ static gboolean recheck_callback(gpointer data)
 	 */
 
 	dir_merge_new(dir);
+	start_sniffing(dir);
 	
 	dir->have_scanned = TRUE;
 	dir_set_scanning(dir, FALSE);
@@ -730,7 +810,7 @@ static DirItem *insert_item(Directory *dir, const guchar *leafname)
 				g_object_ref(old._image);
 			do_compare = TRUE;
 		}
-		diritem_restat(full_path, item, &dir->stat_info);
+		diritem_restat_quick(full_path, item, &dir->stat_info);
 	}
 	else
 	{
@@ -739,7 +819,7 @@ static DirItem *insert_item(Directory *dir, const guchar *leafname)
 		 * we get here.
 		 */
 		item = diritem_new(leafname);
-		diritem_restat(full_path, item, &dir->stat_info);
+		diritem_restat_quick(full_path, item, &dir->stat_info);
 		if (item->base_type == TYPE_ERROR &&
 				item->lstat_errno == ENOENT)
 		{
@@ -766,6 +846,24 @@ static DirItem *insert_item(Directory *dir, const guchar *leafname)
 		return NULL;
 	}
 
+	if (do_compare && item->flags & ITEM_FLAG_NEED_SNIFF &&
+	    !(old.flags & ITEM_FLAG_NEED_SNIFF) &&
+	    item->base_type == old.base_type &&
+	    item->size == old.size &&
+	    item->mtime == old.mtime && item->ctime == old.ctime)
+	{
+		/* Unchanged since we last checked the contents. Don't go back
+		 * to the guess from the name.
+		 */
+		item->mime_type = old.mime_type;
+		item->flags = (item->flags & ~(ITEM_FLAG_NEED_SNIFF |
+					       ITEM_FLAG_EXEC_FILE))
+			      | (old.flags & ITEM_FLAG_EXEC_FILE);
+	}
+
+	if (item->flags & ITEM_FLAG_NEED_SNIFF)
+		queue_sniff(dir, item);
+
 	if (do_compare)
 	{
 		/* It's a bit inefficient that we force the image to be
@@ -867,15 +965,41 @@ out:
 }
 
 static void dir_recheck(Directory *dir,
-			const guchar *path, const guchar *leafname)
+			const guchar *path, GPtrArray *leafnames)
 {
 	guchar *old = dir->pathname;
+	int	i;
 
 	dir->pathname = g_strdup(path);
 	g_free(old);
 
 	time(&diritem_recent_time);
-	insert_item(dir, leafname);
+	for (i = 0; i < leafnames->len; i++)
+		insert_item(dir, g_ptr_array_index(leafnames, i));
+}
+
+/* TRUE if the type found when 'item' was scanned must still be right.
+ * Only regular files are trusted, since the type of anything else may
+ * depend on more than the item's own details (eg, a symlink's target).
+ */
+static gboolean item_unchanged(const guchar *path, DirItem *item)
+{
+	struct stat info;
+
+	if (item->base_type != TYPE_FILE)
+		return FALSE;
+	if (item->flags & (ITEM_FLAG_SYMLINK | ITEM_FLAG_NEED_SNIFF |
+			   ITEM_FLAG_RECENT))
+		return FALSE;
+
+	if (mc_lstat(path, &info))
+		return FALSE;
+
+	/* (setting extended attributes changes the ctime) */
+	return info.st_mode == item->mode &&
+	       info.st_size == item->size &&
+	       info.st_mtime == item->mtime &&
+	       info.st_ctime == item->ctime;
 }
 
 static void to_array(gpointer key, gpointer value, gpointer data)
@@ -912,6 +1036,19 @@ static void dir_finialize(GObject *object)
 	g_print("[ dir finalize ]\n");
 
 	free_recheck_list(dir);
+	destroy_glist(&dir->sniff_list);
+
+	/* (a sniffer holds a ref, so shouldn't still be running) */
+	if (dir->sniff_fd != -1)
+	{
+		/* The child gets EPIPE and gives up */
+		g_source_remove(dir->sniff_input);
+		close(dir->sniff_fd);
+		dir->sniff_fd = -1;
+		n_sniffers--;
+	}
+	g_string_free(dir->sniff_buffer, TRUE);
+
 	set_idle_callback(dir);
 	if (dir->rescan_timeout != -1)
 		g_source_remove(dir->rescan_timeout);
@@ -948,6 +1085,10 @@ static void directory_init(GTypeInstance *object, gpointer gclass)
 	dir->known_items = g_hash_table_new(g_str_hash, g_str_equal);
 	dir->recheck_list = NULL;
 	dir->idle_callback = 0;
+	dir->sniff_list = NULL;
+	dir->sniff_fd = -1;
+	dir->sniff_input = 0;
+	dir->sniff_buffer = g_string_new(NULL);
 	dir->scanning = FALSE;
 	dir->have_scanned = FALSE;
 	
@@ -1078,6 +1219,7 @@ static void dir_rescan(Directory *dir)
 	remove_missing(dir, names);
 
 	free_recheck_list(dir);
+	destroy_glist(&dir->sniff_list);	/* Rechecking requeues them */
 
 	/* For each name found, mark it as needing to be put on the rescan
 	 * list at some point in the future.
@@ -1128,6 +1270,206 @@ static void dir_rescan(Directory *dir)
 	dir_merge_new(dir);
 }
 
+/* This item's type was guessed from its name. Arrange for the contents to
+ * be checked in the background. If we're scanning, this starts when the
+ * scan finishes.
+ */
+static void queue_sniff(Directory *dir, DirItem *item)
+{
+	dir->sniff_list = g_list_prepend(dir->sniff_list,
+					 g_strdup(item->leafname));
+	if (!dir->scanning)
+		start_sniffing(dir);
+}
+
+/* Fork a child to check the types of the next batch of files on the
+ * sniff_list, unless one is already running for this directory. If too
+ * many are running, wait for one to finish.
+ */
+static void start_sniffing(Directory *dir)
+{
+	GList	*batch, *last;
+	int	fds[2];
+	int	i;
+
+	if (dir->sniff_fd != -1 || !dir->sniff_list)
+		return;
+
+	if (n_sniffers >= MAX_SNIFFERS)
+	{
+		if (!g_list_find(waiting_to_sniff, dir))
+		{
+			g_object_ref(dir);
+			waiting_to_sniff = g_list_append(waiting_to_sniff, dir);
+		}
+		return;
+	}
+
+	/* Split the batch off the front of the list */
+	batch = dir->sniff_list;
+	last = batch;
+	for (i = 1; i < SNIFF_BATCH && last->next; i++)
+		last = last->next;
+	dir->sniff_list = last->next;
+	if (last->next)
+		last->next->prev = NULL;
+	last->next = NULL;
+
+	if (pipe(fds))
+	{
+		g_warning("pipe(): %s", g_strerror(errno));
+		destroy_glist(&batch);
+		return;
+	}
+
+	switch (fork())
+	{
+		case -1:
+			g_warning("fork(): %s", g_strerror(errno));
+			close(fds[0]);
+			close(fds[1]);
+			break;
+		case 0:
+			/* We are the child */
+			close(fds[0]);
+			remote_drop_socket();
+			sniff_batch(dir->pathname, batch, fds[1]);
+			_exit(0);
+		default:
+			/* We are the parent */
+			close(fds[1]);
+			n_sniffers++;
+			g_object_ref(dir);
+			dir->sniff_fd = fds[0];
+			dir->sniff_input = gdk_input_add_full(fds[0],
+				GDK_INPUT_READ,
+				(GdkInputFunction) got_sniff_output,
+				dir, NULL);
+			break;
+	}
+
+	destroy_glist(&batch);
+}
+
+/* In the child process. For each file, write its type (an empty string
+ * for none), a newline, the leafname and a nul.
+ */
+static void sniff_batch(const char *dir_path, GList *leafnames, int fd)
+{
+	GString	*out;
+	GList	*next;
+
+	out = g_string_new(NULL);
+
+	for (next = leafnames; next; next = next->next)
+	{
+		const char *leaf = (const char *) next->data;
+		const guchar *path;
+		guchar	*target;
+		MIME_type *type;
+
+		/* Symlinks are typed by their target, as diritem_restat()
+		 * does. Items with a type attribute never need sniffing.
+		 */
+		path = make_path(dir_path, leaf);
+		target = pathdup(path);
+		type = type_from_file(target ? (char *) target : path);
+		g_free(target);
+
+		g_string_truncate(out, 0);
+		if (type)
+			g_string_printf(out, "%s/%s",
+					type->media_type, type->subtype);
+		g_string_append_c(out, '\n');
+		g_string_append(out, leaf);
+
+		/* Include the nul */
+		if (write(fd, out->str, out->len + 1) != out->len + 1)
+			break;
+	}
+
+	close(fd);
+}
+
+/* Results from a sniffing child. Update the types of any items which are
+ * still waiting for them and send the changes to our users together.
+ */
+static void got_sniff_output(Directory *dir, gint source,
+			     GdkInputCondition condition)
+{
+	char	buffer[4096];
+	int	got;
+	gsize	done = 0;
+	gboolean changed = FALSE;
+
+	got = read(source, buffer, sizeof(buffer));
+	if (got > 0)
+		g_string_append_len(dir->sniff_buffer, buffer, got);
+
+	while (1)
+	{
+		char	*record = dir->sniff_buffer->str + done;
+		char	*end, *leaf;
+		DirItem	*item;
+		MIME_type *old_type;
+		int	old_flags;
+
+		end = memchr(record, '\0', dir->sniff_buffer->len - done);
+		if (!end)
+			break;
+		done = end + 1 - dir->sniff_buffer->str;
+
+		leaf = strchr(record, '\n');
+		if (!leaf)
+			continue;
+		*leaf++ = '\0';
+
+		item = g_hash_table_lookup(dir->known_items, leaf);
+		if (!item || !(item->flags & ITEM_FLAG_NEED_SNIFF))
+			continue;	/* Gone, or restatted since */
+
+		old_type = item->mime_type;
+		old_flags = item->flags;
+		diritem_set_sniffed_type(make_path(dir->pathname, leaf), item,
+				*record ? mime_type_lookup(record) : NULL);
+
+		if (item->mime_type != old_type ||
+		    item->flags != (old_flags & ~ITEM_FLAG_NEED_SNIFF))
+		{
+			g_ptr_array_add(dir->up_items, item);
+			changed = TRUE;
+		}
+	}
+	g_string_erase(dir->sniff_buffer, 0, done);
+
+	if (changed)
+		dir_merge_new(dir);
+
+	if (got > 0)
+		return;
+
+	/* Child has finished */
+	g_source_remove(dir->sniff_input);
+	close(source);
+	dir->sniff_fd = -1;
+	g_string_truncate(dir->sniff_buffer, 0);
+	n_sniffers--;
+
+	start_sniffing(dir);
+
+	/* Let someone else have a go */
+	while (waiting_to_sniff && n_sniffers < MAX_SNIFFERS)
+	{
+		Directory *next = (Directory *) waiting_to_sniff->data;
+
+		waiting_to_sniff = g_list_remove(waiting_to_sniff, next);
+		start_sniffing(next);
+		g_object_unref(next);
+	}
+
+	g_object_unref(dir);
+}
+
 #ifdef USE_DNOTIFY
 /* Signal handler - don't do anything dangerous here */
 static void dnotify_handler(int sig, siginfo_t *si, void *data)
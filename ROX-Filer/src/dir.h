@@ -74,6 +74,14 @@ struct _Directory
 
 	GList		*recheck_list;	/* Items to check on callback */
 
+	/* Files whose contents still need checking to get their type
+	 * (ITEM_FLAG_NEED_SNIFF). This is done by a child process.
+	 */
+	GList		*sniff_list;	/* Leafnames */
+	int		sniff_fd;	/* From the child, or -1 */
+	gint		sniff_input;
+	GString		*sniff_buffer;	/* Partial results from the child */
+
 	gboolean	have_scanned;	/* TRUE after first complete scan */
 	gboolean	scanning;	/* TRUE if we sent DIR_START_SCAN */
 
@@ -103,6 +111,9 @@ void dir_detach(Directory *dir, DirCallback callback, gpointer data);
 void dir_update(Directory *dir, gchar *pathname);
 void refresh_dirs(const char *path);
 void dir_check_this(const guchar *path);
+void dir_check_these(const guchar *dir_path, GPtrArray *leafnames);
+void dir_get_types(const guchar *dir_path, GPtrArray *leafnames,
+		   MIME_type **types);
 DirItem *dir_update_item(Directory *dir, const gchar *leafname);
 void dir_merge_new(Directory *dir);
 void dir_force_update_path(const gchar *path);
@@ -31,6 +31,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "global.h"
 
@@ -45,6 +46,9 @@
 #include "pixmaps.h"
 #include "xtypes.h"
 
+/* Forget all remembered directory probes once we have this many */
+#define MAX_DIR_PROBES 32768
+
 #define RECENT_DELAY (5 * 60)	/* Time in seconds to consider a file recent */
 #define ABOUT_NOW(time) (diritem_recent_time - time < RECENT_DELAY)
 /* If you want to make use of the RECENT flag, make sure this is set to
@@ -52,9 +56,33 @@
  */
 time_t diritem_recent_time;
 
+/* What examine_dir() found inside a directory. Entries are looked up by
+ * device and inode, and are only used while the directory's mtime, ctime
+ * and owner are unchanged.
+ */
+typedef struct _DirProbe DirProbe;
+
+struct _DirProbe {
+	dev_t	dev;
+	ino_t	ino;
+	time_t	mtime, ctime;
+	uid_t	uid;
+	guint	dir_icon : 1;	/* Has a usable .DirIcon */
+	guint	app_run : 1;	/* Has an executable AppRun */
+	guint	app_icon : 1;	/* Has a usable AppIcon.xpm */
+};
+
+static GHashTable *dir_probes = NULL;	/* DirProbe -> itself */
+
 /* Static prototypes */
+static void restat(const guchar *path, DirItem *item, struct stat *parent,
+		   gboolean quick);
 static void examine_dir(const guchar *path, DirItem *item,
 			struct stat *link_target);
+static void adjust_file_type(const guchar *path, DirItem *item, mode_t mode);
+static const DirProbe *probe_dir(const guchar *path, struct stat *info);
+static guint dir_probe_hash(gconstpointer key);
+static gboolean dir_probe_equal(gconstpointer a, gconstpointer b);
 
 /****************************************************************
  *			EXTERNAL INTERFACE			*
@@ -62,15 +90,73 @@ static void examine_dir(const guchar *path, DirItem *item,
 
 void diritem_init(void)
 {
+	dir_probes = g_hash_table_new_full(dir_probe_hash, dir_probe_equal,
+					   g_free, NULL);
+
 	read_globicons();
 }
 
+/* Forget what we found inside directories. Changes which don't alter the
+ * directory itself (eg, chmod +x AppRun) are seen after this.
+ */
+void diritem_purge_probes(void)
+{
+	g_hash_table_remove_all(dir_probes);
+}
+
 /* Bring this item's structure uptodate.
  * 'parent' is optional; it saves one stat() for directories.
  */
 void diritem_restat(const guchar *path, DirItem *item, struct stat *parent)
+{
+	restat(path, item, parent, FALSE);
+}
+
+/* As diritem_restat(), but a regular file's type is only found from its
+ * extended attributes and name, without opening it. If that isn't enough,
+ * the type is a guess and ITEM_FLAG_NEED_SNIFF is set. Check the contents
+ * later and pass the result to diritem_set_sniffed_type().
+ */
+void diritem_restat_quick(const guchar *path, DirItem *item,
+			  struct stat *parent)
+{
+	restat(path, item, parent, TRUE);
+}
+
+/* Replace the guessed type of an ITEM_FLAG_NEED_SNIFF item with 'type',
+ * found by checking its contents (type_from_file() on the target).
+ */
+void diritem_set_sniffed_type(const guchar *path, DirItem *item,
+			      MIME_type *type)
+{
+	struct stat info;
+
+	g_return_if_fail(item->flags & ITEM_FLAG_NEED_SNIFF);
+
+	item->flags &= ~(ITEM_FLAG_NEED_SNIFF | ITEM_FLAG_EXEC_FILE);
+
+	/* Note: for symlinks we need the mode of the target */
+	if (!(item->flags & ITEM_FLAG_SYMLINK))
+		info.st_mode = item->mode;
+	else if (mc_stat(path, &info))
+		info.st_mode = 0;
+
+	if (item->_image)
+	{
+		g_object_unref(item->_image);
+		item->_image = NULL;
+	}
+
+	item->mime_type = type;
+	adjust_file_type(path, item, info.st_mode);
+}
+
+/* Does the work for diritem_restat() and diritem_restat_quick() */
+static void restat(const guchar *path, DirItem *item, struct stat *parent,
+		   gboolean quick)
 {
 	struct stat	info;
+	int		mime_xattr = FALSE;	/* Has XATTR_MIME_TYPE */
 
 	if (item->_image)
 	{
@@ -105,9 +191,6 @@ void diritem_restat(const guchar *path, DirItem *item, struct stat *parent)
 		if (ABOUT_NOW(item->mtime) || ABOUT_NOW(item->ctime))
 			item->flags |= ITEM_FLAG_RECENT;
 
-		if (xattr_have(path))
-			item->flags |= ITEM_FLAG_HAS_XATTR;
-
 		if (S_ISLNK(info.st_mode))
 		{
 			if (mc_stat(path, &info))
@@ -126,6 +209,13 @@ void diritem_restat(const guchar *path, DirItem *item, struct stat *parent)
 			target_path = (guchar *) path;
 		}
 
+		/* (info is now for the target, which is what listxattr()
+		 * looks at)
+		 */
+		if (item->base_type != TYPE_ERROR &&
+		    xattr_have_dev(path, info.st_dev, &mime_xattr))
+			item->flags |= ITEM_FLAG_HAS_XATTR;
+
 		if (item->base_type == TYPE_DIRECTORY)
 		{
 			if (mount_is_mounted(target_path, &info,
@@ -153,52 +243,36 @@ void diritem_restat(const guchar *path, DirItem *item, struct stat *parent)
 	}
 	else if (item->base_type == TYPE_FILE)
 	{
+		guchar *link_path = NULL;
+		const guchar *type_path = path;
+
 		if (item->flags & ITEM_FLAG_SYMLINK)
 		{
-			guchar *link_path;
 			link_path = pathdup(path);
-			item->mime_type = type_from_path(link_path
-					? link_path
-					: path);
-			g_free(link_path);
-		}
-		else
-			item->mime_type = type_from_path(path);
-	
-		/* Note: for symlinks we need the mode of the target */
-		if (info.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))
-		{
-			/* Note that the flag is set for ALL executable
-			 * files, but the mime_type must also be executable
-			 * for clicking on the file to run it.
-			 */
-			item->flags |= ITEM_FLAG_EXEC_FILE;
-
-			if (item->mime_type == NULL ||
-			    item->mime_type == application_octet_stream)
-			{
-				item->mime_type = application_executable;
-			}
-			else if (item->mime_type == text_plain &&
-			         !strchr(item->leafname, '.'))
-			{
-				item->mime_type = application_x_shellscript;
-			}
-		}		
-		else if (item->mime_type == application_x_desktop)
-		{
-			item->flags |= ITEM_FLAG_EXEC_FILE;
+			if (link_path)
+				type_path = link_path;
 		}
 
-		if (!item->mime_type)
-			item->mime_type = text_plain;
+		if (mime_xattr)
+			item->mime_type = xtype_get(type_path);
 
-		check_globicon(path, item);
-
-		if (item->mime_type == application_x_desktop && item->_image == NULL)
+		/* Empty files are never sniffed, so don't defer those */
+		if (!item->mime_type && quick && info.st_size != 0)
 		{
-			item->_image = g_fscache_lookup(desktop_icon_cache, path);
+			gboolean need_sniff;
+
+			item->mime_type = type_from_name(type_path,
+							 &need_sniff);
+			if (need_sniff)
+				item->flags |= ITEM_FLAG_NEED_SNIFF;
 		}
+		else if (!item->mime_type)
+			item->mime_type = type_from_file(type_path);
+
+		g_free(link_path);
+	
+		/* Note: for symlinks we need the mode of the target */
+		adjust_file_type(path, item, info.st_mode);
 	}
 	else
 		check_globicon(path, item);
@@ -253,6 +327,30 @@ void _diritem_get_image(DirItem *item)
  *			INTERNAL FUNCTIONS			*
  ****************************************************************/
 
+/* Apply the rules that depend on both the type and the mode of a file.
+ * 'mode' is the mode of the target, for symlinks.
+ */
+static void adjust_file_type(const guchar *path, DirItem *item, mode_t mode)
+{
+	/* Note that the flag is set for ALL executable
+	 * files, but the mime_type must also be executable
+	 * for clicking on the file to run it.
+	 */
+	if (mode & (S_IXUSR | S_IXGRP | S_IXOTH) ||
+	    item->mime_type == application_x_desktop)
+		item->flags |= ITEM_FLAG_EXEC_FILE;
+
+	item->mime_type = type_adjust_for_mode(item->mime_type,
+					       item->leafname, mode);
+
+	check_globicon(path, item);
+
+	if (item->mime_type == application_x_desktop && item->_image == NULL)
+	{
+		item->_image = g_fscache_lookup(desktop_icon_cache, path);
+	}
+}
+
 /* Fill in more details of the DirItem for a directory item.
  * - Looks for an image (but maybe still NULL on error)
  * - Updates ITEM_FLAG_APPDIR
@@ -263,9 +361,8 @@ void _diritem_get_image(DirItem *item)
 static void examine_dir(const guchar *path, DirItem *item,
 			struct stat *link_target)
 {
-	struct stat info;
 	static GString *tmp = NULL;
-	uid_t uid = link_target->st_uid;
+	const DirProbe *probe;
 
 	if (!tmp)
 		tmp = g_string_new(NULL);
@@ -287,28 +384,100 @@ static void examine_dir(const guchar *path, DirItem *item,
 	 * - If it contains an AppRun then it's an application
 	 * - If it contains an AppRun but no .DirIcon then try to
 	 *   use AppIcon.xpm as the icon.
-	 *
-	 * .DirIcon and AppRun must have the same owner as the
+	 */
+
+	probe = probe_dir(path, link_target);
+
+	if (probe->dir_icon && !item->_image)
+	{
+		/* Try to load image; may still get NULL... */
+		g_string_printf(tmp, "%s/.DirIcon", path);
+		item->_image = g_fscache_lookup(pixmap_cache, tmp->str);
+	}
+
+	if (!probe->app_run)
+		return;
+
+	item->flags |= ITEM_FLAG_APPDIR;
+
+	if (probe->app_icon && !item->_image)
+	{
+		g_string_printf(tmp, "%s/AppIcon.xpm", path);
+		item->_image = g_fscache_lookup(pixmap_cache, tmp->str);
+	}
+
+	if (!item->_image)
+	{
+		/* This is an application without an icon */
+		item->_image = im_appdir;
+		g_object_ref(item->_image);
+	}
+}
+
+/* Look inside the directory 'path' (whose details, following symlinks, are
+ * 'info') for the files examine_dir() cares about. If the directory hasn't
+ * changed since we last looked, no further system calls are made.
+ */
+static const DirProbe *probe_dir(const guchar *path, struct stat *info)
+{
+	static GString *tmp = NULL;
+	static DirProbe scratch;
+	struct stat icon;
+	DirProbe key, *probe;
+	uid_t uid = info->st_uid;
+	time_t now;
+
+	key.dev = info->st_dev;
+	key.ino = info->st_ino;
+	probe = g_hash_table_lookup(dir_probes, &key);
+	if (probe && probe->mtime == info->st_mtime &&
+	    probe->ctime == info->st_ctime && probe->uid == uid)
+		return probe;
+
+	if (!tmp)
+		tmp = g_string_new(NULL);
+
+	/* A directory changed within the last second may change again
+	 * without its times changing. Don't remember what we find in it.
+	 */
+	now = time(NULL);
+	if (now - info->st_mtime < 2 || now - info->st_ctime < 2)
+	{
+		if (probe)
+			g_hash_table_remove(dir_probes, probe);
+		probe = &scratch;
+	}
+	else if (!probe)
+	{
+		if (g_hash_table_size(dir_probes) >= MAX_DIR_PROBES)
+			g_hash_table_remove_all(dir_probes);
+		probe = g_new(DirProbe, 1);
+		probe->dev = info->st_dev;
+		probe->ino = info->st_ino;
+		g_hash_table_insert(dir_probes, probe, probe);
+	}
+
+	probe->mtime = info->st_mtime;
+	probe->ctime = info->st_ctime;
+	probe->uid = uid;
+	probe->dir_icon = probe->app_run = probe->app_icon = FALSE;
+
+	/* .DirIcon and AppRun must have the same owner as the
 	 * directory itself, to prevent abuse of /tmp, etc.
-	 * For symlinks, we want the symlink's owner.
 	 */
 
 	g_string_printf(tmp, "%s/.DirIcon", path);
 
-	if (item->_image)
-		goto no_diricon;	/* Already got an icon */
-
-	if (mc_lstat(tmp->str, &info) != 0 || info.st_uid != uid)
+	if (mc_lstat(tmp->str, &icon) != 0 || icon.st_uid != uid)
 		goto no_diricon;	/* Missing, or wrong owner */
 
-	if (S_ISLNK(info.st_mode) && mc_stat(tmp->str, &info) != 0)
+	if (S_ISLNK(icon.st_mode) && mc_stat(tmp->str, &icon) != 0)
 		goto no_diricon;	/* Bad symlink */
 
-	if (info.st_size > MAX_ICON_SIZE || !S_ISREG(info.st_mode))
+	if (icon.st_size > MAX_ICON_SIZE || !S_ISREG(icon.st_mode))
 		goto no_diricon;	/* Too big, or non-regular file */
 
-	/* Try to load image; may still get NULL... */
-	item->_image = g_fscache_lookup(pixmap_cache, tmp->str);
+	probe->dir_icon = TRUE;
 
 no_diricon:
 
@@ -316,41 +485,42 @@ no_diricon:
 	g_string_truncate(tmp, tmp->len - 8);
 	g_string_append(tmp, "AppRun");
 
-	if (mc_lstat(tmp->str, &info) != 0 || info.st_uid != uid)
-		goto out;	/* Missing, or wrong owner */
+	if (mc_lstat(tmp->str, &icon) != 0 || icon.st_uid != uid)
+		return probe;	/* Missing, or wrong owner */
 		
-	if (!(info.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)))
-		goto out;	/* Not executable */
-
-	item->flags |= ITEM_FLAG_APPDIR;
-
-	/* Try to load AppIcon.xpm... */
+	if (!(icon.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)))
+		return probe;	/* Not executable */
 
-	if (item->_image)
-		goto out;	/* Already got an icon */
+	probe->app_run = TRUE;
 
+	/* Look for AppIcon.xpm, in case .DirIcon is missing or won't
+	 * load. Since AppRun is valid we don't need to check it so
+	 * carefully.
+	 */
 	g_string_truncate(tmp, tmp->len - 3);
 	g_string_append(tmp, "Icon.xpm");
 
-	/* Note: since AppRun is valid we don't need to check AppIcon.xpm
-	 *	 so carefully.
-	 */
+	if (mc_stat(tmp->str, &icon) != 0)
+		return probe;	/* Missing, or broken symlink */
 
-	if (mc_stat(tmp->str, &info) != 0)
-		goto out;	/* Missing, or broken symlink */
+	if (icon.st_size > MAX_ICON_SIZE || !S_ISREG(icon.st_mode))
+		return probe;	/* Too big, or non-regular file */
 
-	if (info.st_size > MAX_ICON_SIZE || !S_ISREG(info.st_mode))
-		goto out;	/* Too big, or non-regular file */
+	probe->app_icon = TRUE;
 
-	/* Try to load image; may still get NULL... */
-	item->_image = g_fscache_lookup(pixmap_cache, tmp->str);
+	return probe;
+}
 
-out:
+static guint dir_probe_hash(gconstpointer key)
+{
+	const DirProbe *probe = key;
 
-	if ((item->flags & ITEM_FLAG_APPDIR) && !item->_image)
-	{
-		/* This is an application without an icon */
-		item->_image = im_appdir;
-		g_object_ref(item->_image);
-	}
+	return (guint) probe->ino ^ ((guint) probe->dev << 16);
+}
+
+static gboolean dir_probe_equal(gconstpointer a, gconstpointer b)
+{
+	const DirProbe *pa = a, *pb = b;
+
+	return pa->ino == pb->ino && pa->dev == pb->dev;
 }
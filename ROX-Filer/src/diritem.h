@@ -28,6 +28,11 @@ typedef enum
 	ITEM_FLAG_NEED_RESCAN_QUEUE = 0x100,
 	
 	ITEM_FLAG_HAS_XATTR      = 0x200, /* Has extended attributes set */
+
+	/* The type was guessed from the name only. The contents still need
+	 * to be checked (see diritem_restat_quick()).
+	 */
+	ITEM_FLAG_NEED_SNIFF	= 0x400,
 } ItemFlags;
 
 struct _DirItem
@@ -48,8 +53,13 @@ struct _DirItem
 };
 
 void diritem_init(void);
+void diritem_purge_probes(void);
 DirItem *diritem_new(const guchar *leafname);
 void diritem_restat(const guchar *path, DirItem *item, struct stat *parent);
+void diritem_restat_quick(const guchar *path, DirItem *item,
+			  struct stat *parent);
+void diritem_set_sniffed_type(const guchar *path, DirItem *item,
+			      MIME_type *type);
 void _diritem_get_image(DirItem *item);
 void diritem_free(DirItem *item);
 
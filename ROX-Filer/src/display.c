@@ -56,9 +56,43 @@
 #include "fscache.h"
 #include "view_iface.h"
 #include "xtypes.h"
+#include "toolbar.h"
 
 #define HUGE_WRAP (1.5 * o_large_width.int_value)
 
+/* For display_sort_order(). 'key' holds everything that matters for the
+ * sort except the name, packed so that comparing the integers gives the
+ * right order.
+ */
+typedef struct _SortKey SortKey;
+
+struct _SortKey {
+	guint64	key;
+	guint	index;		/* Position in the unsorted array */
+};
+
+/* Laying out text with Pango is the slowest part of adding items to a
+ * window, and the same names (and sizes, dates, etc) come up again and
+ * again, so the sizes are remembered here for all windows. There is one
+ * table for each combination of settings that affects the size.
+ */
+typedef struct _TextMetrics TextMetrics;
+
+struct _TextMetrics {
+	PangoFontDescription *font;	/* The widget's font */
+	gboolean	monospace;	/* Layout uses the monospace font */
+	int		wrap_width;	/* (Pango units) -1 for no wrapping */
+	gboolean	bold;
+	GHashTable	*sizes;		/* Text -> packed width and height */
+	int		char_width;	/* (Pango units) for monospace ASCII */
+	int		line_height;	/* (pixels) ditto */
+};
+
+/* Tables are emptied when they get this big */
+#define TEXT_METRICS_MAX 65536
+
+static GList *text_metrics = NULL;
+
 /* Options bits */
 static Option o_display_caps_first;
 static Option o_display_dirs_first;
@@ -82,6 +116,15 @@ static void display_style_set(FilerWindow *filer_window, DisplayStyle style);
 static void options_changed(void);
 static char *details(FilerWindow *filer_window, DirItem *item);
 static void display_set_actual_size_real(FilerWindow *filer_window);
+static GHashTable *sort_ranks(DirItem **items, guint n, SortType type);
+static void layout_size(GtkWidget *widget, PangoLayout *layout,
+			const char *text, gboolean monospace, int wrap_width,
+			gboolean bold, int *width, int *height);
+static void radix_sort(SortKey *keys, guint n);
+static void refilter(FilerWindow *filer_window, gboolean narrower,
+		     gboolean wider);
+static gboolean filter_rejects(gpointer item, gpointer data);
+static void add_if_unshown(gpointer key, gpointer value, gpointer data);
 
 /****************************************************************
  *			EXTERNAL INTERFACE			*
@@ -363,11 +406,7 @@ int sort_by_type(const void *item1, const void *item2)
 	m2 = i2->mime_type;
 	
 	if (m1 && m2)
-	{
-		diff = strcmp(m1->media_type, m2->media_type);
-		if (!diff)
-			diff = strcmp(m1->subtype, m2->subtype);
-	}
+		diff = mime_type_compare(m1, m2);
 	else if (m1 || m2)
 		diff = m1 ? 1 : -1;
 	else
@@ -435,6 +474,117 @@ int sort_by_size(const void *item1, const void *item2)
 		sort_by_name(item1, item2);
 }
 
+static gint sort_index_by_name(gconstpointer a, gconstpointer b,
+			       gpointer items)
+{
+	return sort_by_name(((DirItem **) items)[*(guint *) a],
+			    ((DirItem **) items)[*(guint *) b]);
+}
+
+/* Work out how to sort 'n' items using filer_window's sort settings.
+ * Returns a new array where element i is the index in 'items' of the item
+ * which should go at position i. This gives the same order as sorting
+ * with the sort_by_* functions, but it's much quicker: a key is packed into
+ * an integer for each item once, and then only items with equal keys need
+ * to have their names compared.
+ */
+guint *display_sort_order(FilerWindow *filer_window, DirItem **items, guint n)
+{
+	SortType type = filer_window->sort_type;
+	guint	 *order;
+	SortKey	 *keys;
+	GHashTable *ranks;
+	gboolean dirs_first = o_display_dirs_first.int_value;
+	guint	 i, j;
+
+	order = g_new(guint, n);
+
+	if (type == SORT_NAME)
+	{
+		for (i = 0; i < n; i++)
+			order[i] = i;
+		g_qsort_with_data(order, n, sizeof(guint),
+				  sort_index_by_name, items);
+		goto done;
+	}
+
+	ranks = sort_ranks(items, n, type);
+	keys = g_new(SortKey, n);
+
+	for (i = 0; i < n; i++)
+	{
+		DirItem	*item = items[i];
+		guint64	key;
+
+		switch (type)
+		{
+			case SORT_TYPE:
+				key = ((guint64) item->base_type << 40) |
+				      ((item->flags & ITEM_FLAG_APPDIR) ?
+				       (G_GUINT64_CONSTANT(1) << 39) : 0) |
+				      GPOINTER_TO_UINT(g_hash_table_lookup(
+						ranks, item->mime_type));
+				break;
+			case SORT_DATE:
+				/* (flip the sign bit, in case it's signed) */
+				key = ((guint64) (gint64) item->mtime) ^
+				      (G_GUINT64_CONSTANT(1) << 63);
+				break;
+			case SORT_SIZE:
+				key = (guint64) item->size;
+				if (dirs_first && !IS_A_DIR(item))
+					key |= G_GUINT64_CONSTANT(1) << 63;
+				break;
+			case SORT_OWNER:
+				key = GPOINTER_TO_UINT(g_hash_table_lookup(
+					ranks, GUINT_TO_POINTER(item->uid)));
+				break;
+			case SORT_GROUP:
+				key = GPOINTER_TO_UINT(g_hash_table_lookup(
+					ranks, GUINT_TO_POINTER(item->gid)));
+				break;
+			default:
+				g_assert_not_reached();
+				key = 0;
+		}
+
+		keys[i].key = key;
+		keys[i].index = i;
+	}
+
+	if (ranks)
+		g_hash_table_destroy(ranks);
+
+	radix_sort(keys, n);
+
+	for (i = 0; i < n; i++)
+		order[i] = keys[i].index;
+
+	/* Sort each run of equal keys by name */
+	for (i = 0; i < n; i = j)
+	{
+		for (j = i + 1; j < n && keys[j].key == keys[i].key; j++)
+			;
+		if (j - i > 1)
+			g_qsort_with_data(order + i, j - i, sizeof(guint),
+					  sort_index_by_name, items);
+	}
+
+	g_free(keys);
+done:
+	if (filer_window->sort_order == GTK_SORT_DESCENDING && n > 1)
+	{
+		for (i = 0, j = n - 1; i < j; i++, j--)
+		{
+			guint tmp = order[i];
+			order[i] = order[j];
+			order[j] = tmp;
+		}
+	}
+
+	return order;
+}
+
 void display_set_sort_type(FilerWindow *filer_window, SortType sort_type,
 			   GtkSortType order)
 {
@@ -532,11 +682,26 @@ void display_set_filter_directories(FilerWindow *filer_window, gboolean filter_d
 	display_update_hidden(filer_window);
 }
 
+/* Changing the filter doesn't rescan; only the items which could have
+ * changed state are tested again (see refilter()).
+ */
 void display_set_filter(FilerWindow *filer_window, FilterType type,
 			const gchar *filter_string)
 {
+	FilterType old_type = filer_window->filter;
+	gchar	*old_string = g_strdup(filer_window->filter_string);
+	gboolean narrower, wider;
+
 	if (filer_set_filter(filer_window, type, filter_string))
-		display_update_hidden(filer_window);
+	{
+		narrower = filer_filter_narrows(old_type, old_string,
+				type, filer_window->filter_string);
+		wider = filer_filter_narrows(type, filer_window->filter_string,
+				old_type, old_string);
+		refilter(filer_window, narrower, wider);
+	}
+
+	g_free(old_string);
 }
 
 
@@ -598,12 +763,31 @@ ViewData *display_create_viewdata(FilerWindow *filer_window, DirItem *item)
 	view->layout = NULL;
 	view->details = NULL;
 	view->image = NULL;
+	view->pool_index = -1;
+	view->last_drawn = 0;
 
 	display_update_view(filer_window, item, view, TRUE);
 
 	return view;
 }
 
+/* Free the PangoLayouts, keeping the sizes and image.
+ * display_update_layouts() will create them again.
+ */
+void display_drop_layouts(ViewData *view)
+{
+	if (view->layout)
+	{
+		g_object_unref(G_OBJECT(view->layout));
+		view->layout = NULL;
+	}
+	if (view->details)
+	{
+		g_object_unref(G_OBJECT(view->details));
+		view->details = NULL;
+	}
+}
+
 /* Set the display style to the desired style. If the desired style
  * is AUTO_SIZE_ICONS, choose an appropriate size. Also resizes filer
  * window, if requested.
@@ -740,6 +924,54 @@ void display_update_view(FilerWindow *filer_window,
 			 DirItem *item,
 			 ViewData *view,
 			 gboolean update_name_layout)
+{
+	if (view->image)
+	{
+		g_object_unref(view->image);
+		view->image = NULL;
+	}
+
+	if (filer_window->show_thumbs && item->base_type == TYPE_FILE /*&&
+									strcmp(item->mime_type->media_type, "image") == 0*/)
+	{
+		const guchar    *path;
+
+		path = make_path(filer_window->real_path, item->leafname);
+
+		view->image = g_fscache_lookup_full(pixmap_cache, path,
+				FSCACHE_LOOKUP_ONLY_NEW, NULL);
+	}
+
+	if (!view->image)
+	{
+		view->image = di_image(item);
+		if (view->image)
+			g_object_ref(view->image);
+	}
+
+	if (view->details)
+	{
+		g_object_unref(G_OBJECT(view->details));
+		view->details = NULL;
+	}
+
+	if (view->layout && update_name_layout)
+	{
+		g_object_unref(G_OBJECT(view->layout));
+		view->layout = NULL;
+	}
+
+	display_update_layouts(filer_window, item, view);
+}
+
+/* Create the PangoLayouts for the name and details, if missing, and measure
+ * them. Unlike display_update_view(), this doesn't look up the image, so it
+ * is cheap enough to use when a view drops and recreates layouts as items
+ * are drawn.
+ */
+void display_update_layouts(FilerWindow *filer_window,
+			    DirItem *item,
+			    ViewData *view)
 {
 	DisplayStyle	style = filer_window->display_style;
 	int	w, h;
@@ -747,17 +979,12 @@ void display_update_view(FilerWindow *filer_window,
 	char	*str;
 	static PangoFontDescription *monospace = NULL;
 	PangoAttrList *list = NULL;
+	gboolean new_layout = TRUE;
 
 	if (!monospace)
 		monospace = pango_font_description_from_string("monospace");
 	
-	if (view->details)
-	{
-		g_object_unref(G_OBJECT(view->details));
-		view->details = NULL;
-	}
-
-	str = details(filer_window, item);
+	str = view->details ? NULL : details(filer_window, item);
 	if (str)
 	{
 		PangoAttrList	*details_list;
@@ -765,12 +992,12 @@ void display_update_view(FilerWindow *filer_window,
 		
 		view->details = gtk_widget_create_pango_layout(
 					filer_window->window, str);
-		g_free(str);
 
 		pango_layout_set_font_description(view->details, monospace);
-		pango_layout_get_size(view->details, &w, &h);
-		view->details_width = w / PANGO_SCALE;
-		view->details_height = h / PANGO_SCALE;
+		layout_size(filer_window->window, view->details, str,
+			    TRUE, -1, FALSE,
+			    &view->details_width, &view->details_height);
+		g_free(str);
 
 		if (filer_window->details_type == DETAILS_PERMISSIONS)
 			perm_offset = 0;
@@ -791,39 +1018,12 @@ void display_update_view(FilerWindow *filer_window,
 		}
 	}
 
-	if (view->image)
-	{
-		g_object_unref(view->image);
-		view->image = NULL;
-	}
-
-	if (filer_window->show_thumbs && item->base_type == TYPE_FILE /*&&
-									strcmp(item->mime_type->media_type, "image") == 0*/)
-	{
-		const guchar    *path;
-
-		path = make_path(filer_window->real_path, item->leafname);
-
-		view->image = g_fscache_lookup_full(pixmap_cache, path,
-				FSCACHE_LOOKUP_ONLY_NEW, NULL);
-	}
-
-	if (!view->image)
-	{
-		view->image = di_image(item);
-		if (view->image)
-			g_object_ref(view->image);
-	}
-
-	if (view->layout && update_name_layout)
-	{
-		g_object_unref(G_OBJECT(view->layout));
-		view->layout = NULL;
-	}
-
 	if (view->layout)
 	{
-		/* Do nothing */
+		/* Keep it (its attributes may not match the item flags,
+		 * so don't trust the cache for its size either)
+		 */
+		new_layout = FALSE;
 	}
 	else if (g_utf8_validate(item->leafname, -1, NULL))
 	{
@@ -878,9 +1078,18 @@ void display_update_view(FilerWindow *filer_window,
 	if (wrap_width != -1)
 		pango_layout_set_width(view->layout, wrap_width);
 
-	pango_layout_get_size(view->layout, &w, &h);
-	view->name_width = w / PANGO_SCALE;
-	view->name_height = h / PANGO_SCALE;
+	if (new_layout)
+		layout_size(filer_window->window, view->layout,
+			    pango_layout_get_text(view->layout),
+			    FALSE, wrap_width,
+			    (item->flags & ITEM_FLAG_RECENT) != 0,
+			    &view->name_width, &view->name_height);
+	else
+	{
+		pango_layout_get_size(view->layout, &w, &h);
+		view->name_width = w / PANGO_SCALE;
+		view->name_height = h / PANGO_SCALE;
+	}
 }
 
 /* Sets display_style from display_style_wanted.
@@ -905,3 +1114,335 @@ static void display_set_actual_size_real(FilerWindow *filer_window)
 	
 	filer_window->display_style = size;
 }
+
+static gint cmp_user_names(gconstpointer a, gconstpointer b)
+{
+	uid_t u1 = *(guint *) a;
+	uid_t u2 = *(guint *) b;
+	int diff;
+
+	diff = strcmp(user_name(u1), user_name(u2));
+
+	return diff ? diff : (u1 < u2 ? -1 : u1 > u2);
+}
+
+static gint cmp_group_names(gconstpointer a, gconstpointer b)
+{
+	gid_t g1 = *(guint *) a;
+	gid_t g2 = *(guint *) b;
+	int diff;
+
+	diff = strcmp(group_name(g1), group_name(g2));
+
+	return diff ? diff : (g1 < g2 ? -1 : g1 > g2);
+}
+
+/* No type sorts before any type */
+static gint cmp_mime_types(gconstpointer a, gconstpointer b)
+{
+	MIME_type *m1 = *(MIME_type **) a;
+	MIME_type *m2 = *(MIME_type **) b;
+
+	if (!m1 || !m2)
+		return m1 ? 1 : m2 ? -1 : 0;
+
+	return mime_type_compare(m1, m2);
+}
+
+static void add_rank_key(gpointer key, gpointer value, gpointer keys)
+{
+	g_ptr_array_add((GPtrArray *) keys, key);
+}
+
+/* For sorting by type, owner or group, map each distinct MIME type, uid or
+ * gid among the items to its position in the sorted list of them. Only
+ * these few values need comparing as strings (and looking up in the
+ * password database). NULL for other sort types.
+ */
+static GHashTable *sort_ranks(DirItem **items, guint n, SortType type)
+{
+	GHashTable *ranks;
+	GPtrArray *keys;
+	guint	i;
+
+	if (type != SORT_TYPE && type != SORT_OWNER && type != SORT_GROUP)
+		return NULL;
+
+	ranks = g_hash_table_new(NULL, NULL);
+
+	for (i = 0; i < n; i++)
+	{
+		gpointer key;
+
+		if (type == SORT_TYPE)
+			key = items[i]->mime_type;
+		else if (type == SORT_OWNER)
+			key = GUINT_TO_POINTER(items[i]->uid);
+		else
+			key = GUINT_TO_POINTER(items[i]->gid);
+
+		g_hash_table_insert(ranks, key, NULL);
+	}
+
+	keys = g_ptr_array_new();
+	g_hash_table_foreach(ranks, add_rank_key, keys);
+
+	if (type == SORT_TYPE)
+		g_ptr_array_sort(keys, cmp_mime_types);
+	else
+	{
+		/* (uids and gids fit in a pointer, but sort them as guints) */
+		guint *ids;
+
+		ids = g_new(guint, keys->len);
+		for (i = 0; i < keys->len; i++)
+			ids[i] = GPOINTER_TO_UINT(keys->pdata[i]);
+		qsort(ids, keys->len, sizeof(guint),
+		      type == SORT_OWNER ? cmp_user_names : cmp_group_names);
+		for (i = 0; i < keys->len; i++)
+			keys->pdata[i] = GUINT_TO_POINTER(ids[i]);
+		g_free(ids);
+	}
+
+	for (i = 0; i < keys->len; i++)
+		g_hash_table_insert(ranks, keys->pdata[i],
+				    GUINT_TO_POINTER(i));
+
+	g_ptr_array_free(keys, TRUE);
+
+	return ranks;
+}
+
+/* A stable LSD radix sort on the keys, a byte at a time. Bytes which are
+ * the same for every key (eg, the high bytes of file sizes) are skipped.
+ */
+static void radix_sort(SortKey *keys, guint n)
+{
+	guint	 (*counts)[256];
+	SortKey	 *tmp, *from = keys, *to;
+	guint	 i, byte;
+
+	if (n < 2)
+		return;
+
+	counts = g_malloc0(8 * sizeof(*counts));
+	for (i = 0; i < n; i++)
+	{
+		guint64	key = keys[i].key;
+
+		for (byte = 0; byte < 8; byte++)
+			counts[byte][(key >> (byte * 8)) & 0xff]++;
+	}
+
+	tmp = g_new(SortKey, n);
+	to = tmp;
+
+	for (byte = 0; byte < 8; byte++)
+	{
+		guint	*count = counts[byte];
+		guint	pos = 0, b;
+
+		if (count[(from[0].key >> (byte * 8)) & 0xff] == n)
+			continue;
+
+		/* Turn the counts into starting positions */
+		for (b = 0; b < 256; b++)
+		{
+			guint c = count[b];
+			count[b] = pos;
+			pos += c;
+		}
+
+		for (i = 0; i < n; i++)
+			to[count[(from[i].key >> (byte * 8)) & 0xff]++] =
+								from[i];
+
+		to = from;
+		from = from == keys ? tmp : keys;
+	}
+
+	if (from != keys)
+		memcpy(keys, from, n * sizeof(SortKey));
+
+	g_free(tmp);
+	g_free(counts);
+}
+
+/* Find (or create) the metrics table for text laid out for 'widget' with
+ * these settings.
+ */
+static TextMetrics *get_text_metrics(GtkWidget *widget, gboolean monospace,
+				     int wrap_width, gboolean bold)
+{
+	const PangoFontDescription *font;
+	TextMetrics *tm;
+	GList	*next;
+
+	font = pango_context_get_font_description(
+			gtk_widget_get_pango_context(widget));
+
+	for (next = text_metrics; next; next = next->next)
+	{
+		tm = (TextMetrics *) next->data;
+
+		if (tm->monospace == monospace &&
+		    tm->wrap_width == wrap_width &&
+		    tm->bold == bold &&
+		    pango_font_description_equal(tm->font, font))
+			return tm;
+	}
+
+	tm = g_new(TextMetrics, 1);
+	tm->font = pango_font_description_copy(font);
+	tm->monospace = monospace;
+	tm->wrap_width = wrap_width;
+	tm->bold = bold;
+	tm->sizes = g_hash_table_new_full(g_str_hash, g_str_equal,
+					  g_free, NULL);
+	tm->char_width = 0;
+	tm->line_height = 0;
+
+	text_metrics = g_list_prepend(text_metrics, tm);
+
+	return tm;
+}
+
+/* TRUE if every character in text is printable ASCII (so, for a monospace
+ * font, the width is just the number of characters times the advance).
+ */
+static gboolean is_plain_ascii(const char *text)
+{
+	for (; *text; text++)
+	{
+		if (*text < 0x20 || *text > 0x7e)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Get the size (in pixels) of 'layout', whose text is 'text'. The other
+ * arguments must give the settings used for the layout. Laying out is
+ * avoided if the same text has been seen before with the same settings
+ * (in any window), or if it's plain ASCII in the monospace font.
+ */
+static void layout_size(GtkWidget *widget, PangoLayout *layout,
+			const char *text, gboolean monospace, int wrap_width,
+			gboolean bold, int *width, int *height)
+{
+	TextMetrics *tm;
+	gpointer value;
+	int	w, h;
+
+	tm = get_text_metrics(widget, monospace, wrap_width, bold);
+
+	if (monospace && wrap_width == -1 && is_plain_ascii(text))
+	{
+		if (!tm->char_width)
+		{
+			PangoLayout *sample;
+
+			sample = pango_layout_copy(layout);
+			pango_layout_set_attributes(sample, NULL);
+			pango_layout_set_text(sample, "0", -1);
+			pango_layout_get_size(sample, &w, &h);
+			g_object_unref(G_OBJECT(sample));
+
+			tm->char_width = MAX(w, 1);
+			tm->line_height = h / PANGO_SCALE;
+		}
+
+		*width = tm->char_width * strlen(text) / PANGO_SCALE;
+		*height = tm->line_height;
+		return;
+	}
+
+	value = g_hash_table_lookup(tm->sizes, text);
+	if (value)
+	{
+		guint packed = GPOINTER_TO_UINT(value);
+
+		*width = (packed >> 16) - 1;
+		*height = packed & 0xffff;
+		return;
+	}
+
+	pango_layout_get_size(layout, &w, &h);
+	*width = w / PANGO_SCALE;
+	*height = h / PANGO_SCALE;
+
+	if (g_hash_table_size(tm->sizes) >= TEXT_METRICS_MAX)
+		g_hash_table_remove_all(tm->sizes);
+
+	if (*width < 0xffff && *height <= 0xffff)
+		g_hash_table_insert(tm->sizes, g_strdup(text),
+			GUINT_TO_POINTER(((*width + 1) << 16) | *height));
+}
+
+static gboolean filter_rejects(gpointer item, gpointer data)
+{
+	return !filer_match_filter((FilerWindow *) data, (DirItem *) item);
+}
+
+typedef struct {
+	GHashTable *shown;
+	GPtrArray  *unshown;
+} Unshown;
+
+static void add_if_unshown(gpointer key, gpointer value, gpointer data)
+{
+	Unshown	*unshown = (Unshown *) data;
+
+	if (!g_hash_table_lookup(unshown->shown, value))
+		g_ptr_array_add(unshown->unshown, value);
+}
+
+/* The filter has changed. Instead of rescanning, remove items which no
+ * longer match and add any which now do. If the new filter is narrower
+ * than the old one, only the items currently shown need testing; if it's
+ * wider, only the ones not shown.
+ */
+static void refilter(FilerWindow *filer_window, gboolean narrower,
+		     gboolean wider)
+{
+	ViewIface *view = filer_window->view;
+	int	  n_shown = view_count_items(view);
+
+	if (!wider)
+	{
+		view_delete_if(view, filter_rejects, filer_window);
+		filer_window->n_hidden += n_shown - view_count_items(view);
+		n_shown = view_count_items(view);
+	}
+
+	if (!narrower)
+	{
+		Unshown	 unshown;
+		ViewIter iter;
+		DirItem	 *item;
+
+		unshown.shown = g_hash_table_new(NULL, NULL);
+		unshown.unshown = g_ptr_array_new();
+
+		view_get_iter(view, &iter, 0);
+		while ((item = iter.next(&iter)))
+			g_hash_table_insert(unshown.shown, item, item);
+
+		g_hash_table_foreach(filer_window->directory->known_items,
+				     add_if_unshown, &unshown);
+
+		/* (view_add_items() skips any which don't match) */
+		if (unshown.unshown->len)
+			view_add_items(view, unshown.unshown);
+		filer_window->n_hidden -= view_count_items(view) - n_shown;
+
+		g_hash_table_destroy(unshown.shown);
+		g_ptr_array_free(unshown.unshown, TRUE);
+
+		filer_create_thumbs(filer_window);
+	}
+
+	filer_set_title(filer_window);
+	toolbar_update_info(filer_window);
+	display_set_actual_size(filer_window, FALSE);
+}
@@ -25,6 +25,12 @@ struct _ViewData
 	int	details_height;
 
 	MaskedPixmap *image;		/* Image; possibly thumbnail */
+
+	/* The layouts are only kept for recently drawn items. The sizes
+	 * above are always valid.
+	 */
+	int	pool_index;		/* In the view's layout pool, or -1 */
+	guint	last_drawn;
 };
 
 extern Option o_display_inherit_options, o_display_sort_by;
@@ -52,6 +58,7 @@ int sort_by_date(const void *item1, const void *item2);
 int sort_by_size(const void *item1, const void *item2);
 int sort_by_owner(const void *item1, const void *item2);
 int sort_by_group(const void *item1, const void *item2);
+guint *display_sort_order(FilerWindow *filer_window, DirItem **items, guint n);
 void display_set_sort_type(FilerWindow *filer_window, SortType sort_type,
 			   GtkSortType order);
 void display_set_autoselect(FilerWindow *filer_window, const gchar *leaf);
@@ -71,6 +78,10 @@ void display_update_view(FilerWindow *filer_window,
 			 DirItem *item,
 			 ViewData *view,
 			 gboolean update_name_layout);
+void display_update_layouts(FilerWindow *filer_window,
+			    DirItem *item,
+			    ViewData *view);
+void display_drop_layouts(ViewData *view);
 void display_update_views(FilerWindow *filer_window);
 void draw_small_icon(GdkWindow *window, GtkStyle *style, GdkRectangle *area,
 		     DirItem  *item, MaskedPixmap *image, gboolean selected,
@@ -28,7 +28,6 @@
 #include <ctype.h>
 #include <netdb.h>
 #include <sys/param.h>
-#include <fnmatch.h>
 
 #include <gtk/gtk.h>
 #include <gdk/gdkx.h>
@@ -161,6 +160,10 @@ static void load_settings(void);
 static void save_settings(void);
 static void check_settings(FilerWindow *filer_window);
 static char *tip_from_desktop_file(const char *full_path);
+static void compile_filter(FilerWindow *filer_window);
+static void free_filter_regexp(FilerWindow *filer_window);
+static gboolean glob_narrows(const char *wide, const char *narrow,
+			     gboolean alternatives);
 
 static GdkCursor *busy_cursor = NULL;
 static GdkCursor *crosshair = NULL;
@@ -388,16 +391,24 @@ static void update_display(Directory *dir,
 			FilerWindow *filer_window)
 {
 	ViewIface *view = (ViewIface *) filer_window->view;
+	int	  n_shown = view_count_items(view);
 
 	switch (action)
 	{
 		case DIR_ADD:
+			minibuffer_index_add(filer_window, items);
 			view_add_items(view, items);
+			/* (the view only takes the ones the filter accepts) */
+			filer_window->n_hidden += items->len -
+				(view_count_items(view) - n_shown);
 			/* Open and resize if currently hidden */
 			open_filer_window(filer_window);
 			break;
 		case DIR_REMOVE:
+			minibuffer_index_remove(filer_window, items);
 			view_delete_if(view, if_deleted, items);
+			filer_window->n_hidden -= items->len -
+				(n_shown - view_count_items(view));
 			toolbar_update_info(filer_window);
 			break;
 		case DIR_START_SCAN:
@@ -434,6 +445,7 @@ static void update_display(Directory *dir,
 				start_thumb_scanning(filer_window);
 			break;
 		case DIR_UPDATE:
+			minibuffer_index_add(filer_window, items);
 			view_update_items(view, items);
 			break;
 		case DIR_ERROR_CHANGED:
@@ -449,6 +461,8 @@ static void attach(FilerWindow *filer_window)
 {
 	gdk_window_set_cursor(filer_window->window->window, busy_cursor);
 	view_clear(filer_window->view);
+	minibuffer_index_clear(filer_window);
+	filer_window->n_hidden = 0;
 	filer_window->scanning = TRUE;
 	dir_attach(filer_window->directory, (DirCallback) update_display,
 			filer_window);
@@ -715,8 +729,7 @@ static void filer_window_destroyed(GtkWidget *widget, FilerWindow *filer_window)
 
 	if(filer_window->filter_string)
 		g_free(filer_window->filter_string);
-	if(filer_window->regexp)
-		g_free(filer_window->regexp);
+	free_filter_regexp(filer_window);
 
 	g_free(filer_window->auto_select);
 	g_free(filer_window->real_path);
@@ -1511,6 +1524,7 @@ FilerWindow *filer_opendir(const char *path, FilerWindow *src_win,
 	filer_window->filter = FILER_SHOW_ALL;
 	filer_window->filter_string = NULL;
 	filer_window->regexp = NULL;
+	filer_window->n_hidden = 0;
 	filer_window->filter_directories = FALSE;
 	
 	if (src_win && o_display_inherit_options.int_value)
@@ -1914,6 +1928,8 @@ void filer_update_all(void)
 void full_refresh(void)
 {
 	mount_update(TRUE);
+	diritem_purge_probes();
+	xattr_forget_unsupported();
 	reread_mime_files();	/* Refreshes all windows */
 }
 
@@ -2075,7 +2091,9 @@ void filer_set_title(FilerWindow *filer_window)
 			case FILER_SHOW_ALL:
 				hidden=filer_window->show_hidden? _("A") : "";
 				break;
-			case FILER_SHOW_GLOB:   hidden =  _("G"); break;
+			case FILER_SHOW_GLOB:
+			case FILER_SHOW_GLOBS:  hidden =  _("G"); break;
+			case FILER_SHOW_REGEX:  hidden =  _("R"); break;
 			default: break;
 			}
 
@@ -2095,9 +2113,14 @@ void filer_set_title(FilerWindow *filer_window)
 						? _("All, ") : "");
 				break;
 			case FILER_SHOW_GLOB:
+			case FILER_SHOW_GLOBS:
 				hidden = g_strdup_printf(_("Glob (%s), "),
 						 filer_window->filter_string);
 				break;
+			case FILER_SHOW_REGEX:
+				hidden = g_strdup_printf(_("Regex (%s), "),
+						 filer_window->filter_string);
+				break;
 			default:
 				hidden  =g_strdup("");
 				break;
@@ -3007,10 +3030,16 @@ gboolean filer_match_filter(FilerWindow *filer_window, DirItem *item)
 
 	switch(filer_window->filter) {
 	case FILER_SHOW_GLOB:
-		return fnmatch(filer_window->filter_string,
-			       item->leafname, 0)==0 ||
-		  (item->base_type==TYPE_DIRECTORY &&
-		   !filer_window->filter_directories);
+	case FILER_SHOW_GLOBS:
+	case FILER_SHOW_REGEX:
+		if (item->base_type==TYPE_DIRECTORY &&
+		    !filer_window->filter_directories)
+			return TRUE;
+
+		/* (an invalid pattern shows everything) */
+		return !filer_window->regexp ||
+			regexec(filer_window->regexp, item->leafname,
+				0, NULL, 0) == 0;
 		
 	case FILER_SHOW_ALL:
 	default:
@@ -3046,6 +3075,8 @@ gboolean filer_set_filter(FilerWindow *filer_window, FilterType type,
 		case FILER_SHOW_ALL:
 			return FALSE;
 		case FILER_SHOW_GLOB:
+		case FILER_SHOW_GLOBS:
+		case FILER_SHOW_REGEX:
 			if (strcmp(filer_window->filter_string,
 				   filter_string) == 0)
 				return FALSE;
@@ -3059,7 +3090,7 @@ gboolean filer_set_filter(FilerWindow *filer_window, FilterType type,
 		g_free(filer_window->filter_string);
 		filer_window->filter_string = NULL;
 	}
-	/* Also clean up compiled regexp when implemented */
+	free_filter_regexp(filer_window);
 
 	filer_window->filter = type;
 
@@ -3070,7 +3101,10 @@ gboolean filer_set_filter(FilerWindow *filer_window, FilterType type,
 		break;
 
 	case FILER_SHOW_GLOB:
+	case FILER_SHOW_GLOBS:
+	case FILER_SHOW_REGEX:
 		filer_window->filter_string = g_strdup(filter_string);
+		compile_filter(filer_window);
 		break;
 
 	default:
@@ -3083,6 +3117,309 @@ gboolean filer_set_filter(FilerWindow *filer_window, FilterType type,
 	return TRUE;
 }
 
+/* Returns TRUE if every item matching the 'narrow' filter is certain to
+ * match 'wide' too, so that changing from 'wide' to 'narrow' can only
+ * hide items. FALSE if we can't tell cheaply.
+ */
+gboolean filer_filter_narrows(FilterType wide_type, const gchar *wide,
+			      FilterType narrow_type, const gchar *narrow)
+{
+	if (wide_type == FILER_SHOW_ALL)
+		return TRUE;
+	if (narrow_type != wide_type)
+		return FALSE;
+	if (strcmp(wide, narrow) == 0)
+		return TRUE;
+	if (wide_type == FILER_SHOW_GLOB || wide_type == FILER_SHOW_GLOBS)
+		return glob_narrows(wide, narrow,
+				    wide_type == FILER_SHOW_GLOBS);
+	return FALSE;
+}
+
+/* If 'p' starts a class, equivalence class or collating symbol inside a
+ * bracket expression (eg, "[:alpha:]"), return the character after it.
+ * Otherwise (or if it isn't closed before 'limit'), NULL.
+ */
+static const char *bracket_class_end(const char *p, const char *limit)
+{
+	char	kind;
+
+	if (*p != '[' || (p[1] != ':' && p[1] != '.' && p[1] != '='))
+		return NULL;
+
+	kind = p[1];
+	for (p += 2; p + 1 < limit && *p; p++)
+		if (p[0] == kind && p[1] == ']')
+			return p + 2;
+
+	return NULL;
+}
+
+/* Return the ']' closing the bracket expression starting at 'p', or NULL
+ * if it isn't closed (in which case the '[' is literal, as for fnmatch).
+ * As for fnmatch, a backslash quotes the next character and a ']' inside
+ * a class such as "[:alpha:]" doesn't end the expression.
+ */
+static const char *bracket_end(const char *p)
+{
+	const char *class_end;
+
+	p++;
+	if (*p == '!' || *p == '^')
+		p++;
+	if (*p == ']')
+		p++;
+	while (*p && *p != ']')
+	{
+		class_end = bracket_class_end(p, p + strlen(p));
+		if (class_end)
+			p = class_end;
+		else if (*p == '\\' && p[1])
+			p += 2;
+		else
+			p++;
+	}
+
+	return *p ? p : NULL;
+}
+
+/* Is glob[i] a '*' wildcard (not escaped or inside brackets)? */
+static gboolean is_wildcard_star(const char *glob, int i)
+{
+	int	j;
+
+	if (i < 0 || glob[i] != '*')
+		return FALSE;
+
+	for (j = 0; j < i; j++)
+	{
+		if (glob[j] == '\\' && glob[j + 1])
+			j++;
+		else if (glob[j] == '[')
+		{
+			const char *end = bracket_end(glob + j);
+			if (end)
+				j = end - glob;
+		}
+	}
+
+	return j == i;
+}
+
+/* 'narrow' is 'wide' with some extra text inserted next to a '*', as
+ * happens while typing a pattern into the minibuffer. Anything the
+ * longer pattern matches, the '*' alone matched too. If 'alternatives'
+ * is set, '|' separates patterns.
+ */
+static gboolean glob_narrows(const char *wide, const char *narrow,
+			     gboolean alternatives)
+{
+	int	wlen = strlen(wide), nlen = strlen(narrow);
+	int	pre = 0, suf = 0, i;
+
+	if (nlen <= wlen)
+		return FALSE;
+
+	while (pre < wlen && wide[pre] == narrow[pre])
+		pre++;
+	while (suf < wlen && wide[wlen - 1 - suf] == narrow[nlen - 1 - suf])
+		suf++;
+
+	/* Try each place where the extra text could have been inserted */
+	for (i = MAX(wlen - suf, 0); i <= pre; i++)
+	{
+		/* Brackets and escapes change how the rest is parsed */
+		if (memchr(narrow + i, '[', nlen - wlen) ||
+		    memchr(narrow + i, ']', nlen - wlen) ||
+		    memchr(narrow + i, '\\', nlen - wlen))
+			return FALSE;
+
+		if (alternatives && memchr(narrow + i, '|', nlen - wlen))
+			continue;	/* Added a whole new pattern */
+
+		if (is_wildcard_star(wide, i - 1) || is_wildcard_star(wide, i))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Append one character from a glob bracket expression to 're', which is
+ * inside a regex bracket expression. Characters which are special there
+ * depending on their position are written as collating symbols.
+ */
+static void bracket_char_to_regex(GString *re, char c)
+{
+	if (strchr("]-^[", c))
+		g_string_append_printf(re, "[.%c.]", c);
+	else
+		g_string_append_c(re, c);
+}
+
+/* Append the contents of the glob bracket expression between 'p' and
+ * 'end' (the closing ']', and without any leading '!') to 're'. Unlike in
+ * a glob, backslash isn't special in a regex bracket expression.
+ */
+static void bracket_to_regex(GString *re, const char *p, const char *end)
+{
+	const char *class_end;
+
+	while (p < end)
+	{
+		class_end = bracket_class_end(p, end);
+		if (class_end)
+		{
+			g_string_append_len(re, p, class_end - p);
+			p = class_end;
+			continue;
+		}
+
+		if (*p == '\\' && p + 1 < end)
+			p++;
+		bracket_char_to_regex(re, *p++);
+
+		/* A '-' between two characters makes a range */
+		if (*p == '-' && p + 1 < end)
+		{
+			p++;
+			g_string_append_c(re, '-');
+			if (*p == '\\' && p + 1 < end)
+				p++;
+			bracket_char_to_regex(re, *p++);
+		}
+	}
+}
+
+/* Append a regular expression for this glob to 're', matching the same
+ * names as fnmatch() would with no flags.
+ */
+static void glob_to_regex(GString *re, const char *glob)
+{
+	for (; *glob; glob++)
+	{
+		const char *end;
+
+		switch (*glob)
+		{
+			case '*':
+				g_string_append(re, ".*");
+				continue;
+			case '?':
+				g_string_append_c(re, '.');
+				continue;
+			case '[':
+				end = bracket_end(glob);
+				if (!end)
+					break;
+				g_string_append_c(re, '[');
+				glob++;
+				if (*glob == '!' || *glob == '^')
+				{
+					g_string_append_c(re, '^');
+					glob++;
+				}
+				bracket_to_regex(re, glob, end);
+				g_string_append_c(re, ']');
+				glob = end;
+				continue;
+			case '\\':
+				if (glob[1])
+					glob++;
+				break;
+		}
+
+		if (strchr(".[]()*+?{}|^$\\", *glob))
+			g_string_append_c(re, '\\');
+		g_string_append_c(re, *glob);
+	}
+}
+
+/* Split a FILER_SHOW_GLOBS pattern at each '|' which isn't quoted or
+ * inside brackets. g_strfreev() the result.
+ */
+static gchar **split_globs(const char *globs)
+{
+	GPtrArray	*list;
+	const char	*start = globs, *p, *end;
+
+	list = g_ptr_array_new();
+	for (p = globs; *p; p++)
+	{
+		if (*p == '\\' && p[1])
+			p++;
+		else if (*p == '[' && (end = bracket_end(p)))
+			p = end;
+		else if (*p == '|')
+		{
+			g_ptr_array_add(list, g_strndup(start, p - start));
+			start = p + 1;
+		}
+	}
+	g_ptr_array_add(list, g_strdup(start));
+	g_ptr_array_add(list, NULL);
+
+	return (gchar **) g_ptr_array_free(list, FALSE);
+}
+
+/* Compile filter_string into filer_window->regexp, once, so that
+ * filer_match_filter() doesn't have to reparse it for every item.
+ * Globs are turned into a single anchored alternation.
+ */
+static void compile_filter(FilerWindow *filer_window)
+{
+	GString	*re;
+	int	err;
+
+	g_return_if_fail(filer_window->regexp == NULL);
+
+	re = g_string_new(NULL);
+
+	if (filer_window->filter == FILER_SHOW_GLOB)
+	{
+		g_string_append(re, "^(");
+		glob_to_regex(re, filer_window->filter_string);
+		g_string_append(re, ")$");
+	}
+	else if (filer_window->filter == FILER_SHOW_GLOBS)
+	{
+		gchar	**globs, **glob;
+
+		globs = split_globs(filer_window->filter_string);
+		g_string_append(re, "^(");
+		for (glob = globs; *glob; glob++)
+		{
+			if (glob != globs)
+				g_string_append_c(re, '|');
+			glob_to_regex(re, *glob);
+		}
+		g_string_append(re, ")$");
+		g_strfreev(globs);
+	}
+	else
+		g_string_append(re, filer_window->filter_string);
+
+	filer_window->regexp = g_new(regex_t, 1);
+	err = regcomp(filer_window->regexp, re->str, REG_EXTENDED | REG_NOSUB);
+	if (err)
+	{
+		/* Probably still being typed; show everything for now */
+		g_free(filer_window->regexp);
+		filer_window->regexp = NULL;
+	}
+
+	g_string_free(re, TRUE);
+}
+
+static void free_filter_regexp(FilerWindow *filer_window)
+{
+	if (!filer_window->regexp)
+		return;
+
+	regfree(filer_window->regexp);
+	g_free(filer_window->regexp);
+	filer_window->regexp = NULL;
+}
+
 /* Setting stuff */
 static Settings *settings_new(const char *path)
 {
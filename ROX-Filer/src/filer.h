@@ -7,6 +7,8 @@
 #define _FILER_H
 
 #include <gtk/gtk.h>
+#include <sys/types.h>
+#include <regex.h>
 
 enum {
 	RESIZE_STYLE = 0,
@@ -41,6 +43,9 @@ typedef enum
 {
 	FILER_SHOW_ALL,           /* Show all files, modified by show_hidden */
 	FILER_SHOW_GLOB,          /* Show files that match a glob pattern */
+	FILER_SHOW_REGEX,         /* Show files that match a regexp */
+	FILER_SHOW_GLOBS,         /* Show files that match any of several
+				   * globs, separated by '|' */
 } FilterType;
 
 /* What to do when all a mount point's windows are closed */
@@ -91,7 +96,8 @@ struct _FilerWindow
 
 	FilterType      filter;
 	gchar           *filter_string;  /* Glob or regexp pattern */
-	gchar           *regexp;         /* Compiled regexp pattern */
+	regex_t         *regexp;         /* Compiled from filter_string */
+	int		n_hidden;	 /* Known items the filter rejected */
 	/* TRUE if hidden files are shown because the minibuffer leafname
 	 * starts with a dot.
 	 */
@@ -171,6 +177,8 @@ void filer_refresh(FilerWindow *filer_window);
 gboolean filer_match_filter(FilerWindow *filer_window, DirItem *item);
 gboolean filer_set_filter(FilerWindow *filer_window,
 			  FilterType type, const gchar *filter_string);
+gboolean filer_filter_narrows(FilterType wide_type, const gchar *wide,
+			      FilterType narrow_type, const gchar *narrow);
 void filer_set_filter_directories(FilerWindow *fwin, gboolean filter_directories);
 void filer_set_hidden(FilerWindow *fwin, gboolean hidden);
 void filer_next_selected(FilerWindow *filer_window, int dir);
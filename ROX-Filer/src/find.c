@@ -22,6 +22,11 @@
  * A Condition is a tree structure. Each node has a test() fn which
  * can be used to see whether the current file matches, and a free() fn
  * which frees it. Both will recurse down the tree as needed.
+ *
+ * Leafname globs are classified when they are parsed, so that the common
+ * cases ('core', '*.orig', 'foo*', '*bak*') can be tested without calling
+ * fnmatch(). find_condition_needs() tells the caller which fields of the
+ * FindInfo the condition will actually look at.
  */
 
 #include "config.h"
@@ -53,6 +58,7 @@ static Eval *parse_eval(const gchar **expression);
 static Eval *parse_variable(const gchar **expression);
 
 static gboolean match(const gchar **expression, const gchar *word);
+static FindNeeds condition_needs(FindCondition *condition);
 
 typedef enum {
 	IS_DIR,
@@ -95,6 +101,18 @@ typedef enum {
 	V_BLOCKS,
 } VarType;
 
+/* How a leafname glob is tested. 'data2' holds the fixed part of the
+ * pattern (without the stars) for all but GLOB_FNMATCH.
+ */
+typedef enum {
+	GLOB_FNMATCH,		/* Anything else - use fnmatch() */
+	GLOB_LITERAL,		/* 'core' */
+	GLOB_ANY,		/* '*' */
+	GLOB_PREFIX,		/* 'core*' */
+	GLOB_SUFFIX,		/* '*.orig' */
+	GLOB_SUBSTRING,		/* '*core*' */
+} GlobType;
+
 enum
 {
 	FLAG_AGO 	= 1 << 0,
@@ -174,6 +192,18 @@ void find_condition_free(FindCondition *condition)
 		condition->free(condition);
 }
 
+/* Which fields of the FindInfo will find_test_condition() look at?
+ * 'leaf' and 'fullpath' must always be set. If the result doesn't include
+ * FIND_NEED_STAT then only the type bits of 'stats.st_mode' (and only if
+ * FIND_NEED_TYPE is included) need to be valid.
+ */
+FindNeeds find_condition_needs(FindCondition *condition)
+{
+	g_return_val_if_fail(condition != NULL, FIND_NEED_STAT);
+
+	return condition_needs(condition);
+}
+
 /****************************************************************
  *			INTERNAL FUNCTIONS			*
  ****************************************************************/
@@ -247,7 +277,31 @@ static gboolean test_prune(FindCondition *condition, FindInfo *info)
 
 static gboolean test_leaf(FindCondition *condition, FindInfo *info)
 {
-	return fnmatch(condition->data1, info->leaf, 0) == 0;
+	const gchar *fixed = condition->data2;
+	const gchar *leaf = info->leaf;
+	size_t	leaf_len, fixed_len;
+
+	switch ((GlobType) condition->value)
+	{
+		case GLOB_LITERAL:
+			return strcmp(leaf, fixed) == 0;
+		case GLOB_ANY:
+			return TRUE;
+		case GLOB_PREFIX:
+			return strncmp(leaf, fixed, strlen(fixed)) == 0;
+		case GLOB_SUFFIX:
+			leaf_len = strlen(leaf);
+			fixed_len = strlen(fixed);
+			return leaf_len >= fixed_len &&
+				memcmp(leaf + leaf_len - fixed_len,
+				       fixed, fixed_len) == 0;
+		case GLOB_SUBSTRING:
+			return strstr(leaf, fixed) != NULL;
+		case GLOB_FNMATCH:
+			break;
+	}
+
+	return fnmatch(condition->data1, leaf, 0) == 0;
 }
 
 static gboolean test_path(FindCondition *condition, FindInfo *info)
@@ -788,6 +842,47 @@ static FindCondition *parse_is(const gchar **expression)
 	return cond;
 }
 
+/* Look at a leafname glob in cond->data1 and, if it is one of the simple
+ * forms, set cond->value and store the fixed part in cond->data2 so that
+ * test_leaf() can avoid fnmatch().
+ */
+static void classify_glob(FindCondition *cond)
+{
+	const gchar *start = cond->data1, *end;
+	gboolean    lead, trail;
+
+	lead = *start == '*';
+	if (lead)
+		start++;
+
+	end = start + strlen(start);
+	trail = end > start && end[-1] == '*';
+	if (trail)
+		end--;
+
+	if (lead && !trail && *start == '\0')
+	{
+		cond->value = GLOB_ANY;
+		cond->data2 = g_strdup("");
+		return;
+	}
+
+	/* The middle must be plain text */
+	if (strcspn(start, "*?[\\") < (size_t) (end - start))
+		return;
+
+	cond->data2 = g_strndup(start, end - start);
+
+	if (lead && trail)
+		cond->value = GLOB_SUBSTRING;
+	else if (lead)
+		cond->value = GLOB_SUFFIX;
+	else if (trail)
+		cond->value = GLOB_PREFIX;
+	else
+		cond->value = GLOB_LITERAL;
+}
+
 /* Call this just after reading a ' */
 static FindCondition *parse_match(const gchar **expression)
 {
@@ -822,6 +917,10 @@ static FindCondition *parse_match(const gchar **expression)
 	cond->free = &free_simple;
 	cond->data1 = str->str;
 	cond->data2 = NULL;
+	cond->value = GLOB_FNMATCH;
+
+	if (test == &test_leaf)
+		classify_glob(cond);
 
 out:
 	g_string_free(str, cond ? FALSE : TRUE);
@@ -988,6 +1087,48 @@ static Eval *parse_variable(const gchar **expression)
 	return eval;
 }
 
+static FindNeeds eval_needs(Eval *eval)
+{
+	return eval->calc == &get_var ? FIND_NEED_STAT : FIND_NEED_NAME;
+}
+
+static FindNeeds condition_needs(FindCondition *condition)
+{
+	FindTest test = condition->test;
+
+	if (test == &test_OR || test == &test_AND)
+		return condition_needs(condition->data1) |
+		       condition_needs(condition->data2);
+	if (test == &test_neg)
+		return condition_needs(condition->data1);
+	if (test == &test_comp)
+		return eval_needs(condition->data1) |
+		       eval_needs(condition->data2);
+	if (test == &test_is)
+	{
+		switch ((IsTest) condition->value)
+		{
+			case IS_SUID:
+			case IS_SGID:
+			case IS_STICKY:
+			case IS_EMPTY:
+			case IS_MINE:
+				return FIND_NEED_STAT;
+			case IS_READABLE:
+			case IS_WRITEABLE:
+			case IS_EXEC:
+				return FIND_NEED_NAME;	/* Uses access() */
+			default:
+				return FIND_NEED_TYPE;
+		}
+	}
+
+	/* test_leaf, test_path, test_prune and test_system only need
+	 * the name.
+	 */
+	return FIND_NEED_NAME;
+}
+
 static gboolean match(const gchar **expression, const gchar *word)
 {
 	int	len;
@@ -11,6 +11,16 @@ typedef struct _FindInfo FindInfo;
 typedef gboolean (*FindTest)(FindCondition *condition, FindInfo *info);
 typedef void (*FindFree)(FindCondition *condition);
 
+/* What a condition needs to know about a file before it can be tested.
+ * Walkers use this to avoid calling lstat() when the name (or the type
+ * from the directory entry) is enough.
+ */
+typedef enum {
+	FIND_NEED_NAME	= 0,		/* Leafname and fullpath only */
+	FIND_NEED_TYPE	= 1 << 0,	/* The S_IFMT bits of stats.st_mode */
+	FIND_NEED_STAT	= 1 << 1,	/* Everything from lstat() */
+} FindNeeds;
+
 struct _FindInfo
 {
 	const guchar	*fullpath;
@@ -23,3 +33,4 @@ struct _FindInfo
 FindCondition *find_compile(const gchar *string);
 gboolean find_test_condition(FindCondition *condition, FindInfo *info);
 void find_condition_free(FindCondition *condition);
+FindNeeds find_condition_needs(FindCondition *condition);
@@ -125,6 +125,8 @@ GtkTooltips *tooltips = NULL;
        "  -h, --help		display this help and exit\n"		\
        "  -l, --left=PANEL	open PAN as a left-edge panel\n"	\
        "  -m, --mime-type=FILE	print MIME type of FILE and exit\n" \
+       "			(FILE - reads a list of paths, each ending\n"	\
+       "			with a NUL character, from stdin)\n"		\
        "  -n, --new		start new copy; for debugging the filer\n"  \
        "  -p, --pinboard=PIN	use pinboard PIN as the pinboard\n"	\
        "  -r, --right=PANEL	open PAN as a right-edge panel\n"	\
@@ -201,6 +203,9 @@ static void child_died_callback(void);
 static void wake_up_cb(gpointer data, gint source, GdkInputCondition condition);
 static void xrandr_size_change(GdkScreen *screen, gpointer user_data);
 static void add_default_panel_and_pinboard(xmlNodePtr body);
+static void gui_init(void);
+static void load_options(void);
+static void print_mime_types(int fd);
 static GList *build_launch(Option *option, xmlNode *node, guchar *label);
 static GList *build_make_script(Option *option, xmlNode *node, guchar *label);
 
@@ -261,7 +266,7 @@ int main(int argc, char **argv)
 	gboolean	show_user = FALSE;
 	gboolean	rpc_mode = FALSE;
 	xmlDocPtr	rpc, soap_rpc = NULL, reply;
-	xmlNodePtr	body;
+	xmlNodePtr	body, examine_list = NULL;
 	int		fd, ofd0=-1;
 
 	/* Relocate stdin. We do need it (-R), but it can cause problems if
@@ -282,13 +287,12 @@ int main(int argc, char **argv)
 	home_dir_len = strlen(home_dir);
 	app_dir = g_strdup(getenv("APP_DIR"));
 
-	/* Get internationalisation up and running. This requires the
-	 * choices system, to discover the user's preferred language.
+	/* Get internationalisation up and running, for the messages below.
+	 * The options aren't loaded until we know we need them (see
+	 * load_options()).
 	 */
 	choices_init();
-	options_init();
 	i18n_init();
-	xattr_init();
 
 	if (!app_dir)
 	{
@@ -334,15 +338,6 @@ int main(int argc, char **argv)
 		return EXIT_SUCCESS;
 	}
 
-	option_add_int(&o_override_redirect, "override_redirect", FALSE);
-
-	option_add_int(&o_session_panel_or_pin, "session_panel_or_pin",
-		       SESSION_BOTH);
-	option_add_string(&o_session_pinboard_name, "session_pinboard_name",
-			  "Default");
-	option_register_widget("launch", build_launch);
-	option_register_widget("make-script", build_make_script);
-
 #ifdef UNIT_TESTS
 	bulk_rename_tests();
 #endif
@@ -356,26 +351,10 @@ int main(int argc, char **argv)
 
 	/* Note: must do this before checking our options,
 	 * otherwise we report an error for Gtk's options.
+	 * This doesn't open the display (see gui_init()), so that we don't
+	 * need to if a running filer can be reached through its socket.
 	 */
-	gtk_init(&argc, &argv);
-	/* Set a default style for the collection widget */
-	gtk_rc_parse_string("style \"rox-default-collection-style\" {\n"
-		"  bg[NORMAL] = \"#f3f3f3\"\n"
-		"  fg[NORMAL] = \"#000000\"\n"
-		"  bg[INSENSITIVE] = \"#bfbfbf\"\n"
-		"  fg[INSENSITIVE] = \"#000000\"\n"
-		"}\n"
-		"style \"rox-default-pinboard-style\" {\n"
-		"  bg[NORMAL] = \"#666666\"\n"
-		"}\n"
-		"widget \"rox-pinboard\" style : gtk "
-		"\"rox-default-pinboard-style\"\n"
-
-		"class \"Collection\" style : gtk "
-		"\"rox-default-collection-style\"\n");
-
-	g_signal_connect(gdk_screen_get_default(), "size-changed",
-			 G_CALLBACK(xrandr_size_change), NULL);
+	gtk_parse_args(&argc, &argv);
 
 	/* Process each option in turn */
 	while (1)
@@ -398,6 +377,7 @@ int main(int argc, char **argv)
 				new_copy = TRUE;
 				break;
 			case 'o':
+				gui_init();
 				info_message(_("The -o argument is no longer "
 					"used. You can turn on override "
 					"redirect from the Options box "
@@ -412,9 +392,28 @@ int main(int argc, char **argv)
 			        g_print(_(HELP), BUGS_TO);
 				g_print("%s", _(SHORT_ONLY_WARNING));
 				return EXIT_SUCCESS;
+		        case 'x':
+				/* All the files to examine go in a single
+				 * call, so the filer can do them together.
+				 */
+				if (!examine_list)
+				{
+					xmlNs *rox;
+
+					rox = xmlSearchNsByHref(body->doc,
+								body, ROX_NS);
+					examine_list = xmlNewChild(
+						xmlNewChild(body, rox,
+							"ExamineMany", NULL),
+						rox, "Filenames", NULL);
+				}
+				tmp = pathdup(VALUE);
+				xmlNewTextChild(examine_list, examine_list->ns,
+						"Path", tmp);
+				g_free(tmp);
+				break;
 			case 'D':
 			case 'd':
-		        case 'x':
 				/* Argument is a path */
 				if (c == 'd' && VALUE[0] == '/')
 					tmp = g_strdup(VALUE);
@@ -422,8 +421,7 @@ int main(int argc, char **argv)
 					tmp = pathdup(VALUE);
 				soap_add(body,
 					c == 'D' ? "CloseDir" :
-					c == 'd' ? "OpenDir" :
-					c == 'x' ? "Examine" : "Unknown",
+					c == 'd' ? "OpenDir" : "Unknown",
 					"Filename", tmp,
 					NULL, NULL);
 				g_free(tmp);
@@ -474,10 +472,16 @@ int main(int argc, char **argv)
 		        case 'm':
 			{
 				MIME_type *type;
-				type_init();
-				diritem_init();
-				pixmaps_init();
-				type = type_get_type(VALUE);
+
+				/* Doesn't need GTK or the X server */
+				load_options();
+				type_init_database();
+				if (strcmp(VALUE, "-") == 0)
+				{
+					print_mime_types(ofd0 > -1 ? ofd0 : 0);
+					return EXIT_SUCCESS;
+				}
+				type = type_get_type_headless(VALUE);
 				printf("%s/%s\n", type->media_type,
 						type->subtype);
 				return EXIT_SUCCESS;
@@ -509,6 +513,7 @@ int main(int argc, char **argv)
 
 			case 'S':
 				new_copy = TRUE;
+				load_options();
 				add_default_panel_and_pinboard(body);
 				session_auto_respawn = TRUE;
 				break;
@@ -524,8 +529,6 @@ int main(int argc, char **argv)
 		}
 	}
 
-	tooltips = gtk_tooltips_new();
-
 	if (euid == 0 || show_user)
 		show_user_message = g_strdup_printf(_("Running as user '%s'"), 
 						    user_name(euid));
@@ -563,9 +566,14 @@ int main(int argc, char **argv)
 		g_free(dir);
 	}
 
-	option_add_int(&o_dnd_no_hostnames, "dnd_no_hostnames", 1);
+	/* Try to send the request to an already-running copy of the filer,
+	 * through its socket if possible, else through the X server.
+	 */
+	if (!new_copy && remote_send_by_socket(rpc))
+		return EXIT_SUCCESS;	/* It worked - exit */
 
-	/* Try to send the request to an already-running copy of the filer */
+	load_options();
+	gui_init();
 	gui_support_init();
 	if (remote_init(rpc, new_copy))
 		return EXIT_SUCCESS;	/* It worked - exit */
@@ -839,6 +847,107 @@ static void xrandr_size_change(GdkScreen *screen, gpointer user_data)
 	pinboard_update_size();
 }
 
+/* Open the display and finish setting up GTK. gtk_parse_args() must have
+ * been called already. Does nothing after the first call.
+ */
+static void gui_init(void)
+{
+	static gboolean done = FALSE;
+
+	if (done)
+		return;
+	done = TRUE;
+
+	gtk_init(NULL, NULL);
+
+	/* Set a default style for the collection widget */
+	gtk_rc_parse_string("style \"rox-default-collection-style\" {\n"
+		"  bg[NORMAL] = \"#f3f3f3\"\n"
+		"  fg[NORMAL] = \"#000000\"\n"
+		"  bg[INSENSITIVE] = \"#bfbfbf\"\n"
+		"  fg[INSENSITIVE] = \"#000000\"\n"
+		"}\n"
+		"style \"rox-default-pinboard-style\" {\n"
+		"  bg[NORMAL] = \"#666666\"\n"
+		"}\n"
+		"widget \"rox-pinboard\" style : gtk "
+		"\"rox-default-pinboard-style\"\n"
+
+		"class \"Collection\" style : gtk "
+		"\"rox-default-collection-style\"\n");
+
+	g_signal_connect(gdk_screen_get_default(), "size-changed",
+			 G_CALLBACK(xrandr_size_change), NULL);
+
+	tooltips = gtk_tooltips_new();
+}
+
+/* Read the user's options and register our own. A client which manages to
+ * pass its request on through the socket never needs them, so this isn't
+ * done until we know otherwise. Does nothing after the first call.
+ */
+static void load_options(void)
+{
+	static gboolean done = FALSE;
+
+	if (done)
+		return;
+	done = TRUE;
+
+	options_init();
+	xattr_init();
+
+	option_add_int(&o_override_redirect, "override_redirect", FALSE);
+
+	option_add_int(&o_session_panel_or_pin, "session_panel_or_pin",
+		       SESSION_BOTH);
+	option_add_string(&o_session_pinboard_name, "session_pinboard_name",
+			  "Default");
+	option_register_widget("launch", build_launch);
+	option_register_widget("make-script", build_make_script);
+
+	option_add_int(&o_dnd_no_hostnames, "dnd_no_hostnames", 1);
+}
+
+/* Read NUL-terminated paths from 'fd' until end-of-file, writing the
+ * MIME type of each to stdout on a line by itself (for --mime-type=-).
+ */
+static void print_mime_types(int fd)
+{
+	GString	*buffer;
+	char	chunk[4096];
+	ssize_t	got;
+
+	buffer = g_string_new(NULL);
+
+	do
+	{
+		gsize	start = 0;
+		char	*end;
+
+		got = read(fd, chunk, sizeof(chunk));
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got > 0)
+			g_string_append_len(buffer, chunk, got);
+		else if (buffer->len)
+			g_string_append_c(buffer, '\0'); /* Unterminated */
+
+		while ((end = memchr(buffer->str + start, '\0',
+				     buffer->len - start)))
+		{
+			MIME_type *type;
+
+			type = type_get_type_headless(buffer->str + start);
+			printf("%s/%s\n", type->media_type, type->subtype);
+			start = end - buffer->str + 1;
+		}
+		g_string_erase(buffer, 0, start);
+	} while (got > 0 || (got < 0 && errno == EINTR));
+
+	g_string_free(buffer, TRUE);
+}
+
 static void add_default_panel_and_pinboard(xmlNodePtr body)
 {
 	const char *name;
@@ -66,6 +66,7 @@
 #include "bulk_rename.h"
 #include "xtypes.h"
 #include "log.h"
+#include "opqueue.h"
 
 typedef enum {
 	FILE_COPY_ITEM,
@@ -153,6 +154,7 @@ static void open_parent(gpointer data, guint action, GtkWidget *widget);
 static void home_directory(gpointer data, guint action, GtkWidget *widget);
 static void show_bookmarks(gpointer data, guint action, GtkWidget *widget);
 static void show_log(gpointer data, guint action, GtkWidget *widget);
+static void show_queue(gpointer data, guint action, GtkWidget *widget);
 static void new_window(gpointer data, guint action, GtkWidget *widget);
 /* static void new_user(gpointer data, guint action, GtkWidget *widget); */
 static void close_window(gpointer data, guint action, GtkWidget *widget);
@@ -244,6 +246,7 @@ static GtkItemFactoryEntry filer_menu_def[] = {
 {">" N_("Home Directory"),	"<Ctrl>Home", home_directory, 0, "<StockItem>", GTK_STOCK_HOME},
 {">" N_("Show Bookmarks"),	"<Ctrl>B", show_bookmarks, 0, "<StockItem>", ROX_STOCK_BOOKMARKS},
 {">" N_("Show Log"),		NULL, show_log, 0, "<StockItem>", GTK_STOCK_INFO},
+{">" N_("Show Queue"),		NULL, show_queue, 0, NULL},
 {">" N_("Follow Symbolic Links"),	NULL, follow_symlinks, 0, NULL},
 {">" N_("Resize Window"),	"<Ctrl>E", resize, 0, NULL},
 /* {">" N_("New, As User..."),	NULL, new_user, 0, NULL}, */
@@ -1638,8 +1641,8 @@ static void show_send_to_menu(GList *paths, GdkEvent *event)
 				if(type!=item->mime_type)
 				{
 					same=FALSE;
-					if(strcmp(type->media_type,
-						  item->mime_type->media_type)!=0)
+					if(type->media_id !=
+					   item->mime_type->media_id)
 					{
 						same_media=FALSE;
 						break;
@@ -1728,6 +1731,11 @@ static void show_log(gpointer data, guint action, GtkWidget *widget)
 	log_show_window();
 }
 
+static void show_queue(gpointer data, guint action, GtkWidget *widget)
+{
+	opqueue_show_window();
+}
+
 static void follow_symlinks(gpointer data, guint action, GtkWidget *widget)
 {
 	g_return_if_fail(window_with_focus != NULL);
@@ -51,6 +51,37 @@
 
 static GList *shell_history = NULL;
 
+/* A sorted, case-folded index of the leafnames in the directory, so that
+ * type-ahead and completion don't have to scan every item on each key
+ * press. Entries are ordered by folded name, then by item. It follows the
+ * directory (not the view) so that changing the filter doesn't affect it,
+ * and is kept up-to-date by update_display() while the minibuffer is open.
+ */
+typedef struct _MiniEntry MiniEntry;
+typedef struct _MiniIndex MiniIndex;
+
+struct _MiniEntry {
+	gchar		*folded;
+	DirItem		*item;
+};
+
+struct _MiniIndex {
+	MiniEntry	*entries;
+	int		n_entries;
+	int		size;		/* Space allocated in entries */
+
+	/* Where each item is in the view (item -> position + 1) */
+	GHashTable	*positions;
+	ViewIface	*view;
+	guint		generation;	/* view_get_generation() for positions */
+
+	/* The entries which fuzzy_pattern is an abbreviation of. Typing
+	 * more of the pattern only needs to look at these again.
+	 */
+	gchar		*fuzzy_pattern;
+	GArray		*fuzzy;		/* MiniEntry (not owned) */
+};
+
 /* Static prototypes */
 static gint key_press_event(GtkWidget	*widget,
 			GdkEventKey	*event,
@@ -67,6 +98,14 @@ static const gchar *mini_contents(FilerWindow *filer_window);
 static void show_help(FilerWindow *filer_window);
 static gboolean grab_focus(GtkWidget *minibuffer);
 static gboolean select_if_glob(ViewIter *iter, gpointer data);
+static MiniIndex *get_index(FilerWindow *filer_window);
+static void prefix_range(MiniIndex *index, const gchar *folded,
+			 int *start, int *end);
+static int entry_pos(MiniIndex *index, MiniEntry *entry);
+static int find_entry(MiniIndex *index, const gchar *folded, DirItem *item);
+static void drop_fuzzy(MiniIndex *index);
+static gboolean find_fuzzy_match(FilerWindow *filer_window,
+				 const char *pattern);
 
 /****************************************************************
  *			EXTERNAL INTERFACE			*
@@ -162,13 +201,28 @@ void minibuffer_show(FilerWindow *filer_window, MiniType mini_type)
 			view_select_if(filer_window->view, select_if_glob, "*.");
 			break;
 		case MINI_FILTER:
-			if(filer_window->filter!=FILER_SHOW_GLOB ||
-			   !filer_window->filter_string)
-				gtk_entry_set_text(mini, "*");
+		{
+			gchar *tmp;
+
+			if (!filer_window->filter_string)
+				tmp = g_strdup("*");
+			else if (filer_window->filter == FILER_SHOW_REGEX)
+				tmp = g_strconcat("/",
+						filer_window->filter_string,
+						NULL);
+			else if (filer_window->filter == FILER_SHOW_GLOBS)
+				tmp = g_strconcat("|",
+						filer_window->filter_string,
+						NULL);
 			else
-				gtk_entry_set_text(mini,
-						  filer_window->filter_string);
+				tmp = g_strdup(filer_window->filter_string);
+			gtk_entry_set_text(mini, tmp);
+
+			/* So that Escape can put it back */
+			g_object_set_data_full(G_OBJECT(mini), "old-filter",
+					       tmp, g_free);
 			break;
+		}
 		case MINI_SHELL:
 		{
 			DirItem *item;
@@ -211,6 +265,10 @@ void minibuffer_hide(FilerWindow *filer_window)
 {
 	filer_window->mini_type = MINI_NONE;
 
+	/* (rebuilt on demand; no point keeping it up-to-date meanwhile) */
+	g_object_set_data(G_OBJECT(filer_window->minibuffer),
+			  "mini-index", NULL);
+
 	gtk_widget_hide(filer_window->minibuffer_area);
 
 	gtk_widget_child_focus(filer_window->window, GTK_DIR_TAB_FORWARD);
@@ -255,6 +313,96 @@ void minibuffer_add(FilerWindow *filer_window, const gchar *leafname)
 	g_free(esc);
 }
 
+/* These items have been added to (or updated in) the window's directory.
+ * Does nothing unless the minibuffer's index has been built.
+ */
+void minibuffer_index_add(FilerWindow *filer_window, GPtrArray *items)
+{
+	MiniIndex *index;
+	int	  i;
+
+	if (!filer_window->minibuffer)
+		return;
+	index = g_object_get_data(G_OBJECT(filer_window->minibuffer),
+				  "mini-index");
+	if (!index)
+		return;
+
+	for (i = 0; i < items->len; i++)
+	{
+		DirItem	*item = (DirItem *) items->pdata[i];
+		gchar	*folded;
+		int	at;
+
+		folded = g_ascii_strdown(item->leafname, -1);
+		at = find_entry(index, folded, item);
+		if (at < index->n_entries &&
+		    index->entries[at].item == item)
+		{
+			g_free(folded);
+			continue;	/* Already known */
+		}
+
+		if (index->n_entries == index->size)
+		{
+			index->size *= 2;
+			index->entries = g_renew(MiniEntry, index->entries,
+						 index->size);
+		}
+		memmove(index->entries + at + 1, index->entries + at,
+			(index->n_entries - at) * sizeof(MiniEntry));
+		index->entries[at].folded = folded;
+		index->entries[at].item = item;
+		index->n_entries++;
+	}
+
+	drop_fuzzy(index);
+}
+
+/* These items are about to be removed from the window's directory */
+void minibuffer_index_remove(FilerWindow *filer_window, GPtrArray *items)
+{
+	MiniIndex *index;
+	int	  i;
+
+	if (!filer_window->minibuffer)
+		return;
+	index = g_object_get_data(G_OBJECT(filer_window->minibuffer),
+				  "mini-index");
+	if (!index)
+		return;
+
+	for (i = 0; i < items->len; i++)
+	{
+		DirItem	*item = (DirItem *) items->pdata[i];
+		gchar	*folded;
+		int	at;
+
+		folded = g_ascii_strdown(item->leafname, -1);
+		at = find_entry(index, folded, item);
+		g_free(folded);
+
+		if (at >= index->n_entries || index->entries[at].item != item)
+			continue;
+
+		g_free(index->entries[at].folded);
+		index->n_entries--;
+		memmove(index->entries + at, index->entries + at + 1,
+			(index->n_entries - at) * sizeof(MiniEntry));
+	}
+
+	/* (the view has changed too, so positions will be redone) */
+	drop_fuzzy(index);
+}
+
+/* The window is now showing a different directory */
+void minibuffer_index_clear(FilerWindow *filer_window)
+{
+	if (filer_window->minibuffer)
+		g_object_set_data(G_OBJECT(filer_window->minibuffer),
+				  "mini-index", NULL);
+}
+
 
 /****************************************************************
  *			INTERNAL FUNCTIONS			*
@@ -290,8 +438,11 @@ static void show_help(FilerWindow *filer_window)
 		case MINI_FILTER:
 			info_message(
 				_("Enter a pattern to match for files to "
-				"be shown.  An empty filter turns the "
-				  "filter off."));
+				"be shown.  Start with '|' to give several "
+				"patterns separated by '|', or with '/' to use a "
+				"regular expression instead.  An empty filter "
+				"turns the filter off.  Escape to go back to "
+				"the previous filter."));
 			break;
 		default:
 			g_warning("Unknown minibuffer type!");
@@ -334,11 +485,14 @@ static void path_return_pressed(FilerWindow *filer_window, GdkEventKey *event)
 static void complete(FilerWindow *filer_window)
 {
 	GtkEntry	*entry;
-	DirItem 	*item, *other;
+	DirItem 	*item;
 	int		shortest_stem = -1;
 	int		current_stem;
 	const gchar	*text, *leaf;
-	ViewIter	cursor, iter;
+	gchar		*folded;
+	ViewIter	cursor;
+	MiniIndex	*index;
+	int		start, end, i;
 
 	view_get_cursor(filer_window->view, &cursor);
 	item = cursor.peek(&cursor);
@@ -370,32 +524,48 @@ static void complete(FilerWindow *filer_window)
 
 	/* Find the longest other match of this name. If it's longer than
 	 * the currently entered text then complete only up to that length.
+	 *
+	 * The other matches are the index entries sharing this prefix. In
+	 * sorted order, the one with the least in common with our item is
+	 * at one end of that range, so only the ends need checking.
+	 * Like the matches() function below, the comparison of leafs must
+	 * be case-insensitive (which the folded names take care of).
 	 */
-	view_get_iter(filer_window->view, &iter, 0);
-	while ((other = iter.next(&iter)))
+	index = get_index(filer_window);
+	folded = g_ascii_strdown(leaf, -1);
+	prefix_range(index, folded, &start, &end);
+	g_free(folded);
+
+	/* (skipping any the view isn't showing) */
+	while (start < end && entry_pos(index, &index->entries[start]) < 0)
+		start++;
+	while (end > start && entry_pos(index, &index->entries[end - 1]) < 0)
+		end--;
+
+	for (i = start; i < end; i++)
+		if (index->entries[i].item == item)
+			break;
+
+	if (i < end && end - start > 1)
 	{
-		int	stem = 0;
+		const gchar *ours = index->entries[i].folded;
+		int	    ends[2], j;
 
-		if (iter.i == cursor.i)	/* XXX */
-			continue;
+		ends[0] = i == start ? end - 1 : start;
+		ends[1] = i == end - 1 ? start : end - 1;
 
-		while (other->leafname[stem] && item->leafname[stem])
+		for (j = 0; j < 2; j++)
 		{
-			gchar	a, b;
-			/* Like the matches() function below, the comparison of
-			 * leafs must be case-insensitive.
-			 */
-		  	a = g_ascii_tolower(item->leafname[stem]);
-		  	b = g_ascii_tolower(other->leafname[stem]);
-			if (a != b)
-				break;
-			stem++;
-		}
+			const gchar *other = index->entries[ends[j]].folded;
+			int	    stem = 0;
 
-		/* stem is the index of the first difference */
-		if (stem >= current_stem &&
-				(shortest_stem == -1 || stem < shortest_stem))
-			shortest_stem = stem;
+			while (ours[stem] && ours[stem] == other[stem])
+				stem++;
+
+			/* stem is the index of the first difference */
+			if (shortest_stem == -1 || stem < shortest_stem)
+				shortest_stem = stem;
+		}
 	}
 
 	if (current_stem == shortest_stem)
@@ -532,9 +702,15 @@ static void path_changed(FilerWindow *filer_window)
 			display_update_hidden(filer_window);
 		}
 		
+		/* An abbreviation is only a guess, so still say that
+		 * nothing matched.
+		 */
 		if (find_exact_match(filer_window, leaf) == FALSE &&
 		    find_next_match(filer_window, leaf, 0) == FALSE)
+		{
+			find_fuzzy_match(filer_window, leaf);
 			error = TRUE;
+		}
 	}
 		
 	g_free(new);
@@ -549,19 +725,35 @@ static void path_changed(FilerWindow *filer_window)
 static gboolean find_exact_match(FilerWindow *filer_window,
 				 const gchar *pattern)
 {
-	DirItem		*item;
-	ViewIter	iter;
 	ViewIface	*view = filer_window->view;
+	MiniIndex	*index;
+	ViewIter	iter;
+	DirItem		*item;
+	gchar		*folded;
+	int		start, end, i, len;
 
-	view_get_iter(view, &iter, 0);
+	index = get_index(filer_window);
+	folded = g_ascii_strdown(pattern, -1);
+	prefix_range(index, folded, &start, &end);
+	g_free(folded);
 
-	while ((item = iter.next(&iter)))
+	/* Exact matches come first in the range */
+	len = strlen(pattern);
+	for (i = start; i < end && !index->entries[i].folded[len]; i++)
 	{
-		if (strcmp(item->leafname, pattern) == 0)
-		{
-			view_cursor_to_iter(view, &iter);
-			return TRUE;
-		}
+		int pos;
+
+		item = index->entries[i].item;
+		if (strcmp(item->leafname, pattern) != 0)
+			continue;
+
+		pos = entry_pos(index, &index->entries[i]);
+		if (pos < 0)
+			continue;	/* Not shown */
+
+		view_get_iter_at_index(view, &iter, pos);
+		view_cursor_to_iter(view, &iter);
+		return TRUE;
 	}
 
 	return FALSE;
@@ -581,31 +773,56 @@ static gboolean find_next_match(FilerWindow *filer_window,
 {
 	ViewIface  *view = filer_window->view;
 	ViewIter   iter;
+	MiniIndex  *index;
+	gchar	   *folded;
+	int	   n, base, start, end, i;
+	int	   best = -1, best_dist = -1;
 
-	if (view_count_items(view) < 1)
+	n = view_count_items(view);
+	if (n < 1)
 		return FALSE;
 
+	/* (also used below if there are no matches) */
 	view_get_iter(view, &iter,
-		VIEW_ITER_FROM_BASE |
+		VIEW_ITER_FROM_BASE | VIEW_ITER_ONE_ONLY |
 		(dir >= 0 ? 0 : VIEW_ITER_BACKWARDS));
+	base = iter.i;
 
-	if (dir != 0)
-		iter.next(&iter);	/* Don't look at the base itself */
+	index = get_index(filer_window);
+	folded = g_ascii_strdown(pattern, -1);
+	prefix_range(index, folded, &start, &end);
+	g_free(folded);
 
-	while (iter.next(&iter))
+	/* Of the items with this prefix, pick the first one we'd reach
+	 * going from the base in the requested direction.
+	 */
+	for (i = start; i < end; i++)
 	{
-		if (matches(&iter, pattern))
+		int pos = entry_pos(index, &index->entries[i]);
+		int dist = dir >= 0 ? pos - base : base - pos;
+
+		if (pos < 0)
+			continue;	/* Not shown */
+		if (dist < 0)
+			dist += n;
+		if (dist == 0 && dir != 0)
+			continue;	/* Don't look at the base itself */
+
+		if (best == -1 || dist < best_dist)
 		{
-			view_cursor_to_iter(view, &iter);
-			return TRUE;
+			best = pos;
+			best_dist = dist;
 		}
 	}
 
-	/* No matches (except possibly base itself) */
-	view_get_iter(view, &iter,
-		VIEW_ITER_FROM_BASE | VIEW_ITER_ONE_ONLY |
-		(dir >= 0 ? 0 : VIEW_ITER_BACKWARDS));
+	if (best != -1)
+	{
+		view_get_iter_at_index(view, &iter, best);
+		view_cursor_to_iter(view, &iter);
+		return TRUE;
+	}
 
+	/* No matches (except possibly base itself) */
 	view_cursor_to_iter(view, &iter);
 
 	return FALSE;
@@ -636,6 +853,271 @@ static void search_in_dir(FilerWindow *filer_window, int dir)
 	view_set_base(filer_window->view, &iter);
 }
 
+static int compare_entries(const void *a, const void *b)
+{
+	const MiniEntry *ea = (const MiniEntry *) a;
+	const MiniEntry *eb = (const MiniEntry *) b;
+	int diff;
+
+	diff = strcmp(ea->folded, eb->folded);
+	if (diff)
+		return diff;
+	return ea->item < eb->item ? -1 : ea->item > eb->item;
+}
+
+static void free_index(MiniIndex *index)
+{
+	int i;
+
+	for (i = 0; i < index->n_entries; i++)
+		g_free(index->entries[i].folded);
+	g_free(index->entries);
+	g_hash_table_destroy(index->positions);
+	drop_fuzzy(index);
+	g_free(index);
+}
+
+static void add_entry(gpointer key, gpointer value, gpointer data)
+{
+	MiniIndex *index = (MiniIndex *) data;
+	DirItem	  *item = (DirItem *) value;
+
+	index->entries[index->n_entries].folded =
+			g_ascii_strdown(item->leafname, -1);
+	index->entries[index->n_entries].item = item;
+	index->n_entries++;
+}
+
+/* Return the index for this window's directory, building it first if the
+ * minibuffer has only just been opened. Once built, the index is updated
+ * as items come and go, but where each item is in the view is
+ * recalculated (in a single pass) whenever the view has changed.
+ */
+static MiniIndex *get_index(FilerWindow *filer_window)
+{
+	GObject	  *mini = G_OBJECT(filer_window->minibuffer);
+	ViewIface *view = filer_window->view;
+	MiniIndex *index;
+	ViewIter  iter;
+	DirItem	  *item;
+	int	  n = 0;
+
+	index = g_object_get_data(mini, "mini-index");
+	if (!index)
+	{
+		GHashTable *known = filer_window->directory->known_items;
+
+		index = g_new(MiniIndex, 1);
+		index->size = MAX(g_hash_table_size(known), 16);
+		index->entries = g_new(MiniEntry, index->size);
+		index->n_entries = 0;
+		index->positions = g_hash_table_new(NULL, NULL);
+		index->view = NULL;
+		index->generation = 0;
+		index->fuzzy_pattern = NULL;
+		index->fuzzy = NULL;
+
+		g_hash_table_foreach(known, add_entry, index);
+		qsort(index->entries, index->n_entries, sizeof(MiniEntry),
+		      compare_entries);
+
+		g_object_set_data_full(mini, "mini-index", index,
+				       (GDestroyNotify) free_index);
+	}
+	else if (index->view == view &&
+		 index->generation == view_get_generation(view))
+		return index;
+
+	index->view = view;
+	index->generation = view_get_generation(view);
+	g_hash_table_remove_all(index->positions);
+
+	view_get_iter(view, &iter, 0);
+	while ((item = iter.next(&iter)))
+		g_hash_table_insert(index->positions, item,
+				    GINT_TO_POINTER(++n));
+
+	return index;
+}
+
+/* Where this entry's item is in the view, or -1 if it isn't shown */
+static int entry_pos(MiniIndex *index, MiniEntry *entry)
+{
+	return GPOINTER_TO_INT(g_hash_table_lookup(index->positions,
+						   entry->item)) - 1;
+}
+
+/* Return where an entry for this item is, or would be inserted */
+static int find_entry(MiniIndex *index, const gchar *folded, DirItem *item)
+{
+	MiniEntry key;
+	int	  low = 0, high = index->n_entries;
+
+	key.folded = (gchar *) folded;
+	key.item = item;
+
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+
+		if (compare_entries(&index->entries[mid], &key) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/* The entries have changed, so the fuzzy matches must be found again */
+static void drop_fuzzy(MiniIndex *index)
+{
+	null_g_free(&index->fuzzy_pattern);
+	if (index->fuzzy)
+	{
+		g_array_free(index->fuzzy, TRUE);
+		index->fuzzy = NULL;
+	}
+}
+
+/* Set [start, end) to the entries whose folded names start with 'folded'.
+ * O(log n).
+ */
+static void prefix_range(MiniIndex *index, const gchar *folded,
+			 int *start, int *end)
+{
+	int len = strlen(folded);
+	int low, high;
+
+	low = 0;
+	high = index->n_entries;
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+
+		if (strncmp(index->entries[mid].folded, folded, len) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	*start = low;
+
+	high = index->n_entries;
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+
+		if (strncmp(index->entries[mid].folded, folded, len) <= 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	*end = low;
+}
+
+/* How well does 'name' match 'pattern', both folded? -1 if the pattern
+ * isn't a subsequence of the name at all. Runs of consecutive characters
+ * and matches at the start of a word score highest, and shorter names
+ * win ties.
+ */
+static int fuzzy_score(const gchar *name, const gchar *pattern)
+{
+	const gchar *n, *p = pattern;
+	int	    score = 0, run = 0;
+
+	for (n = name; *n && *p; n++)
+	{
+		if (*n != *p)
+		{
+			run = 0;
+			continue;
+		}
+
+		score += ++run;
+		if (n == name || strchr(" ._-", n[-1]))
+			score += 3;
+		p++;
+	}
+
+	if (*p)
+		return -1;
+
+	return score * 256 - MIN(strlen(name), 255);
+}
+
+/* No item starts with 'pattern'; move the cursor to the item it matches
+ * best as an abbreviation (eg, 'mkf' for 'Makefile.in'), if any.
+ * Returns TRUE if one was found.
+ *
+ * Every item that 'mkfi' abbreviates is also abbreviated by 'mkf', so when
+ * the pattern is extended only the previous key's matches are checked.
+ */
+static gboolean find_fuzzy_match(FilerWindow *filer_window,
+				 const char *pattern)
+{
+	ViewIface  *view = filer_window->view;
+	MiniIndex  *index;
+	ViewIter   iter;
+	MiniEntry  *candidates;
+	GArray	   *matched;
+	gchar	   *folded;
+	int	   n_candidates, i, best = -1, best_score = -1;
+
+	if (!*pattern)
+		return FALSE;
+
+	index = get_index(filer_window);
+	folded = g_ascii_strdown(pattern, -1);
+
+	if (index->fuzzy && strncmp(folded, index->fuzzy_pattern,
+				    strlen(index->fuzzy_pattern)) == 0)
+	{
+		candidates = (MiniEntry *) index->fuzzy->data;
+		n_candidates = index->fuzzy->len;
+	}
+	else
+	{
+		candidates = index->entries;
+		n_candidates = index->n_entries;
+	}
+
+	matched = g_array_new(FALSE, FALSE, sizeof(MiniEntry));
+
+	for (i = 0; i < n_candidates; i++)
+	{
+		int score, pos;
+
+		score = fuzzy_score(candidates[i].folded, folded);
+		if (score < 0)
+			continue;
+		g_array_append_val(matched, candidates[i]);
+
+		pos = entry_pos(index, &candidates[i]);
+		if (pos < 0)
+			continue;	/* Not shown */
+
+		if (score > best_score ||
+		    (score == best_score && pos < best))
+		{
+			best = pos;
+			best_score = score;
+		}
+	}
+
+	/* (candidates may point into the old list) */
+	drop_fuzzy(index);
+	index->fuzzy_pattern = folded;
+	index->fuzzy = matched;
+
+	if (best == -1)
+		return FALSE;
+
+	view_get_iter_at_index(view, &iter, best);
+	view_cursor_to_iter(view, &iter);
+
+	return TRUE;
+}
+
 /*			SHELL COMMANDS			*/
 
 static void add_to_history(const gchar *line)
@@ -876,6 +1358,7 @@ typedef struct {
 	FindInfo info;
 	FilerWindow *filer_window;
 	FindCondition *cond;
+	FindNeeds needs;
 } SelectData;
 
 static gboolean select_if_test(ViewIter *iter, gpointer user_data)
@@ -890,8 +1373,12 @@ static gboolean select_if_test(ViewIter *iter, gpointer user_data)
 	data->info.fullpath = make_path(data->filer_window->sym_path,
 					data->info.leaf);
 
-	return mc_lstat(data->info.fullpath, &data->info.stats) == 0 &&
-			find_test_condition(data->cond, &data->info);
+	/* Don't stat if only the name is needed */
+	if (data->needs != FIND_NEED_NAME &&
+	    mc_lstat(data->info.fullpath, &data->info.stats) != 0)
+		return FALSE;
+
+	return find_test_condition(data->cond, &data->info);
 }
 
 static void select_return_pressed(FilerWindow *filer_window, guint etime)
@@ -913,6 +1400,7 @@ static void select_return_pressed(FilerWindow *filer_window, guint etime)
 		return;
 	}
 
+	data.needs = find_condition_needs(data.cond);
 	data.info.now = time(NULL);
 	data.info.prune = FALSE;	/* (don't care) */
 	data.filer_window = filer_window;
@@ -924,18 +1412,31 @@ out:
 	minibuffer_hide(filer_window);
 }
 
-static void filter_return_pressed(FilerWindow *filer_window, guint etime)
+/* Called as the pattern is edited, so the view follows the typing */
+static void filter_changed(FilerWindow *filer_window)
 {
 	const gchar	*entry;
 
 	entry = mini_contents(filer_window);
 
-	if (entry && *entry && strcmp(entry, "*")!=0) {
+	if (entry && entry[0] == '/' && entry[1]) {
+		display_set_filter(filer_window, FILER_SHOW_REGEX,
+				   entry + 1);
+	} else if (entry && entry[0] == '|' && entry[1]) {
+		display_set_filter(filer_window, FILER_SHOW_GLOBS,
+				   entry + 1);
+	} else if (entry && *entry && strcmp(entry, "*")!=0 &&
+		   strcmp(entry, "/")!=0 && strcmp(entry, "|")!=0) {
 		display_set_filter(filer_window, FILER_SHOW_GLOB,
 				   entry);
 	} else {
 		display_set_filter(filer_window, FILER_SHOW_ALL, NULL);
 	}
+}
+
+static void filter_return_pressed(FilerWindow *filer_window, guint etime)
+{
+	filter_changed(filer_window);
 	minibuffer_hide(filer_window);
 }
 
@@ -956,6 +1457,16 @@ static gint key_press_event(GtkWidget	*widget,
 			if (line)
 				add_to_history(line);
 		}
+		else if (filer_window->mini_type == MINI_FILTER)
+		{
+			const gchar *old;
+
+			/* Undo the filtering done while typing */
+			old = g_object_get_data(G_OBJECT(widget),
+						"old-filter");
+			if (old)
+				gtk_entry_set_text(GTK_ENTRY(widget), old);
+		}
 
 		minibuffer_hide(filer_window);
 		return TRUE;
@@ -1099,6 +1610,9 @@ static void changed(GtkEditable *mini, FilerWindow *filer_window)
 			if (iter.next(&iter))
 				view_cursor_to_iter(filer_window->view, &iter);
 			return;
+		case MINI_FILTER:
+			filter_changed(filer_window);
+			return;
 		default:
 			break;
 	}
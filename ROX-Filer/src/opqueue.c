@@ -0,0 +1,456 @@
+/*
+ * ROX-Filer, filer for the ROX desktop project
+ * Copyright (C) 2006, Thomas Leonard and others (see changelog for details).
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* opqueue.c - the queue of file operations
+ *
+ * Copy, move and delete operations are added to this queue instead of all
+ * being started at once. Each job records the devices (st_dev) it reads
+ * and writes. Jobs on different devices run in parallel, but jobs sharing
+ * a device run one at a time, in queue order, so that (eg) three copies to
+ * the same USB stick don't thrash it with interleaved writes.
+ *
+ * The queue window shows what is running and waiting, and lets the user
+ * pause jobs or change the order.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "global.h"
+
+#include "opqueue.h"
+#include "main.h"
+#include "options.h"
+#include "gui_support.h"
+
+typedef enum {
+	JOB_WAITING,
+	JOB_RUNNING,
+} JobState;
+
+struct _OpJob {
+	gchar		*title;		/* eg "Copy" */
+	gchar		*details;	/* eg "'foo' -> /mnt/usb" */
+	dev_t		*devices;
+	int		n_devices;
+
+	JobState	state;
+	gboolean	paused;
+	gboolean	told_to_wait;	/* OPJOB_WAIT has been sent */
+
+	OpJobCallback	callback;
+	gpointer	data;
+};
+
+/* The columns in the queue window's list */
+enum {
+	COL_JOB,
+	COL_STATE,
+	COL_TITLE,
+	COL_DETAILS,
+	N_COLS
+};
+
+enum {RESPONSE_PAUSE, RESPONSE_UP, RESPONSE_DOWN};
+
+static GList *queue = NULL;		/* All OpJobs, in order */
+static gint schedule_tag = 0;		/* Idle callback, or 0 */
+
+static GtkWidget *queue_window = NULL;
+static GtkListStore *queue_store = NULL;
+static GtkWidget *queue_view = NULL;
+
+static Option o_action_queue;
+
+/* Static prototypes */
+static void queue_changed(void);
+static gboolean schedule(gpointer data);
+static void update_window(void);
+static void add_device(OpJob *job, const char *path, gboolean follow);
+static gboolean uses_device(OpJob *job, GArray *devices);
+static void claim_devices(OpJob *job, GArray *devices);
+static OpJob *selected_job(void);
+static void queue_response(GtkDialog *dialog, gint response, gpointer data);
+static void queue_window_destroyed(GtkWidget *widget, gpointer data);
+
+
+/****************************************************************
+ *			EXTERNAL INTERFACE			*
+ ****************************************************************/
+
+void opqueue_init(void)
+{
+	option_add_int(&o_action_queue, "action_queue", TRUE);
+}
+
+/* Add a new job to the end of the queue. 'paths' are the items it reads
+ * (or deletes) and 'dest' is the directory it writes to (if any); these
+ * decide which devices it uses.
+ * callback(OPJOB_START, data) is called from the main loop once the job
+ * may run. Call opqueue_job_done() when it finishes or is cancelled.
+ */
+OpJob *opqueue_add(const gchar *title, GList *paths, const gchar *dest,
+		   OpJobCallback callback, gpointer data)
+{
+	OpJob	*job;
+	int	n_paths;
+	GList	*next;
+
+	g_return_val_if_fail(callback != NULL, NULL);
+
+	job = g_new(OpJob, 1);
+	job->title = g_strdup(title);
+	job->devices = NULL;
+	job->n_devices = 0;
+	job->state = JOB_WAITING;
+	job->paused = FALSE;
+	job->told_to_wait = FALSE;
+	job->callback = callback;
+	job->data = data;
+
+	for (next = paths; next; next = next->next)
+		add_device(job, (char *) next->data, FALSE);
+	if (dest)
+		add_device(job, dest, TRUE);
+
+	n_paths = g_list_length(paths);
+	if (n_paths == 1)
+		job->details = g_strdup_printf("'%s'",
+					g_basename((char *) paths->data));
+	else
+		job->details = g_strdup_printf(_("%d items"), n_paths);
+	if (dest)
+	{
+		gchar *tmp = job->details;
+
+		job->details = g_strdup_printf("%s -> %s", tmp, dest);
+		g_free(tmp);
+	}
+
+	queue = g_list_append(queue, job);
+	queue_changed();
+
+	return job;
+}
+
+/* The job has finished, or was cancelled before starting. Remove it and
+ * let anything waiting for its devices start.
+ */
+void opqueue_job_done(OpJob *job)
+{
+	g_return_if_fail(job != NULL);
+	g_return_if_fail(g_list_find(queue, job) != NULL);
+
+	queue = g_list_remove(queue, job);
+
+	g_free(job->title);
+	g_free(job->details);
+	g_free(job->devices);
+	g_free(job);
+
+	queue_changed();
+}
+
+/* Show the list of queued operations */
+void opqueue_show_window(void)
+{
+	GtkWidget		*swin;
+	GtkTreeViewColumn	*column;
+	GtkCellRenderer		*cell_renderer;
+
+	if (queue_window)
+	{
+		gtk_window_present(GTK_WINDOW(queue_window));
+		return;
+	}
+
+	queue_window = gtk_dialog_new();
+	gtk_window_set_title(GTK_WINDOW(queue_window), _("File operations"));
+	gtk_dialog_set_has_separator(GTK_DIALOG(queue_window), FALSE);
+	gtk_window_set_default_size(GTK_WINDOW(queue_window), 500, 250);
+
+	gtk_dialog_add_action_widget(GTK_DIALOG(queue_window),
+			button_new_mixed(GTK_STOCK_MEDIA_PAUSE,
+					 _("_Pause/Resume")),
+			RESPONSE_PAUSE);
+	gtk_dialog_add_button(GTK_DIALOG(queue_window),
+				GTK_STOCK_GO_UP, RESPONSE_UP);
+	gtk_dialog_add_button(GTK_DIALOG(queue_window),
+				GTK_STOCK_GO_DOWN, RESPONSE_DOWN);
+	gtk_dialog_add_button(GTK_DIALOG(queue_window),
+				GTK_STOCK_CLOSE, GTK_RESPONSE_CLOSE);
+
+	queue_store = gtk_list_store_new(N_COLS, G_TYPE_POINTER,
+				G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
+	queue_view = gtk_tree_view_new_with_model(
+					GTK_TREE_MODEL(queue_store));
+
+	cell_renderer = gtk_cell_renderer_text_new();
+	column = gtk_tree_view_column_new_with_attributes(_("State"),
+				cell_renderer, "text", COL_STATE, NULL);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(queue_view), column);
+	column = gtk_tree_view_column_new_with_attributes(_("Action"),
+				cell_renderer, "text", COL_TITLE, NULL);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(queue_view), column);
+	column = gtk_tree_view_column_new_with_attributes(_("Items"),
+				cell_renderer, "text", COL_DETAILS, NULL);
+	gtk_tree_view_column_set_resizable(column, TRUE);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(queue_view), column);
+
+	swin = gtk_scrolled_window_new(NULL, NULL);
+	gtk_container_set_border_width(GTK_CONTAINER(swin), 4);
+	gtk_scrolled_window_set_shadow_type(GTK_SCROLLED_WINDOW(swin),
+						GTK_SHADOW_IN);
+	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(swin),
+				GTK_POLICY_AUTOMATIC, GTK_POLICY_ALWAYS);
+	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(queue_window)->vbox),
+				swin, TRUE, TRUE, 0);
+	gtk_container_add(GTK_CONTAINER(swin), queue_view);
+
+	g_signal_connect(queue_window, "response",
+			G_CALLBACK(queue_response), NULL);
+	g_signal_connect(queue_window, "destroy",
+			G_CALLBACK(queue_window_destroyed), NULL);
+
+	update_window();
+
+	gtk_widget_show_all(queue_window);
+}
+
+/****************************************************************
+ *			INTERNAL FUNCTIONS			*
+ ****************************************************************/
+
+/* Something was added, removed, paused or moved. Jobs are only ever started
+ * from the main loop, so that callers never see a callback from inside
+ * opqueue_add() or opqueue_job_done().
+ */
+static void queue_changed(void)
+{
+	if (!schedule_tag)
+		schedule_tag = g_idle_add(schedule, NULL);
+
+	update_window();
+}
+
+/* Start every waiting job whose devices are free. A job which has to wait
+ * still claims its devices, so later jobs can't overtake it on a shared
+ * device. Paused jobs don't claim anything.
+ */
+static gboolean schedule(gpointer data)
+{
+	GArray	*claimed;
+	GList	*next;
+
+	schedule_tag = 0;
+
+	claimed = g_array_new(FALSE, FALSE, sizeof(dev_t));
+
+	for (next = queue; next; next = next->next)
+	{
+		OpJob *job = (OpJob *) next->data;
+
+		if (job->state == JOB_RUNNING)
+			claim_devices(job, claimed);
+	}
+
+	next = queue;
+	while (next)
+	{
+		OpJob *job = (OpJob *) next->data;
+
+		/* (starting may remove this job from the queue) */
+		next = next->next;
+
+		if (job->state != JOB_WAITING || job->paused)
+			continue;
+
+		if (o_action_queue.int_value && uses_device(job, claimed))
+		{
+			if (!job->told_to_wait)
+			{
+				job->told_to_wait = TRUE;
+				job->callback(OPJOB_WAIT, job->data);
+			}
+			claim_devices(job, claimed);
+			continue;
+		}
+
+		claim_devices(job, claimed);
+		job->state = JOB_RUNNING;
+		job->callback(OPJOB_START, job->data);
+	}
+
+	g_array_free(claimed, TRUE);
+
+	update_window();
+
+	return FALSE;
+}
+
+/* Record the device 'path' is on, if we don't have it already */
+static void add_device(OpJob *job, const char *path, gboolean follow)
+{
+	struct stat info;
+	int	i;
+
+	if ((follow ? mc_stat(path, &info) : mc_lstat(path, &info)) != 0)
+		return;
+
+	for (i = 0; i < job->n_devices; i++)
+		if (job->devices[i] == info.st_dev)
+			return;
+
+	job->devices = g_renew(dev_t, job->devices, job->n_devices + 1);
+	job->devices[job->n_devices++] = info.st_dev;
+}
+
+static gboolean uses_device(OpJob *job, GArray *devices)
+{
+	int	i;
+	guint	j;
+
+	for (i = 0; i < job->n_devices; i++)
+		for (j = 0; j < devices->len; j++)
+			if (job->devices[i] == g_array_index(devices, dev_t, j))
+				return TRUE;
+
+	return FALSE;
+}
+
+static void claim_devices(OpJob *job, GArray *devices)
+{
+	g_array_append_vals(devices, job->devices, job->n_devices);
+}
+
+static const gchar *job_state(OpJob *job)
+{
+	if (job->state == JOB_RUNNING)
+		return job->paused ? _("Paused") : _("Running");
+
+	return job->paused ? _("On hold") : _("Waiting");
+}
+
+/* Refill the queue window's list (if open), keeping the selection */
+static void update_window(void)
+{
+	GtkTreeSelection *selection;
+	OpJob		*selected;
+	GList		*next;
+
+	if (!queue_window)
+		return;
+
+	selected = selected_job();
+	selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(queue_view));
+
+	gtk_list_store_clear(queue_store);
+
+	for (next = queue; next; next = next->next)
+	{
+		OpJob		*job = (OpJob *) next->data;
+		GtkTreeIter	iter;
+
+		gtk_list_store_append(queue_store, &iter);
+		gtk_list_store_set(queue_store, &iter,
+				COL_JOB, job,
+				COL_STATE, job_state(job),
+				COL_TITLE, job->title,
+				COL_DETAILS, job->details,
+				-1);
+
+		if (job == selected)
+			gtk_tree_selection_select_iter(selection, &iter);
+	}
+}
+
+static OpJob *selected_job(void)
+{
+	GtkTreeSelection *selection;
+	GtkTreeModel	*model;
+	GtkTreeIter	iter;
+	OpJob		*job = NULL;
+
+	selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(queue_view));
+	if (gtk_tree_selection_get_selected(selection, &model, &iter))
+		gtk_tree_model_get(model, &iter, COL_JOB, &job, -1);
+
+	return job;
+}
+
+/* Swap a waiting job with its neighbour in direction 'dir' (-1 or 1) */
+static void move_job(OpJob *job, int dir)
+{
+	GList	*link, *other;
+
+	if (job->state != JOB_WAITING)
+		return;
+
+	link = g_list_find(queue, job);
+	g_return_if_fail(link != NULL);
+
+	other = dir < 0 ? link->prev : link->next;
+	if (!other)
+		return;
+
+	link->data = other->data;
+	other->data = job;
+
+	queue_changed();
+}
+
+static void queue_response(GtkDialog *dialog, gint response, gpointer data)
+{
+	OpJob	*job;
+
+	if (response != RESPONSE_PAUSE && response != RESPONSE_UP &&
+	    response != RESPONSE_DOWN)
+	{
+		gtk_widget_destroy(GTK_WIDGET(dialog));
+		return;
+	}
+
+	job = selected_job();
+	if (!job)
+		return;
+
+	if (response == RESPONSE_UP)
+		move_job(job, -1);
+	else if (response == RESPONSE_DOWN)
+		move_job(job, 1);
+	else
+	{
+		job->paused = !job->paused;
+		if (job->state == JOB_RUNNING)
+			job->callback(job->paused ? OPJOB_STOP
+						  : OPJOB_CONTINUE,
+				      job->data);
+		queue_changed();
+	}
+}
+
+static void queue_window_destroyed(GtkWidget *widget, gpointer data)
+{
+	g_object_unref(queue_store);
+	queue_store = NULL;
+	queue_view = NULL;
+	queue_window = NULL;
+}
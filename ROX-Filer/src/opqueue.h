@@ -0,0 +1,26 @@
+/*
+ * ROX-Filer, filer for the ROX desktop project
+ * By Thomas Leonard, <tal197@users.sourceforge.net>.
+ */
+
+#ifndef _OPQUEUE_H
+#define _OPQUEUE_H
+
+typedef struct _OpJob OpJob;
+
+typedef enum {
+	OPJOB_START,		/* The job may run now */
+	OPJOB_WAIT,		/* Another job is using the same device */
+	OPJOB_STOP,		/* The user paused the running job */
+	OPJOB_CONTINUE,		/* ... and now wants it to continue */
+} OpJobEvent;
+
+typedef void (*OpJobCallback)(OpJobEvent event, gpointer data);
+
+void opqueue_init(void);
+OpJob *opqueue_add(const gchar *title, GList *paths, const gchar *dest,
+		   OpJobCallback callback, gpointer data);
+void opqueue_job_done(OpJob *job);
+void opqueue_show_window(void);
+
+#endif /* _OPQUEUE_H */
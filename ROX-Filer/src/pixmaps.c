@@ -54,6 +54,7 @@
 #include "options.h"
 #include "action.h"
 #include "type.h"
+#include "remote.h"
 
 GFSCache *pixmap_cache = NULL;
 GFSCache *desktop_icon_cache = NULL;
@@ -308,7 +309,7 @@ void pixmap_background_thumb(const gchar *path, GFunc callback, gpointer data)
 	thumb_prog = thumbnail_program(type);
 
 	/* Only attempt to load 'images' types ourselves */
-	if (thumb_prog == NULL && strcmp(type->media_type, "image") != 0)
+	if (thumb_prog == NULL && type->media_id != MEDIA_IMAGE)
 	{
 		callback(data, NULL);
 		return;		/* Don't know how to handle this type */
@@ -328,6 +329,7 @@ void pixmap_background_thumb(const gchar *path, GFunc callback, gpointer data)
 	{
 		/* We are the child process.  (We are sloppy with freeing
 		 memory, but since we go away very quickly, that's ok.) */
+		remote_drop_socket();
 		if (thumb_prog)
 		{
 			DirItem *item;
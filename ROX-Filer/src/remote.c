@@ -26,6 +26,13 @@
 #include "config.h"
 
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 
 #include <gdk/gdkx.h>
 #include <X11/X.h>
@@ -49,6 +56,7 @@
 #include "display.h"
 #include "xml.h"
 #include "diritem.h"
+#include "dir.h"
 #include "usericons.h"
 
 static GdkAtom filer_atom;	/* _ROX_FILER_EUID_VERSION_HOST */
@@ -66,6 +74,33 @@ struct _SOAP_call {
 
 static GHashTable *rpc_calls = NULL; /* MethodName -> Function */
 
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+/* Sent before the reply, to show that the request will be carried out */
+#define SOCKET_ACK '\006'
+
+static int listen_fd = -1;	/* Our socket, or -1 */
+
+/* The paths given to a list-valued call, grouped by parent directory */
+typedef struct _DirGroup DirGroup;
+
+struct _DirGroup {
+	gchar		*dir;
+	GPtrArray	*leafnames;
+	GArray		*indices;	/* Position of each in the list */
+};
+
+/* A SOAP message arriving on our socket */
+typedef struct _SocketClient SocketClient;
+
+struct _SocketClient {
+	int	fd;
+	GString	*data;		/* The message, then the reply */
+	gsize	sent;		/* Bytes of the reply written so far */
+};
+
 /* Static prototypes */
 static GdkWindow *get_existing_ipc_window(void);
 static gboolean get_ipc_property(GdkWindow *window, Window *r_xid);
@@ -78,6 +113,18 @@ static void soap_done(GtkWidget *widget,
 		      gpointer data);
 static void soap_register(char *name, SOAP_func func, char *req, char *opt);
 static xmlNodePtr soap_invoke(xmlNode *method);
+static gchar *socket_path(gboolean create);
+static void listen_on_socket(void);
+static gboolean socket_accept(GIOChannel *source, GIOCondition cond,
+			      gpointer data);
+static gboolean socket_read(GIOChannel *source, GIOCondition cond,
+			    gpointer data);
+static gboolean socket_write(GIOChannel *source, GIOCondition cond,
+			     gpointer data);
+static void socket_client_free(SocketClient *client);
+static gboolean write_all(int fd, const char *data, int size);
+static GPtrArray *group_by_dir(GList *paths);
+static void free_dir_groups(GPtrArray *groups);
 
 static xmlNodePtr rpc_Version(GList *args);
 static xmlNodePtr rpc_OpenDir(GList *args);
@@ -92,6 +139,8 @@ static xmlNodePtr rpc_Copy(GList *args);
 static xmlNodePtr rpc_Move(GList *args);
 static xmlNodePtr rpc_Link(GList *args);
 static xmlNodePtr rpc_FileType(GList *args);
+static xmlNodePtr rpc_FileTypes(GList *args);
+static xmlNodePtr rpc_ExamineMany(GList *args);
 static xmlNodePtr rpc_Mount(GList *args);
 static xmlNodePtr rpc_Unmount(GList *args);
 
@@ -110,6 +159,113 @@ static xmlNodePtr rpc_UnsetIcon(GList *args);
  ****************************************************************/
 
 
+/* Try to get an already-running filer to handle things by sending the
+ * message to its socket. This doesn't need GTK to be initialised or the
+ * X server to be contacted. TRUE on success; FALSE if no filer is listening
+ * (use remote_init() instead).
+ */
+gboolean remote_send_by_socket(xmlDocPtr rpc)
+{
+	struct sockaddr_un addr;
+	struct timeval	timeout;
+	gchar		*path;
+	xmlChar		*mem;
+	int		size;
+	int		fd;
+	GString		*reply;
+	char		buffer[4096];
+	ssize_t		got;
+
+	path = socket_path(FALSE);
+	if (!path)
+		return FALSE;
+
+	fd = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+	{
+		g_free(path);
+		return FALSE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	g_free(path);
+
+	/* A missing socket or one left behind by a filer that has
+	 * gone away; use X instead.
+	 */
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+	{
+		close(fd);
+		return FALSE;
+	}
+
+	xmlDocDumpMemory(rpc, &mem, &size);
+	if (size <= 0 || !write_all(fd, mem, size))
+	{
+		g_free(mem);
+		close(fd);
+		return FALSE;
+	}
+	g_free(mem);
+	shutdown(fd, SHUT_WR);
+
+	timeout.tv_sec = 10;
+	timeout.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	/* Until the filer acknowledges the message, it may not have been
+	 * delivered (eg, the socket is still open in a child process of a
+	 * filer which has quit), so use X if there's no answer. After that,
+	 * don't fall back to X even if the reply doesn't arrive.
+	 */
+	reply = g_string_new(NULL);
+	while ((got = read(fd, buffer, sizeof(buffer))) != 0)
+	{
+		if (got > 0)
+			g_string_append_len(reply, buffer, got);
+		else if (errno == EINTR)
+			continue;
+		else if (reply->len &&
+			 (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			g_warning("Existing ROX-Filer process is not "
+				  "responding! Try with -n");
+			break;
+		}
+		else
+			break;
+	}
+	close(fd);
+
+	if (reply->len == 0 || reply->str[0] != SOCKET_ACK)
+	{
+		g_string_free(reply, TRUE);
+		return FALSE;
+	}
+	g_string_erase(reply, 0, 1);
+
+	/* If we got a reply, display it here */
+	if (reply->len)
+		puts(reply->str);
+	g_string_free(reply, TRUE);
+
+	return TRUE;
+}
+
+/* Forked children must call this, so that messages can't be sent to the
+ * socket while only they have it open.
+ */
+void remote_drop_socket(void)
+{
+	if (listen_fd == -1)
+		return;
+
+	close(listen_fd);
+	listen_fd = -1;
+}
+
 /* Try to get an already-running filer to handle things (only if
  * new_copy is FALSE); TRUE if we succeed.
  * Create an IPC widget so that future filers can contact us.
@@ -132,6 +288,7 @@ gboolean remote_init(xmlDocPtr rpc, gboolean new_copy)
 			      "Style,Details,Sort,Class,ID,Hidden,Filter");
 	soap_register("CloseDir", rpc_CloseDir, "Filename", NULL);
 	soap_register("Examine", rpc_Examine, "Filename", NULL);
+	soap_register("ExamineMany", rpc_ExamineMany, "Filenames", NULL);
 	soap_register("Show", rpc_Show, "Directory,Leafname", NULL);
 	soap_register("RunURI", rpc_RunURI, "URI", NULL);
 
@@ -139,6 +296,7 @@ gboolean remote_init(xmlDocPtr rpc, gboolean new_copy)
 	soap_register("Panel", rpc_Panel, NULL, "Side,Name");
 
 	soap_register("FileType", rpc_FileType, "Filename", NULL);
+	soap_register("FileTypes", rpc_FileTypes, "Filenames", NULL);
 
 	soap_register("Copy", rpc_Copy, "From,To", "Leafname,Quiet");
 	soap_register("Move", rpc_Move, "From,To", "Leafname,Quiet");
@@ -246,6 +404,9 @@ gboolean remote_init(xmlDocPtr rpc, gboolean new_copy)
 			GDK_PROP_MODE_REPLACE,
 			(void *) &xwindow, 1);
 
+	/* Let future clients reach us without going through X */
+	listen_on_socket();
+
 	return FALSE;
 }
 
@@ -844,6 +1005,28 @@ static xmlNodePtr rpc_Examine(GList *args)
 	return NULL;
 }
 
+static xmlNodePtr rpc_ExamineMany(GList *args)
+{
+	GList	*paths;
+	GPtrArray *groups;
+	int	i;
+
+	paths = list_value(ARG(0));
+	groups = group_by_dir(paths);
+	destroy_glist(&paths);
+
+	for (i = 0; i < groups->len; i++)
+	{
+		DirGroup *group = g_ptr_array_index(groups, i);
+
+		examine_these(group->dir, group->leafnames);
+	}
+
+	free_dir_groups(groups);
+
+	return NULL;
+}
+
 static xmlNodePtr rpc_Show(GList *args)
 {
 	char	   *dir, *leaf;
@@ -1132,6 +1315,56 @@ static xmlNodePtr rpc_FileType(GList *args)
 	return reply;
 }
 
+/* As FileType, but returns a list of types, one for each path */
+static xmlNodePtr rpc_FileTypes(GList *args)
+{
+	GList	*paths;
+	GPtrArray *groups;
+	MIME_type **types;
+	xmlNodePtr reply, result;
+	int	n, i, j;
+
+	paths = list_value(ARG(0));
+	n = g_list_length(paths);
+	groups = group_by_dir(paths);
+	destroy_glist(&paths);
+
+	types = g_new(MIME_type *, n);
+
+	for (i = 0; i < groups->len; i++)
+	{
+		DirGroup *group = g_ptr_array_index(groups, i);
+		MIME_type **found;
+
+		found = g_new(MIME_type *, group->leafnames->len);
+		dir_get_types(group->dir, group->leafnames, found);
+
+		for (j = 0; j < group->indices->len; j++)
+			types[g_array_index(group->indices, int, j)] = found[j];
+		g_free(found);
+	}
+
+	free_dir_groups(groups);
+
+	reply = xmlNewNode(NULL, "rox:FileTypesResponse");
+	xmlNewNs(reply, SOAP_RPC_NS, "soap");
+	result = xmlNewChild(reply, NULL, "soap:result", NULL);
+
+	for (i = 0; i < n; i++)
+	{
+		gchar *tname;
+
+		tname = g_strconcat(types[i]->media_type, "/",
+				    types[i]->subtype, NULL);
+		xmlNewTextChild(result, NULL, "rox:Type", tname);
+		g_free(tname);
+	}
+
+	g_free(types);
+
+	return reply;
+}
+
 static xmlNodePtr rpc_Mount(GList *args)
 {
 	GList *paths;
@@ -1226,6 +1459,332 @@ static void soap_send(GtkWidget *from, GdkAtom prop, GdkWindow *dest)
 	gtk_main();
 }
 
+/* Returns the path of the socket used by filers of this version, run by
+ * this user on this host and display, or NULL if there isn't a suitable
+ * one. The directory is created if 'create' is set. g_free() the result.
+ */
+static gchar *socket_path(gboolean create)
+{
+	struct sockaddr_un addr;
+	const gchar	*display;
+	const gchar	*runtime;
+	gchar		*dir, *leaf, *path, *p;
+	struct stat	info;
+
+	display = gdk_get_display_arg_name();
+	if (!display)
+		display = g_getenv("DISPLAY");
+	if (!display || !*display)
+		return NULL;
+
+	runtime = g_getenv("XDG_RUNTIME_DIR");
+	if (runtime && g_path_is_absolute(runtime))
+		dir = g_strdup(runtime);
+	else
+	{
+		/* Only we may use the directory, since anyone who can
+		 * connect to the socket can ask us to run things.
+		 */
+		dir = g_strdup_printf("%s/rox-filer-%d",
+				g_get_tmp_dir(), (int) euid);
+		if (create)
+			mkdir(dir, 0700);
+		if (lstat(dir, &info) || !S_ISDIR(info.st_mode) ||
+		    info.st_uid != euid || (info.st_mode & 077))
+		{
+			g_free(dir);
+			return NULL;
+		}
+	}
+
+	leaf = g_strdup_printf("rox-filer-%d-%s-%s-%s",
+			(int) euid, VERSION, our_host_name(), display);
+	for (p = leaf; *p; p++)
+		if (*p == '/')
+			*p = '_';
+
+	path = g_strconcat(dir, "/", leaf, NULL);
+	g_free(dir);
+	g_free(leaf);
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		g_free(path);
+		return NULL;
+	}
+
+	return path;
+}
+
+/* Accept SOAP messages on our socket, replacing any existing one */
+static void listen_on_socket(void)
+{
+	struct sockaddr_un addr;
+	GIOChannel	*channel;
+	gchar		*path;
+	mode_t		old_mask;
+	int		fd, bound;
+
+	path = socket_path(TRUE);
+	if (!path)
+		return;
+
+	fd = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+	{
+		g_free(path);
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* The socket must never be usable by anyone else */
+	unlink(path);
+	old_mask = umask(077);
+	bound = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+	umask(old_mask);
+
+	if (bound || listen(fd, 16))
+	{
+		g_warning("Can't listen on '%s': %s", path, g_strerror(errno));
+		close(fd);
+		g_free(path);
+		return;
+	}
+	g_free(path);
+
+	close_on_exec(fd, TRUE);
+	set_blocking(fd, FALSE);
+	listen_fd = fd;
+
+	channel = g_io_channel_unix_new(fd);
+	g_io_add_watch(channel, G_IO_IN, socket_accept, NULL);
+	g_io_channel_unref(channel);
+}
+
+static gboolean socket_accept(GIOChannel *source, GIOCondition cond,
+			      gpointer data)
+{
+	SocketClient	*client;
+	GIOChannel	*channel;
+	int		fd;
+
+	fd = accept(g_io_channel_unix_get_fd(source), NULL, NULL);
+	if (fd == -1)
+		return TRUE;
+
+	close_on_exec(fd, TRUE);
+	set_blocking(fd, FALSE);
+
+	client = g_new(SocketClient, 1);
+	client->fd = fd;
+	client->data = g_string_new(NULL);
+
+	channel = g_io_channel_unix_new(fd);
+	g_io_add_watch(channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+			socket_read, client);
+	g_io_channel_unref(channel);
+
+	return TRUE;
+}
+
+/* Collect the message until the client closes its end, then run it and
+ * send back the reply (if any).
+ */
+static gboolean socket_read(GIOChannel *source, GIOCondition cond,
+			    gpointer data)
+{
+	SocketClient	*client = (SocketClient *) data;
+	char		buffer[4096];
+	char		ack = SOCKET_ACK;
+	ssize_t		got;
+	xmlDocPtr	doc, reply;
+
+	got = read(client->fd, buffer, sizeof(buffer));
+	if (got > 0)
+	{
+		g_string_append_len(client->data, buffer, got);
+		return TRUE;
+	}
+	if (got < 0 && (errno == EAGAIN || errno == EINTR))
+		return TRUE;
+
+	doc = NULL;
+	if (got == 0 && client->data->len)
+		doc = xmlParseMemory(client->data->str, client->data->len);
+
+	/* If the client has given up waiting, it will try X instead */
+	if (doc && !write_all(client->fd, &ack, 1))
+	{
+		xmlFreeDoc(doc);
+		doc = NULL;
+	}
+	else if (doc)
+	{
+		reply = run_soap(doc);
+		xmlFreeDoc(doc);
+
+		if (reply)
+		{
+			xmlChar *mem;
+			int	size;
+
+			xmlDocDumpMemory(reply, &mem, &size);
+			xmlFreeDoc(reply);
+
+			g_string_truncate(client->data, 0);
+			if (size > 0)
+				g_string_append_len(client->data, mem, size);
+			g_free(mem);
+		}
+		else
+			g_string_truncate(client->data, 0);
+
+		/* Send the reply as the client reads it, since a client
+		 * which has been suspended mustn't hold us up.
+		 */
+		if (client->data->len)
+		{
+			GIOChannel *channel;
+
+			client->sent = 0;
+			channel = g_io_channel_unix_new(client->fd);
+			g_io_add_watch(channel, G_IO_OUT | G_IO_HUP | G_IO_ERR,
+					socket_write, client);
+			g_io_channel_unref(channel);
+			return FALSE;
+		}
+	}
+	else if (got == 0 && client->data->len)
+		g_warning("Bad SOAP message received!");
+
+	socket_client_free(client);
+
+	return FALSE;
+}
+
+/* Send more of the reply to the client, as its socket has room */
+static gboolean socket_write(GIOChannel *source, GIOCondition cond,
+			     gpointer data)
+{
+	SocketClient	*client = (SocketClient *) data;
+	ssize_t		sent;
+
+	sent = send(client->fd, client->data->str + client->sent,
+			client->data->len - client->sent, MSG_NOSIGNAL);
+	if (sent < 0 && (errno == EAGAIN || errno == EINTR))
+		return TRUE;
+	if (sent < 0)
+		g_warning("Failed to send SOAP reply!");
+	else
+	{
+		client->sent += sent;
+		if (client->sent < client->data->len)
+			return TRUE;
+	}
+
+	socket_client_free(client);
+
+	return FALSE;
+}
+
+/* Finished with this client (the reply, if any, has been sent) */
+static void socket_client_free(SocketClient *client)
+{
+	close(client->fd);
+	g_string_free(client->data, TRUE);
+	g_free(client);
+
+	if (number_of_windows == 0)
+		gtk_main_quit();
+}
+
+/* Sort the paths of a list-valued call by their parent directories, so
+ * that each directory only has to be looked up once. Returns a list of
+ * DirGroups in the order each directory was first seen.
+ * free_dir_groups() the result.
+ */
+static GPtrArray *group_by_dir(GList *paths)
+{
+	GHashTable *dirs;
+	GPtrArray *groups;
+	GList	*next;
+	int	i = 0;
+
+	dirs = g_hash_table_new(g_str_hash, g_str_equal);
+	groups = g_ptr_array_new();
+
+	for (next = paths; next; next = next->next, i++)
+	{
+		const gchar *path = next->data;
+		DirGroup *group;
+		gchar	*dir;
+
+		dir = g_path_get_dirname(path);
+		group = g_hash_table_lookup(dirs, dir);
+		if (group)
+			g_free(dir);
+		else
+		{
+			group = g_new(DirGroup, 1);
+			group->dir = dir;
+			group->leafnames = g_ptr_array_new();
+			group->indices = g_array_new(FALSE, FALSE, sizeof(int));
+			g_hash_table_insert(dirs, dir, group);
+			g_ptr_array_add(groups, group);
+		}
+
+		g_ptr_array_add(group->leafnames, g_strdup(g_basename(path)));
+		g_array_append_val(group->indices, i);
+	}
+
+	g_hash_table_destroy(dirs);
+
+	return groups;
+}
+
+static void free_dir_groups(GPtrArray *groups)
+{
+	int	i, j;
+
+	for (i = 0; i < groups->len; i++)
+	{
+		DirGroup *group = g_ptr_array_index(groups, i);
+
+		for (j = 0; j < group->leafnames->len; j++)
+			g_free(g_ptr_array_index(group->leafnames, j));
+		g_ptr_array_free(group->leafnames, TRUE);
+		g_array_free(group->indices, TRUE);
+		g_free(group->dir);
+		g_free(group);
+	}
+
+	g_ptr_array_free(groups, TRUE);
+}
+
+/* Write all of 'data' to 'fd'. FALSE on error. */
+static gboolean write_all(int fd, const char *data, int size)
+{
+	while (size > 0)
+	{
+		ssize_t sent;
+
+		sent = send(fd, data, size, MSG_NOSIGNAL);
+		if (sent < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		data += sent;
+		size -= sent;
+	}
+
+	return TRUE;
+}
+
 /* Lookup this method in rpc_calls and invoke it.
  * Returns the SOAP reply or fault, or NULL if this method
  * doesn't return anything.
@@ -6,6 +6,8 @@
 #ifndef _REMOTE_H
 #define _REMOTE_H
 
+gboolean remote_send_by_socket(xmlDocPtr rpc);
+void remote_drop_socket(void);
 gboolean remote_init(xmlDocPtr rpc, gboolean new_copy);
 xmlDocPtr run_soap(xmlDocPtr soap);
 
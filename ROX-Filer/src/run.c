@@ -456,6 +456,60 @@ void examine(const guchar *path)
 	}
 }
 
+/* As examine(), for each of 'leafnames' inside 'dir_path'. Used for
+ * ExamineMany, so that the directory is only looked up once.
+ */
+void examine_these(const guchar *dir_path, GPtrArray *leafnames)
+{
+	GPtrArray *found;
+	GPtrArray *subdirs;
+	int	i;
+
+	found = g_ptr_array_new();
+	subdirs = g_ptr_array_new();
+
+	for (i = 0; i < leafnames->len; i++)
+	{
+		gchar	*leaf = g_ptr_array_index(leafnames, i);
+		gchar	*path;
+		struct stat info;
+
+		path = g_build_filename(dir_path, leaf, NULL);
+
+		if (mc_stat(path, &info) != 0)
+		{
+			/* Deleted? Do a paranoid update of everything... */
+			filer_check_mounted(path);
+			g_free(path);
+			continue;
+		}
+
+		g_ptr_array_add(found, leaf);
+
+		/* If it's on the pinboard or a panel, update the icon... */
+		icons_may_update(path);
+
+		if (S_ISDIR(info.st_mode))
+			g_ptr_array_add(subdirs, path);
+		else
+			g_free(path);
+	}
+
+	/* Update directory containing these items... */
+	if (found->len)
+		dir_check_these(dir_path, found);
+
+	/* Rescan the contents of any that are directories... */
+	for (i = 0; i < subdirs->len; i++)
+	{
+		refresh_dirs(g_ptr_array_index(subdirs, i));
+		g_free(g_ptr_array_index(subdirs, i));
+	}
+
+	g_ptr_array_free(found, TRUE);
+	g_ptr_array_free(subdirs, TRUE);
+}
+
 /****************************************************************
  *			INTERNAL FUNCTIONS			*
  ****************************************************************/
@@ -20,6 +20,7 @@ gboolean run_diritem(const guchar *full_path,
 		     gboolean edit);
 void open_to_show(const guchar *path);
 void examine(const guchar *path);
+void examine_these(const guchar *dir_path, GPtrArray *leafnames);
 void show_help_files(const char *dir);
 void run_with_args(const char *path, DirItem *item, const char *args);
 
@@ -59,8 +59,6 @@ struct _Tool {
 Option o_toolbar, o_toolbar_info, o_toolbar_disable;
 Option o_toolbar_min_width;
 
-static FilerWindow *filer_window_being_counted;
-
 /* TRUE if the button presses (or released) should open a new window,
  * rather than reusing the existing one.
  */
@@ -107,7 +105,6 @@ static void handle_drops(FilerWindow *filer_window,
 static void toggle_selected(GtkToggleButton *widget, gpointer data);
 static void option_notify(void);
 static GList *build_tool_options(Option *option, xmlNode *node, guchar *label);
-static void tally_items(gpointer key, gpointer value, gpointer data);
 
 static Tool all_tools[] = {
 	{N_("Close"), GTK_STOCK_CLOSE, N_("Close filer window"),
@@ -207,22 +204,18 @@ void toolbar_update_info(FilerWindow *filer_window)
 			return;
 		}
 
+		n_items = view_count_items(view);
+
 		if (!(filer_window->show_hidden ||
 		      filer_window->temp_show_hidden) ||
 		    filer_window->filter!=FILER_SHOW_ALL)
 		{
-			GHashTable *hash = filer_window->directory->known_items;
-			int	   tally = 0;
-
-			filer_window_being_counted=filer_window;
-			g_hash_table_foreach(hash, tally_items, &tally);
+			int tally = filer_window->n_hidden;
 
-			if (tally)
+			if (tally > 0)
 				s = g_strdup_printf(_(" (%u hidden)"), tally);
 		}
 
-		n_items = view_count_items(view);
-
 		if (n_items)
 			label = g_strdup_printf("%d %s%s",
 					n_items,
@@ -235,21 +228,9 @@ void toolbar_update_info(FilerWindow *filer_window)
 	}
 	else
 	{
-		double	size = 0;
-		ViewIter iter;
-		DirItem *item;
-
-		view_get_iter(filer_window->view, &iter, VIEW_ITER_SELECTED);
-
-		while ((item = iter.next(&iter)))
-		{
-			if (item->base_type != TYPE_DIRECTORY &&
-			    item->base_type != TYPE_UNKNOWN)
-				size += (double) item->size;
-		}
-
 		label = g_strdup_printf(_("%u selected (%s)"),
-				n_selected, format_double_size(size));
+				n_selected,
+				format_double_size(view_selected_size(view)));
 	}
 
 	gtk_label_set_text(GTK_LABEL(filer_window->toolbar_text), label);
@@ -765,15 +746,6 @@ static void handle_drops(FilerWindow *filer_window,
 	g_object_set_data(G_OBJECT(button), "toolbar_dest", (gpointer) dest);
 }
 
-static void tally_items(gpointer key, gpointer value, gpointer data)
-{
-	DirItem *item = (DirItem *) value;
-	int     *tally = (int *) data;
-
-	if (!filer_match_filter(filer_window_being_counted, item))
-		(*tally)++;
-}
-
 static void option_notify(void)
 {
 	int		i;
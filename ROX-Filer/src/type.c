@@ -30,6 +30,7 @@
 #include <fnmatch.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #ifdef WITH_GNOMEVFS
 # include <libgnomevfs/gnome-vfs.h>
@@ -58,6 +59,11 @@
 #include "dropbox.h"
 #include "xdgmime.h"
 #include "xtypes.h"
+#include "dir.h"
+
+#ifdef USE_INOTIFY
+# include <sys/inotify.h>
+#endif
 #include "run.h"
 
 #define TYPE_NS "http://www.freedesktop.org/standards/shared-mime-info"
@@ -89,15 +95,36 @@ static void alloc_type_colours(void);
 static void options_changed(void);
 static char *get_action_save_path(GtkWidget *dialog);
 static MIME_type *get_mime_type(const gchar *type_name, gboolean can_create);
+static int intern_media_type(const char *media, int len);
 static gboolean remove_handler_with_confirm(const guchar *path);
 static void set_icon_theme(void);
 static GList *build_icon_theme(Option *option, xmlNode *node, guchar *label);
+static char **get_xdg_data_dirs(int *n_dirs);
+static void init_mime_database(void);
+static void forget_icons(void);
+static void icon_theme_changed(GtkIconTheme *theme, gpointer data);
+static char *find_handler(MIME_type *type);
+static void forget_handlers(void);
+#ifdef USE_INOTIFY
+static void watch_choices_dirs(const char *dir, GHashTable *watched);
+static void watch_choices_parents(void);
+#endif
 
 /* Hash of all allocated MIME types, indexed by "media/subtype".
  * MIME_type structs are never freed; this table prevents memory leaks
  * when rereading the config files.
  */
 static GHashTable *type_hash = NULL;
+static int n_types = 0;
+
+/* Each distinct media type string is stored once. media_ids[name] is one
+ * more than the media_id, and media_names[media_id] is the string.
+ */
+static GHashTable *media_ids = NULL;
+static GPtrArray *media_names = NULL;
+
+/* Whether each type's sort_rank is uptodate (new types clear this) */
+static gboolean ranks_valid = FALSE;
 
 /* Most things on Unix are text files, so this is the default type */
 MIME_type *text_plain;
@@ -121,13 +148,89 @@ static GtkIconTheme *icon_theme = NULL;
 static GtkIconTheme *rox_theme = NULL;
 static GtkIconTheme *gnome_theme = NULL;
 
+/* A type's image is only valid while its image_generation matches this.
+ * Bumped whenever something that affects the choice of icon changes.
+ */
+static int icon_generation = 1;
+static guint icons_update_timeout = 0;
+
+/* TRUE if every MIME-icons directory, and every place where one could be
+ * created, is being watched. If not, images are looked up again after a
+ * couple of seconds, in case something else changed them.
+ */
+static gboolean icons_watched = FALSE;
+
+/* The result of find_handler() for each type, indexed by type->id. NULL if
+ * not looked up yet, or no_handler if there isn't one. Only used while the
+ * MIME-types directories, and the places where they may be created, are
+ * being watched.
+ */
+static GPtrArray *handlers = NULL;
+static char no_handler[] = "";
+
+#ifdef USE_INOTIFY
+/* Watches on the <datadir>/mime directories, so that we reload the MIME
+ * database when it changes instead of having xdgmime poll it, and on the
+ * MIME-icons and MIME-types directories, so that we notice icons and run
+ * actions being set or removed.
+ */
+static int mime_notify_fd = -1;
+static GHashTable *mime_notify_dirs = NULL;	/* wd -> data dir with mime/ */
+static GHashTable *mime_notify_parents = NULL;	/* wd -> data dir without mime/ */
+static GHashTable *icon_notify_dirs = NULL;	/* wd -> MIME-icons dir */
+static GHashTable *handler_notify_dirs = NULL;	/* wd -> MIME-types dir */
+/* wd -> Choices directory where MIME-icons or MIME-types may be created
+ * (or an XDG directory where the Choices directory may be created).
+ */
+static GHashTable *choices_notify_parents = NULL;
+static gboolean choices_all_watched = FALSE;
+static guint mime_reread_timeout = 0;
+#endif
+
 void type_init(void)
 {
 	int	    i;
 
 	icon_theme = gtk_icon_theme_new();
+	g_signal_connect(icon_theme, "changed",
+			 G_CALLBACK(icon_theme_changed), NULL);
+
+	type_init_database();
+
+	option_add_string(&o_icon_theme, "icon_theme", "ROX");
+	option_add_int(&o_display_colour_types, "display_colour_types", TRUE);
+	option_register_widget("icon-theme-chooser", build_icon_theme);
 	
+	for (i = 0; i < NUM_TYPE_COLOURS; i++)
+		option_add_string(&o_type_colours[i],
+				  opt_type_colours[i][0],
+				  opt_type_colours[i][1]);
+	alloc_type_colours();
+
+	set_icon_theme();
+
+	option_add_notify(options_changed);
+}
+
+/* Just the part of type_init() needed to find types, for use without GTK
+ * (see type_get_type_headless()). type_init() calls this itself.
+ */
+void type_init_database(void)
+{
+	if (type_hash)
+		return;
+
 	type_hash = g_hash_table_new(g_str_hash, g_str_equal);
+	media_ids = g_hash_table_new(g_str_hash, g_str_equal);
+	media_names = g_ptr_array_new();
+
+	/* Must match the MEDIA_* ids */
+	intern_media_type("text", 4);
+	intern_media_type("inode", 5);
+	intern_media_type("application", 11);
+	intern_media_type("image", 5);
+
+	init_mime_database();
 
 	text_plain = get_mime_type("text/plain", TRUE);
 	inode_directory = get_mime_type("inode/directory", TRUE);
@@ -143,20 +246,6 @@ void type_init(void)
 	application_x_desktop->executable = TRUE;
 	inode_unknown = get_mime_type("inode/unknown", TRUE);
 	inode_door = get_mime_type("inode/door", TRUE);
-
-	option_add_string(&o_icon_theme, "icon_theme", "ROX");
-	option_add_int(&o_display_colour_types, "display_colour_types", TRUE);
-	option_register_widget("icon-theme-chooser", build_icon_theme);
-	
-	for (i = 0; i < NUM_TYPE_COLOURS; i++)
-		option_add_string(&o_type_colours[i],
-				  opt_type_colours[i][0],
-				  opt_type_colours[i][1]);
-	alloc_type_colours();
-
-	set_icon_theme();
-
-	option_add_notify(options_changed);
 }
 
 /* Read-load all the glob patterns.
@@ -165,10 +254,25 @@ void type_init(void)
 void reread_mime_files(void)
 {
 	gtk_icon_theme_rescan_if_needed(icon_theme);
+	forget_icons();
+
+#ifdef USE_INOTIFY
+	/* Setting an icon may have created a new MIME-icons directory */
+	if (mime_notify_fd != -1)
+		watch_choices_dirs("MIME-icons", icon_notify_dirs);
+#endif
+	forget_handlers();
 
 	xdg_mime_shutdown();
 
 	filer_update_all();
+
+	/* That's done anything a pending update would have done */
+	if (icons_update_timeout)
+	{
+		g_source_remove(icons_update_timeout);
+		icons_update_timeout = 0;
+	}
 }
 
 /* Returns the MIME_type structure for the given type name. It is looked
@@ -195,8 +299,12 @@ static MIME_type *get_mime_type(const gchar *type_name, gboolean can_create)
 	}
 
 	mtype = g_new(MIME_type, 1);
-	mtype->media_type = g_strndup(type_name, slash - type_name);
+	mtype->media_id = intern_media_type(type_name, slash - type_name);
+	mtype->media_type = g_ptr_array_index(media_names, mtype->media_id);
 	mtype->subtype = g_strdup(slash + 1);
+	mtype->id = n_types++;
+	mtype->sort_rank = 0;
+	ranks_valid = FALSE;
 	mtype->image = NULL;
 	mtype->comment = NULL;
 
@@ -208,6 +316,74 @@ static MIME_type *get_mime_type(const gchar *type_name, gboolean can_create)
 	return mtype;
 }
 
+/* Returns the media_id for the first 'len' bytes of 'media', giving it a
+ * new one if it hasn't been seen before.
+ */
+static int intern_media_type(const char *media, int len)
+{
+	gchar *name;
+	gpointer id;
+
+	name = g_strndup(media, len);
+	id = g_hash_table_lookup(media_ids, name);
+	if (id)
+	{
+		g_free(name);
+		return GPOINTER_TO_INT(id) - 1;
+	}
+
+	g_ptr_array_add(media_names, name);
+	g_hash_table_insert(media_ids, name,
+			    GINT_TO_POINTER(media_names->len));
+
+	return media_names->len - 1;
+}
+
+static int sort_types(const void *a, const void *b)
+{
+	const MIME_type *ta = *(MIME_type **) a;
+	const MIME_type *tb = *(MIME_type **) b;
+	int diff;
+
+	diff = strcmp(ta->media_type, tb->media_type);
+	if (!diff)
+		diff = strcmp(ta->subtype, tb->subtype);
+
+	return diff;
+}
+
+static void add_type_to_array(gpointer key, gpointer value, gpointer data)
+{
+	g_ptr_array_add((GPtrArray *) data, value);
+}
+
+/* Compare two types by name (media type first, then subtype), without
+ * looking at the strings. New types are ranked on the next call after they
+ * are created.
+ */
+int mime_type_compare(MIME_type *a, MIME_type *b)
+{
+	if (a == b)
+		return 0;
+
+	if (!ranks_valid)
+	{
+		GPtrArray *types;
+		guint i;
+
+		types = g_ptr_array_sized_new(n_types);
+		g_hash_table_foreach(type_hash, add_type_to_array, types);
+		qsort(types->pdata, types->len, sizeof(gpointer), sort_types);
+		for (i = 0; i < types->len; i++)
+			((MIME_type *) types->pdata[i])->sort_rank = i;
+		g_ptr_array_free(types, TRUE);
+
+		ranks_valid = TRUE;
+	}
+
+	return a->sort_rank < b->sort_rank ? -1 : 1;
+}
+
 const char *basetype_name(DirItem *item)
 {
 	if (item->flags & ITEM_FLAG_SYMLINK)
@@ -295,6 +471,59 @@ MIME_type *type_get_type(const guchar *path)
 	return type;
 }
 
+/* As type_get_type(), but doesn't look for icons or use the list of mounted
+ * filesystems, so only type_init_database() is needed. Mount points are
+ * reported as plain directories.
+ */
+MIME_type *type_get_type_headless(const guchar *path)
+{
+	struct stat	info;
+	MIME_type	*type;
+	guchar		*link_path = NULL;
+	const char	*leaf;
+
+	/* If we can't stat it, go by the name as type_get_type() does */
+	if (mc_lstat(path, &info))
+		info.st_mode = 0;
+	else if (S_ISLNK(info.st_mode))
+	{
+		if (mc_stat(path, &info))
+			info.st_mode = 0;	/* Broken link */
+		else
+			link_path = pathdup(path);
+	}
+
+	if (info.st_mode && !S_ISREG(info.st_mode))
+		return mime_type_from_base_type(
+				mode_to_base_type(info.st_mode));
+
+	type = type_from_path(link_path ? link_path : path);
+	g_free(link_path);
+
+	leaf = strrchr(path, '/');
+	leaf = leaf ? leaf + 1 : (const char *) path;
+
+	return type_adjust_for_mode(type, leaf, info.st_mode);
+}
+
+/* Apply the rules that depend on a regular file's mode as well as its name
+ * and contents. 'type' is the type from type_from_path() (may be NULL) and
+ * 'mode' is the mode of the target, for symlinks.
+ */
+MIME_type *type_adjust_for_mode(MIME_type *type, const char *leafname,
+				mode_t mode)
+{
+	if (mode & (S_IXUSR | S_IXGRP | S_IXOTH))
+	{
+		if (type == NULL || type == application_octet_stream)
+			type = application_executable;
+		else if (type == text_plain && !strchr(leafname, '.'))
+			type = application_x_shellscript;
+	}
+
+	return type ? type : text_plain;
+}
+
 /* Returns a pointer to the MIME-type.
  *
  * Tries all enabled methods:
@@ -307,14 +536,23 @@ MIME_type *type_get_type(const guchar *path)
 MIME_type *type_from_path(const char *path)
 {
 	MIME_type *mime_type = NULL;
-	const char *type_name;
 
 	/* Check for extended attribute first */
 	mime_type = xtype_get(path);
 	if (mime_type)
 		return mime_type;
 
-	/* Try name and contents next */
+	return type_from_file(path);
+}
+
+/* As type_from_path(), but without checking the extended attribute (for
+ * callers which already know there isn't one).
+ */
+MIME_type *type_from_file(const char *path)
+{
+	const char *type_name;
+
+	/* Try name and contents */
 	type_name = xdg_mime_get_mime_type_for_file(path, NULL);
 	if (type_name)
 		return get_mime_type(type_name, TRUE);
@@ -322,10 +560,66 @@ MIME_type *type_from_path(const char *path)
 	return NULL;
 }
 
+/* As type_from_file(), but never opens the file. If the name doesn't give
+ * a single type then *need_sniff is set, and the result is only a guess
+ * (possibly NULL); type_from_file() will check the contents.
+ */
+MIME_type *type_from_name(const char *path, gboolean *need_sniff)
+{
+	const char *type_names[5];
+	int n;
+
+	*need_sniff = FALSE;
+
+	/* type_from_file() doesn't check these at all */
+	if (!g_utf8_validate(path, -1, NULL))
+		return NULL;
+
+	n = xdg_mime_get_mime_types_from_file_name(g_basename(path),
+						   type_names, 5);
+	if (n != 1)
+		*need_sniff = TRUE;
+	if (n >= 1)
+		return get_mime_type(type_names[0], TRUE);
+
+	return NULL;
+}
+
 /* Returns the file/dir in Choices for handling this type.
  * NULL if there isn't one. g_free() the result.
  */
 char *handler_for(MIME_type *type)
+{
+	char *handler;
+
+#ifdef USE_INOTIFY
+	/* Only safe if we'd see any new MIME-types directory appear */
+	if (handler_notify_dirs && choices_all_watched)
+	{
+		if ((guint) type->id < handlers->len)
+		{
+			handler = g_ptr_array_index(handlers, type->id);
+			if (handler == no_handler)
+				return NULL;
+			if (handler)
+				return g_strdup(handler);
+		}
+		else
+			g_ptr_array_set_size(handlers, type->id + 1);
+
+		handler = find_handler(type);
+		g_ptr_array_index(handlers, type->id) =
+			handler ? g_strdup(handler) : no_handler;
+
+		return handler;
+	}
+#endif
+
+	return find_handler(type);
+}
+
+/* Look up the handler for handler_for(), without using the cache */
+static char *find_handler(MIME_type *type)
 {
 	char	*type_name;
 	char	*open;
@@ -374,6 +668,32 @@ char *handler_for(MIME_type *type)
 	}
 }
 
+/* The MIME-types directories have changed (or may have). Look up each
+ * type's handler again next time.
+ */
+static void forget_handlers(void)
+{
+	guint i;
+
+	if (!handlers)
+		return;
+
+	for (i = 0; i < handlers->len; i++)
+	{
+		char *handler = g_ptr_array_index(handlers, i);
+
+		if (handler != no_handler)
+			g_free(handler);
+	}
+	g_ptr_array_set_size(handlers, 0);
+
+#ifdef USE_INOTIFY
+	/* Setting a run action may have created a new MIME-types directory */
+	if (handler_notify_dirs)
+		watch_choices_dirs("MIME-types", handler_notify_dirs);
+#endif
+}
+
 MIME_type *mime_type_lookup(const char *type)
 {
 	return get_mime_type(type, TRUE);
@@ -385,6 +705,8 @@ static void init_aux_theme(GtkIconTheme **ptheme, const char *name)
 		return;
 	*ptheme = gtk_icon_theme_new();
 	gtk_icon_theme_set_custom_theme(*ptheme, name);
+	g_signal_connect(*ptheme, "changed",
+			 G_CALLBACK(icon_theme_changed), NULL);
 }
 
 inline static void init_rox_theme(void)
@@ -453,7 +775,6 @@ MaskedPixmap *type_to_icon(MIME_type *type)
 {
 	GtkIconInfo *full;
 	char	*type_name, *path;
-	time_t	now;
 
 	if (type == NULL)
 	{
@@ -461,12 +782,14 @@ MaskedPixmap *type_to_icon(MIME_type *type)
 		return im_unknown;
 	}
 
-	now = time(NULL);
 	/* Already got an image? */
 	if (type->image)
 	{
-		/* Yes - don't recheck too often */
-		if (abs(now - type->image_time) < 2)
+		/* Yes - keep it until the icons change (or for a couple of
+		 * seconds, if we can't tell when that happens).
+		 */
+		if (type->image_generation == icon_generation &&
+		    (icons_watched || abs(time(NULL) - type->image_time) < 2))
 		{
 			g_object_ref(type->image);
 			return type->image;
@@ -529,7 +852,9 @@ out:
 		g_object_ref(im_unknown);
 	}
 
-	type->image_time = now;
+	type->image_generation = icon_generation;
+	if (!icons_watched)
+		type->image_time = time(NULL);
 	
 	g_object_ref(type->image);
 	return type->image;
@@ -607,6 +932,7 @@ static gboolean set_shell_action(GtkWidget *dialog)
 
 	if (error)
 		report_error(g_strerror(error));
+	forget_handlers();
 
 	g_free(tmp);
 	g_free(path);
@@ -726,6 +1052,7 @@ static void drag_app_dropped(GtkWidget	*drop_box,
 						g_strerror(errno));
 			else
 				destroy_on_idle(dialog);
+			forget_handlers();
 
 			g_free(path);
 		}
@@ -971,6 +1298,7 @@ static gboolean remove_handler_with_confirm(const guchar *path)
 				path, g_strerror(errno));
 			return FALSE;
 		}
+		forget_handlers();
 	}
 
 	return TRUE;
@@ -1118,11 +1446,35 @@ static void alloc_type_colours(void)
 	}
 }
 
-static void expire_timer(gpointer key, gpointer value, gpointer data)
+/* Make type_to_icon() look each type's icon up again next time */
+static void forget_icons(void)
+{
+	icon_generation++;
+}
+
+static gboolean icons_update(gpointer data)
+{
+	icons_update_timeout = 0;
+	forget_icons();
+	filer_update_all();
+
+	return FALSE;
+}
+
+/* Something changed that may affect the icons. Redisplay everything once
+ * things have settled down.
+ */
+static void queue_icons_update(void)
 {
-	MIME_type *type = value;
+	if (!icons_update_timeout)
+		icons_update_timeout = g_timeout_add(1000, icons_update, NULL);
+}
 
-	type->image_time = 0;
+/* GTK noticed the theme's directories change, or the theme was replaced */
+static void icon_theme_changed(GtkIconTheme *theme, gpointer data)
+{
+	forget_icons();
+	queue_icons_update();
 }
 
 static void options_changed(void)
@@ -1131,8 +1483,7 @@ static void options_changed(void)
 	if (o_icon_theme.has_changed)
 	{
 		set_icon_theme();
-		g_hash_table_foreach(type_hash, expire_timer, NULL);
-		full_refresh();
+		full_refresh();		/* Also forgets the old icons */
 	}
 }
 
@@ -1181,6 +1532,308 @@ static char **get_xdg_data_dirs(int *n_dirs)
 	return dirs;
 }
 
+#ifdef USE_INOTIFY
+static gboolean reread_mime_timeout(gpointer data)
+{
+	mime_reread_timeout = 0;
+	reread_mime_files();
+
+	return FALSE;
+}
+
+/* The files xdgmime reads from a mime directory */
+static gboolean is_mime_database_file(const char *leaf)
+{
+	return strcmp(leaf, "mime.cache") == 0 ||
+	       strcmp(leaf, "globs2") == 0 ||
+	       strcmp(leaf, "globs") == 0 ||
+	       strcmp(leaf, "magic") == 0 ||
+	       strcmp(leaf, "aliases") == 0 ||
+	       strcmp(leaf, "subclasses") == 0;
+}
+
+/* Watch data_dir/mime, or data_dir itself (to see mime/ being created) if
+ * there isn't one yet. FALSE if neither can be watched.
+ */
+static gboolean watch_mime_dir(const char *data_dir)
+{
+	gchar *path;
+	int wd;
+
+	path = g_build_filename(data_dir, "mime", NULL);
+	wd = inotify_add_watch(mime_notify_fd, path,
+			IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVE |
+			IN_DELETE_SELF | IN_MOVE_SELF);
+	g_free(path);
+
+	if (wd != -1)
+		g_hash_table_insert(mime_notify_dirs, GINT_TO_POINTER(wd),
+				    g_strdup(data_dir));
+	else
+	{
+		wd = inotify_add_watch(mime_notify_fd, data_dir,
+				       IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+		if (wd != -1)
+			g_hash_table_insert(mime_notify_parents,
+					    GINT_TO_POINTER(wd),
+					    g_strdup(data_dir));
+	}
+
+	return wd != -1;
+}
+
+/* Watch each existing Choices directory called 'dir', recording the watches
+ * in 'watched'. Watching a directory twice just gives back the existing
+ * watch.
+ */
+static void watch_choices_dirs(const char *dir, GHashTable *watched)
+{
+	GPtrArray *dirs;
+	guint i;
+
+	dirs = choices_list_xdg_dirs((char *) dir, SITE);
+	g_return_if_fail(dirs != NULL);
+
+	for (i = 0; i < dirs->len; i++)
+	{
+		gchar *path = g_ptr_array_index(dirs, i);
+		int wd;
+
+		wd = inotify_add_watch(mime_notify_fd, path,
+				IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+				IN_MOVE | IN_DELETE_SELF | IN_MOVE_SELF);
+		if (wd != -1)
+			g_hash_table_insert(watched, GINT_TO_POINTER(wd),
+					    g_strdup(path));
+	}
+
+	choices_free_list(dirs);
+}
+
+/* Watch each Choices directory for MIME-icons or MIME-types directories
+ * being created in it. Where the Choices directory doesn't exist, watch
+ * its parent for it being created instead. Sets choices_all_watched.
+ */
+static void watch_choices_parents(void)
+{
+	GPtrArray *sites, *roots;
+	guint i;
+
+	sites = choices_list_all_xdg_dirs(NULL, SITE);
+	roots = choices_list_all_xdg_dirs(NULL, NULL);
+	g_return_if_fail(sites != NULL && roots != NULL);
+
+	choices_all_watched = TRUE;
+	for (i = 0; i < sites->len; i++)
+	{
+		gchar *path = g_ptr_array_index(sites, i);
+		int wd;
+
+		wd = inotify_add_watch(mime_notify_fd, path,
+				       IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+		if (wd == -1)
+		{
+			path = g_ptr_array_index(roots, i);
+			wd = inotify_add_watch(mime_notify_fd, path,
+					IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+		}
+
+		if (wd != -1)
+			g_hash_table_insert(choices_notify_parents,
+					    GINT_TO_POINTER(wd),
+					    g_strdup(path));
+		else
+			choices_all_watched = FALSE;
+	}
+
+	choices_free_list(sites);
+	choices_free_list(roots);
+
+	icons_watched = choices_all_watched;
+}
+
+/* Something was created in a directory in choices_notify_parents */
+static void choices_parent_changed(const struct inotify_event *event)
+{
+	gboolean new_site;
+
+	if (event->mask & IN_IGNORED)
+	{
+		/* Watch its parent instead */
+		g_hash_table_remove(choices_notify_parents,
+				    GINT_TO_POINTER(event->wd));
+		watch_choices_parents();
+		forget_handlers();
+		return;
+	}
+
+	if (event->len == 0)
+		return;
+
+	new_site = strcmp(event->name, SITE) == 0;
+	if (new_site)
+		watch_choices_parents();
+
+	if (new_site || strcmp(event->name, "MIME-icons") == 0)
+	{
+		watch_choices_dirs("MIME-icons", icon_notify_dirs);
+		queue_icons_update();
+	}
+
+	/* (this watches the new MIME-types directory too) */
+	if (new_site || strcmp(event->name, "MIME-types") == 0)
+		forget_handlers();
+}
+
+static gboolean mime_dir_changed(GIOChannel *source, GIOCondition condition,
+				 gpointer data)
+{
+	char buf[sizeof(struct inotify_event) + 1024];
+	gboolean changed = FALSE;
+	int len, i = 0;
+
+	len = read(mime_notify_fd, buf, sizeof(buf));
+	if (len < 0)
+	{
+		if (errno != EINTR)
+			perror("read");
+		return TRUE;
+	}
+
+	while (i < len)
+	{
+		struct inotify_event *event = (struct inotify_event *) (buf + i);
+		const char *parent, *data_dir;
+
+		parent = g_hash_table_lookup(mime_notify_parents,
+					     GINT_TO_POINTER(event->wd));
+		data_dir = g_hash_table_lookup(mime_notify_dirs,
+					       GINT_TO_POINTER(event->wd));
+		if (g_hash_table_lookup(icon_notify_dirs,
+					GINT_TO_POINTER(event->wd)))
+		{
+			if (event->len == 0 ||
+			    g_str_has_suffix(event->name, ".png"))
+				queue_icons_update();
+			if (event->mask & IN_IGNORED)
+				g_hash_table_remove(icon_notify_dirs,
+						GINT_TO_POINTER(event->wd));
+		}
+		else if (g_hash_table_lookup(handler_notify_dirs,
+					     GINT_TO_POINTER(event->wd)))
+		{
+			if (event->mask & IN_IGNORED)
+				g_hash_table_remove(handler_notify_dirs,
+						GINT_TO_POINTER(event->wd));
+			forget_handlers();
+		}
+		else if (g_hash_table_lookup(choices_notify_parents,
+					     GINT_TO_POINTER(event->wd)))
+			choices_parent_changed(event);
+		else if (parent)
+		{
+			if (event->len && strcmp(event->name, "mime") == 0)
+			{
+				watch_mime_dir(parent);
+				changed = TRUE;
+			}
+		}
+		else if (data_dir && (event->mask & IN_IGNORED))
+		{
+			/* mime/ has been deleted or moved (or unmounted).
+			 * Watch for it coming back.
+			 */
+			gchar *dir = g_strdup(data_dir);
+
+			g_hash_table_remove(mime_notify_dirs,
+					    GINT_TO_POINTER(event->wd));
+			/* (back to xdgmime's default if we can't) */
+			if (!watch_mime_dir(dir))
+				xdg_mime_set_check_interval(5);
+			g_free(dir);
+			changed = TRUE;
+		}
+		else if (event->len == 0 || is_mime_database_file(event->name))
+			changed = TRUE;
+
+		i += sizeof(*event) + event->len;
+	}
+
+	/* update-mime-database rewrites several files; wait for it to finish */
+	if (changed && !mime_reread_timeout)
+		mime_reread_timeout = g_timeout_add(1000, reread_mime_timeout,
+						    NULL);
+
+	return TRUE;
+}
+#endif
+
+/* Let xdgmime keep a compiled copy of the database in our cache directory
+ * (used if the system hasn't got a mime.cache), and watch for changes to
+ * the database rather than having xdgmime poll it.
+ */
+static void init_mime_database(void)
+{
+	gchar *dir;
+
+	dir = g_build_filename(g_get_user_cache_dir(), SITE, PROJECT, NULL);
+	if (g_mkdir_with_parents(dir, 0700) == 0)
+	{
+		gchar *cache;
+
+		cache = g_build_filename(dir, "mime.cache", NULL);
+		xdg_mime_set_private_cache(cache);
+		g_free(cache);
+	}
+	g_free(dir);
+
+#ifdef USE_INOTIFY
+	{
+		GIOChannel *channel;
+		gboolean all_watched = TRUE;
+		char **dirs;
+		int i, n_dirs = 0;
+
+		mime_notify_fd = inotify_init();
+		if (mime_notify_fd == -1)
+			return;
+		mime_notify_dirs = g_hash_table_new_full(NULL, NULL,
+							 NULL, g_free);
+		mime_notify_parents = g_hash_table_new_full(NULL, NULL,
+							    NULL, g_free);
+		icon_notify_dirs = g_hash_table_new_full(NULL, NULL,
+							 NULL, g_free);
+		handler_notify_dirs = g_hash_table_new_full(NULL, NULL,
+							    NULL, g_free);
+		choices_notify_parents = g_hash_table_new_full(NULL, NULL,
+							       NULL, g_free);
+		handlers = g_ptr_array_new();
+
+		dirs = get_xdg_data_dirs(&n_dirs);
+		g_return_if_fail(dirs != NULL);
+		for (i = 0; i < n_dirs; i++)
+		{
+			if (dirs[i][0] && !watch_mime_dir(dirs[i]))
+				all_watched = FALSE;
+			g_free(dirs[i]);
+		}
+		g_free(dirs);
+
+		watch_choices_parents();
+		watch_choices_dirs("MIME-icons", icon_notify_dirs);
+		watch_choices_dirs("MIME-types", handler_notify_dirs);
+
+		channel = g_io_channel_unix_new(mime_notify_fd);
+		g_io_add_watch(channel, G_IO_IN, mime_dir_changed, NULL);
+		g_io_channel_unref(channel);
+
+		/* Directories we can't watch still need polling */
+		if (all_watched)
+			xdg_mime_set_check_interval(0);
+	}
+#endif
+}
+
 /* Try to fill in 'type->comment' from this document */
 static void get_comment(MIME_type *type, const guchar *path)
 {
@@ -1280,7 +1933,11 @@ static void set_icon_theme(void)
 	else
 	{
 		if (icon_theme == rox_theme || icon_theme == gnome_theme)
+		{
 			icon_theme = gtk_icon_theme_new();
+			g_signal_connect(icon_theme, "changed",
+					 G_CALLBACK(icon_theme_changed), NULL);
+		}
 		gtk_icon_theme_set_custom_theme(icon_theme, theme_name);
 	}
 
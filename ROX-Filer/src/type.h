@@ -8,6 +8,14 @@
 
 #include <gtk/gtk.h>
 
+/* Media types interned by type_init(), so these are their media_ids */
+enum {
+	MEDIA_TEXT,
+	MEDIA_INODE,
+	MEDIA_APPLICATION,
+	MEDIA_IMAGE,
+};
+
 extern MIME_type *text_plain;		/* Often used as a default type */
 extern MIME_type *inode_directory;
 extern MIME_type *inode_mountpoint;
@@ -24,9 +32,13 @@ extern MIME_type *application_x_desktop;
 
 struct _MIME_type
 {
-	char		*media_type;
+	char		*media_type;	/* Shared by all types with this media */
 	char		*subtype;
+	int		id;		/* 0, 1, 2... in order of creation */
+	int		media_id;	/* Same for types with equal media_type */
+	int		sort_rank;	/* Private: use mime_type_compare() */
 	MaskedPixmap 	*image;		/* NULL => not loaded yet */
+	int		image_generation; /* icon_generation when loaded */
 	time_t		image_time;	/* When we loaded the image */
 
 	/* Private: use mime_type_comment() instead */
@@ -36,10 +48,16 @@ struct _MIME_type
 
 /* Prototypes */
 void type_init(void);
+void type_init_database(void);
 const char *basetype_name(DirItem *item);
 MIME_type *type_get_type(const guchar *path);
+MIME_type *type_get_type_headless(const guchar *path);
+MIME_type *type_adjust_for_mode(MIME_type *type, const char *leafname,
+				mode_t mode);
 
 MIME_type *type_from_path(const char *path);
+MIME_type *type_from_file(const char *path);
+MIME_type *type_from_name(const char *path, gboolean *need_sniff);
 MaskedPixmap *type_to_icon(MIME_type *type);
 GdkAtom type_to_atom(MIME_type *type);
 MIME_type *mime_type_from_base_type(int base_type);
@@ -51,6 +69,7 @@ GdkColor *type_get_colour(DirItem *item, GdkColor *normal);
 void reread_mime_files(void);
 extern const char *mime_type_comment(MIME_type *type);
 extern MIME_type *mime_type_lookup(const char *type);
+int mime_type_compare(MIME_type *a, MIME_type *b);
 extern GList *mime_type_name_list(gboolean only_regular);
 char *handler_for(MIME_type *type);
 
@@ -47,6 +47,9 @@
 
 #define MIN_ITEM_WIDTH 64
 
+/* Keep layouts for at least this many items, even if fewer are visible */
+#define MIN_POOLED_LAYOUTS 512
+
 static gpointer parent_class = NULL;
 
 struct _ViewCollectionClass {
@@ -60,6 +63,15 @@ struct _ViewCollection {
 	FilerWindow *filer_window;	/* Used for styles, etc */
 
 	int	cursor_base;		/* Cursor when minibuffer opened */
+
+	/* Selection colour the cached tiles were drawn with */
+	GtkStateType	tile_selection_state;
+
+	/* ViewData structs which currently have PangoLayouts.
+	 * See ensure_layouts().
+	 */
+	GPtrArray	*layout_pool;
+	guint		layout_clock;
 };
 
 typedef struct _Template Template;
@@ -79,6 +91,7 @@ static void view_collection_class_init(gpointer gclass, gpointer data);
 static void view_collection_init(GTypeInstance *object, gpointer gclass);
 
 static void draw_item(GtkWidget *widget,
+			GdkDrawable *drawable,
 			CollectionItem *item,
 			GdkRectangle *area,
 			gpointer user_data);
@@ -102,6 +115,7 @@ static gboolean test_point(Collection *collection,
 				int width, int height,
 				gpointer user_data);
 static void draw_string(GtkWidget *widget,
+		GdkDrawable *drawable,
 		PangoLayout *layout,
 		GdkRectangle *area,	/* Area available on screen */
 		int 	width,		/* Width of the full string */
@@ -118,11 +132,15 @@ static gint coll_button_press(GtkWidget *widget,
 			      GdkEventButton *event,
 			      ViewCollection *view_collection);
 static void size_allocate(GtkWidget *w, GtkAllocation *a, gpointer data);
+static gint coll_expose(GtkWidget *widget,
+			GdkEventExpose *event,
+			ViewCollection *view_collection);
 static void style_set(Collection 	*collection,
 		      GtkStyle		*style,
 		      ViewCollection	*view_collection);
 static void display_free_colitem(Collection *collection,
 				 CollectionItem *colitem);
+static double weigh_colitem(Collection *collection, CollectionItem *colitem);
 static void lost_selection(Collection  *collection,
 			   guint        time,
 			   gpointer     user_data);
@@ -134,6 +152,11 @@ static void calc_size(FilerWindow *filer_window, CollectionItem *colitem,
 static void make_iter(ViewCollection *view_collection, ViewIter *iter,
 		      IterFlags flags);
 static void make_item_iter(ViewCollection *vc, ViewIter *iter, int i);
+static void ensure_layouts(ViewCollection *view_collection,
+			   CollectionItem *colitem);
+static gint by_last_drawn(gconstpointer a, gconstpointer b);
+static void trim_layout_pool(ViewCollection *view_collection);
+static void done_measuring(CollectionItem *colitem);
 
 static void view_collection_sort(ViewIface *view);
 static void view_collection_style_changed(ViewIface *view, int flags);
@@ -147,9 +170,12 @@ static void view_collection_select_all(ViewIface *view);
 static void view_collection_clear_selection(ViewIface *view);
 static int view_collection_count_items(ViewIface *view);
 static int view_collection_count_selected(ViewIface *view);
+static double view_collection_selected_size(ViewIface *view);
 static void view_collection_show_cursor(ViewIface *view);
 static void view_collection_get_iter(ViewIface *view,
 				     ViewIter *iter, IterFlags flags);
+static void view_collection_get_iter_at_index(ViewIface *view, ViewIter *iter,
+					      int i);
 static void view_collection_get_iter_at_point(ViewIface *view, ViewIter *iter,
 					      GdkWindow *src, int x, int y);
 static void view_collection_cursor_to_iter(ViewIface *view, ViewIter *iter);
@@ -184,6 +210,7 @@ GtkWidget *view_collection_new(FilerWindow *filer_window)
 
 	view_collection = g_object_new(view_collection_get_type(), NULL);
 	view_collection->filer_window = filer_window;
+	view_collection->tile_selection_state = filer_window->selection_state;
 
 	/* Starting with GTK+-2.2.2, the vadjustment is reset after init
 	 * (even though it's already set during init) to a new adjustment.
@@ -240,7 +267,9 @@ static void view_collection_destroy(GtkObject *view_collection)
 
 static void view_collection_finialize(GObject *object)
 {
-	/* ViewCollection *view_collection = (ViewCollection *) object; */
+	ViewCollection *view_collection = (ViewCollection *) object;
+
+	g_ptr_array_free(view_collection->layout_pool, TRUE);
 
 	G_OBJECT_CLASS(parent_class)->finalize(object);
 }
@@ -271,6 +300,9 @@ static void view_collection_init(GTypeInstance *object, gpointer gclass)
 	GtkWidget *collection;
 	GtkAdjustment *adj;
 
+	view_collection->layout_pool = g_ptr_array_new();
+	view_collection->layout_clock = 0;
+
 	collection = collection_new();
 	view_collection->collection = COLLECTION(collection);
 
@@ -286,6 +318,7 @@ static void view_collection_init(GTypeInstance *object, gpointer gclass)
 			GTK_RESIZE_IMMEDIATE);
 
 	view_collection->collection->free_item = display_free_colitem;
+	view_collection->collection->weigh_item = weigh_colitem;
 	view_collection->collection->draw_item = draw_item;
 	view_collection->collection->test_point = test_point;
 	view_collection->collection->cb_user_data = view_collection;
@@ -307,6 +340,8 @@ static void view_collection_init(GTypeInstance *object, gpointer gclass)
 			G_CALLBACK(coll_motion_notify), view_collection);
 	g_signal_connect(viewport, "size-allocate",
 			G_CALLBACK(size_allocate), view_collection);
+	g_signal_connect(collection, "expose-event",
+			G_CALLBACK(coll_expose), view_collection);
 
 	gtk_widget_set_events(collection,
 			GDK_BUTTON1_MOTION_MASK | GDK_BUTTON2_MOTION_MASK |
@@ -316,6 +351,7 @@ static void view_collection_init(GTypeInstance *object, gpointer gclass)
 
 
 static void draw_item(GtkWidget *widget,
+			GdkDrawable *drawable,
 			CollectionItem *colitem,
 			GdkRectangle *area,
 			gpointer user_data)
@@ -331,6 +367,8 @@ static void draw_item(GtkWidget *widget,
 
 	g_return_if_fail(view != NULL);
 
+	ensure_layouts(view_collection, colitem);
+
 	if (selected)
 		selection_state = filer_window->selection_state;
 	else
@@ -350,28 +388,28 @@ static void draw_item(GtkWidget *widget,
 	if (template.icon.width <= SMALL_WIDTH &&
 			template.icon.height <= SMALL_HEIGHT)
 	{
-		draw_small_icon(widget->window, widget->style, &template.icon,
+		draw_small_icon(drawable, widget->style, &template.icon,
 				item, view->image, selected, color);
 	}
 	else if (template.icon.width <= ICON_WIDTH &&
 			template.icon.height <= ICON_HEIGHT)
 	{
-		draw_large_icon(widget->window, widget->style, &template.icon,
+		draw_large_icon(drawable, widget->style, &template.icon,
 				item, view->image, selected, color);
 	}
 	else
 	{
-		draw_huge_icon(widget->window, widget->style, &template.icon,
+		draw_huge_icon(drawable, widget->style, &template.icon,
 				item, view->image, selected, color);
 	}
 	
-	draw_string(widget, view->layout,
+	draw_string(widget, drawable, view->layout,
 			&template.leafname,
 			view->name_width,
 			selection_state,
 			TRUE);
 	if (view->details)
-		draw_string(widget, view->details,
+		draw_string(widget, drawable, view->details,
 				&template.details,
 				template.details.width,
 				selection_state,
@@ -385,10 +423,10 @@ static void draw_item(GtkWidget *widget,
 static void fill_template(GdkRectangle *area, CollectionItem *colitem,
 			ViewCollection *view_collection, Template *template)
 {
-	DisplayStyle	style = view_collection->filer_window->display_style;
-	ViewData 	*view = (ViewData *) colitem->view_data;
+	FilerWindow	*filer_window = view_collection->filer_window;
+	DisplayStyle	style = filer_window->display_style;
 
-	if (view->details)
+	if (filer_window->details_type != DETAILS_NONE)
 	{
 		template->details.width = view->details_width;
 		template->details.height = view->details_height;
@@ -613,7 +651,6 @@ static gboolean test_point(Collection *collection,
 {
 	Template	template;
 	GdkRectangle	area;
-	ViewData	*view = (ViewData *) colitem->view_data;
 	ViewCollection	*view_collection = (ViewCollection *) user_data;
 
 	area.x = 0;
@@ -625,11 +662,13 @@ static gboolean test_point(Collection *collection,
 
 	return INSIDE(point_x, point_y, template.leafname) ||
 	       INSIDE(point_x, point_y, template.icon) ||
-	       (view->details && INSIDE(point_x, point_y, template.details));
+	       (view_collection->filer_window->details_type != DETAILS_NONE &&
+		INSIDE(point_x, point_y, template.details));
 }
 
 /* 'box' renders a background box if the string is also selected */
 static void draw_string(GtkWidget *widget,
+		GdkDrawable *drawable,
 		PangoLayout *layout,
 		GdkRectangle *area,	/* Area available on screen */
 		int 	width,		/* Width of the full string */
@@ -641,7 +680,7 @@ static void draw_string(GtkWidget *widget,
 			: widget->style->text_gc[selection_state];
 	
 	if (selection_state != GTK_STATE_NORMAL && box)
-		gtk_paint_flat_box(widget->style, widget->window, 
+		gtk_paint_flat_box(widget->style, drawable,
 				selection_state, GTK_SHADOW_NONE,
 				NULL, widget, "text",
 				area->x, area->y,
@@ -654,7 +693,7 @@ static void draw_string(GtkWidget *widget,
 		gdk_gc_set_clip_rectangle(gc, area);
 	}
 
-	gdk_draw_layout(widget->window, gc, area->x, area->y, layout);
+	gdk_draw_layout(drawable, gc, area->x, area->y, layout);
 
 	if (width > area->width)
 	{
@@ -671,7 +710,7 @@ static void draw_string(GtkWidget *widget,
 					&red, 1, FALSE, TRUE, &success);
 			gdk_gc_set_foreground(red_gc, &red);
 		}
-		gdk_draw_rectangle(widget->window, red_gc, TRUE,
+		gdk_draw_rectangle(drawable, red_gc, TRUE,
 				area->x + area->width - 1, area->y,
 				1, area->height);
 		gdk_gc_set_clip_rectangle(gc, NULL);
@@ -696,8 +735,10 @@ static void view_collection_iface_init(gpointer giface, gpointer iface_data)
 	iface->clear_selection = view_collection_clear_selection;
 	iface->count_items = view_collection_count_items;
 	iface->count_selected = view_collection_count_selected;
+	iface->selected_size = view_collection_selected_size;
 	iface->show_cursor = view_collection_show_cursor;
 	iface->get_iter = view_collection_get_iter;
+	iface->get_iter_at_index = view_collection_get_iter_at_index;
 	iface->get_iter_at_point = view_collection_get_iter_at_point;
 	iface->cursor_to_iter = view_collection_cursor_to_iter;
 	iface->set_selected = view_collection_set_selected;
@@ -825,6 +866,11 @@ static void selection_changed(Collection *collection,
 	filer_selection_changed(view_collection->filer_window, time);
 }
 
+static double weigh_colitem(Collection *collection, CollectionItem *colitem)
+{
+	return view_item_weight((DirItem *) colitem->data);
+}
+
 static void display_free_colitem(Collection *collection,
 				 CollectionItem *colitem)
 {
@@ -833,13 +879,17 @@ static void display_free_colitem(Collection *collection,
 	if (!view)
 		return;
 
-	if (view->layout)
+	if (view->pool_index >= 0)
 	{
-		g_object_unref(G_OBJECT(view->layout));
-		view->layout = NULL;
+		ViewCollection *view_collection = collection->cb_user_data;
+		GPtrArray *pool = view_collection->layout_pool;
+		ViewData *last = pool->pdata[pool->len - 1];
+
+		last->pool_index = view->pool_index;
+		g_ptr_array_remove_index_fast(pool, view->pool_index);
 	}
-	if (view->details)
-		g_object_unref(G_OBJECT(view->details));
+
+	display_drop_layouts(view);
 
 	if (view->image)
 		g_object_unref(view->image);
@@ -859,6 +909,7 @@ static void add_item(ViewCollection *view_collection, DirItem *item)
 				display_create_viewdata(filer_window, item));
 
 	calc_size(filer_window, &collection->items[i], &w, &h); 
+	done_measuring(&collection->items[i]);
 
 	if (w > old_w || h > old_h)
 		collection_set_item_size(collection,
@@ -866,6 +917,88 @@ static void add_item(ViewCollection *view_collection, DirItem *item)
 					 MAX(old_h, h));
 }
 
+/* Items only keep their PangoLayouts while they are in the view's pool
+ * (ie, they've been drawn recently). Make sure this item has them before
+ * drawing it.
+ */
+static void ensure_layouts(ViewCollection *view_collection,
+			   CollectionItem *colitem)
+{
+	ViewData *view = (ViewData *) colitem->view_data;
+
+	view->last_drawn = ++view_collection->layout_clock;
+
+	if (view->pool_index >= 0)
+		return;
+
+	display_update_layouts(view_collection->filer_window,
+			       (DirItem *) colitem->data, view);
+
+	view->pool_index = view_collection->layout_pool->len;
+	g_ptr_array_add(view_collection->layout_pool, view);
+
+	trim_layout_pool(view_collection);
+}
+
+static gint by_last_drawn(gconstpointer a, gconstpointer b)
+{
+	const ViewData *va = *((ViewData **) a);
+	const ViewData *vb = *((ViewData **) b);
+
+	/* Most recent first */
+	return va->last_drawn < vb->last_drawn ? 1
+	     : va->last_drawn > vb->last_drawn ? -1 : 0;
+}
+
+/* If too many items have layouts, free the layouts of the ones that were
+ * drawn least recently. We keep enough for several screens, so scrolling
+ * back and forth doesn't recreate them.
+ */
+static void trim_layout_pool(ViewCollection *view_collection)
+{
+	Collection *collection = view_collection->collection;
+	GPtrArray *pool = view_collection->layout_pool;
+	int	page, visible, limit, keep, i;
+
+	if (collection->vadj)
+		page = collection->vadj->page_size;
+	else
+		page = GTK_WIDGET(collection)->allocation.height;
+	visible = (page / collection->item_height + 2) * collection->columns;
+	limit = MAX(MIN_POOLED_LAYOUTS, visible * 4);
+
+	if (pool->len <= limit)
+		return;
+
+	/* Trim to below the limit so that we don't do this for every item */
+	keep = limit * 3 / 4;
+
+	g_ptr_array_sort(pool, by_last_drawn);
+
+	for (i = keep; i < pool->len; i++)
+	{
+		ViewData *view = pool->pdata[i];
+
+		display_drop_layouts(view);
+		view->pool_index = -1;
+	}
+	g_ptr_array_set_size(pool, keep);
+
+	for (i = 0; i < keep; i++)
+		((ViewData *) pool->pdata[i])->pool_index = i;
+}
+
+/* display_update_view() creates the layouts in order to measure them. Drop
+ * them again unless the item is in the pool.
+ */
+static void done_measuring(CollectionItem *colitem)
+{
+	ViewData *view = (ViewData *) colitem->view_data;
+
+	if (view->pool_index < 0)
+		display_drop_layouts(view);
+}
+
 static void style_set(Collection 	*collection,
 		      GtkStyle		*style,
 		      ViewCollection	*view_collection)
@@ -874,6 +1007,25 @@ static void style_set(Collection 	*collection,
 			VIEW_UPDATE_VIEWDATA | VIEW_UPDATE_NAME);
 }
 
+/* Runs before the Collection's own expose handler. Selected items are drawn
+ * using the window's selection colour, so the cached tiles are no good once
+ * that changes.
+ */
+static gint coll_expose(GtkWidget *widget,
+			GdkEventExpose *event,
+			ViewCollection *view_collection)
+{
+	GtkStateType state = view_collection->filer_window->selection_state;
+
+	if (state != view_collection->tile_selection_state)
+	{
+		collection_discard_tiles(view_collection->collection);
+		view_collection->tile_selection_state = state;
+	}
+
+	return FALSE;
+}
+
 /* Return the size needed for this item */
 static void calc_size(FilerWindow *filer_window, CollectionItem *colitem,
 		int *width, int *height)
@@ -963,12 +1115,13 @@ static void update_item(ViewCollection *view_collection, int i)
 			FALSE);
 	
 	calc_size(filer_window, colitem, &w, &h); 
+	done_measuring(colitem);
 	if (w > old_w || h > old_h)
 		collection_set_item_size(collection,
 					 MAX(old_w, w),
 					 MAX(old_h, h));
 
-	collection_draw_item(collection, i, TRUE);
+	collection_item_changed(collection, i);
 }
 
 /* Implementations of the View interface. See view_iface.c for comments. */
@@ -1013,12 +1166,14 @@ static void view_collection_style_changed(ViewIface *view, int flags)
 					(flags & VIEW_UPDATE_NAME) != 0);
 
 		calc_size(filer_window, ci, &w, &h);
+		done_measuring(ci);
 		if (w > width)
 			width = w;
 		if (h > height)
 			height = h;
 	}
 
+	collection_discard_tiles(col);
 	collection_set_item_size(col, width, height);
 	
 	gtk_widget_queue_draw(GTK_WIDGET(view_collection));
@@ -1047,9 +1202,23 @@ static void view_collection_sort(ViewIface *view)
 {
 	ViewCollection	*view_collection = VIEW_COLLECTION(view);
 	FilerWindow	*filer_window = view_collection->filer_window;
+	Collection	*collection = view_collection->collection;
+	int		i, n = collection->number_of_items;
+	DirItem		**items;
+	guint		*order;
+
+	if (n < 2)
+		return;
 
-	collection_qsort(view_collection->collection, sort_fn(filer_window),
-			filer_window->sort_order);
+	items = g_new(DirItem *, n);
+	for (i = 0; i < n; i++)
+		items[i] = (DirItem *) collection->items[i].data;
+
+	order = display_sort_order(filer_window, items, n);
+	collection_reorder(collection, order);
+
+	g_free(order);
+	g_free(items);
 }
 
 static void view_collection_add_items(ViewIface *view, GPtrArray *items)
@@ -1070,8 +1239,12 @@ static void view_collection_add_items(ViewIface *view, GPtrArray *items)
 		add_item(view_collection, item);
 	}
 
-	if (old_num != collection->number_of_items)
+	if (old_num == 0)
 		view_collection_sort(view);
+	else if (old_num != collection->number_of_items)
+		collection_merge_tail(collection, old_num,
+				      sort_fn(filer_window),
+				      filer_window->sort_order);
 }
 
 static void view_collection_update_items(ViewIface *view, GPtrArray *items)
@@ -1080,14 +1253,20 @@ static void view_collection_update_items(ViewIface *view, GPtrArray *items)
 	Collection	*collection = view_collection->collection;
 	FilerWindow	*filer_window = view_collection->filer_window;
 	int		i;
+	GHashTable	*changed;
+	gboolean	reweigh = FALSE;
 
 	g_return_if_fail(items->len > 0);
 	
-	/* The item data has already been modified, so this gives the
-	 * final sort order...
+	/* The item data has already been modified, so only these items
+	 * may be out of place now...
 	 */
-	collection_qsort(collection, sort_fn(filer_window),
-			 filer_window->sort_order);
+	changed = g_hash_table_new(NULL, NULL);
+	for (i = 0; i < items->len; i++)
+		g_hash_table_insert(changed, items->pdata[i], items->pdata[i]);
+	collection_resort_items(collection, changed, sort_fn(filer_window),
+				filer_window->sort_order);
+	g_hash_table_destroy(changed);
 
 	for (i = 0; i < items->len; i++)
 	{
@@ -1105,8 +1284,16 @@ static void view_collection_update_items(ViewIface *view, GPtrArray *items)
 		if (j < 0)
 			g_warning("Failed to find '%s'\n", leafname);
 		else
+		{
+			if (collection->items[j].selected)
+				reweigh = TRUE;
 			update_item(view_collection, j);
+		}
 	}
+
+	/* A selected item may have changed size */
+	if (reweigh)
+		collection_reweigh_selection(collection);
 }
 
 static void view_collection_delete_if(ViewIface *view,
@@ -1159,6 +1346,13 @@ static int view_collection_count_selected(ViewIface *view)
 	return collection->number_selected;
 }
 
+static double view_collection_selected_size(ViewIface *view)
+{
+	ViewCollection	*view_collection = VIEW_COLLECTION(view);
+	
+	return view_collection->collection->selected_weight;
+}
+
 static void view_collection_show_cursor(ViewIface *view)
 {
 	ViewCollection	*view_collection = VIEW_COLLECTION(view);
@@ -1342,6 +1536,12 @@ static void view_collection_get_iter(ViewIface *view,
 	make_iter(view_collection, iter, flags);
 }
 
+static void view_collection_get_iter_at_index(ViewIface *view, ViewIter *iter,
+					      int i)
+{
+	make_item_iter(VIEW_COLLECTION(view), iter, i);
+}
+
 static void view_collection_get_iter_at_point(ViewIface *view, ViewIter *iter,
 					      GdkWindow *src, int x, int y)
 {
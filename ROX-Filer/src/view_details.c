@@ -21,6 +21,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
 
@@ -56,6 +58,18 @@
 #define COL_VIEW_ITEM 10
 #define N_COLUMNS 11
 
+/* Adding or removing at least this many rows, and at least a quarter of the
+ * list, is done with the model detached from the view. GtkTreeView does
+ * O(n) work for each row_inserted or row_deleted signal, so it's much
+ * quicker to let it rebuild its tree once.
+ */
+#define BULK_MIN_ROWS 256
+
+/* The strings in ViewItem->cells */
+#define CELL_SIZE 0
+#define CELL_PERM 1
+#define CELL_MTIME 2
+
 static gpointer parent_class = NULL;
 
 struct _ViewDetailsClass {
@@ -81,9 +95,12 @@ static void view_details_select_all(ViewIface *view);
 static void view_details_clear_selection(ViewIface *view);
 static int view_details_count_items(ViewIface *view);
 static int view_details_count_selected(ViewIface *view);
+static double view_details_selected_size(ViewIface *view);
 static void view_details_show_cursor(ViewIface *view);
 static void view_details_get_iter(ViewIface *view,
 				     ViewIter *iter, IterFlags flags);
+static void view_details_get_iter_at_index(ViewIface *view, ViewIter *iter,
+					   int i);
 static void view_details_get_iter_at_point(ViewIface *view, ViewIter *iter,
 					   GdkWindow *src, int x, int y);
 static void view_details_cursor_to_iter(ViewIface *view, ViewIter *iter);
@@ -130,6 +147,18 @@ static void view_details_sortable_init(GtkTreeSortableIface *iface);
 static void set_selected(ViewDetails *view_details, int i, gboolean selected);
 static gboolean get_selected(ViewDetails *view_details, int i);
 static void free_view_item(ViewItem *view_item);
+static void sync_selection(ViewDetails *view_details, gboolean selected);
+static void mark_selected(ViewDetails *view_details, ViewItem *view_item,
+			  gboolean selected);
+static void reweigh_selection(ViewDetails *view_details);
+static gboolean is_bulk_change(ViewDetails *view_details, int n_changed,
+			       int n_total);
+static void detach_model(ViewDetails *view_details,
+			 ViewItem **cursor, ViewItem **top);
+static int find_view_item(ViewDetails *view_details, ViewItem *view_item);
+static void reattach_model(ViewDetails *view_details,
+			   ViewItem *cursor, ViewItem *top);
+static const gchar *get_cell(ViewDetails *view_details, int i, int cell);
 static void details_update_header_visibility(ViewDetails *view_details);
 static void set_lasso(ViewDetails *view_details, int x, int y);
 static void cancel_wink(ViewDetails *view_details);
@@ -355,23 +384,20 @@ static void details_get_value(GtkTreeModel *tree_model,
 			g_value_set_string(value, group_name(item->gid));
 			break;
 		case COL_MTIME:
-		{
-			gchar *time;
-			time = pretty_time(&item->mtime);
 			g_value_init(value, G_TYPE_STRING);
-			g_value_set_string(value, time);
-			g_free(time);
+			g_value_set_string(value,
+					get_cell(view_details, i, CELL_MTIME));
 			break;
-		}
 		case COL_PERM:
 			g_value_init(value, G_TYPE_STRING);
-			g_value_set_string(value, pretty_permissions(m));
+			g_value_set_string(value,
+					get_cell(view_details, i, CELL_PERM));
 			break;
 		case COL_SIZE:
 			g_value_init(value, G_TYPE_STRING);
 			if (item->base_type != TYPE_DIRECTORY)
 				g_value_set_string(value,
-						   format_size(item->size));
+					get_cell(view_details, i, CELL_SIZE));
 			break;
 		case COL_TYPE:
 			g_value_init(value, G_TYPE_STRING);
@@ -1029,6 +1055,8 @@ static void view_details_init(GTypeInstance *object, gpointer gclass)
 	view_details->desired_size.width = -1;
 	view_details->desired_size.height = -1;
 	view_details->can_change_selection = 0;
+	view_details->n_selected = 0;
+	view_details->selected_size = 0;
 	view_details->lasso_box = FALSE;
 
 	view_details->selection = gtk_tree_view_get_selection(treeview);
@@ -1097,8 +1125,10 @@ static void view_details_iface_init(gpointer giface, gpointer iface_data)
 	iface->clear_selection = view_details_clear_selection;
 	iface->count_items = view_details_count_items;
 	iface->count_selected = view_details_count_selected;
+	iface->selected_size = view_details_selected_size;
 	iface->show_cursor = view_details_show_cursor;
 	iface->get_iter = view_details_get_iter;
+	iface->get_iter_at_index = view_details_get_iter_at_index;
 	iface->get_iter_at_point = view_details_get_iter_at_point;
 	iface->cursor_to_iter = view_details_cursor_to_iter;
 	iface->set_selected = view_details_set_selected;
@@ -1139,6 +1169,7 @@ static void view_details_style_changed(ViewIface *view, int flags)
 			g_object_unref(G_OBJECT(item->image));
 			item->image = NULL;
 		}
+		null_g_free(&item->cells);	/* (options may have changed) */
 		gtk_tree_model_row_changed(model, path, &iter);
 		gtk_tree_path_next(path);
 	}
@@ -1163,20 +1194,8 @@ static gint wrap_sort(gconstpointer a, gconstpointer b,
 		return -view_details->sort_fn(ia->item, ib->item);
 }
 
-static void resort(ViewDetails *view_details)
+static void set_sort_fn(ViewDetails *view_details)
 {
-	ViewItem **items = (ViewItem **) view_details->items->pdata;
-	gint i, len = view_details->items->len;
-	guint *new_order;
-	GtkTreePath *path;
-	int wink_item = view_details->wink_item;
-
-	if (!len)
-		return;
-
-	for (i = len - 1; i >= 0; i--)
-		items[i]->old_pos = i;
-
 	switch (view_details->filer_window->sort_type)
 	{
 		case SORT_NAME: view_details->sort_fn = sort_by_name; break;
@@ -1188,28 +1207,122 @@ static void resort(ViewDetails *view_details)
 		default:
 			g_assert_not_reached();
 	}
-	
-	g_ptr_array_sort_with_data(view_details->items,
-				   (GCompareDataFunc) wrap_sort,
-				   view_details);
+}
+
+/* The items have been rearranged, and each one's old_pos says where it
+ * used to be. Tell GTK about it (if anything actually moved).
+ */
+static void reordered(ViewDetails *view_details)
+{
+	ViewItem **items = (ViewItem **) view_details->items->pdata;
+	gint i, len = view_details->items->len;
+	guint *new_order;
+	GtkTreePath *path;
+	int wink_item = view_details->wink_item;
+	gboolean moved = FALSE;
 
 	new_order = g_new(guint, len);
 	for (i = len - 1; i >= 0; i--)
 	{
 		new_order[i] = items[i]->old_pos;
+		if (new_order[i] != i)
+			moved = TRUE;
 		if (wink_item == items[i]->old_pos)
 			wink_item = i;
 	}
 
 	view_details->wink_item = wink_item;
 
-	path = gtk_tree_path_new();
-	gtk_tree_model_rows_reordered((GtkTreeModel *) view_details,
-					path, NULL, new_order);
-	gtk_tree_path_free(path);
+	if (moved)
+	{
+		path = gtk_tree_path_new();
+		gtk_tree_model_rows_reordered((GtkTreeModel *) view_details,
+						path, NULL, new_order);
+		gtk_tree_path_free(path);
+	}
 	g_free(new_order);
 }
 
+/* Put items[first..] in order (using packed keys; see display_sort_order).
+ * Doesn't touch old_pos.
+ */
+static void sort_range(ViewDetails *view_details, guint first)
+{
+	ViewItem **items = (ViewItem **) view_details->items->pdata;
+	guint i, n = view_details->items->len - first;
+	ViewItem **copy;
+	DirItem **dir_items;
+	guint *order;
+
+	if (n < 2)
+		return;
+
+	copy = g_memdup(items + first, n * sizeof(*items));
+	dir_items = g_new(DirItem *, n);
+	for (i = 0; i < n; i++)
+		dir_items[i] = copy[i]->item;
+
+	order = display_sort_order(view_details->filer_window, dir_items, n);
+	for (i = 0; i < n; i++)
+		items[first + i] = copy[order[i]];
+
+	g_free(order);
+	g_free(dir_items);
+	g_free(copy);
+}
+
+static void resort(ViewDetails *view_details)
+{
+	ViewItem **items = (ViewItem **) view_details->items->pdata;
+	gint i, len = view_details->items->len;
+
+	if (!len)
+		return;
+
+	for (i = len - 1; i >= 0; i--)
+		items[i]->old_pos = i;
+
+	set_sort_fn(view_details);
+	sort_range(view_details, 0);
+
+	reordered(view_details);
+}
+
+/* Items before 'n_sorted' are in order, but the rest aren't. Sort just
+ * the rest, and then merge the two runs together in a single pass.
+ */
+static void merge_tail(ViewDetails *view_details, guint n_sorted)
+{
+	ViewItem **items = (ViewItem **) view_details->items->pdata;
+	guint len = view_details->items->len;
+	ViewItem **tail;
+	gint i, j, out;
+
+	if (n_sorted >= len)
+		return;
+
+	set_sort_fn(view_details);
+
+	sort_range(view_details, n_sorted);
+	tail = g_memdup(items + n_sorted, (len - n_sorted) * sizeof(*items));
+
+	/* Fill in from the end, taking the larger of the two runs' last
+	 * items each time. Existing items go before equal new ones.
+	 */
+	i = n_sorted - 1;
+	j = len - n_sorted - 1;
+	out = len - 1;
+	while (j >= 0)
+	{
+		if (i >= 0 && wrap_sort(&items[i], &tail[j], view_details) > 0)
+			items[out--] = items[i--];
+		else
+			items[out--] = tail[j--];
+	}
+
+	g_free(tail);
+}
+
 static void view_details_sort(ViewIface *view)
 {
 	resort((ViewDetails *) view);
@@ -1222,12 +1335,14 @@ static void view_details_add_items(ViewIface *view, GPtrArray *new_items)
 	FilerWindow *filer_window = view_details->filer_window;
 	GPtrArray *items = view_details->items;
 	GtkTreeIter iter;
-	int i;
-	GtkTreePath *path;
+	int i, n_sorted = items->len;
+	int wink_item = view_details->wink_item;
 	GtkTreeModel *model = (GtkTreeModel *) view;
+	ViewItem *cursor = NULL, *top = NULL;
+	gboolean bulk;
 
-	iter.user_data = GINT_TO_POINTER(items->len);
-	path = details_get_path(model, &iter);
+	for (i = 0; i < n_sorted; i++)
+		((ViewItem *) items->pdata[i])->old_pos = i;
 
 	for (i = 0; i < new_items->len; i++)
 	{
@@ -1254,17 +1369,49 @@ static void view_details_add_items(ViewIface *view, GPtrArray *new_items)
 			vitem->utf8_name = to_utf8(leafname);
 		else
 			vitem->utf8_name = NULL;
+		vitem->old_pos = -1;
+		vitem->cells = NULL;
+		vitem->selected = FALSE;
 		
 		g_ptr_array_add(items, vitem);
-
-		iter.user_data = GINT_TO_POINTER(items->len - 1);
-		gtk_tree_model_row_inserted(model, path, &iter);
-		gtk_tree_path_next(path);
 	}
 
-	gtk_tree_path_free(path);
+	if (items->len == n_sorted)
+		return;
+
+	bulk = is_bulk_change(view_details, items->len - n_sorted,
+			      items->len);
+	if (bulk)
+		detach_model(view_details, &cursor, &top);
+
+	merge_tail(view_details, n_sorted);
 
-	resort(view_details);
+	/* Announce the new rows in their final positions, from the top
+	 * down, so that GTK's idea of the rows above is always right.
+	 */
+	for (i = 0; i < items->len; i++)
+	{
+		ViewItem *vitem = (ViewItem *) items->pdata[i];
+
+		if (vitem->old_pos == -1)
+		{
+			GtkTreePath *path;
+
+			if (bulk)
+				continue;
+
+			path = gtk_tree_path_new();
+			gtk_tree_path_append_index(path, i);
+			iter.user_data = GINT_TO_POINTER(i);
+			gtk_tree_model_row_inserted(model, path, &iter);
+			gtk_tree_path_free(path);
+		}
+		else if (vitem->old_pos == wink_item)
+			view_details->wink_item = i;
+	}
+
+	if (bulk)
+		reattach_model(view_details, cursor, top);
 }
 
 /* Find an item in the sorted array.
@@ -1306,19 +1453,55 @@ static int details_find_item(ViewDetails *view_details, DirItem *item)
 	return -1;
 }
 
+/* Move the ViewItems for the DirItems in 'changed' to the end of the array
+ * (keeping the others in order), recording everyone's old_pos.
+ * Returns the number of items left at the start.
+ */
+static guint move_to_end(ViewDetails *view_details, GPtrArray *changed)
+{
+	GPtrArray *items = view_details->items;
+	GPtrArray *moved;
+	GHashTable *set;
+	guint i, n = 0;
+
+	set = g_hash_table_new(NULL, NULL);
+	for (i = 0; i < changed->len; i++)
+		g_hash_table_insert(set, changed->pdata[i], changed->pdata[i]);
+
+	moved = g_ptr_array_new();
+	for (i = 0; i < items->len; i++)
+	{
+		ViewItem *vitem = (ViewItem *) items->pdata[i];
+
+		vitem->old_pos = i;
+		if (g_hash_table_lookup(set, vitem->item))
+			g_ptr_array_add(moved, vitem);
+		else
+			items->pdata[n++] = vitem;
+	}
+	memcpy(items->pdata + n, moved->pdata, moved->len * sizeof(gpointer));
+
+	g_ptr_array_free(moved, TRUE);
+	g_hash_table_destroy(set);
+
+	return n;
+}
+
 static void view_details_update_items(ViewIface *view, GPtrArray *items)
 {
 	ViewDetails	*view_details = (ViewDetails *) view;
 	FilerWindow	*filer_window = view_details->filer_window;
 	int		i;
 	GtkTreeModel	*model = (GtkTreeModel *) view_details;
+	gboolean	reweigh = FALSE;
 
 	g_return_if_fail(items->len > 0);
 	
-	/* The item data has already been modified, so this gives the
-	 * final sort order...
+	/* The item data has already been modified, so only these items
+	 * may be out of place. Take them out and merge them back in...
 	 */
-	resort(view_details);
+	merge_tail(view_details, move_to_end(view_details, items));
+	reordered(view_details);
 
 	for (i = 0; i < items->len; i++)
 	{
@@ -1343,12 +1526,19 @@ static void view_details_update_items(ViewIface *view, GPtrArray *items)
 				g_object_unref(G_OBJECT(view_item->image));
 				view_item->image = NULL;
 			}
+			null_g_free(&view_item->cells);
+			if (view_item->selected)
+				reweigh = TRUE;
 			path = gtk_tree_path_new();
 			gtk_tree_path_append_index(path, j);
 			iter.user_data = GINT_TO_POINTER(j);
 			gtk_tree_model_row_changed(model, path, &iter);
 		}
 	}
+
+	/* A selected item may have changed size */
+	if (reweigh)
+		reweigh_selection(view_details);
 }
 
 static void view_details_delete_if(ViewIface *view,
@@ -1357,40 +1547,98 @@ static void view_details_delete_if(ViewIface *view,
 {
 	GtkTreePath *path;
 	ViewDetails *view_details = (ViewDetails *) view;
-	int	    i = 0;
+	int	    i, n, out, n_doomed = 0;
 	GPtrArray   *items = view_details->items;
 	GtkTreeModel *model = (GtkTreeModel *) view;
+	ViewItem    *cursor = NULL, *top = NULL;
+	gboolean    *doomed;
+	gboolean    bulk;
 
-	path = gtk_tree_path_new();
+	/* Decide what to remove first, so we know whether this is a bulk
+	 * change. 'test' is only called once per item.
+	 */
+	doomed = g_new(gboolean, items->len);
+	for (i = 0; i < items->len; i++)
+	{
+		ViewItem *item = items->pdata[i];
 
-	gtk_tree_path_append_index(path, i);
+		doomed[i] = test(item->item, data);
+		if (doomed[i])
+			n_doomed++;
+	}
 
-	while (i < items->len)
+	if (n_doomed == 0)
 	{
-		ViewItem *item = items->pdata[i];
+		g_free(doomed);
+		return;
+	}
+
+	bulk = is_bulk_change(view_details, n_doomed, items->len);
+	if (bulk)
+		detach_model(view_details, &cursor, &top);
+
+	/* When not detached, keep the array in step with GTK's idea of the
+	 * rows as each one is removed. 'i' is the row's original position
+	 * and 'out' the number of rows kept so far (which is also where the
+	 * row is now).
+	 */
+	path = gtk_tree_path_new();
+	gtk_tree_path_append_index(path, 0);
+
+	n = items->len;
+	out = 0;
+	for (i = 0; i < n; i++)
+	{
+		ViewItem *item = items->pdata[bulk ? i : out];
 
-		if (test(item->item, data))
+		if (!doomed[i])
 		{
-			free_view_item(items->pdata[i]);
-			g_ptr_array_remove_index(items, i);
-			gtk_tree_model_row_deleted(model, path);
+			items->pdata[out++] = item;
+			gtk_tree_path_next(path);
+			continue;
 		}
-		else
+
+		/* The row leaves the selection with it */
+		mark_selected(view_details, item, FALSE);
+
+		if (item == cursor)
+			cursor = NULL;
+		if (item == top)
+			top = NULL;
+		free_view_item(item);
+
+		if (!bulk)
 		{
-			i++;
-			gtk_tree_path_next(path);
+			g_ptr_array_remove_index(items, out);
+			gtk_tree_model_row_deleted(model, path);
 		}
 	}
+	g_ptr_array_set_size(items, out);
 
 	gtk_tree_path_free(path);
+	g_free(doomed);
+
+	if (bulk)
+		reattach_model(view_details, cursor, top);
 }
 
 static void view_details_clear(ViewIface *view)
 {
 	GtkTreePath *path;
-	GPtrArray *items = ((ViewDetails *) view)->items;
+	ViewDetails *view_details = (ViewDetails *) view;
+	GPtrArray *items = view_details->items;
 	GtkTreeModel *model = (GtkTreeModel *) view;
 
+	if (is_bulk_change(view_details, items->len, items->len))
+	{
+		detach_model(view_details, NULL, NULL);
+		g_ptr_array_set_size(items, 0);
+		view_details->n_selected = 0;
+		view_details->selected_size = 0;
+		reattach_model(view_details, NULL, NULL);
+		return;
+	}
+
 	path = gtk_tree_path_new();
 	gtk_tree_path_append_index(path, items->len);
 
@@ -1398,6 +1646,8 @@ static void view_details_clear(ViewIface *view)
 		gtk_tree_model_row_deleted(model, path);
 
 	g_ptr_array_set_size(items, 0);
+	view_details->n_selected = 0;
+	view_details->selected_size = 0;
 	gtk_tree_path_free(path);
 }
 
@@ -1408,6 +1658,8 @@ static void view_details_select_all(ViewIface *view)
 	view_details->can_change_selection++;
 	gtk_tree_selection_select_all(view_details->selection);
 	view_details->can_change_selection--;
+
+	sync_selection(view_details, TRUE);
 }
 
 static void view_details_clear_selection(ViewIface *view)
@@ -1417,6 +1669,8 @@ static void view_details_clear_selection(ViewIface *view)
 	view_details->can_change_selection++;
 	gtk_tree_selection_unselect_all(view_details->selection);
 	view_details->can_change_selection--;
+
+	sync_selection(view_details, FALSE);
 }
 
 static int view_details_count_items(ViewIface *view)
@@ -1426,28 +1680,18 @@ static int view_details_count_items(ViewIface *view)
 	return view_details->items->len;
 }
 
-#if GTK_MINOR_VERSION < 2
-static void view_details_count_inc(GtkTreeModel *model, GtkTreePath *path,
-				   GtkTreeIter *iter, gpointer data)
+static int view_details_count_selected(ViewIface *view)
 {
-	int *count = (int *) data;
-	(*count) += 1;
+	ViewDetails *view_details = (ViewDetails *) view;
+
+	return view_details->n_selected;
 }
-#endif
 
-static int view_details_count_selected(ViewIface *view)
+static double view_details_selected_size(ViewIface *view)
 {
 	ViewDetails *view_details = (ViewDetails *) view;
 
-#if GTK_MINOR_VERSION >= 2
-	return gtk_tree_selection_count_selected_rows(view_details->selection);
-#else
-	int count = 0;
-	
-	gtk_tree_selection_selected_foreach(view_details->selection,
-					    view_details_count_inc, &count);
-	return count;
-#endif
+	return view_details->selected_size;
 }
 
 static void view_details_show_cursor(ViewIface *view)
@@ -1460,6 +1704,12 @@ static void view_details_get_iter(ViewIface *view,
 	make_iter((ViewDetails *) view, iter, flags);
 }
 
+static void view_details_get_iter_at_index(ViewIface *view, ViewIter *iter,
+					   int i)
+{
+	make_item_iter((ViewDetails *) view, iter, i);
+}
+
 static void view_details_get_iter_at_point(ViewIface *view, ViewIter *iter,
 					   GdkWindow *src, int x, int y)
 {
@@ -1515,6 +1765,8 @@ static void set_selected(ViewDetails *view_details, int i, gboolean selected)
 		gtk_tree_selection_unselect_iter(view_details->selection,
 						&iter);
 	view_details->can_change_selection--;
+
+	mark_selected(view_details, view_details->items->pdata[i], selected);
 }
 
 static void view_details_set_selected(ViewIface *view,
@@ -1551,6 +1803,9 @@ static void view_details_select_only(ViewIface *view, ViewIter *iter)
 	gtk_tree_selection_select_range(view_details->selection, path, path);
 	view_details->can_change_selection--;
 	gtk_tree_path_free(path);
+
+	sync_selection(view_details, FALSE);
+	mark_selected(view_details, view_details->items->pdata[iter->i], TRUE);
 }
 
 static void view_details_set_frozen(ViewIface *view, gboolean frozen)
@@ -1901,9 +2156,267 @@ static void free_view_item(ViewItem *view_item)
 	if (view_item->image)
 		g_object_unref(G_OBJECT(view_item->image));
 	g_free(view_item->utf8_name);
+	g_free(view_item->cells);
 	g_free(view_item);
 }
 
+/* Record that view_item has been selected or unselected in GTK, keeping
+ * the totals up-to-date.
+ */
+static void mark_selected(ViewDetails *view_details, ViewItem *view_item,
+			  gboolean selected)
+{
+	if (view_item->selected == selected)
+		return;
+
+	view_item->selected = selected;
+	if (selected)
+	{
+		view_details->n_selected++;
+		view_details->selected_size +=
+			view_item_weight(view_item->item);
+	}
+	else if (--view_details->n_selected == 0)
+		view_details->selected_size = 0;
+	else
+		view_details->selected_size -=
+			view_item_weight(view_item->item);
+}
+
+/* After selecting or unselecting everything, make sure our per-item flags
+ * and totals agree with GTK.
+ */
+static void sync_selection(ViewDetails *view_details, gboolean selected)
+{
+	GPtrArray *items = view_details->items;
+	int	  i;
+
+	for (i = 0; i < items->len; i++)
+		((ViewItem *) items->pdata[i])->selected = selected;
+
+	view_details->n_selected = selected ? items->len : 0;
+	reweigh_selection(view_details);
+}
+
+/* Recalculate selected_size from scratch */
+static void reweigh_selection(ViewDetails *view_details)
+{
+	GPtrArray *items = view_details->items;
+	double	  total = 0;
+	int	  i;
+
+	if (view_details->n_selected)
+	{
+		for (i = 0; i < items->len; i++)
+		{
+			ViewItem *view_item = items->pdata[i];
+
+			if (view_item->selected)
+				total += view_item_weight(view_item->item);
+		}
+	}
+
+	view_details->selected_size = total;
+}
+
+/* Should adding or removing this many of 'n_total' rows be done with the
+ * model detached?
+ */
+static gboolean is_bulk_change(ViewDetails *view_details, int n_changed,
+			       int n_total)
+{
+	return n_changed >= BULK_MIN_ROWS && n_changed * 4 >= n_total;
+}
+
+/* Disconnect the model from the view, so that rows can be added or removed
+ * without telling GTK about each one. If 'cursor' and 'top' aren't NULL,
+ * they're set to the items with the cursor and at the top of the window,
+ * for reattach_model() to restore. Selected items keep their 'selected'
+ * flags.
+ */
+static void detach_model(ViewDetails *view_details,
+			 ViewItem **cursor, ViewItem **top)
+{
+	GtkTreeView *tree = (GtkTreeView *) view_details;
+	GPtrArray *items = view_details->items;
+	GtkTreePath *path = NULL;
+
+	if (cursor)
+	{
+		*cursor = NULL;
+		gtk_tree_view_get_cursor(tree, &path, NULL);
+		if (path)
+		{
+			int i = gtk_tree_path_get_indices(path)[0];
+
+			if (i >= 0 && i < items->len)
+				*cursor = items->pdata[i];
+			gtk_tree_path_free(path);
+		}
+	}
+
+	if (top)
+	{
+		*top = NULL;
+		if (GTK_WIDGET_REALIZED(tree) &&
+		    gtk_tree_view_get_path_at_pos(tree, 0, 0, &path,
+						  NULL, NULL, NULL))
+		{
+			int i = gtk_tree_path_get_indices(path)[0];
+
+			if (i >= 0 && i < items->len)
+				*top = items->pdata[i];
+			gtk_tree_path_free(path);
+		}
+	}
+
+	/* Setting the model emits "changed", but the selection hasn't
+	 * really changed. Selected rows may be removed while we're detached,
+	 * though; reattach_model() reports that if so.
+	 */
+	view_details->detached_n_selected = view_details->n_selected;
+	g_signal_handlers_block_by_func(view_details->selection,
+					selection_changed, view_details);
+	gtk_tree_view_set_model(tree, NULL);
+}
+
+static int find_view_item(ViewDetails *view_details, ViewItem *view_item)
+{
+	GPtrArray *items = view_details->items;
+	int	  i;
+
+	for (i = 0; i < items->len; i++)
+		if (items->pdata[i] == view_item)
+			return i;
+
+	return -1;
+}
+
+/* Undo detach_model(), restoring the cursor, scroll position and
+ * selection. 'cursor' and 'top' may be NULL.
+ */
+static void reattach_model(ViewDetails *view_details,
+			   ViewItem *cursor, ViewItem *top)
+{
+	GtkTreeView *tree = (GtkTreeView *) view_details;
+	GPtrArray *items = view_details->items;
+	GtkTreePath *path;
+	int	  i, start = -1;
+
+	gtk_tree_view_set_model(tree, GTK_TREE_MODEL(view_details));
+
+	/* can_change_selection is zero here, so this doesn't select it */
+	i = cursor ? find_view_item(view_details, cursor) : -1;
+	if (i >= 0)
+	{
+		path = gtk_tree_path_new_from_indices(i, -1);
+		gtk_tree_view_set_cursor(tree, path, NULL, FALSE);
+		gtk_tree_path_free(path);
+	}
+
+	i = top ? find_view_item(view_details, top) : -1;
+	if (i >= 0)
+	{
+		path = gtk_tree_path_new_from_indices(i, -1);
+		gtk_tree_view_scroll_to_cell(tree, path, NULL, TRUE, 0, 0);
+		gtk_tree_path_free(path);
+	}
+
+	/* Select each run of selected items in one go */
+	if (view_details->n_selected)
+	{
+		view_details->can_change_selection++;
+		for (i = 0; i <= items->len; i++)
+		{
+			gboolean selected = i < items->len &&
+				((ViewItem *) items->pdata[i])->selected;
+
+			if (selected && start == -1)
+				start = i;
+			else if (!selected && start != -1)
+			{
+				GtkTreePath *first, *last;
+
+				first = gtk_tree_path_new_from_indices(start,
+								       -1);
+				last = gtk_tree_path_new_from_indices(i - 1,
+								      -1);
+				gtk_tree_selection_select_range(
+					view_details->selection, first, last);
+				gtk_tree_path_free(first);
+				gtk_tree_path_free(last);
+				start = -1;
+			}
+		}
+		view_details->can_change_selection--;
+	}
+
+	g_signal_handlers_unblock_by_func(view_details->selection,
+					  selection_changed, view_details);
+
+	if (view_details->n_selected != view_details->detached_n_selected)
+		filer_selection_changed(view_details->filer_window,
+					gtk_get_current_event_time());
+}
+
+static void fill_cells(ViewItem *view_item)
+{
+	DirItem	*item = view_item->item;
+	GString	*cells;
+	gchar	*time;
+
+	cells = g_string_new(format_size(item->size));
+	g_string_append_c(cells, '\0');
+	g_string_append(cells, pretty_permissions(item->mode));
+	g_string_append_c(cells, '\0');
+	time = pretty_time(&item->mtime);
+	g_string_append(cells, time);
+	g_free(time);
+
+	view_item->cells = g_string_free(cells, FALSE);
+}
+
+/* Get the formatted text for one of the cached columns of row i.
+ * Formatting is done when first needed; if the row is on screen then
+ * all the other rows on screen are done at the same time.
+ */
+static const gchar *get_cell(ViewDetails *view_details, int i, int cell)
+{
+	ViewItem **items = (ViewItem **) view_details->items->pdata;
+	const gchar *text;
+
+	if (!items[i]->cells)
+	{
+		GtkTreePath *start, *end;
+		int first = i, last = i, j;
+
+		if (GTK_WIDGET_REALIZED(view_details) &&
+		    gtk_tree_view_get_visible_range((GtkTreeView *) view_details,
+						    &start, &end))
+		{
+			int s = gtk_tree_path_get_indices(start)[0];
+			int e = gtk_tree_path_get_indices(end)[0];
+
+			if (i >= s && i <= e)
+			{
+				first = s;
+				last = MIN(e, view_details->items->len - 1);
+			}
+			gtk_tree_path_free(start);
+			gtk_tree_path_free(end);
+		}
+
+		for (j = first; j <= last; j++)
+			if (!items[j]->cells)
+				fill_cells(items[j]);
+	}
+
+	for (text = items[i]->cells; cell > 0; cell--)
+		text += strlen(text) + 1;
+
+	return text;
+}
+
 static gboolean view_details_auto_scroll_callback(ViewIface *view)
 {
 	GtkTreeView	*tree = (GtkTreeView *) view;
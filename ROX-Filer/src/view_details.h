@@ -17,6 +17,9 @@ struct _ViewItem {
 	MaskedPixmap *image;
 	int	old_pos;	/* Used while sorting */
 	gchar   *utf8_name;	/* NULL => leafname is valid */
+	gchar	*cells;		/* Formatted size, permissions and mtime
+				 * (NUL-separated). NULL => not done yet */
+	gboolean selected;	/* Mirrors the GtkTreeSelection */
 };
 
 typedef struct _ViewDetails ViewDetails;
@@ -39,6 +42,13 @@ struct _ViewDetails {
 
 	int	    can_change_selection;
 
+	/* Updated wherever we change the GtkTreeSelection, so that the
+	 * toolbar doesn't have to walk the selection on every change.
+	 */
+	int	    n_selected;
+	double	    selected_size;
+	int	    detached_n_selected;	/* n_selected at detach_model() */
+
 	GtkRequisition desired_size;
 
 	gboolean	lasso_box;
@@ -28,6 +28,10 @@
 #include "view_iface.h"
 #include "diritem.h"
 
+static GQuark generation_quark = 0;
+
+static void changed(ViewIface *obj);
+
 /* A word about interfaces:
  *
  * gobject's documentation's explanation of interfaces leaves something[1] to
@@ -105,6 +109,7 @@ void view_sort(ViewIface *obj)
 {
 	g_return_if_fail(VIEW_IS_IFACE(obj));
 	VIEW_IFACE_GET_CLASS(obj)->sort(obj);
+	changed(obj);
 }
 
 /* The style has changed -- shrink the grid and redraw.
@@ -150,12 +155,14 @@ gboolean view_autoselect(ViewIface *obj, const gchar *leaf)
 void view_add_items(ViewIface *obj, GPtrArray *items)
 {
 	VIEW_IFACE_GET_CLASS(obj)->add_items(obj, items);
+	changed(obj);
 }
 
 /* These items are already known, but have changed... */
 void view_update_items(ViewIface *obj, GPtrArray *items)
 {
 	VIEW_IFACE_GET_CLASS(obj)->update_items(obj, items);
+	changed(obj);
 }
 
 /* Call test(item) for each item in the view and delete all those for
@@ -168,6 +175,7 @@ void view_delete_if(ViewIface *obj,
 	g_return_if_fail(VIEW_IS_IFACE(obj));
 
 	VIEW_IFACE_GET_CLASS(obj)->delete_if(obj, test, data);
+	changed(obj);
 }
 
 /* Remove all items from the view (used when changing directory) */
@@ -176,6 +184,7 @@ void view_clear(ViewIface *obj)
 	g_return_if_fail(VIEW_IS_IFACE(obj));
 
 	VIEW_IFACE_GET_CLASS(obj)->clear(obj);
+	changed(obj);
 }
 
 /* Select all items */
@@ -210,6 +219,26 @@ int view_count_selected(ViewIface *obj)
 	return VIEW_IFACE_GET_CLASS(obj)->count_selected(obj);
 }
 
+/* Return the total size of the selected items, as shown in the toolbar */
+double view_selected_size(ViewIface *obj)
+{
+	g_return_val_if_fail(VIEW_IS_IFACE(obj), 0);
+
+	return VIEW_IFACE_GET_CLASS(obj)->selected_size(obj);
+}
+
+/* How much 'item' adds to view_selected_size() when it is selected.
+ * Views use this to keep a running total as the selection changes.
+ */
+double view_item_weight(DirItem *item)
+{
+	if (item->base_type == TYPE_DIRECTORY ||
+	    item->base_type == TYPE_UNKNOWN)
+		return 0;
+
+	return (double) item->size;
+}
+
 void view_show_cursor(ViewIface *obj)
 {
 	g_return_if_fail(VIEW_IS_IFACE(obj));
@@ -371,6 +400,16 @@ void view_set_base(ViewIface *obj, ViewIter *iter)
 	VIEW_IFACE_GET_CLASS(obj)->set_base(obj, iter);
 }
 
+/* Returns an interator which yields just item number 'i' (as counted by
+ * a normal iteration from the start).
+ */
+void view_get_iter_at_index(ViewIface *obj, ViewIter *iter, int i)
+{
+	g_return_if_fail(VIEW_IS_IFACE(obj));
+
+	VIEW_IFACE_GET_CLASS(obj)->get_iter_at_index(obj, iter, i);
+}
+
 /* Returns an interator which yields just the item under the pointer.
  * iter.peek() will return NULL if no item was under the pointer.
  * x, y is relative to 'window'.
@@ -412,3 +451,30 @@ gboolean view_auto_scroll_callback(ViewIface *obj)
 	return VIEW_IFACE_GET_CLASS(obj)->auto_scroll_callback(obj);
 }
 
+/* Returns a number which changes whenever items are added to, removed
+ * from, altered in or reordered within the view. Anything derived from
+ * the view's contents can use it to tell when it's out of date.
+ */
+guint view_get_generation(ViewIface *obj)
+{
+	g_return_val_if_fail(VIEW_IS_IFACE(obj), 0);
+
+	if (!generation_quark)
+		return 0;
+
+	return GPOINTER_TO_UINT(g_object_get_qdata(G_OBJECT(obj),
+						   generation_quark));
+}
+
+/****************************************************************
+ *			INTERNAL FUNCTIONS			*
+ ****************************************************************/
+
+static void changed(ViewIface *obj)
+{
+	if (!generation_quark)
+		generation_quark = g_quark_from_static_string("view-generation");
+
+	g_object_set_qdata(G_OBJECT(obj), generation_quark,
+			GUINT_TO_POINTER(view_get_generation(obj) + 1));
+}
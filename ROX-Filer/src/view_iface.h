@@ -67,9 +67,11 @@ struct _ViewIfaceClass {
 	void (*clear_selection)(ViewIface *obj);
 	int (*count_items)(ViewIface *obj);
 	int (*count_selected)(ViewIface *obj);
+	double (*selected_size)(ViewIface *obj);
 	void (*show_cursor)(ViewIface *obj);
 
 	void (*get_iter)(ViewIface *obj, ViewIter *iter, IterFlags flags);
+	void (*get_iter_at_index)(ViewIface *obj, ViewIter *iter, int i);
 	void (*get_iter_at_point)(ViewIface *obj, ViewIter *iter,
 				  GdkWindow *src, int x, int y);
 	void (*cursor_to_iter)(ViewIface *obj, ViewIter *iter);
@@ -119,9 +121,13 @@ void view_select_all(ViewIface *obj);
 void view_clear_selection(ViewIface *obj);
 int view_count_items(ViewIface *obj);
 int view_count_selected(ViewIface *obj);
+double view_selected_size(ViewIface *obj);
+double view_item_weight(DirItem *item);
+guint view_get_generation(ViewIface *obj);
 void view_show_cursor(ViewIface *obj);
 
 void view_get_iter(ViewIface *obj, ViewIter *iter, IterFlags flags);
+void view_get_iter_at_index(ViewIface *obj, ViewIter *iter, int i);
 void view_get_iter_at_point(ViewIface *obj, ViewIter *iter,
 			    GdkWindow *src, int x, int y);
 void view_get_cursor(ViewIface *obj, ViewIter *iter);
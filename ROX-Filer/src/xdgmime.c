@@ -46,9 +46,12 @@
 
 typedef struct XdgDirTimeList XdgDirTimeList;
 typedef struct XdgCallbackList XdgCallbackList;
+typedef struct XdgSourceList XdgSourceList;
 
 static int need_reread = TRUE;
 static time_t last_stat_time = 0;
+static int check_interval = 5;
+static char *private_cache_file = NULL;
 
 static XdgGlobHash *global_hash = NULL;
 static XdgMimeMagic *global_magic = NULL;
@@ -90,6 +93,15 @@ struct XdgCallbackList
   XdgMimeDestroy   destroy;
 };
 
+/* The text files the database would be read from */
+struct XdgSourceList
+{
+  char **names;
+  time_t *mtimes;
+  int n_sources;
+  int found_cache;	/* A directory has its own mime.cache */
+};
+
 /* Function called by xdg_run_command_on_dirs.  If it returns TRUE, further
  * directories aren't looked at */
 typedef int (*XdgDirectoryFunc) (const char *directory,
@@ -197,17 +209,130 @@ xdg_mime_init_from_directory (const char *directory)
 
   file_name = malloc (strlen (directory) + strlen ("/mime/aliases") + 1);
   strcpy (file_name, directory); strcat (file_name, "/mime/aliases");
-  _xdg_mime_alias_read_from_file (alias_list, file_name);
-  free (file_name);
+  if (stat (file_name, &st) == 0)
+    {
+      _xdg_mime_alias_read_from_file (alias_list, file_name);
+      xdg_dir_time_list_add (file_name, st.st_mtime);
+    }
+  else
+    {
+      free (file_name);
+    }
 
   file_name = malloc (strlen (directory) + strlen ("/mime/subclasses") + 1);
   strcpy (file_name, directory); strcat (file_name, "/mime/subclasses");
-  _xdg_mime_parent_read_from_file (parent_list, file_name);
+  if (stat (file_name, &st) == 0)
+    {
+      _xdg_mime_parent_read_from_file (parent_list, file_name);
+      xdg_dir_time_list_add (file_name, st.st_mtime);
+    }
+  else
+    {
+      free (file_name);
+    }
+
+  return FALSE; /* Keep processing */
+}
+
+static void
+xdg_source_list_add (XdgSourceList *sources,
+		     const char    *directory,
+		     const char    *leaf)
+{
+  struct stat st;
+  char *file_name;
+
+  file_name = malloc (strlen (directory) + strlen (leaf) + 1);
+  strcpy (file_name, directory); strcat (file_name, leaf);
+  if (stat (file_name, &st) != 0)
+    {
+      free (file_name);
+      return;
+    }
+
+  sources->names = realloc (sources->names,
+			    sizeof (char *) * (sources->n_sources + 1));
+  sources->mtimes = realloc (sources->mtimes,
+			     sizeof (time_t) * (sources->n_sources + 1));
+  sources->names[sources->n_sources] = file_name;
+  sources->mtimes[sources->n_sources] = st.st_mtime;
+  sources->n_sources++;
+}
+
+/* Find the files xdg_mime_init_from_directory would read, in the same
+ * order. Stops if a directory has a mime.cache, since that is used instead.
+ */
+static int
+xdg_source_list_add_directory (const char    *directory,
+			       XdgSourceList *sources)
+{
+  struct stat st;
+  char *file_name;
+  int n;
+
+  file_name = malloc (strlen (directory) + strlen ("/mime/mime.cache") + 1);
+  strcpy (file_name, directory); strcat (file_name, "/mime/mime.cache");
+  if (stat (file_name, &st) == 0)
+    sources->found_cache = TRUE;
   free (file_name);
+  if (sources->found_cache)
+    return TRUE;
+
+  n = sources->n_sources;
+  xdg_source_list_add (sources, directory, "/mime/globs2");
+  if (sources->n_sources == n)
+    xdg_source_list_add (sources, directory, "/mime/globs");
+  xdg_source_list_add (sources, directory, "/mime/magic");
+  xdg_source_list_add (sources, directory, "/mime/aliases");
+  xdg_source_list_add (sources, directory, "/mime/subclasses");
 
   return FALSE; /* Keep processing */
 }
 
+static void
+xdg_source_list_free (XdgSourceList *sources)
+{
+  int i;
+
+  for (i = 0; i < sources->n_sources; i++)
+    free (sources->names[i]);
+  free (sources->names);
+  free (sources->mtimes);
+}
+
+/* Use the cache written on an earlier run, if it was built from exactly
+ * the files we would otherwise read now.
+ */
+static int
+xdg_mime_load_private_cache (XdgSourceList *sources)
+{
+  XdgMimeCache *cache;
+  int i;
+
+  cache = _xdg_mime_cache_new_from_file (private_cache_file);
+  if (cache == NULL)
+    return FALSE;
+
+  if (!_xdg_mime_cache_sources_match (cache,
+				      (const char **) sources->names,
+				      sources->mtimes, sources->n_sources))
+    {
+      _xdg_mime_cache_unref (cache);
+      return FALSE;
+    }
+
+  _caches = malloc (sizeof (XdgMimeCache *) * 2);
+  _caches[0] = cache;
+  _caches[1] = NULL;
+  n_caches = 1;
+
+  /* Watch the text files, not the cache, for changes */
+  for (i = 0; i < sources->n_sources; i++)
+    xdg_dir_time_list_add (strdup (sources->names[i]), sources->mtimes[i]);
+
+  return TRUE;
+}
+
 /* Runs a command on all the directories in the search path */
 static void
 xdg_run_command_on_dirs (XdgDirectoryFunc  func,
@@ -349,11 +474,18 @@ xdg_check_dir (const char *directory,
       return FALSE;
     }
 
-  /* Check the globs file */
-  file_name = malloc (strlen (directory) + strlen ("/mime/globs") + 1);
-  strcpy (file_name, directory); strcat (file_name, "/mime/globs");
-  invalid = xdg_check_file (file_name, NULL);
+  /* Check the globs file (only globs2 is read if both exist) */
+  file_name = malloc (strlen (directory) + strlen ("/mime/globs2") + 1);
+  strcpy (file_name, directory); strcat (file_name, "/mime/globs2");
+  invalid = xdg_check_file (file_name, &exists);
   free (file_name);
+  if (!invalid && !exists)
+    {
+      file_name = malloc (strlen (directory) + strlen ("/mime/globs") + 1);
+      strcpy (file_name, directory); strcat (file_name, "/mime/globs");
+      invalid = xdg_check_file (file_name, NULL);
+      free (file_name);
+    }
   if (invalid)
     {
       *invalid_dir_list = TRUE;
@@ -371,6 +503,28 @@ xdg_check_dir (const char *directory,
       return TRUE;
     }
 
+  /* Check the aliases file */
+  file_name = malloc (strlen (directory) + strlen ("/mime/aliases") + 1);
+  strcpy (file_name, directory); strcat (file_name, "/mime/aliases");
+  invalid = xdg_check_file (file_name, NULL);
+  free (file_name);
+  if (invalid)
+    {
+      *invalid_dir_list = TRUE;
+      return TRUE;
+    }
+
+  /* Check the subclasses file */
+  file_name = malloc (strlen (directory) + strlen ("/mime/subclasses") + 1);
+  strcpy (file_name, directory); strcat (file_name, "/mime/subclasses");
+  invalid = xdg_check_file (file_name, NULL);
+  free (file_name);
+  if (invalid)
+    {
+      *invalid_dir_list = TRUE;
+      return TRUE;
+    }
+
   return FALSE; /* Keep processing */
 }
 
@@ -401,8 +555,9 @@ xdg_check_dirs (void)
 }
 
 /* We want to avoid stat()ing on every single mime call, so we only look for
- * newer files every 5 seconds.  This will return TRUE if we need to reread the
- * mime data from disk.
+ * newer files every check_interval seconds (never, if it is zero, when the
+ * caller is monitoring the directories itself).  This will return TRUE if we
+ * need to reread the mime data from disk.
  */
 static int
 xdg_check_time_and_dirs (void)
@@ -414,7 +569,7 @@ xdg_check_time_and_dirs (void)
   gettimeofday (&tv, NULL);
   current_time = tv.tv_sec;
 
-  if (current_time >= last_stat_time + 5)
+  if (check_interval > 0 && current_time >= last_stat_time + check_interval)
     {
       retval = xdg_check_dirs ();
       last_stat_time = current_time;
@@ -435,13 +590,36 @@ xdg_mime_init (void)
 
   if (need_reread)
     {
+      XdgSourceList sources;
+
       global_hash = _xdg_glob_hash_new ();
       global_magic = _xdg_mime_magic_new ();
       alias_list = _xdg_mime_alias_list_new ();
       parent_list = _xdg_mime_parent_list_new ();
 
-      xdg_run_command_on_dirs ((XdgDirectoryFunc) xdg_mime_init_from_directory,
-			       NULL);
+      /* Stat the source files before reading them, so that a change made
+       * while we read will be noticed next time.
+       */
+      memset (&sources, 0, sizeof (sources));
+      if (private_cache_file)
+	xdg_run_command_on_dirs ((XdgDirectoryFunc) xdg_source_list_add_directory,
+				 &sources);
+
+      if (!private_cache_file || sources.found_cache ||
+	  !xdg_mime_load_private_cache (&sources))
+	{
+	  xdg_run_command_on_dirs ((XdgDirectoryFunc) xdg_mime_init_from_directory,
+				   NULL);
+
+	  if (private_cache_file && n_caches == 0 && sources.n_sources > 0)
+	    _xdg_mime_cache_write (private_cache_file,
+				   global_hash, global_magic,
+				   alias_list, parent_list,
+				   (const char **) sources.names,
+				   sources.mtimes, sources.n_sources);
+	}
+
+      xdg_source_list_free (&sources);
 
       need_reread = FALSE;
     }
@@ -482,7 +660,6 @@ xdg_mime_get_mime_type_for_file (const char  *file_name,
    * more often, so 5 seems plenty.
    */
   const char *mime_types[5];
-  FILE *file;
   unsigned char *data;
   int max_extent;
   int bytes_read;
@@ -524,34 +701,16 @@ xdg_mime_get_mime_type_for_file (const char  *file_name,
    * be large and need getting from a stream instead of just reading it all
    * in. */
   max_extent = _xdg_mime_magic_get_buffer_extents (global_magic);
-  data = malloc (max_extent);
-  if (data == NULL)
+  bytes_read = _xdg_read_file_head (file_name, max_extent, &data);
+  if (bytes_read < 0)
     return XDG_MIME_TYPE_UNKNOWN;
-        
-  file = fopen (file_name, "r");
-  if (file == NULL)
-    {
-      free (data);
-      return XDG_MIME_TYPE_UNKNOWN;
-    }
-
-  bytes_read = fread (data, 1, max_extent, file);
-  if (ferror (file))
-    {
-      free (data);
-      fclose (file);
-      return XDG_MIME_TYPE_UNKNOWN;
-    }
 
   mime_type = _xdg_mime_magic_lookup_data (global_magic, data, bytes_read, NULL,
 					   mime_types, n);
 
-  fclose (file);
-
   if (!mime_type)
     mime_type = _xdg_binary_or_text_fallback(data, bytes_read);
 
-  free (data);
   return mime_type;
 }
 
@@ -644,6 +803,30 @@ xdg_mime_shutdown (void)
   need_reread = TRUE;
 }
 
+/* If no data directory has a mime.cache file, write one to file_name from
+ * the text files, and use it instead of reading them in future (until they
+ * change).
+ */
+void
+xdg_mime_set_private_cache (const char *file_name)
+{
+#ifdef HAVE_MMAP
+  free (private_cache_file);
+  private_cache_file = file_name ? strdup (file_name) : NULL;
+#endif
+  /* (else we couldn't load it, so don't bother writing it) */
+}
+
+/* Check for changed files at most every 'seconds' seconds. Zero disables
+ * the checks; the caller should then call xdg_mime_shutdown() itself when
+ * the files change.
+ */
+void
+xdg_mime_set_check_interval (int seconds)
+{
+  check_interval = seconds;
+}
+
 int
 xdg_mime_get_max_buffer_extents (void)
 {
@@ -72,6 +72,8 @@ typedef void (*XdgMimeDestroy)  (void *user_data);
 #define xdg_mime_type_textplain               XDG_ENTRY(type_textplain)
 #define xdg_mime_get_icon                     XDG_ENTRY(get_icon)
 #define xdg_mime_get_generic_icon             XDG_ENTRY(get_generic_icon)
+#define xdg_mime_set_private_cache            XDG_ENTRY(set_private_cache)
+#define xdg_mime_set_check_interval           XDG_ENTRY(set_check_interval)
 
 #define _xdg_mime_mime_type_equal             XDG_RESERVED_ENTRY(mime_type_equal)
 #define _xdg_mime_mime_type_subclass          XDG_RESERVED_ENTRY(mime_type_subclass)
@@ -118,6 +120,8 @@ int          xdg_mime_register_reload_callback     (XdgMimeCallback  callback,
 						    void            *data,
 						    XdgMimeDestroy   destroy);
 void         xdg_mime_remove_callback              (int              callback_id);
+void         xdg_mime_set_private_cache            (const char      *file_name);
+void         xdg_mime_set_check_interval           (int              seconds);
 
    /* Private versions of functions that don't call xdg_mime_init () */
 int          _xdg_mime_mime_type_equal             (const char *mime_a,
@@ -181,4 +181,27 @@ _xdg_mime_alias_list_dump (XdgAliasList *list)
     }
 }
 
+/* Add the alias list section of a mime.cache file to buffer, returning
+ * its offset. The list is already sorted by alias.
+ */
+xdg_uint32_t
+_xdg_mime_alias_list_write_cache (XdgAliasList   *list,
+				  XdgCacheBuffer *buffer)
+{
+  xdg_uint32_t list_offset, offset;
+  int i;
+
+  list_offset = _xdg_cache_buffer_alloc (buffer, 4 + 8 * list->n_aliases);
+  _xdg_cache_buffer_set_uint32 (buffer, list_offset, list->n_aliases);
 
+  for (i = 0; i < list->n_aliases; i++)
+    {
+      offset = _xdg_cache_buffer_add_string (buffer, list->aliases[i].alias);
+      _xdg_cache_buffer_set_uint32 (buffer, list_offset + 4 + 8 * i, offset);
+      offset = _xdg_cache_buffer_add_string (buffer,
+					     list->aliases[i].mime_type);
+      _xdg_cache_buffer_set_uint32 (buffer, list_offset + 8 + 8 * i, offset);
+    }
+
+  return list_offset;
+}
@@ -29,6 +29,7 @@
 #define __XDG_MIME_ALIAS_H__
 
 #include "xdgmime.h"
+#include "xdgmimeint.h"
 
 typedef struct XdgAliasList XdgAliasList;
 
@@ -38,6 +39,7 @@ typedef struct XdgAliasList XdgAliasList;
 #define _xdg_mime_alias_list_free             XDG_RESERVED_ENTRY(alias_list_free)
 #define _xdg_mime_alias_list_lookup           XDG_RESERVED_ENTRY(alias_list_lookup)
 #define _xdg_mime_alias_list_dump             XDG_RESERVED_ENTRY(alias_list_dump)
+#define _xdg_mime_alias_list_write_cache      XDG_RESERVED_ENTRY(alias_list_write_cache)
 #endif
 
 void          _xdg_mime_alias_read_from_file (XdgAliasList *list,
@@ -47,5 +49,7 @@ void          _xdg_mime_alias_list_free      (XdgAliasList *list);
 const char   *_xdg_mime_alias_list_lookup    (XdgAliasList *list,
 					      const char  *alias);
 void          _xdg_mime_alias_list_dump      (XdgAliasList *list);
+xdg_uint32_t  _xdg_mime_alias_list_write_cache (XdgAliasList   *list,
+						XdgCacheBuffer *buffer);
 
 #endif /* __XDG_MIME_ALIAS_H__ */
@@ -34,7 +34,7 @@
 
 #include <fcntl.h>
 #include <unistd.h>
-#include <fnmatch.h>
+#include <errno.h>
 #include <assert.h>
 
 #include <netinet/in.h> /* for ntohl/ntohs */
@@ -50,6 +50,10 @@
 
 #include "xdgmimecache.h"
 #include "xdgmimeint.h"
+#include "xdgmimeglob.h"
+#include "xdgmimemagic.h"
+#include "xdgmimealias.h"
+#include "xdgmimeparent.h"
 
 #ifndef MAX
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
@@ -75,6 +79,12 @@
 #define MINOR_VERSION_MIN 1
 #define MINOR_VERSION_MAX 2
 
+/* Caches written by _xdg_mime_cache_write have an extra header field,
+ * giving the offset of the list of files they were built from.
+ */
+#define SOURCES_LIST_OFFSET 40
+#define WRITTEN_HEADER_SIZE 44
+
 struct _XdgMimeCache
 {
   int ref_count;
@@ -82,6 +92,8 @@ struct _XdgMimeCache
 
   size_t  size;
   char   *buffer;
+
+  XdgMimeMagicIndex *magic_index;	/* Built on first use */
 };
 
 #define GET_UINT16(cache,offset) (ntohs(*(xdg_uint16_t*)((cache) + (offset))))
@@ -104,6 +116,7 @@ _xdg_mime_cache_unref (XdgMimeCache *cache)
 #ifdef HAVE_MMAP
       munmap (cache->buffer, cache->size);
 #endif
+      _xdg_mime_magic_index_free (cache->magic_index);
       free (cache);
     }
 }
@@ -149,6 +162,7 @@ _xdg_mime_cache_new_from_file (const char *file_name)
   cache->ref_count = 1;
   cache->buffer = buffer;
   cache->size = st.st_size;
+  cache->magic_index = NULL;
 
  done:
   if (fd != -1)
@@ -259,6 +273,61 @@ cache_magic_compare_to_data (XdgMimeCache *cache,
   return NULL;
 }
 
+/* File each match under the first bytes its top-level matchlets test,
+ * as for the magic file, so that lookups only try the ones which might
+ * succeed.
+ */
+static void
+cache_magic_build_index (XdgMimeCache *cache)
+{
+  xdg_uint32_t list_offset = GET_UINT32 (cache->buffer, 24);
+  xdg_uint32_t n_entries = GET_UINT32 (cache->buffer, list_offset);
+  xdg_uint32_t offset = GET_UINT32 (cache->buffer, list_offset + 8);
+  int i, j;
+
+  cache->magic_index = _xdg_mime_magic_index_new ();
+
+  for (j = 0; j < n_entries; j++)
+    {
+      xdg_uint32_t n_matchlets = GET_UINT32 (cache->buffer, offset + 16 * j + 8);
+      xdg_uint32_t matchlet_offset = GET_UINT32 (cache->buffer, offset + 16 * j + 12);
+      int indexable = TRUE;
+
+      for (i = 0; i < n_matchlets; i++)
+	{
+	  xdg_uint32_t matchlet = matchlet_offset + 32 * i;
+	  xdg_uint32_t mask_offset = GET_UINT32 (cache->buffer, matchlet + 20);
+
+	  if (GET_UINT32 (cache->buffer, matchlet + 4) != 1 ||
+	      GET_UINT32 (cache->buffer, matchlet + 12) < 1 ||
+	      (mask_offset &&
+	       ((unsigned char *) cache->buffer)[mask_offset] != 0xff))
+	    {
+	      indexable = FALSE;
+	      break;
+	    }
+	}
+
+      if (!indexable)
+	{
+	  _xdg_mime_magic_index_add (cache->magic_index, j, 0, -1);
+	  continue;
+	}
+
+      for (i = 0; i < n_matchlets; i++)
+	{
+	  xdg_uint32_t matchlet = matchlet_offset + 32 * i;
+	  xdg_uint32_t data_offset = GET_UINT32 (cache->buffer, matchlet + 16);
+
+	  _xdg_mime_magic_index_add (cache->magic_index, j,
+				     GET_UINT32 (cache->buffer, matchlet),
+				     ((unsigned char *) cache->buffer)[data_offset]);
+	}
+    }
+
+  _xdg_mime_magic_index_compile (cache->magic_index, n_entries);
+}
+
 static const char *
 cache_magic_lookup_data (XdgMimeCache *cache, 
 			 const void   *data, 
@@ -270,41 +339,52 @@ cache_magic_lookup_data (XdgMimeCache *cache,
   xdg_uint32_t list_offset;
   xdg_uint32_t n_entries;
   xdg_uint32_t offset;
+  const char *match = NULL;
+  const int *candidates;
+  int n_candidates;
 
-  int j, n;
+  int i, j, n;
 
   *prio = 0;
 
   list_offset = GET_UINT32 (cache->buffer, 24);
   n_entries = GET_UINT32 (cache->buffer, list_offset);
   offset = GET_UINT32 (cache->buffer, list_offset + 8);
-  
-  for (j = 0; j < n_entries; j++)
-    {
-      const char *match;
 
-      match = cache_magic_compare_to_data (cache, offset + 16 * j, 
+  if (cache->magic_index == NULL)
+    cache_magic_build_index (cache);
+
+  n_candidates = _xdg_mime_magic_index_lookup (cache->magic_index, data, len,
+					       &candidates);
+  for (i = 0; i < n_candidates; i++)
+    {
+      match = cache_magic_compare_to_data (cache, offset + 16 * candidates[i],
 					   data, len, prio);
       if (match)
-	return match;
-      else
 	{
-	  xdg_uint32_t mimetype_offset;
-	  const char *non_match;
-	  
-	  mimetype_offset = GET_UINT32 (cache->buffer, offset + 16 * j + 4);
-	  non_match = cache->buffer + mimetype_offset;
+	  n_entries = candidates[i];
+	  break;
+	}
+    }
 
-	  for (n = 0; n < n_mime_types; n++)
-	    {
-	      if (mime_types[n] && 
-		  _xdg_mime_mime_type_equal (mime_types[n], non_match))
-		mime_types[n] = NULL;
-	    }
+  /* Every entry ahead of the match has failed */
+  for (j = 0; j < n_entries && n_mime_types > 0; j++)
+    {
+      xdg_uint32_t mimetype_offset;
+      const char *non_match;
+
+      mimetype_offset = GET_UINT32 (cache->buffer, offset + 16 * j + 4);
+      non_match = cache->buffer + mimetype_offset;
+
+      for (n = 0; n < n_mime_types; n++)
+	{
+	  if (mime_types[n] && 
+	      _xdg_mime_mime_type_equal (mime_types[n], non_match))
+	    mime_types[n] = NULL;
 	}
     }
 
-  return NULL;
+  return match;
 }
 
 static const char *
@@ -432,7 +512,7 @@ cache_glob_lookup_fnmatch (const char *file_name,
 	  if (case_sensitive_check || !case_sensitive)
 	    {
 	      /* FIXME: Not UTF-8 safe */
-	      if (fnmatch (ptr, file_name, 0) == 0)
+	      if (_xdg_glob_match (ptr, file_name))
 	        {
 	          mime_types[n].mime = mime_type;
 	          mime_types[n].weight = weight;
@@ -565,22 +645,6 @@ static int compare_mime_weight (const void *a, const void *b)
   return bb->weight - aa->weight;
 }
 
-#define ISUPPER(c)		((c) >= 'A' && (c) <= 'Z')
-static char *
-ascii_tolower (const char *str)
-{
-  char *p, *lower;
-
-  lower = strdup (str);
-  p = lower;
-  while (*p != 0)
-    {
-      char c = *p;
-      *p++ = ISUPPER (c) ? c - 'A' + 'a' : c;
-    }
-  return lower;
-}
-
 static int
 cache_glob_lookup_file_name (const char *file_name, 
 			     const char *mime_types[],
@@ -591,25 +655,24 @@ cache_glob_lookup_file_name (const char *file_name,
   int n_mimes = 10;
   int i;
   int len;
+  char lower_buf[256];
   char *lower_case;
 
   assert (file_name != NULL && n_mime_types > 0);
 
   /* First, check the literals */
 
-  lower_case = ascii_tolower (file_name);
+  lower_case = _xdg_ascii_tolower (file_name, lower_buf, sizeof (lower_buf));
+  if (lower_case == NULL)
+    return 0;
 
   n = cache_glob_lookup_literal (lower_case, mime_types, n_mime_types, FALSE);
+  if (n == 0)
+    n = cache_glob_lookup_literal (file_name, mime_types, n_mime_types, TRUE);
   if (n > 0)
     {
-      free (lower_case);
-      return n;
-    }
-
-  n = cache_glob_lookup_literal (file_name, mime_types, n_mime_types, TRUE);
-  if (n > 0)
-    {
-      free (lower_case);
+      if (lower_case != lower_buf)
+	free (lower_case);
       return n;
     }
 
@@ -624,7 +687,8 @@ cache_glob_lookup_file_name (const char *file_name,
   if (n == 0)
     n = cache_glob_lookup_fnmatch (file_name, mimes, n_mimes, TRUE);
 
-  free (lower_case);
+  if (lower_case != lower_buf)
+    free (lower_case);
 
   qsort (mimes, n, sizeof (MimeWeight), compare_mime_weight);
 
@@ -724,7 +788,6 @@ _xdg_mime_cache_get_mime_type_for_file (const char  *file_name,
 {
   const char *mime_type;
   const char *mime_types[10];
-  FILE *file;
   unsigned char *data;
   int max_extent;
   int bytes_read;
@@ -762,24 +825,9 @@ _xdg_mime_cache_get_mime_type_for_file (const char  *file_name,
    * be large and need getting from a stream instead of just reading it all
    * in. */
   max_extent = _xdg_mime_cache_get_max_buffer_extents ();
-  data = malloc (max_extent);
-  if (data == NULL)
+  bytes_read = _xdg_read_file_head (file_name, max_extent, &data);
+  if (bytes_read < 0)
     return XDG_MIME_TYPE_UNKNOWN;
-        
-  file = fopen (file_name, "r");
-  if (file == NULL)
-    {
-      free (data);
-      return XDG_MIME_TYPE_UNKNOWN;
-    }
-
-  bytes_read = fread (data, 1, max_extent, file);
-  if (ferror (file))
-    {
-      free (data);
-      fclose (file);
-      return XDG_MIME_TYPE_UNKNOWN;
-    }
 
   mime_type = cache_get_mime_type_for_data (data, bytes_read, NULL,
 					    mime_types, n);
@@ -787,9 +835,6 @@ _xdg_mime_cache_get_mime_type_for_file (const char  *file_name,
   if (!mime_type)
     mime_type = _xdg_binary_or_text_fallback(data, bytes_read);
 
-  free (data);
-  fclose (file);
-
   return mime_type;
 }
 
@@ -1066,4 +1111,138 @@ _xdg_mime_cache_glob_dump (void)
   }
 }
 
+/* Write the parsed text database out as a mime.cache file, so that later
+ * runs can just map it in. The list of files it came from (and their
+ * mtimes) is stored too, for _xdg_mime_cache_sources_match to check.
+ * Icon and namespace lists are left empty. The file is written under a
+ * temporary name and then renamed into place.
+ * Returns TRUE on success.
+ */
+int
+_xdg_mime_cache_write (const char     *file_name,
+		       XdgGlobHash    *glob_hash,
+		       XdgMimeMagic   *mime_magic,
+		       XdgAliasList   *alias_list,
+		       XdgParentList  *parent_list,
+		       const char     *sources[],
+		       const time_t    mtimes[],
+		       int             n_sources)
+{
+  XdgCacheBuffer buffer;
+  xdg_uint32_t literal_list, suffix_tree, glob_list;
+  xdg_uint32_t empty_list, sources_list, offset;
+  char *tmp_name;
+  int fd, i, written, ok = FALSE;
+
+  memset (&buffer, 0, sizeof (buffer));
+
+  _xdg_cache_buffer_alloc (&buffer, WRITTEN_HEADER_SIZE);
+  _xdg_cache_buffer_set_uint32 (&buffer, 0,
+				(MAJOR_VERSION << 16) | MINOR_VERSION_MAX);
+
+  _xdg_cache_buffer_set_uint32 (&buffer, 4,
+				_xdg_mime_alias_list_write_cache (alias_list,
+								  &buffer));
+  _xdg_cache_buffer_set_uint32 (&buffer, 8,
+				_xdg_mime_parent_list_write_cache (parent_list,
+								   &buffer));
+  _xdg_glob_hash_write_cache (glob_hash, &buffer,
+			      &literal_list, &suffix_tree, &glob_list);
+  _xdg_cache_buffer_set_uint32 (&buffer, 12, literal_list);
+  _xdg_cache_buffer_set_uint32 (&buffer, 16, suffix_tree);
+  _xdg_cache_buffer_set_uint32 (&buffer, 20, glob_list);
+  _xdg_cache_buffer_set_uint32 (&buffer, 24,
+				_xdg_mime_magic_write_cache (mime_magic,
+							     &buffer));
+
+  empty_list = _xdg_cache_buffer_alloc (&buffer, 4);
+  _xdg_cache_buffer_set_uint32 (&buffer, 28, empty_list);
+  _xdg_cache_buffer_set_uint32 (&buffer, 32, empty_list);
+  _xdg_cache_buffer_set_uint32 (&buffer, 36, empty_list);
+
+  sources_list = _xdg_cache_buffer_alloc (&buffer, 4 + 8 * n_sources);
+  _xdg_cache_buffer_set_uint32 (&buffer, sources_list, n_sources);
+  for (i = 0; i < n_sources; i++)
+    {
+      _xdg_cache_buffer_set_uint32 (&buffer, sources_list + 4 + 8 * i,
+				    (xdg_uint32_t) mtimes[i]);
+      offset = _xdg_cache_buffer_add_string (&buffer, sources[i]);
+      _xdg_cache_buffer_set_uint32 (&buffer, sources_list + 8 + 8 * i,
+				    offset);
+    }
+  _xdg_cache_buffer_set_uint32 (&buffer, SOURCES_LIST_OFFSET, sources_list);
+
+  if (buffer.failed)
+    {
+      free (buffer.data);
+      return FALSE;
+    }
+
+  tmp_name = malloc (strlen (file_name) + 32);
+  sprintf (tmp_name, "%s.%ld.new", file_name, (long) getpid ());
+
+  fd = open (tmp_name, O_WRONLY | O_CREAT | O_TRUNC | _O_BINARY, 0644);
+  if (fd != -1)
+    {
+      xdg_uint32_t done = 0;
+
+      while (done < buffer.len)
+	{
+	  written = write (fd, buffer.data + done, buffer.len - done);
+	  if (written < 0 && errno == EINTR)
+	    continue;
+	  if (written <= 0)
+	    break;
+	  done += written;
+	}
+
+      if (close (fd) == 0 && done == buffer.len &&
+	  rename (tmp_name, file_name) == 0)
+	ok = TRUE;
+      else
+	unlink (tmp_name);
+    }
+
+  free (tmp_name);
+  free (buffer.data);
+
+  return ok;
+}
+
+/* Check that cache was written by _xdg_mime_cache_write from exactly
+ * these source files, which haven't been modified since.
+ */
+int
+_xdg_mime_cache_sources_match (XdgMimeCache   *cache,
+			       const char     *sources[],
+			       const time_t    mtimes[],
+			       int             n_sources)
+{
+  xdg_uint32_t list_offset, name_offset;
+  int i;
+
+  if (cache->size < WRITTEN_HEADER_SIZE)
+    return FALSE;
+
+  list_offset = GET_UINT32 (cache->buffer, SOURCES_LIST_OFFSET);
+  if (list_offset < WRITTEN_HEADER_SIZE ||
+      list_offset + 4 + 8 * n_sources > cache->size ||
+      GET_UINT32 (cache->buffer, list_offset) != n_sources)
+    return FALSE;
+
+  for (i = 0; i < n_sources; i++)
+    {
+      if (GET_UINT32 (cache->buffer, list_offset + 4 + 8 * i) !=
+	  (xdg_uint32_t) mtimes[i])
+	return FALSE;
+
+      name_offset = GET_UINT32 (cache->buffer, list_offset + 8 + 8 * i);
+      if (name_offset >= cache->size ||
+	  memchr (cache->buffer + name_offset, '\0',
+		  cache->size - name_offset) == NULL ||
+	  strcmp (cache->buffer + name_offset, sources[i]) != 0)
+	return FALSE;
+    }
 
+  return TRUE;
+}
@@ -28,6 +28,10 @@
 #define __XDG_MIME_CACHE_H__
 
 #include "xdgmime.h"
+#include "xdgmimeglob.h"
+#include "xdgmimemagic.h"
+#include "xdgmimealias.h"
+#include "xdgmimeparent.h"
 
 typedef struct _XdgMimeCache XdgMimeCache;
 
@@ -46,6 +50,8 @@ typedef struct _XdgMimeCache XdgMimeCache;
 #define _xdg_mime_cache_get_icon                      XDG_RESERVED_ENTRY(cache_get_icon)
 #define _xdg_mime_cache_get_generic_icon              XDG_RESERVED_ENTRY(cache_get_generic_icon)
 #define _xdg_mime_cache_glob_dump                     XDG_RESERVED_ENTRY(cache_glob_dump)
+#define _xdg_mime_cache_write                         XDG_RESERVED_ENTRY(cache_write)
+#define _xdg_mime_cache_sources_match                 XDG_RESERVED_ENTRY(cache_sources_match)
 #endif
 
 extern XdgMimeCache **_caches;
@@ -78,4 +84,17 @@ const char  *_xdg_mime_cache_get_icon                     (const char *mime);
 const char  *_xdg_mime_cache_get_generic_icon             (const char *mime);
 void         _xdg_mime_cache_glob_dump                    (void);
 
+int          _xdg_mime_cache_write         (const char     *file_name,
+					    XdgGlobHash    *glob_hash,
+					    XdgMimeMagic   *mime_magic,
+					    XdgAliasList   *alias_list,
+					    XdgParentList  *parent_list,
+					    const char     *sources[],
+					    const time_t    mtimes[],
+					    int             n_sources);
+int          _xdg_mime_cache_sources_match (XdgMimeCache   *cache,
+					    const char     *sources[],
+					    const time_t    mtimes[],
+					    int             n_sources);
+
 #endif /* __XDG_MIME_CACHE_H__ */
@@ -35,7 +35,6 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
-#include <fnmatch.h>
 
 #ifndef	FALSE
 #define	FALSE	(0)
@@ -384,22 +383,6 @@ static int compare_mime_weight (const void *a, const void *b)
   return bb->weight - aa->weight;
 }
 
-#define ISUPPER(c)		((c) >= 'A' && (c) <= 'Z')
-static char *
-ascii_tolower (const char *str)
-{
-  char *p, *lower;
-
-  lower = strdup (str);
-  p = lower;
-  while (*p != 0)
-    {
-      char c = *p;
-      *p++ = ISUPPER (c) ? c - 'A' + 'a' : c;
-    }
-  return lower;
-}
-
 int
 _xdg_glob_hash_lookup_file_name (XdgGlobHash *glob_hash,
 				 const char  *file_name,
@@ -411,6 +394,7 @@ _xdg_glob_hash_lookup_file_name (XdgGlobHash *glob_hash,
   MimeWeight mimes[10];
   int n_mimes = 10;
   int len;
+  char lower_buf[256];
   char *lower_case;
 
   /* First, check the literals */
@@ -419,14 +403,17 @@ _xdg_glob_hash_lookup_file_name (XdgGlobHash *glob_hash,
 
   n = 0;
 
-  lower_case = ascii_tolower (file_name);
+  lower_case = _xdg_ascii_tolower (file_name, lower_buf, sizeof (lower_buf));
+  if (lower_case == NULL)
+    return 0;
 
   for (list = glob_hash->literal_list; list; list = list->next)
     {
       if (strcmp ((const char *)list->data, file_name) == 0)
 	{
 	  mime_types[0] = list->mime_type;
-	  free (lower_case);
+	  if (lower_case != lower_buf)
+	    free (lower_case);
 	  return 1;
 	}
     }
@@ -437,7 +424,8 @@ _xdg_glob_hash_lookup_file_name (XdgGlobHash *glob_hash,
 	  strcmp ((const char *)list->data, lower_case) == 0)
 	{
 	  mime_types[0] = list->mime_type;
-	  free (lower_case);
+	  if (lower_case != lower_buf)
+	    free (lower_case);
 	  return 1;
 	}
     }
@@ -454,7 +442,7 @@ _xdg_glob_hash_lookup_file_name (XdgGlobHash *glob_hash,
     {
       for (list = glob_hash->full_list; list && n < n_mime_types; list = list->next)
         {
-          if (fnmatch ((const char *)list->data, file_name, 0) == 0)
+          if (_xdg_glob_match ((const char *)list->data, file_name))
 	    {
 	      mimes[n].mime = list->mime_type;
 	      mimes[n].weight = list->weight;
@@ -462,7 +450,8 @@ _xdg_glob_hash_lookup_file_name (XdgGlobHash *glob_hash,
 	    }
         }
     }
-  free (lower_case);
+  if (lower_case != lower_buf)
+    free (lower_case);
 
   qsort (mimes, n, sizeof (MimeWeight), compare_mime_weight);
 
@@ -605,6 +594,145 @@ _xdg_glob_hash_dump (XdgGlobHash *glob_hash)
     }
 }
 
+static xdg_uint32_t
+_xdg_glob_weight_flags (int weight, int case_sensitive)
+{
+  return weight | (case_sensitive ? 0x100 : 0);
+}
+
+static int
+_xdg_glob_list_cmp (const void *a, const void *b)
+{
+  return strcmp ((*(XdgGlobList **) a)->data, (*(XdgGlobList **) b)->data);
+}
+
+/* Write a list of globs as a mime.cache literal or glob list section,
+ * sorted by pattern if sort is TRUE.
+ */
+static xdg_uint32_t
+_xdg_glob_list_write_cache (XdgGlobList    *glob_list,
+			    XdgCacheBuffer *buffer,
+			    int             sort)
+{
+  XdgGlobList *list;
+  XdgGlobList **entries;
+  xdg_uint32_t list_offset, entry, offset;
+  int i, n = 0;
+
+  for (list = glob_list; list; list = list->next)
+    n++;
+
+  entries = malloc (sizeof (XdgGlobList *) * (n + 1));
+  n = 0;
+  for (list = glob_list; list; list = list->next)
+    entries[n++] = list;
+  if (sort)
+    qsort (entries, n, sizeof (XdgGlobList *), _xdg_glob_list_cmp);
+
+  list_offset = _xdg_cache_buffer_alloc (buffer, 4 + 12 * n);
+  _xdg_cache_buffer_set_uint32 (buffer, list_offset, n);
+  for (i = 0; i < n; i++)
+    {
+      entry = list_offset + 4 + 12 * i;
+      offset = _xdg_cache_buffer_add_string (buffer, entries[i]->data);
+      _xdg_cache_buffer_set_uint32 (buffer, entry, offset);
+      offset = _xdg_cache_buffer_add_string (buffer, entries[i]->mime_type);
+      _xdg_cache_buffer_set_uint32 (buffer, entry + 4, offset);
+      _xdg_cache_buffer_set_uint32 (buffer, entry + 8,
+				    _xdg_glob_weight_flags (entries[i]->weight,
+							    entries[i]->case_sensitive));
+    }
+
+  free (entries);
+
+  return list_offset;
+}
+
+static void
+_xdg_glob_leaf_write_cache (XdgCacheBuffer *buffer,
+			    xdg_uint32_t    entry,
+			    const char     *mime_type,
+			    int             weight,
+			    int             case_sensitive)
+{
+  xdg_uint32_t offset;
+
+  offset = _xdg_cache_buffer_add_string (buffer, mime_type);
+  _xdg_cache_buffer_set_uint32 (buffer, entry, 0);
+  _xdg_cache_buffer_set_uint32 (buffer, entry + 4, offset);
+  _xdg_cache_buffer_set_uint32 (buffer, entry + 8,
+				_xdg_glob_weight_flags (weight, case_sensitive));
+}
+
+/* Write node and its children to the 12-byte suffix tree entry at 'entry'.
+ * In the cache, a node's own type becomes a leaf (character 0) at the
+ * start of its children, followed by any other leaves and then the
+ * child nodes, all in increasing character order as in the hash.
+ */
+static void
+_xdg_glob_hash_node_write_cache (XdgGlobHashNode *node,
+				 XdgCacheBuffer  *buffer,
+				 xdg_uint32_t     entry)
+{
+  XdgGlobHashNode *child;
+  xdg_uint32_t children;
+  int i, n_children = 0;
+
+  if (node->character == 0)
+    {
+      _xdg_glob_leaf_write_cache (buffer, entry, node->mime_type,
+				  node->weight, node->case_sensitive);
+      return;
+    }
+
+  if (node->mime_type)
+    n_children++;
+  for (child = node->child; child; child = child->next)
+    n_children++;
+
+  children = _xdg_cache_buffer_alloc (buffer, 12 * n_children);
+  i = 0;
+  if (node->mime_type)
+    _xdg_glob_leaf_write_cache (buffer, children + 12 * i++, node->mime_type,
+				node->weight, node->case_sensitive);
+  for (child = node->child; child; child = child->next)
+    _xdg_glob_hash_node_write_cache (child, buffer, children + 12 * i++);
+
+  _xdg_cache_buffer_set_uint32 (buffer, entry, node->character);
+  _xdg_cache_buffer_set_uint32 (buffer, entry + 4, n_children);
+  _xdg_cache_buffer_set_uint32 (buffer, entry + 8, children);
+}
+
+/* Add the literal list, reverse suffix tree and glob list sections of a
+ * mime.cache file to buffer, storing their offsets.
+ */
+void
+_xdg_glob_hash_write_cache (XdgGlobHash    *glob_hash,
+			    XdgCacheBuffer *buffer,
+			    xdg_uint32_t   *literal_list,
+			    xdg_uint32_t   *suffix_tree,
+			    xdg_uint32_t   *glob_list)
+{
+  XdgGlobHashNode *node;
+  xdg_uint32_t roots;
+  int i, n_roots = 0;
+
+  *literal_list = _xdg_glob_list_write_cache (glob_hash->literal_list,
+					      buffer, TRUE);
+
+  for (node = glob_hash->simple_node; node; node = node->next)
+    n_roots++;
+  *suffix_tree = _xdg_cache_buffer_alloc (buffer, 8);
+  roots = _xdg_cache_buffer_alloc (buffer, 12 * n_roots);
+  _xdg_cache_buffer_set_uint32 (buffer, *suffix_tree, n_roots);
+  _xdg_cache_buffer_set_uint32 (buffer, *suffix_tree + 4, roots);
+  i = 0;
+  for (node = glob_hash->simple_node; node; node = node->next)
+    _xdg_glob_hash_node_write_cache (node, buffer, roots + 12 * i++);
+
+  *glob_list = _xdg_glob_list_write_cache (glob_hash->full_list,
+					   buffer, FALSE);
+}
 
 void
 _xdg_mime_glob_read_from_file (XdgGlobHash *glob_hash,
@@ -29,6 +29,7 @@
 #define __XDG_MIME_GLOB_H__
 
 #include "xdgmime.h"
+#include "xdgmimeint.h"
 
 typedef struct XdgGlobHash XdgGlobHash;
 
@@ -48,6 +49,7 @@ typedef enum
 #define _xdg_glob_hash_append_glob            XDG_RESERVED_ENTRY(hash_append_glob)
 #define _xdg_glob_determine_type              XDG_RESERVED_ENTRY(determine_type)
 #define _xdg_glob_hash_dump                   XDG_RESERVED_ENTRY(hash_dump)
+#define _xdg_glob_hash_write_cache            XDG_RESERVED_ENTRY(hash_write_cache)
 #endif
 
 void         _xdg_mime_glob_read_from_file   (XdgGlobHash *glob_hash,
@@ -66,5 +68,10 @@ void         _xdg_glob_hash_append_glob      (XdgGlobHash *glob_hash,
 					      int          case_sensitive);
 XdgGlobType  _xdg_glob_determine_type        (const char  *glob);
 void         _xdg_glob_hash_dump             (XdgGlobHash *glob_hash);
+void         _xdg_glob_hash_write_cache      (XdgGlobHash    *glob_hash,
+					      XdgCacheBuffer *buffer,
+					      xdg_uint32_t   *literal_list,
+					      xdg_uint32_t   *suffix_tree,
+					      xdg_uint32_t   *glob_list);
 
 #endif /* __XDG_MIME_GLOB_H__ */
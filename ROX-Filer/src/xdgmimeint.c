@@ -32,6 +32,10 @@
 #include "xdgmimeint.h"
 #include <ctype.h>
 #include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 
 #ifndef	FALSE
 #define	FALSE	(0)
@@ -189,6 +193,323 @@ _xdg_reverse_ucs4 (xdg_unichar_t *source, int len)
     }
 }
 
+/* Read up to max_len bytes from the start of file_name. *data is set to a
+ * buffer which is reused by the next call, so sniffing a directory full of
+ * files doesn't allocate (or set up stdio) for each one.
+ * Returns the number of bytes read, or -1 on error.
+ */
+int
+_xdg_read_file_head (const char     *file_name,
+		     int             max_len,
+		     unsigned char **data)
+{
+  static unsigned char *buffer = NULL;
+  static int buffer_size = 0;
+  int fd, got, total = 0;
+
+  if (max_len > buffer_size)
+    {
+      unsigned char *new_buffer = realloc (buffer, max_len);
+
+      if (new_buffer == NULL)
+	return -1;
+      buffer = new_buffer;
+      buffer_size = max_len;
+    }
+
+  fd = open (file_name, O_RDONLY);
+  if (fd == -1)
+    return -1;
+
+  while (total < max_len)
+    {
+      got = read (fd, buffer + total, max_len - total);
+      if (got == 0)
+	break;
+      if (got < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  close (fd);
+	  return -1;
+	}
+      total += got;
+    }
+
+  close (fd);
+
+  *data = buffer;
+  return total;
+}
+
+/* Copy str to buf (of buf_size bytes) with ASCII letters in lower case.
+ * Names too long for buf are copied to a new buffer instead; free() the
+ * result if it isn't buf.
+ */
+char *
+_xdg_ascii_tolower (const char *str,
+		    char       *buf,
+		    size_t      buf_size)
+{
+  size_t len = strlen (str);
+  char *lower = buf;
+  size_t i;
+
+  if (len >= buf_size)
+    {
+      lower = malloc (len + 1);
+      if (lower == NULL)
+	return NULL;
+    }
+
+  for (i = 0; i <= len; i++)
+    {
+      char c = str[i];
+      lower[i] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+
+  return lower;
+}
+
+/* Skip one (UTF-8) character of name, stopping at the end even if the
+ * last character is truncated.
+ */
+static const char *
+glob_skip_char (const char *name)
+{
+  int skip = _xdg_utf8_char_size (name);
+
+  while (skip-- > 0 && *name)
+    name++;
+
+  return name;
+}
+
+/* Match name against the bracket expression starting at glob ('['). Returns
+ * the end of the expression, or NULL if it isn't terminated (in which case
+ * the '[' is an ordinary character). Non-ASCII characters only match
+ * negated expressions.
+ */
+static const char *
+glob_match_class (const char *glob,
+		  const char *name,
+		  int        *matched)
+{
+  const char *p = glob + 1;
+  unsigned char c = *name;
+  int negate = FALSE;
+  int found = FALSE;
+
+  if (*p == '!' || *p == '^')
+    {
+      negate = TRUE;
+      p++;
+    }
+
+  /* A ']' straight after the '[' (or '[!') is an ordinary character */
+  do
+    {
+      unsigned char lo, hi;
+
+      if (*p == '\0')
+	return NULL;
+      if (*p == '\\' && p[1])
+	p++;
+      lo = hi = *p++;
+      if (p[0] == '-' && p[1] && p[1] != ']')
+	{
+	  p++;
+	  if (*p == '\\' && p[1])
+	    p++;
+	  hi = *p++;
+	}
+      if (c < 0x80 && c >= lo && c <= hi)
+	found = TRUE;
+    }
+  while (*p != ']');
+
+  *matched = found != negate;
+  return p + 1;
+}
+
+/* As fnmatch (glob, name, 0), without the cost of converting to wide
+ * characters in multibyte locales. '?' and negated bracket expressions match
+ * a whole UTF-8 character; other non-ASCII characters must match exactly.
+ */
+int
+_xdg_glob_match (const char *glob,
+		 const char *name)
+{
+  const char *star_glob = NULL;
+  const char *star_name = NULL;
+  size_t glob_len = strlen (glob);
+  size_t name_len = strlen (name);
+
+  /* Nearly every glob that can't match ends with an ordinary character
+   * which isn't the last one of the name.
+   */
+  if (glob_len > 0 && name_len > 0)
+    {
+      char last = glob[glob_len - 1];
+
+      if (last != '*' && last != '?' && last != ']' && last != '\\' &&
+	  last != name[name_len - 1])
+	return FALSE;
+    }
+
+  while (*name)
+    {
+      const char *next = NULL;
+
+      switch (*glob)
+	{
+	case '*':
+	  star_glob = ++glob;
+	  star_name = name;
+	  continue;
+	case '?':
+	  glob++;
+	  name = glob_skip_char (name);
+	  continue;
+	case '[':
+	  {
+	    int matched;
+
+	    next = glob_match_class (glob, name, &matched);
+	    if (next != NULL)
+	      {
+		if (!matched)
+		  next = NULL;
+		else if ((unsigned char) *name >= 0x80)
+		  name = glob_skip_char (name);
+		else
+		  name++;
+		break;
+	      }
+	  }
+	  /* Unterminated; match the '[' literally */
+	  if (*name == '[')
+	    {
+	      next = glob + 1;
+	      name++;
+	    }
+	  break;
+	case '\\':
+	  if (glob[1] == '\0')
+	    return FALSE;	/* Invalid pattern, as for fnmatch */
+	  if (glob[1] == *name)
+	    {
+	      next = glob + 2;
+	      name++;
+	    }
+	  break;
+	case '\0':
+	  break;
+	default:
+	  if (*glob == *name)
+	    {
+	      next = glob + 1;
+	      name++;
+	    }
+	}
+
+      if (next != NULL)
+	{
+	  glob = next;
+	  continue;
+	}
+
+      /* Mismatch: let the last '*' swallow one more character */
+      if (star_glob == NULL)
+	return FALSE;
+      glob = star_glob;
+      star_name = glob_skip_char (star_name);
+      name = star_name;
+    }
+
+  while (*glob == '*')
+    glob++;
+
+  return *glob == '\0';
+}
+
+/* Reserve len bytes (zeroed) at the end of the buffer, rounded up to keep
+ * everything 4-byte aligned. Returns the offset of the new space.
+ */
+xdg_uint32_t
+_xdg_cache_buffer_alloc (XdgCacheBuffer *buffer,
+			 xdg_uint32_t    len)
+{
+  xdg_uint32_t offset = buffer->len;
+
+  len = (len + 3) & ~3;
+
+  if (buffer->failed)
+    return 0;
+
+  if (buffer->len + len > buffer->size)
+    {
+      xdg_uint32_t new_size = buffer->size ? buffer->size * 2 : 4096;
+      unsigned char *new_data;
+
+      while (new_size < buffer->len + len)
+	new_size *= 2;
+
+      new_data = realloc (buffer->data, new_size);
+      if (new_data == NULL)
+	{
+	  buffer->failed = TRUE;
+	  return 0;
+	}
+      buffer->data = new_data;
+      buffer->size = new_size;
+    }
+
+  memset (buffer->data + offset, 0, len);
+  buffer->len += len;
+
+  return offset;
+}
+
+/* Store value in network byte order, as mime.cache readers expect */
+void
+_xdg_cache_buffer_set_uint32 (XdgCacheBuffer *buffer,
+			      xdg_uint32_t    offset,
+			      xdg_uint32_t    value)
+{
+  unsigned char *p;
+
+  if (buffer->failed)
+    return;
+
+  p = buffer->data + offset;
+  p[0] = (value >> 24) & 0xff;
+  p[1] = (value >> 16) & 0xff;
+  p[2] = (value >> 8) & 0xff;
+  p[3] = value & 0xff;
+}
+
+xdg_uint32_t
+_xdg_cache_buffer_add_data (XdgCacheBuffer *buffer,
+			    const void     *data,
+			    xdg_uint32_t    len)
+{
+  xdg_uint32_t offset;
+
+  offset = _xdg_cache_buffer_alloc (buffer, len);
+  if (!buffer->failed)
+    memcpy (buffer->data + offset, data, len);
+
+  return offset;
+}
+
+xdg_uint32_t
+_xdg_cache_buffer_add_string (XdgCacheBuffer *buffer,
+			      const char     *string)
+{
+  return _xdg_cache_buffer_add_data (buffer, string, strlen (string) + 1);
+}
+
 const char *
 _xdg_binary_or_text_fallback(const void *data, size_t len)
 {
@@ -45,6 +45,19 @@ typedef unsigned char  xdg_uchar8_t;
 typedef unsigned short xdg_uint16_t;
 typedef unsigned int   xdg_uint32_t;
 
+/* Used to build a mime.cache file in memory. Sections refer to each other
+ * by offset, since data moves as the buffer grows.
+ */
+typedef struct XdgCacheBuffer XdgCacheBuffer;
+
+struct XdgCacheBuffer
+{
+  unsigned char *data;
+  xdg_uint32_t   len;
+  xdg_uint32_t   size;
+  int            failed;	/* Out of memory */
+};
+
 #ifdef XDG_PREFIX
 #define _xdg_utf8_skip       XDG_RESERVED_ENTRY(utf8_skip)
 #define _xdg_utf8_to_ucs4    XDG_RESERVED_ENTRY(utf8_to_ucs4)
@@ -74,5 +87,24 @@ xdg_unichar_t *_xdg_convert_to_ucs4 (const char *source, int *len);
 void           _xdg_reverse_ucs4 (xdg_unichar_t *source, int len);
 const char    *_xdg_get_base_name (const char    *file_name);
 const char    *_xdg_binary_or_text_fallback(const void *data, size_t len);
+int            _xdg_read_file_head (const char     *file_name,
+				    int             max_len,
+				    unsigned char **data);
+char          *_xdg_ascii_tolower (const char     *str,
+				   char           *buf,
+				   size_t          buf_size);
+int            _xdg_glob_match    (const char     *glob,
+				   const char     *name);
+
+xdg_uint32_t   _xdg_cache_buffer_alloc      (XdgCacheBuffer *buffer,
+					     xdg_uint32_t    len);
+void           _xdg_cache_buffer_set_uint32 (XdgCacheBuffer *buffer,
+					     xdg_uint32_t    offset,
+					     xdg_uint32_t    value);
+xdg_uint32_t   _xdg_cache_buffer_add_data   (XdgCacheBuffer *buffer,
+					     const void     *data,
+					     xdg_uint32_t    len);
+xdg_uint32_t   _xdg_cache_buffer_add_string (XdgCacheBuffer *buffer,
+					     const char     *string);
 
 #endif /* __XDG_MIME_INT_H__ */
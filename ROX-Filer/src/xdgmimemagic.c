@@ -53,6 +53,8 @@
 
 typedef struct XdgMimeMagicMatch XdgMimeMagicMatch;
 typedef struct XdgMimeMagicMatchlet XdgMimeMagicMatchlet;
+typedef struct XdgMimeMagicOffset XdgMimeMagicOffset;
+typedef struct XdgMimeMagicKey XdgMimeMagicKey;
 
 typedef enum
 {
@@ -66,6 +68,7 @@ struct XdgMimeMagicMatch
 {
   const char *mime_type;
   int priority;
+  int rank;		/* Position in match_list */
   XdgMimeMagicMatchlet *matchlet;
   XdgMimeMagicMatch *next;
 };
@@ -84,10 +87,47 @@ struct XdgMimeMagicMatchlet
 };
 
 
+/* For one file offset, the ranks of the matches which can only succeed if
+ * the byte there has a particular value. ranks[start[b]] to
+ * ranks[start[b + 1] - 1] are the candidates when the byte is b.
+ */
+struct XdgMimeMagicOffset
+{
+  int offset;
+  int start[257];
+  int *ranks;
+};
+
+/* Added by _xdg_mime_magic_index_add; byte is -1 for a general rule */
+struct XdgMimeMagicKey
+{
+  int rank;
+  int offset;
+  int byte;
+};
+
+struct XdgMimeMagicIndex
+{
+  XdgMimeMagicKey *keys;	/* Until compiled */
+  int n_keys;
+
+  int n_matches;
+  int *general;			/* Ranks which must always be tried */
+  int n_general;
+  XdgMimeMagicOffset *offsets;	/* Sorted by offset */
+  int n_offsets;
+  unsigned char *marks;		/* Scratch space for lookups, by rank */
+  int *candidates;		/* Result of the last lookup */
+};
+
 struct XdgMimeMagic
 {
   XdgMimeMagicMatch *match_list;
   int max_extent;
+
+  /* Built from match_list by _xdg_mime_magic_compile */
+  XdgMimeMagicMatch **matches;	/* Indexed by rank */
+  XdgMimeMagicIndex *index;
 };
 
 static XdgMimeMagicMatch *
@@ -522,13 +562,34 @@ _xdg_mime_magic_matchlet_compare_to_data (XdgMimeMagicMatchlet *matchlet,
 					  size_t                len)
 {
   int i, j;
-  for (i = matchlet->offset; i < matchlet->offset + matchlet->range_length; i++)
+  int end = matchlet->offset + matchlet->range_length;
+  int exact_first = matchlet->value_length > 0 &&
+    (matchlet->mask == NULL || matchlet->mask[0] == 0xff);
+
+  for (i = matchlet->offset; i < end; i++)
     {
       int valid_matchlet = TRUE;
 
       if (i + matchlet->value_length > len)
 	return FALSE;
 
+      /* When searching a range, skip straight to the next place where
+       * the first byte matches.
+       */
+      if (exact_first && end - i > 1)
+	{
+	  const unsigned char *next;
+	  int limit = len - matchlet->value_length + 1;
+
+	  if (limit > end)
+	    limit = end;
+	  next = memchr ((const unsigned char *) data + i, matchlet->value[0],
+			 limit - i);
+	  if (next == NULL)
+	    return FALSE;
+	  i = next - (const unsigned char *) data;
+	}
+
       if (matchlet->mask)
 	{
 	  for (j = 0; j < matchlet->value_length; j++)
@@ -637,10 +698,18 @@ _xdg_mime_magic_new (void)
   return calloc (1, sizeof (XdgMimeMagic));
 }
 
+static int
+_xdg_mime_magic_int_cmp (const void *a, const void *b)
+{
+  return *(const int *) a - *(const int *) b;
+}
+
 void
 _xdg_mime_magic_free (XdgMimeMagic *mime_magic)
 {
   if (mime_magic) {
+    _xdg_mime_magic_index_free (mime_magic->index);
+    free (mime_magic->matches);
     _xdg_mime_magic_match_free (mime_magic->match_list);
     free (mime_magic);
   }
@@ -661,21 +730,43 @@ _xdg_mime_magic_lookup_data (XdgMimeMagic *mime_magic,
                              int           n_mime_types)
 {
   XdgMimeMagicMatch *match;
+  XdgMimeMagicMatch *found = NULL;
+  const int *candidates;
+  int n_candidates;
   const char *mime_type;
-  int n;
+  int n, i;
   int prio;
 
   prio = 0;
   mime_type = NULL;
-  for (match = mime_magic->match_list; match; match = match->next)
+
+  /* Only try the matches which might succeed, given the bytes at the
+   * offsets that the simple rules look at.
+   */
+  n_candidates = 0;
+  if (mime_magic->index)
+    n_candidates = _xdg_mime_magic_index_lookup (mime_magic->index, data, len,
+						 &candidates);
+  for (i = 0; i < n_candidates; i++)
     {
+      match = mime_magic->matches[candidates[i]];
       if (_xdg_mime_magic_match_compare_to_data (match, data, len))
 	{
+	  found = match;
 	  prio = match->priority;
 	  mime_type = match->mime_type;
 	  break;
 	}
-      else 
+    }
+
+  /* Every match ahead of the one found has failed, so none of the
+   * glob results they name can be right.
+   */
+  if (n_mime_types > 0)
+    {
+      for (match = mime_magic->match_list;
+	   match && match != found;
+	   match = match->next)
 	{
 	  for (n = 0; n < n_mime_types; n++)
 	    {
@@ -701,6 +792,273 @@ _xdg_mime_magic_lookup_data (XdgMimeMagic *mime_magic,
   return mime_type;
 }
 
+XdgMimeMagicIndex *
+_xdg_mime_magic_index_new (void)
+{
+  return calloc (1, sizeof (XdgMimeMagicIndex));
+}
+
+void
+_xdg_mime_magic_index_free (XdgMimeMagicIndex *index)
+{
+  int i;
+
+  if (index == NULL)
+    return;
+
+  for (i = 0; i < index->n_offsets; i++)
+    free (index->offsets[i].ranks);
+  free (index->offsets);
+  free (index->keys);
+  free (index->general);
+  free (index->marks);
+  free (index->candidates);
+  free (index);
+}
+
+/* Record that the match with this rank can only succeed if the byte at
+ * offset is byte (or, if it has several top-level rules, if any of its
+ * keys is satisfied). If byte is -1, the match must always be tried.
+ */
+void
+_xdg_mime_magic_index_add (XdgMimeMagicIndex *index,
+			   int                rank,
+			   int                offset,
+			   int                byte)
+{
+  if ((index->n_keys & 63) == 0)
+    index->keys = realloc (index->keys,
+			   sizeof (XdgMimeMagicKey) * (index->n_keys + 64));
+  index->keys[index->n_keys].rank = rank;
+  index->keys[index->n_keys].offset = offset;
+  index->keys[index->n_keys].byte = byte;
+  index->n_keys++;
+}
+
+static XdgMimeMagicOffset *
+_xdg_mime_magic_index_find_offset (XdgMimeMagicIndex *index, int offset)
+{
+  int low = 0, high = index->n_offsets - 1;
+
+  while (low <= high)
+    {
+      int mid = (low + high) / 2;
+
+      if (index->offsets[mid].offset < offset)
+	low = mid + 1;
+      else if (index->offsets[mid].offset > offset)
+	high = mid - 1;
+      else
+	return &index->offsets[mid];
+    }
+
+  assert (0);
+  return NULL;
+}
+
+/* Build the lookup tables from the keys added so far. Ranks run from 0
+ * to n_matches - 1; a rank with no keys is never returned.
+ */
+void
+_xdg_mime_magic_index_compile (XdgMimeMagicIndex *index,
+			       int                n_matches)
+{
+  XdgMimeMagicKey *key;
+  int *offsets;
+  int n_offsets = 0;
+  int i, b;
+
+  index->n_matches = n_matches;
+  index->general = malloc (sizeof (int) * (index->n_keys + 1));
+  offsets = malloc (sizeof (int) * (index->n_keys + 1));
+
+  for (i = 0; i < index->n_keys; i++)
+    {
+      key = &index->keys[i];
+      if (key->byte < 0)
+	{
+	  if (index->n_general == 0 ||
+	      index->general[index->n_general - 1] != key->rank)
+	    index->general[index->n_general++] = key->rank;
+	}
+      else
+	offsets[n_offsets++] = key->offset;
+    }
+
+  qsort (offsets, n_offsets, sizeof (int), _xdg_mime_magic_int_cmp);
+  index->offsets = malloc (sizeof (XdgMimeMagicOffset) * (n_offsets + 1));
+  for (i = 0; i < n_offsets; i++)
+    {
+      XdgMimeMagicOffset *off;
+
+      if (i > 0 && offsets[i] == offsets[i - 1])
+	continue;
+      off = &index->offsets[index->n_offsets++];
+      memset (off, 0, sizeof (XdgMimeMagicOffset));
+      off->offset = offsets[i];
+    }
+  free (offsets);
+
+  /* Count the entries for each (offset, byte) pair... */
+  for (i = 0; i < index->n_keys; i++)
+    {
+      key = &index->keys[i];
+      if (key->byte >= 0)
+	_xdg_mime_magic_index_find_offset (index, key->offset)
+	  ->start[key->byte + 1]++;
+    }
+
+  for (i = 0; i < index->n_offsets; i++)
+    {
+      XdgMimeMagicOffset *off = &index->offsets[i];
+
+      for (b = 1; b <= 256; b++)
+	off->start[b] += off->start[b - 1];
+      off->ranks = malloc (sizeof (int) * (off->start[256] + 1));
+    }
+
+  /* ... then fill them in. Each start[b] is used as a cursor, leaving it
+   * pointing at the end of its bucket, so shift them back afterwards.
+   */
+  for (i = 0; i < index->n_keys; i++)
+    {
+      XdgMimeMagicOffset *off;
+
+      key = &index->keys[i];
+      if (key->byte < 0)
+	continue;
+      off = _xdg_mime_magic_index_find_offset (index, key->offset);
+      off->ranks[off->start[key->byte]++] = key->rank;
+    }
+
+  for (i = 0; i < index->n_offsets; i++)
+    {
+      XdgMimeMagicOffset *off = &index->offsets[i];
+
+      for (b = 256; b > 0; b--)
+	off->start[b] = off->start[b - 1];
+      off->start[0] = 0;
+    }
+
+  free (index->keys);
+  index->keys = NULL;
+  index->n_keys = 0;
+
+  index->marks = calloc (n_matches + 1, 1);
+  index->candidates = malloc (sizeof (int) * (n_matches + 1));
+}
+
+/* Set *ranks to the ranks (in increasing order) of the matches which
+ * might succeed on this data, and return how many there are. The array
+ * is overwritten by the next lookup.
+ */
+int
+_xdg_mime_magic_index_lookup (XdgMimeMagicIndex *index,
+			      const void        *data,
+			      size_t             len,
+			      const int        **ranks)
+{
+  unsigned char *marks = index->marks;
+  int i, j, b, n = 0;
+
+  for (i = 0; i < index->n_general; i++)
+    marks[index->general[i]] = TRUE;
+  for (i = 0; i < index->n_offsets; i++)
+    {
+      XdgMimeMagicOffset *off = &index->offsets[i];
+
+      if (off->offset >= len)
+	break;
+
+      b = ((const unsigned char *) data)[off->offset];
+      for (j = off->start[b]; j < off->start[b + 1]; j++)
+	marks[off->ranks[j]] = TRUE;
+    }
+
+  for (i = 0; i < index->n_matches; i++)
+    {
+      if (marks[i])
+	{
+	  marks[i] = FALSE;
+	  index->candidates[n++] = i;
+	}
+    }
+
+  *ranks = index->candidates;
+  return n;
+}
+
+/* Can we tell that match will fail just by looking at a single byte
+ * for each of its top-level matchlets? Rules which search a range, or
+ * mask out bits of their first byte, can't be indexed this way.
+ */
+static int
+_xdg_mime_magic_match_indexable (XdgMimeMagicMatch *match)
+{
+  XdgMimeMagicMatchlet *matchlet;
+
+  if (match->matchlet == NULL || match->matchlet->indent != 0)
+    return FALSE;
+
+  for (matchlet = match->matchlet; matchlet; matchlet = matchlet->next)
+    {
+      if (matchlet->indent != 0)
+	continue;
+      if (matchlet->range_length != 1 || matchlet->value_length < 1 ||
+	  matchlet->offset < 0)
+	return FALSE;
+      if (matchlet->mask && matchlet->mask[0] != 0xff)
+	return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Build the index used by _xdg_mime_magic_lookup_data, replacing any
+ * existing one. Each match whose top-level rules all test a fixed byte at
+ * a fixed offset is filed under those (offset, byte) pairs; the rest are
+ * always tried.
+ */
+static void
+_xdg_mime_magic_compile (XdgMimeMagic *mime_magic)
+{
+  XdgMimeMagicMatch *match;
+  XdgMimeMagicMatchlet *matchlet;
+  int n_matches = 0;
+
+  _xdg_mime_magic_index_free (mime_magic->index);
+  free (mime_magic->matches);
+
+  for (match = mime_magic->match_list; match; match = match->next)
+    n_matches++;
+
+  mime_magic->index = _xdg_mime_magic_index_new ();
+  mime_magic->matches = malloc (sizeof (XdgMimeMagicMatch *) *
+				(n_matches + 1));
+
+  n_matches = 0;
+  for (match = mime_magic->match_list; match; match = match->next)
+    {
+      match->rank = n_matches;
+      mime_magic->matches[n_matches++] = match;
+
+      if (!_xdg_mime_magic_match_indexable (match))
+	{
+	  _xdg_mime_magic_index_add (mime_magic->index, match->rank, 0, -1);
+	  continue;
+	}
+
+      for (matchlet = match->matchlet; matchlet; matchlet = matchlet->next)
+	{
+	  if (matchlet->indent == 0)
+	    _xdg_mime_magic_index_add (mime_magic->index, match->rank,
+				       matchlet->offset, matchlet->value[0]);
+	}
+    }
+
+  _xdg_mime_magic_index_compile (mime_magic->index, n_matches);
+}
+
 static void
 _xdg_mime_update_mime_magic_extents (XdgMimeMagic *mime_magic)
 {
@@ -789,6 +1147,107 @@ _xdg_mime_magic_read_magic_file (XdgMimeMagic *mime_magic,
 	}
     }
   _xdg_mime_update_mime_magic_extents (mime_magic);
+  _xdg_mime_magic_compile (mime_magic);
+}
+
+/* Write the siblings at this indent, starting with matchlet, as an array
+ * of 32-byte mime.cache matchlet records; deeper matchlets become their
+ * children. Returns the offset of the array and sets *n_matchlets.
+ */
+static xdg_uint32_t
+_xdg_mime_magic_matchlets_write_cache (XdgMimeMagicMatchlet *matchlet,
+				       int                   indent,
+				       XdgCacheBuffer       *buffer,
+				       xdg_uint32_t         *n_matchlets)
+{
+  XdgMimeMagicMatchlet *sibling;
+  xdg_uint32_t array, entry, offset, n_children;
+  int n = 0;
+
+  for (sibling = matchlet; sibling && sibling->indent >= indent;
+       sibling = sibling->next)
+    {
+      if (sibling->indent == indent)
+	n++;
+    }
+
+  array = _xdg_cache_buffer_alloc (buffer, 32 * n);
+  entry = array;
+  for (sibling = matchlet; sibling && sibling->indent >= indent;
+       sibling = sibling->next)
+    {
+      if (sibling->indent != indent)
+	continue;
+
+      _xdg_cache_buffer_set_uint32 (buffer, entry, sibling->offset);
+      _xdg_cache_buffer_set_uint32 (buffer, entry + 4, sibling->range_length);
+      _xdg_cache_buffer_set_uint32 (buffer, entry + 8, sibling->word_size);
+      _xdg_cache_buffer_set_uint32 (buffer, entry + 12, sibling->value_length);
+      offset = _xdg_cache_buffer_add_data (buffer, sibling->value,
+					   sibling->value_length);
+      _xdg_cache_buffer_set_uint32 (buffer, entry + 16, offset);
+      if (sibling->mask)
+	{
+	  offset = _xdg_cache_buffer_add_data (buffer, sibling->mask,
+					       sibling->value_length);
+	  _xdg_cache_buffer_set_uint32 (buffer, entry + 20, offset);
+	}
+
+      if (sibling->next && sibling->next->indent > indent)
+	{
+	  offset = _xdg_mime_magic_matchlets_write_cache (sibling->next,
+							  indent + 1,
+							  buffer,
+							  &n_children);
+	  _xdg_cache_buffer_set_uint32 (buffer, entry + 24, n_children);
+	  _xdg_cache_buffer_set_uint32 (buffer, entry + 28, offset);
+	}
+
+      entry += 32;
+    }
+
+  *n_matchlets = n;
+  return array;
+}
+
+/* Add the magic section of a mime.cache file to buffer, returning its
+ * offset. Matches are written in priority order, as they are tried.
+ */
+xdg_uint32_t
+_xdg_mime_magic_write_cache (XdgMimeMagic   *mime_magic,
+			     XdgCacheBuffer *buffer)
+{
+  XdgMimeMagicMatch *match;
+  xdg_uint32_t header, matches, entry, offset, n_matchlets;
+  int n_matches = 0;
+
+  for (match = mime_magic->match_list; match; match = match->next)
+    n_matches++;
+
+  header = _xdg_cache_buffer_alloc (buffer, 12);
+  matches = _xdg_cache_buffer_alloc (buffer, 16 * n_matches);
+  _xdg_cache_buffer_set_uint32 (buffer, header, n_matches);
+  _xdg_cache_buffer_set_uint32 (buffer, header + 4, mime_magic->max_extent);
+  _xdg_cache_buffer_set_uint32 (buffer, header + 8, matches);
+
+  entry = matches;
+  for (match = mime_magic->match_list; match; match = match->next)
+    {
+      _xdg_cache_buffer_set_uint32 (buffer, entry, match->priority);
+      offset = _xdg_cache_buffer_add_string (buffer, match->mime_type);
+      _xdg_cache_buffer_set_uint32 (buffer, entry + 4, offset);
+      if (match->matchlet && match->matchlet->indent == 0)
+	{
+	  offset = _xdg_mime_magic_matchlets_write_cache (match->matchlet, 0,
+							  buffer,
+							  &n_matchlets);
+	  _xdg_cache_buffer_set_uint32 (buffer, entry + 8, n_matchlets);
+	  _xdg_cache_buffer_set_uint32 (buffer, entry + 12, offset);
+	}
+      entry += 16;
+    }
+
+  return header;
 }
 
 void
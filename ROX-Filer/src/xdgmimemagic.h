@@ -30,7 +30,9 @@
 
 #include <unistd.h>
 #include "xdgmime.h"
+#include "xdgmimeint.h"
 typedef struct XdgMimeMagic XdgMimeMagic;
+typedef struct XdgMimeMagicIndex XdgMimeMagicIndex;
 
 #ifdef XDG_PREFIX
 #define _xdg_mime_glob_read_from_file             XDG_RESERVED_ENTRY(glob_read_from_file)
@@ -39,6 +41,12 @@ typedef struct XdgMimeMagic XdgMimeMagic;
 #define _xdg_mime_magic_free                      XDG_RESERVED_ENTRY(magic_free)
 #define _xdg_mime_magic_get_buffer_extents        XDG_RESERVED_ENTRY(magic_get_buffer_extents)
 #define _xdg_mime_magic_lookup_data               XDG_RESERVED_ENTRY(magic_lookup_data)
+#define _xdg_mime_magic_write_cache               XDG_RESERVED_ENTRY(magic_write_cache)
+#define _xdg_mime_magic_index_new                 XDG_RESERVED_ENTRY(magic_index_new)
+#define _xdg_mime_magic_index_free                XDG_RESERVED_ENTRY(magic_index_free)
+#define _xdg_mime_magic_index_add                 XDG_RESERVED_ENTRY(magic_index_add)
+#define _xdg_mime_magic_index_compile             XDG_RESERVED_ENTRY(magic_index_compile)
+#define _xdg_mime_magic_index_lookup              XDG_RESERVED_ENTRY(magic_index_lookup)
 #endif
 
 
@@ -53,5 +61,21 @@ const char   *_xdg_mime_magic_lookup_data        (XdgMimeMagic *mime_magic,
 						  int          *result_prio,
 						  const char   *mime_types[],
 						  int           n_mime_types);
+xdg_uint32_t  _xdg_mime_magic_write_cache        (XdgMimeMagic   *mime_magic,
+						  XdgCacheBuffer *buffer);
+
+/* Narrows down which of a list of magic matches need to be tried */
+XdgMimeMagicIndex *_xdg_mime_magic_index_new     (void);
+void               _xdg_mime_magic_index_free    (XdgMimeMagicIndex *index);
+void               _xdg_mime_magic_index_add     (XdgMimeMagicIndex *index,
+						  int                rank,
+						  int                offset,
+						  int                byte);
+void               _xdg_mime_magic_index_compile (XdgMimeMagicIndex *index,
+						  int                n_matches);
+int                _xdg_mime_magic_index_lookup  (XdgMimeMagicIndex *index,
+						  const void        *data,
+						  size_t             len,
+						  const int        **ranks);
 
 #endif /* __XDG_MIME_MAGIC_H__ */
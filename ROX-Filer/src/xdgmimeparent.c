@@ -216,4 +216,38 @@ _xdg_mime_parent_list_dump (XdgParentList *list)
     }
 }
 
+/* Add the parent list section of a mime.cache file to buffer, returning
+ * its offset. The list is already sorted by type.
+ */
+xdg_uint32_t
+_xdg_mime_parent_list_write_cache (XdgParentList  *list,
+				   XdgCacheBuffer *buffer)
+{
+  xdg_uint32_t list_offset, parents_offset, offset;
+  int i, j;
+
+  list_offset = _xdg_cache_buffer_alloc (buffer, 4 + 8 * list->n_mimes);
+  _xdg_cache_buffer_set_uint32 (buffer, list_offset, list->n_mimes);
+
+  for (i = 0; i < list->n_mimes; i++)
+    {
+      XdgMimeParents *entry = &list->parents[i];
+
+      offset = _xdg_cache_buffer_add_string (buffer, entry->mime);
+      _xdg_cache_buffer_set_uint32 (buffer, list_offset + 4 + 8 * i, offset);
 
+      parents_offset = _xdg_cache_buffer_alloc (buffer,
+						4 + 4 * entry->n_parents);
+      _xdg_cache_buffer_set_uint32 (buffer, parents_offset, entry->n_parents);
+      for (j = 0; j < entry->n_parents; j++)
+	{
+	  offset = _xdg_cache_buffer_add_string (buffer, entry->parents[j]);
+	  _xdg_cache_buffer_set_uint32 (buffer, parents_offset + 4 + 4 * j,
+					offset);
+	}
+      _xdg_cache_buffer_set_uint32 (buffer, list_offset + 8 + 8 * i,
+				    parents_offset);
+    }
+
+  return list_offset;
+}
@@ -29,6 +29,7 @@
 #define __XDG_MIME_PARENT_H__
 
 #include "xdgmime.h"
+#include "xdgmimeint.h"
 
 typedef struct XdgParentList XdgParentList;
 
@@ -38,6 +39,7 @@ typedef struct XdgParentList XdgParentList;
 #define _xdg_mime_parent_list_free             XDG_RESERVED_ENTRY(parent_list_free)
 #define _xdg_mime_parent_list_lookup           XDG_RESERVED_ENTRY(parent_list_lookup)
 #define _xdg_mime_parent_list_dump             XDG_RESERVED_ENTRY(parent_list_dump)
+#define _xdg_mime_parent_list_write_cache      XDG_RESERVED_ENTRY(parent_list_write_cache)
 #endif
 
 void          _xdg_mime_parent_read_from_file (XdgParentList *list,
@@ -47,5 +49,7 @@ void           _xdg_mime_parent_list_free      (XdgParentList *list);
 const char   **_xdg_mime_parent_list_lookup    (XdgParentList *list,
 						const char    *mime);
 void           _xdg_mime_parent_list_dump      (XdgParentList *list);
+xdg_uint32_t   _xdg_mime_parent_list_write_cache (XdgParentList  *list,
+						  XdgCacheBuffer *buffer);
 
 #endif /* __XDG_MIME_PARENT_H__ */
@@ -55,6 +55,25 @@ static ssize_t (*dyn_getxattr)(const char *path, const char *name,
 static ssize_t (*dyn_listxattr)(const char *path, char *list,
 			 size_t size) = NULL;
 
+/* Devices whose filesystems have told us they don't support extended
+ * attributes. There are only ever a few, so this is just a list.
+ */
+static GArray *unsupported_devs = NULL;
+
+static gboolean dev_unsupported(dev_t dev)
+{
+	guint i;
+
+	if (!unsupported_devs)
+		return FALSE;
+
+	for (i = 0; i < unsupported_devs->len; i++)
+		if (g_array_index(unsupported_devs, dev_t, i) == dev)
+			return TRUE;
+
+	return FALSE;
+}
+
 void xattr_init(void)
 {
 	void *libc;
@@ -116,6 +135,87 @@ int xattr_have(const char *path)
 	return (nent>0);
 }
 
+/* As xattr_have(), but filesystems (identified by 'dev', the device 'path'
+ * is on) which don't support extended attributes are remembered and not
+ * asked again. If 'mime_type' is non-NULL then it is set to whether
+ * XATTR_MIME_TYPE is one of the attributes, so callers can skip xtype_get()
+ * when it isn't.
+ */
+int xattr_have_dev(const char *path, dev_t dev, int *mime_type)
+{
+	char buf[256];
+	char *list = buf;
+	ssize_t size;
+
+	if (mime_type)
+		*mime_type = FALSE;
+
+	RETURN_IF_IGNORED(FALSE);
+
+	if (!dyn_listxattr || dev_unsupported(dev))
+		return FALSE;
+
+	size = dyn_listxattr(path, buf, sizeof(buf));
+	if (size < 0 && errno == ERANGE)
+	{
+		size = dyn_listxattr(path, NULL, 0);
+		if (size > 0)
+		{
+			list = g_malloc(size);
+			size = dyn_listxattr(path, list, size);
+		}
+		if (size < 0 && errno == ERANGE)
+		{
+			/* Still growing; assume the worst */
+			if (mime_type)
+				*mime_type = TRUE;
+			g_free(list);
+			return TRUE;
+		}
+	}
+
+	if (size < 0)
+	{
+		if (errno == ENOTSUP || errno == EOPNOTSUPP)
+		{
+			if (!unsupported_devs)
+				unsupported_devs = g_array_new(FALSE, FALSE,
+							       sizeof(dev_t));
+			g_array_append_val(unsupported_devs, dev);
+		}
+		size = 0;
+	}
+
+	if (mime_type)
+	{
+		const char *name;
+
+		for (name = list; name < list + size;
+		     name += strlen(name) + 1)
+		{
+			if (strcmp(name, XATTR_MIME_TYPE) == 0)
+			{
+				*mime_type = TRUE;
+				break;
+			}
+		}
+	}
+
+	if (list != buf)
+		g_free(list);
+
+	return size > 0;
+}
+
+/* Forget which filesystems don't support extended attributes (the device
+ * numbers may be reused after unmounting).
+ */
+void xattr_forget_unsupported(void)
+{
+	if (unsupported_devs)
+		g_array_set_size(unsupported_devs, 0);
+}
+
 gchar *xattr_get(const char *path, const char *attr, int *len)
 {
 	ssize_t size;
@@ -174,6 +274,7 @@ int xattr_set(const char *path, const char *attr,
 }
 
 
+
 #elif defined(HAVE_ATTROPEN)
 
 /* Solaris 9 implementation */
@@ -206,6 +307,21 @@ int xattr_have(const char *path)
 #endif
 }
 
+int xattr_have_dev(const char *path, dev_t dev, int *mime_type)
+{
+	int have;
+
+	have = xattr_have(path);
+	if (mime_type)
+		*mime_type = have;
+
+	return have;
+}
+
+void xattr_forget_unsupported(void)
+{
+}
+
 #define MAX_ATTR_SIZE BUFSIZ
 gchar *xattr_get(const char *path, const char *attr, int *len)
 {
@@ -285,6 +401,17 @@ int xattr_have(const char *path)
 	return FALSE;
 }
 
+int xattr_have_dev(const char *path, dev_t dev, int *mime_type)
+{
+	if (mime_type)
+		*mime_type = FALSE;
+	return FALSE;
+}
+
+void xattr_forget_unsupported(void)
+{
+}
+
 gchar *xattr_get(const char *path, const char *attr, int *len)
 {
 	/* Fall back to non-extended */
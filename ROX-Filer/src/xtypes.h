@@ -8,6 +8,8 @@
 #ifndef _XTYPES_H
 #define _XTYPES_H
 
+#include <sys/types.h>
+
 /* Know attribute names */
 #define XATTR_MIME_TYPE "user.mime_type"
 #define XATTR_HIDDEN    "user.hidden"
@@ -22,6 +24,8 @@ void xattr_init(void);
 int xattr_supported(const char *path);
 
 int xattr_have(const char *path);
+int xattr_have_dev(const char *path, dev_t dev, int *mime_type);
+void xattr_forget_unsupported(void);
 gchar *xattr_get(const char *path, const char *attr, int *len);
 int xattr_set(const char *path, const char *attr,
 	      const char *value, int value_len);